@@ -0,0 +1,386 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2014 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+/*
+ * Compare the Hashmap against the chained hash table it replaced, on
+ * the string keys buxtond hashes most: inserting, finding, missing,
+ * iterating and removing.
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hashmap.h"
+#include "util.h"
+
+#define INITIAL_N_BUCKETS 31
+
+/* The previous implementation: DJB hashing into a prime number of
+ * buckets, each a list of separately allocated entries, which are
+ * also linked in insertion order */
+struct chained_entry {
+	const void *key;
+	void *value;
+	struct chained_entry *bucket_next;
+	struct chained_entry *iterate_next, *iterate_previous;
+};
+
+struct chained_map {
+	hash_func_t hash_func;
+	compare_func_t compare_func;
+	struct chained_entry **buckets;
+	struct chained_entry *head, *tail;
+	unsigned n_buckets, n_entries;
+};
+
+static unsigned djb_hash(const void *p)
+{
+	unsigned hash = 5381;
+	const signed char *c;
+
+	for (c = p; *c; c++) {
+		hash = (hash << 5) + hash + (unsigned)*c;
+	}
+
+	return hash;
+}
+
+static struct chained_map *chained_new(hash_func_t hash_func,
+				       compare_func_t compare_func)
+{
+	struct chained_map *m;
+
+	m = calloc(1, sizeof(struct chained_map));
+	if (!m) {
+		abort();
+	}
+	m->hash_func = hash_func;
+	m->compare_func = compare_func;
+	m->n_buckets = INITIAL_N_BUCKETS;
+	m->buckets = calloc(m->n_buckets, sizeof(struct chained_entry *));
+	if (!m->buckets) {
+		abort();
+	}
+
+	return m;
+}
+
+static struct chained_entry *chained_scan(struct chained_map *m,
+					  const char *key)
+{
+	struct chained_entry *e;
+
+	for (e = m->buckets[m->hash_func(key) % m->n_buckets]; e;
+	     e = e->bucket_next) {
+		if (m->compare_func(e->key, key) == 0) {
+			return e;
+		}
+	}
+
+	return NULL;
+}
+
+static void chained_resize(struct chained_map *m)
+{
+	struct chained_entry **n, *e;
+	unsigned size;
+
+	if (m->n_entries * 4 < m->n_buckets * 3) {
+		return;
+	}
+
+	size = (m->n_entries + 1) * 4 - 1;
+	n = calloc(size, sizeof(struct chained_entry *));
+	if (!n) {
+		abort();
+	}
+	for (e = m->head; e; e = e->iterate_next) {
+		unsigned x = m->hash_func(e->key) % size;
+
+		e->bucket_next = n[x];
+		n[x] = e;
+	}
+	free(m->buckets);
+	m->buckets = n;
+	m->n_buckets = size;
+}
+
+static void chained_put(struct chained_map *m, const char *key, void *value)
+{
+	struct chained_entry *e;
+	unsigned x;
+
+	if (chained_scan(m, key)) {
+		return;
+	}
+	chained_resize(m);
+
+	e = malloc(sizeof(struct chained_entry));
+	if (!e) {
+		abort();
+	}
+	e->key = key;
+	e->value = value;
+
+	x = m->hash_func(key) % m->n_buckets;
+	e->bucket_next = m->buckets[x];
+	m->buckets[x] = e;
+
+	e->iterate_next = NULL;
+	e->iterate_previous = m->tail;
+	if (m->tail) {
+		m->tail->iterate_next = e;
+	} else {
+		m->head = e;
+	}
+	m->tail = e;
+	m->n_entries++;
+}
+
+static void *chained_get(struct chained_map *m, const char *key)
+{
+	struct chained_entry *e = chained_scan(m, key);
+
+	return e ? e->value : NULL;
+}
+
+static void chained_remove(struct chained_map *m, const char *key)
+{
+	struct chained_entry **p;
+	struct chained_entry *e;
+
+	for (p = &m->buckets[m->hash_func(key) % m->n_buckets]; *p;
+	     p = &(*p)->bucket_next) {
+		if (m->compare_func((*p)->key, key) == 0) {
+			break;
+		}
+	}
+	e = *p;
+	if (!e) {
+		return;
+	}
+	*p = e->bucket_next;
+
+	if (e->iterate_next) {
+		e->iterate_next->iterate_previous = e->iterate_previous;
+	} else {
+		m->tail = e->iterate_previous;
+	}
+	if (e->iterate_previous) {
+		e->iterate_previous->iterate_next = e->iterate_next;
+	} else {
+		m->head = e->iterate_next;
+	}
+	free(e);
+	m->n_entries--;
+}
+
+static void chained_free(struct chained_map *m)
+{
+	struct chained_entry *e, *n;
+
+	for (e = m->head; e; e = n) {
+		n = e->iterate_next;
+		free(e);
+	}
+	free(m->buckets);
+	free(m);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Keep the compiler from dropping lookups whose result is unused */
+static volatile uintptr_t sink;
+
+static void report(const char *map, const char *op, double start, int count)
+{
+	printf("%-8s %-8s %8.1f ns/op\n", map, op,
+	       (now() - start) * 1e9 / (double)count);
+}
+
+/* Visit the keys out of insertion order, 7919 being prime */
+static int scatter(int i, int count)
+{
+	return (int)((int64_t)i * 7919 % count);
+}
+
+static void bench_hashmap(char **keys, char **misses, int count, int rounds)
+{
+	Hashmap *map;
+	Iterator it;
+	void *value;
+	double start;
+
+	map = hashmap_new(string_hash_func, string_compare_func);
+	if (!map) {
+		abort();
+	}
+
+	start = now();
+	for (int i = 0; i < count; i++) {
+		if (hashmap_put(map, keys[i], keys[i]) < 0) {
+			abort();
+		}
+	}
+	report("hashmap", "insert", start, count);
+
+	start = now();
+	for (int r = 0; r < rounds; r++) {
+		for (int i = 0; i < count; i++) {
+			sink += (uintptr_t)hashmap_get(map, keys[scatter(i, count)]);
+		}
+	}
+	report("hashmap", "hit", start, count * rounds);
+
+	start = now();
+	for (int r = 0; r < rounds; r++) {
+		for (int i = 0; i < count; i++) {
+			sink += (uintptr_t)hashmap_get(map, misses[i]);
+		}
+	}
+	report("hashmap", "miss", start, count * rounds);
+
+	start = now();
+	for (int r = 0; r < rounds; r++) {
+		HASHMAP_FOREACH(value, map, it) {
+			sink += (uintptr_t)value;
+		}
+	}
+	report("hashmap", "iterate", start, count * rounds);
+
+	start = now();
+	for (int i = 0; i < count; i++) {
+		hashmap_remove(map, keys[scatter(i, count)]);
+	}
+	report("hashmap", "remove", start, count);
+
+	hashmap_free(map);
+}
+
+static void bench_chained(char **keys, char **misses, int count, int rounds)
+{
+	struct chained_map *map;
+	struct chained_entry *e;
+	double start;
+
+	map = chained_new(djb_hash, string_compare_func);
+
+	start = now();
+	for (int i = 0; i < count; i++) {
+		chained_put(map, keys[i], keys[i]);
+	}
+	report("chained", "insert", start, count);
+
+	start = now();
+	for (int r = 0; r < rounds; r++) {
+		for (int i = 0; i < count; i++) {
+			sink += (uintptr_t)chained_get(map, keys[scatter(i, count)]);
+		}
+	}
+	report("chained", "hit", start, count * rounds);
+
+	start = now();
+	for (int r = 0; r < rounds; r++) {
+		for (int i = 0; i < count; i++) {
+			sink += (uintptr_t)chained_get(map, misses[i]);
+		}
+	}
+	report("chained", "miss", start, count * rounds);
+
+	start = now();
+	for (int r = 0; r < rounds; r++) {
+		for (e = map->head; e; e = e->iterate_next) {
+			sink += (uintptr_t)e->value;
+		}
+	}
+	report("chained", "iterate", start, count * rounds);
+
+	start = now();
+	for (int i = 0; i < count; i++) {
+		chained_remove(map, keys[scatter(i, count)]);
+	}
+	report("chained", "remove", start, count);
+
+	chained_free(map);
+}
+
+int main(int argc, char **argv)
+{
+	char **keys, **misses;
+	int count = 100000;
+	int rounds;
+
+	if (argc > 1) {
+		count = atoi(argv[1]);
+	}
+	if (count < 1) {
+		printf("Usage: %s [keys]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	/* Repeat the lookups of small maps, for steadier timings */
+	rounds = count < 1000000 ? 1000000 / count : 1;
+
+	keys = calloc((size_t)count, sizeof(char *));
+	misses = calloc((size_t)count, sizeof(char *));
+	if (!keys || !misses) {
+		abort();
+	}
+
+	/* Names shaped like the group and key names of a layer */
+	for (int i = 0; i < count; i++) {
+		if (asprintf(&keys[i], "org.tizen.setting%d.key%d", i % 97,
+			     i) == -1) {
+			abort();
+		}
+		if (asprintf(&misses[i], "org.tizen.setting%d.missing%d",
+			     i % 97, i) == -1) {
+			abort();
+		}
+	}
+
+	printf("%d keys, lookups repeated %d times\n", count, rounds);
+	bench_chained(keys, misses, count, rounds);
+	bench_hashmap(keys, misses, count, rounds);
+
+	for (int i = 0; i < count; i++) {
+		free(keys[i]);
+		free(misses[i]);
+	}
+	free(keys);
+	free(misses);
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -0,0 +1,225 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2014 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+/*
+ * Compare Smack access checks against the compiled rules with the checks
+ * they replaced, which looked rules up by a "subject object" string.
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "buxtonlabel.h"
+#include "hashmap.h"
+#include "smack.h"
+#include "util.h"
+
+/* The previous check: builtin rules compared as strings, then a lookup
+ * of the rule by a formatted string */
+static bool string_check(Hashmap *rules, BuxtonString *subject,
+			 BuxtonString *object, BuxtonKeyAccessType request)
+{
+	_cleanup_free_ char *key = NULL;
+	BuxtonKeyAccessType *access;
+
+	if (streq(subject->value, "*")) {
+		return false;
+	}
+	if (streq(object->value, "@") || streq(subject->value, "@")) {
+		return true;
+	}
+	if (streq(object->value, "*")) {
+		return true;
+	}
+	if (streq(subject->value, object->value)) {
+		return true;
+	}
+	if (request == ACCESS_READ) {
+		if (streq(object->value, "_")) {
+			return true;
+		}
+		if (streq(subject->value, "^")) {
+			return true;
+		}
+	}
+
+	if (asprintf(&key, "%s %s", subject->value, object->value) == -1) {
+		abort();
+	}
+	access = hashmap_get(rules, key);
+	if (!access) {
+		return false;
+	}
+	if (request == ACCESS_READ) {
+		return (*access & ACCESS_READ) != 0;
+	}
+	return (*access & ACCESS_READ) && (*access & ACCESS_WRITE);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Keep the compiler from dropping checks whose result is unused */
+static volatile unsigned sink;
+
+static void report(const char *check, double start, int count)
+{
+	printf("%-8s %8.1f ns/check\n", check,
+	       (now() - start) * 1e9 / (double)count);
+}
+
+int main(int argc, char **argv)
+{
+	BuxtonString *subjects, *objects;
+	BuxtonLabelId *subject_ids, *object_ids;
+	Hashmap *string_rules;
+	FILE *load_file;
+	double start;
+	int n_labels = 200;
+	int checks = 1000000;
+
+	if (argc > 1) {
+		n_labels = atoi(argv[1]);
+	}
+	if (n_labels < 1) {
+		printf("Usage: %s [labels]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	subjects = calloc((size_t)n_labels, sizeof(BuxtonString));
+	objects = calloc((size_t)n_labels, sizeof(BuxtonString));
+	subject_ids = calloc((size_t)n_labels, sizeof(BuxtonLabelId));
+	object_ids = calloc((size_t)n_labels, sizeof(BuxtonLabelId));
+	string_rules = hashmap_new(string_hash_func, string_compare_func);
+	load_file = tmpfile();
+	if (!subjects || !objects || !subject_ids || !object_ids ||
+	    !string_rules || !load_file) {
+		abort();
+	}
+
+	for (int i = 0; i < n_labels; i++) {
+		if (asprintf(&subjects[i].value, "org.tizen.app%d", i) == -1 ||
+		    asprintf(&objects[i].value, "org.tizen.app%d::settings",
+			     i) == -1) {
+			abort();
+		}
+		subjects[i].length = (uint32_t)strlen(subjects[i].value) + 1;
+		objects[i].length = (uint32_t)strlen(objects[i].value) + 1;
+	}
+
+	/* Every subject gets a rule for one object in eight */
+	for (int s = 0; s < n_labels; s++) {
+		for (int o = s % 8; o < n_labels; o += 8) {
+			BuxtonKeyAccessType *access;
+			char *key;
+
+			fprintf(load_file, "%s %s %s\n", subjects[s].value,
+				objects[o].value, (s + o) % 3 ? "r" : "rw");
+
+			if (asprintf(&key, "%s %s", subjects[s].value,
+				     objects[o].value) == -1) {
+				abort();
+			}
+			access = malloc(sizeof(BuxtonKeyAccessType));
+			if (!access) {
+				abort();
+			}
+			*access = (s + o) % 3 ? ACCESS_READ :
+				ACCESS_READ | ACCESS_WRITE;
+			if (hashmap_put(string_rules, key, access) < 0) {
+				abort();
+			}
+		}
+	}
+	rewind(load_file);
+	if (!buxton_compile_smack_rules(load_file)) {
+		abort();
+	}
+	fclose(load_file);
+
+	for (int i = 0; i < n_labels; i++) {
+		subject_ids[i] = buxton_label_intern(&subjects[i]);
+		object_ids[i] = buxton_label_intern(&objects[i]);
+	}
+
+	printf("%d labels, %d checks, a quarter of them writes\n", n_labels,
+	       checks);
+
+	start = now();
+	for (int i = 0; i < checks; i++) {
+		int s = i % n_labels;
+		int o = (i / n_labels + i) % n_labels;
+
+		sink += string_check(string_rules, &subjects[s], &objects[o],
+				     i % 4 ? ACCESS_READ : ACCESS_WRITE);
+	}
+	report("string", start, checks);
+
+	/* The daemon passes labels it interned, as here */
+	start = now();
+	for (int i = 0; i < checks; i++) {
+		int s = i % n_labels;
+		int o = (i / n_labels + i) % n_labels;
+
+		sink += buxton_check_smack_access(
+			buxton_label_string(subject_ids[s]),
+			buxton_label_string(object_ids[o]),
+			i % 4 ? ACCESS_READ : ACCESS_WRITE);
+	}
+	report("interned", start, checks);
+
+	start = now();
+	for (int i = 0; i < checks; i++) {
+		int s = i % n_labels;
+		int o = (i / n_labels + i) % n_labels;
+
+		sink += buxton_check_smack_access_id(subject_ids[s],
+						     object_ids[o],
+						     i % 4 ? ACCESS_READ :
+						     ACCESS_WRITE);
+	}
+	report("id", start, checks);
+
+	for (int i = 0; i < n_labels; i++) {
+		free(subjects[i].value);
+		free(objects[i].value);
+	}
+	free(subjects);
+	free(objects);
+	free(subject_ids);
+	free(object_ids);
+	hashmap_free_free_free(string_rules);
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -25,6 +25,7 @@
 #include "direct.h"
 #include "hashmap.h"
 #include "protocol.h"
+#include "snapshot.h"
 #include "util.h"
 
 static char *nv(char *s)
@@ -74,6 +75,29 @@ bool cli_create_db(BuxtonControl *control,
 	return ret;
 }
 
+bool cli_compile_snapshot(BuxtonControl *control,
+			  __attribute__((unused)) BuxtonDataType type,
+			  char *one, char *two,
+			  __attribute__((unused)) char *three,
+			  __attribute__((unused)) char *four)
+{
+	BuxtonString layer_name;
+
+	if (!control->client.direct) {
+		printf("Unable to compile a snapshot in non direct mode\n");
+		return false;
+	}
+
+	layer_name = buxton_string_pack(one);
+
+	if (!buxton_snapshot_compile(control, &layer_name, two)) {
+		printf("Failed to compile layer %s into %s\n", one, two);
+		return false;
+	}
+
+	return true;
+}
+
 bool cli_set_label(BuxtonControl *control, BuxtonDataType type,
 		   char *one, char *two, char *three, char *four)
 {
@@ -126,7 +150,7 @@ bool cli_create_group(BuxtonControl *control, BuxtonDataType type,
 	}
 
 	if (control->client.direct) {
-		ret = buxton_direct_create_group(control, (_BuxtonKey *)key, NULL);
+		ret = buxton_direct_create_group(control, (_BuxtonKey *)key, BUXTON_LABEL_NONE);
 	} else {
 		ret = !buxton_create_group(&control->client, key, NULL, NULL, true);
 	}
@@ -153,7 +177,7 @@ bool cli_remove_group(BuxtonControl *control, BuxtonDataType type,
 	}
 
 	if (control->client.direct) {
-		ret = buxton_direct_remove_group(control, (_BuxtonKey *)key, NULL);
+		ret = buxton_direct_remove_group(control, (_BuxtonKey *)key, BUXTON_LABEL_NONE);
 	} else {
 		ret = !buxton_remove_group(&control->client, key, NULL, NULL, true);
 	}
@@ -213,7 +237,7 @@ bool cli_get_label(BuxtonControl *control, BuxtonDataType type,
 		dlabel.value = NULL;
 		ret = buxton_direct_get_value_for_layer(control, key,
 							&ddata, &dlabel,
-							NULL);
+							BUXTON_LABEL_NONE);
 		if (ddata.type == BUXTON_TYPE_STRING) {
 			free(ddata.store.d_string.value);
 		}
@@ -260,7 +284,7 @@ bool cli_set_value(BuxtonControl *control, BuxtonDataType type,
 		if (control->client.direct) {
 			ret = buxton_direct_set_value(control,
 						      (_BuxtonKey *)key,
-						      &set, NULL);
+						      &set, BUXTON_LABEL_NONE);
 		} else {
 			ret = !buxton_set_value(&control->client, key,
 						four, NULL, NULL, true);
@@ -276,7 +300,7 @@ bool cli_set_value(BuxtonControl *control, BuxtonDataType type,
 		if (control->client.direct) {
 			ret = buxton_direct_set_value(control,
 						      (_BuxtonKey *)key,
-						      &set, NULL);
+						      &set, BUXTON_LABEL_NONE);
 		} else {
 			ret = !buxton_set_value(&control->client, key,
 						&set.store.d_int32, NULL,
@@ -293,7 +317,7 @@ bool cli_set_value(BuxtonControl *control, BuxtonDataType type,
 		if (control->client.direct) {
 			ret = buxton_direct_set_value(control,
 						      (_BuxtonKey *)key,
-						      &set, NULL);
+						      &set, BUXTON_LABEL_NONE);
 		} else {
 			ret = !buxton_set_value(&control->client, key,
 						&set.store.d_uint32, NULL,
@@ -310,7 +334,7 @@ bool cli_set_value(BuxtonControl *control, BuxtonDataType type,
 		if (control->client.direct) {
 			ret = buxton_direct_set_value(control,
 						      (_BuxtonKey *)key,
-						      &set, NULL);
+						      &set, BUXTON_LABEL_NONE);
 		} else {
 			ret = !buxton_set_value(&control->client, key,
 						&set.store.d_int64, NULL,
@@ -327,7 +351,7 @@ bool cli_set_value(BuxtonControl *control, BuxtonDataType type,
 		if (control->client.direct) {
 			ret = buxton_direct_set_value(control,
 						      (_BuxtonKey *)key,
-						      &set, NULL);
+						      &set, BUXTON_LABEL_NONE);
 		} else {
 			ret = !buxton_set_value(&control->client, key,
 						&set.store.d_uint64, NULL,
@@ -344,7 +368,7 @@ bool cli_set_value(BuxtonControl *control, BuxtonDataType type,
 		if (control->client.direct) {
 			ret = buxton_direct_set_value(control,
 						      (_BuxtonKey *)key,
-						      &set, NULL);
+						      &set, BUXTON_LABEL_NONE);
 		} else {
 			ret = !buxton_set_value(&control->client, key,
 						&set.store.d_float, NULL,
@@ -361,7 +385,7 @@ bool cli_set_value(BuxtonControl *control, BuxtonDataType type,
 		if (control->client.direct) {
 			ret = buxton_direct_set_value(control,
 						      (_BuxtonKey *)key,
-						      &set, NULL);
+						      &set, BUXTON_LABEL_NONE);
 		} else {
 			ret = !buxton_set_value(&control->client, key,
 						&set.store.d_double, NULL,
@@ -392,7 +416,7 @@ bool cli_set_value(BuxtonControl *control, BuxtonDataType type,
 		if (control->client.direct) {
 			ret = buxton_direct_set_value(control,
 						      (_BuxtonKey *)key,
-						      &set, NULL);
+						      &set, BUXTON_LABEL_NONE);
 		} else {
 			ret = !buxton_set_value(&control->client, key,
 						&set.store.d_boolean,
@@ -513,7 +537,7 @@ bool cli_get_value(BuxtonControl *control, BuxtonDataType type,
 		if (control->client.direct) {
 			ret = buxton_direct_get_value_for_layer(control, key,
 								&get, &dlabel,
-								NULL);
+								BUXTON_LABEL_NONE);
 		} else {
 			ret = buxton_get_value(&control->client,
 						      key,
@@ -529,7 +553,7 @@ bool cli_get_value(BuxtonControl *control, BuxtonDataType type,
 		}
 	} else {
 		if (control->client.direct) {
-			ret_val = buxton_direct_get_value(control, key, &get, &dlabel, NULL);
+			ret_val = buxton_direct_get_value(control, key, &get, &dlabel, BUXTON_LABEL_NONE);
 			if (ret_val == 0) {
 				ret = true;
 			}
@@ -656,16 +680,6 @@ void list_names_callback(BuxtonResponse response, void *data)
 		list->names[index] = buxton_response_list_names_item(response, index);
 }
 
-/* from man qsort: */
-static int cmpstringp(const void *p1, const void *p2)
-{
-	/* The actual arguments to this function are "pointers to
-	   pointers to char", but strcmp(3) arguments are "pointers
-	   to char", hence the following cast plus dereference */
-
-	return strcmp(* (char * const *) p1, * (char * const *) p2);
-}
-
 /* for freeing arrays of data */
 void free_data_in_array(void *item)
 {
@@ -734,7 +748,7 @@ bool get_list_names(BuxtonControl *control, char *layer, char *group, char *pref
 		}
 		buxton_array_free(&array, free_data_in_array);
 	}
-	qsort(list->names, (size_t)list->count, sizeof * list->names, cmpstringp);
+	/* Every backend lists names in order already */
 	return true;
 }
 
@@ -804,7 +818,7 @@ bool cli_unset_value(BuxtonControl *control,
 	}
 
 	if (control->client.direct) {
-		return buxton_direct_unset_value(control, key, NULL);
+		return buxton_direct_unset_value(control, key, BUXTON_LABEL_NONE);
 	} else {
 		return !buxton_unset_value(&control->client,
 					   key, unset_value_callback,
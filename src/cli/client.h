@@ -85,6 +85,24 @@ bool cli_create_db(BuxtonControl *control,
 		   char *four)
 	__attribute__((warn_unused_result));
 
+/**
+ * Compile a layer into a read-only snapshot file
+ * @param control An initialized control structure
+ * @param type Unused
+ * @param one Layer to compile
+ * @param two Path of the snapshot to write
+ * @param three Unused
+ * @param four Unused
+ * @returns bool indicating success or failure
+ */
+bool cli_compile_snapshot(BuxtonControl *control,
+			  BuxtonDataType type,
+			  char *one,
+			  char *two,
+			  char *three,
+			  char *four)
+	__attribute__((warn_unused_result));
+
 /**
  * Set a label in Buxton
  * @param control An initialized control structure
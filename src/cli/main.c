@@ -95,7 +95,7 @@ int main(int argc, char **argv)
 	Command c_get_label, c_set_label;
 	Command c_create_group, c_remove_group;
 	Command c_unset_value;
-	Command c_create_db;
+	Command c_create_db, c_compile_snapshot;
 	Command c_list_groups, c_list_keys;
 	Command *command;
 	int i = 0;
@@ -229,6 +229,10 @@ int main(int argc, char **argv)
 				    1, 1, "layer", &cli_create_db, BUXTON_TYPE_STRING };
 	hashmap_put(commands, c_create_db.name, &c_create_db);
 
+	c_compile_snapshot = (Command) { "compile-snapshot", "Compile a layer into a read-only snapshot",
+					 2, 2, "layer path", &cli_compile_snapshot, BUXTON_TYPE_STRING };
+	hashmap_put(commands, c_compile_snapshot.name, &c_compile_snapshot);
+
 	/* Listing of names */
 	c_list_groups = (Command) { "list-groups", "List the groups for a layer",
 				    1, 2, "layer [prefix-filter]", &cli_list_names, 0 };
@@ -15,17 +15,31 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
+#include <sys/uio.h>
 #include <attr/xattr.h>
 
 #include "daemon.h"
 #include "direct.h"
 #include "log.h"
+#include "smack.h"
 #include "util.h"
 #include "buxtonlist.h"
 
+/**
+ * Initial size of a client's output buffer
+ */
+#define CLIENT_OUT_MIN 4096
+
+/**
+ * Initial size of a client's receive buffer
+ */
+#define CLIENT_IN_MIN 4096
+
 static char *notify_key_name(_BuxtonKey *key)
 {
 	int r;
@@ -41,6 +55,77 @@ static char *notify_key_name(_BuxtonKey *key)
 	return result;
 }
 
+/* Whether a notify_mapping entry holds wildcard watches */
+static bool is_wildcard_watch(const char *watch_name)
+{
+	size_t len = strlen(watch_name);
+
+	return len > 0 && watch_name[len - 1] == '*';
+}
+
+/* Count a wildcard watch into, or out of, the prefix index of its group */
+static void index_wildcard_watch(BuxtonDaemon *self, const char *watch_name,
+				 bool add)
+{
+	BuxtonNotifyGroup *group;
+	_cleanup_free_ char *group_name = NULL;
+	const char *name;
+	size_t len;
+
+	name = strchr(watch_name, '\n');
+	assert(name);
+	group_name = strndup(watch_name, (size_t)(name - watch_name));
+	if (!group_name) {
+		abort();
+	}
+	/* The prefix is the name up to its trailing '*' */
+	len = strlen(name + 1) - 1;
+
+	group = hashmap_get(self->notify_groups, group_name);
+	if (!group) {
+		assert(add);
+		group = malloc0(sizeof(BuxtonNotifyGroup));
+		if (!group) {
+			abort();
+		}
+		group->name = group_name;
+		group_name = NULL;
+		if (hashmap_put(self->notify_groups, group->name, group) < 0) {
+			abort();
+		}
+	}
+
+	if (add) {
+		if (len >= group->n_prefixes) {
+			if (!greedy_realloc((void **)&group->prefixes,
+					    &group->prefixes_alloc,
+					    sizeof(uint32_t) * (len + 1))) {
+				abort();
+			}
+			memzero(group->prefixes + group->n_prefixes,
+				sizeof(uint32_t) * (len + 1 - group->n_prefixes));
+			group->n_prefixes = len + 1;
+		}
+		group->prefixes[len]++;
+		group->n_watches++;
+		return;
+	}
+
+	assert(len < group->n_prefixes && group->prefixes[len] > 0);
+	group->prefixes[len]--;
+	group->n_watches--;
+	if (group->n_watches == 0) {
+		hashmap_remove(self->notify_groups, group->name);
+		free(group->name);
+		free(group->prefixes);
+		free(group);
+		return;
+	}
+	while (group->prefixes[group->n_prefixes - 1] == 0) {
+		group->n_prefixes--;
+	}
+}
+
 bool parse_list(BuxtonControlMessage msg, size_t count, BuxtonData *list,
 		_BuxtonKey *key, BuxtonData **value)
 {
@@ -185,13 +270,20 @@ bool parse_list(BuxtonControlMessage msg, size_t count, BuxtonData *list,
 		key->type = list[3].store.d_uint32;
 		break;
 	case BUXTON_CONTROL_NOTIFY:
-		if (count != 3) {
+		if (count != 3 && count != 4) {
 			return false;
 		}
 		if (list[0].type != BUXTON_TYPE_STRING || list[1].type != BUXTON_TYPE_STRING ||
 		    list[2].type != BUXTON_TYPE_UINT32) {
 			return false;
 		}
+		/* An optional coalescing window, in ms */
+		if (count == 4) {
+			if (list[3].type != BUXTON_TYPE_UINT32) {
+				return false;
+			}
+			*value = &list[3];
+		}
 		key->group = list[0].store.d_string;
 		key->name = list[1].store.d_string;
 		key->type = list[2].store.d_uint32;
@@ -215,20 +307,403 @@ bool parse_list(BuxtonControlMessage msg, size_t count, BuxtonData *list,
 	return true;
 }
 
-bool buxtond_handle_message(BuxtonDaemon *self, client_list_item *client, size_t size)
+/**
+ * Serialize a status reply into the client's reply buffer and send it
+ * @param self Reference to BuxtonDaemon
+ * @param client Client to reply to
+ * @param msgid Message id of the request being answered
+ * @param out Status code and any data being returned
+ * @param n_out Number of entries in out
+ * @param tail Optional array of further data being returned
+ * @returns bool false if the reply couldn't be sent
+ */
+static bool send_reply(BuxtonDaemon *self, client_list_item *client,
+		       uint32_t msgid, BuxtonData *out, size_t n_out,
+		       BuxtonArray *tail)
+{
+	size_t response_len;
+	bool ret;
+
+	response_len = buxton_serialize_message_into(&client->reply,
+						     &client->reply_alloc,
+						     BUXTON_CONTROL_STATUS,
+						     msgid, out, n_out, tail);
+	if (response_len == 0) {
+		if (errno == ENOMEM) {
+			abort();
+		}
+		buxton_log("Failed to serialize response message\n");
+		abort();
+	}
+
+	ret = buxtond_send(self, client, client->reply, response_len);
+	if (client->reply_alloc > CLIENT_OUT_MIN) {
+		/* Don't hold on to the buffer of a large reply */
+		free(client->reply);
+		client->reply = NULL;
+		client->reply_alloc = 0;
+	}
+
+	return ret;
+}
+
+/**
+ * Get the next operation of a batch request
+ * @param list Parameters of the batch request
+ * @param count Number of parameters
+ * @param pos Position of the operation, advanced past it
+ * @param msg Set to the type of the operation
+ * @param key Key of the operation
+ * @param value Value of the operation, if any
+ * @returns bool false if the operation is malformed
+ */
+static bool next_batch_op(BuxtonData *list, size_t count, size_t *pos,
+			  BuxtonControlMessage *msg, _BuxtonKey *key,
+			  BuxtonData **value)
+{
+	size_t n;
+
+	if (count - *pos < 2) {
+		return false;
+	}
+	if (list[*pos].type != BUXTON_TYPE_UINT32 ||
+	    list[*pos + 1].type != BUXTON_TYPE_UINT32) {
+		return false;
+	}
+	*msg = list[*pos].store.d_uint32;
+	n = list[*pos + 1].store.d_uint32;
+	*pos += 2;
+
+	if (*msg != BUXTON_CONTROL_GET && *msg != BUXTON_CONTROL_SET &&
+	    *msg != BUXTON_CONTROL_UNSET) {
+		return false;
+	}
+	if (n > count - *pos) {
+		return false;
+	}
+
+	memzero(key, sizeof(_BuxtonKey));
+	*value = NULL;
+	if (!parse_list(*msg, n, list + *pos, key, value)) {
+		return false;
+	}
+	*pos += n;
+
+	return true;
+}
+
+/**
+ * Bound the size of a batch reply before running any of the batch
+ * @param self Reference to BuxtonDaemon
+ * @param client Current client
+ * @param list Parameters of the batch request
+ * @param count Number of parameters
+ * @param n_ops Number of operations in the batch
+ * @returns size_t the most the reply may take
+ */
+static size_t batch_reply_bound(BuxtonDaemon *self, client_list_item *client,
+				BuxtonData *list, size_t count, size_t n_ops)
+{
+	BuxtonControlMessage msg, prev_msg;
+	_BuxtonKey key, prev_key;
+	BuxtonData *value, *prev_value;
+	BuxtonData *data;
+	BuxtonData status_param;
+	size_t pos = 0, prev_pos;
+	size_t size, length;
+	int32_t status;
+
+	status_param.type = BUXTON_TYPE_INT32;
+	size = BUXTON_MESSAGE_EMPTY_LENGTH +
+		buxton_serialized_param_length(&status_param) * (n_ops + 1);
+
+	/* A get returns what is stored, or what an earlier set of the
+	 * batch stores, whichever is longer */
+	while (pos < count) {
+		(void)next_batch_op(list, count, &pos, &msg, &key, &value);
+		if (msg != BUXTON_CONTROL_GET) {
+			continue;
+		}
+
+		length = 0;
+		data = get_value(self, client, &key, &status);
+		if (data) {
+			if (status == 0) {
+				length = buxton_serialized_param_length(data);
+			}
+			if (data->type == BUXTON_TYPE_STRING) {
+				free(data->store.d_string.value);
+			}
+			free(data);
+		}
+
+		prev_pos = 0;
+		while (prev_pos < pos) {
+			(void)next_batch_op(list, count, &prev_pos, &prev_msg,
+					    &prev_key, &prev_value);
+			if (prev_msg != BUXTON_CONTROL_SET ||
+			    !streq(prev_key.group.value, key.group.value) ||
+			    !streq(prev_key.name.value, key.name.value)) {
+				continue;
+			}
+			if (buxton_serialized_param_length(prev_value) > length) {
+				length = buxton_serialized_param_length(prev_value);
+			}
+		}
+		size += length;
+	}
+
+	return size;
+}
+
+bool handle_batch(BuxtonDaemon *self, client_list_item *client,
+		  uint32_t msgid, BuxtonData *list, size_t count)
+{
+	BuxtonControlMessage msg;
+	_BuxtonKey key;
+	BuxtonData *value;
+	BuxtonData *data;
+	BuxtonData *results;
+	BuxtonData out;
+	size_t pos = 0;
+	size_t n_results = 1;
+	size_t n_ops = 0;
+	size_t n_gets = 0;
+	size_t reply_len;
+	int32_t status;
+	bool ret;
+
+	assert(self);
+	assert(client);
+
+	out.type = BUXTON_TYPE_INT32;
+	out.store.d_int32 = -1;
+
+	/* Reject a malformed batch before running any of it */
+	while (pos < count) {
+		if (!next_batch_op(list, count, &pos, &msg, &key, &value)) {
+			return send_reply(self, client, msgid, &out, 1, NULL);
+		}
+		if (msg == BUXTON_CONTROL_GET) {
+			n_gets++;
+		}
+		n_ops++;
+	}
+
+	/* The reply has to fit in a message too. A batch that only reads
+	 * is checked once run, a batch that writes before it has changed
+	 * anything */
+	if (n_gets > BUXTON_BATCH_MAX_GETS) {
+		buxton_log("Batch of %zu gets is too large\n", n_gets);
+		return send_reply(self, client, msgid, &out, 1, NULL);
+	}
+	if (n_gets && n_gets < n_ops &&
+	    batch_reply_bound(self, client, list, count, n_ops) >
+	    BUXTON_MESSAGE_MAX_LENGTH) {
+		buxton_log("Reply to batch of %zu operations is too large\n",
+			   n_ops);
+		return send_reply(self, client, msgid, &out, 1, NULL);
+	}
+
+	/* Every operation has a status and may return a value */
+	if (!greedy_realloc((void **)&client->results, &client->results_alloc,
+			    sizeof(BuxtonData) * (n_ops * 2 + 1))) {
+		abort();
+	}
+	results = client->results;
+	results[0].type = BUXTON_TYPE_INT32;
+	results[0].store.d_int32 = 0;
+	reply_len = BUXTON_MESSAGE_EMPTY_LENGTH +
+		buxton_serialized_param_length(&results[0]);
+
+	pos = 0;
+	while (pos < count) {
+		(void)next_batch_op(list, count, &pos, &msg, &key, &value);
+		data = NULL;
+		switch (msg) {
+		case BUXTON_CONTROL_GET:
+			data = get_value(self, client, &key, &status);
+			break;
+		case BUXTON_CONTROL_SET:
+			set_value(self, client, &key, value, &status);
+			break;
+		case BUXTON_CONTROL_UNSET:
+			unset_value(self, client, &key, &status);
+			break;
+		default:
+			assert(0);
+		}
+		results[n_results].type = BUXTON_TYPE_INT32;
+		results[n_results].store.d_int32 = status;
+		reply_len += buxton_serialized_param_length(&results[n_results]);
+		n_results++;
+		if (data) {
+			if (status == 0) {
+				reply_len += buxton_serialized_param_length(data);
+				results[n_results++] = *data;
+			} else if (data->type == BUXTON_TYPE_STRING) {
+				free(data->store.d_string.value);
+			}
+			free(data);
+		}
+	}
+
+	if (reply_len > BUXTON_MESSAGE_MAX_LENGTH) {
+		/* Only a batch without writes gets this far */
+		buxton_log("Reply to batch of %zu operations is too large\n",
+			   n_ops);
+		ret = send_reply(self, client, msgid, &out, 1, NULL);
+	} else {
+		ret = send_reply(self, client, msgid, results, n_results, NULL);
+	}
+
+	/* Values returned by gets are owned by the results */
+	for (size_t i = 1; i < n_results; i++) {
+		if (results[i].type == BUXTON_TYPE_STRING) {
+			free(results[i].store.d_string.value);
+		}
+	}
+
+	/* Tell everyone else about the keys that changed, even if the
+	 * reply didn't make it back */
+	pos = 0;
+	n_results = 1;
+	while (pos < count) {
+		(void)next_batch_op(list, count, &pos, &msg, &key, &value);
+		status = results[n_results++].store.d_int32;
+		if (status != 0) {
+			continue;
+		}
+		if (msg == BUXTON_CONTROL_GET) {
+			n_results++;
+		} else if (msg == BUXTON_CONTROL_SET) {
+			buxtond_notify_clients(self, client, &key, value);
+		} else {
+			buxtond_notify_clients(self, client, &key, NULL);
+		}
+	}
+
+	return ret;
+}
+
+/* Transaction operations hashed by the key they change */
+static unsigned batch_op_hash_func(const void *p)
+{
+	const BuxtonBatchOp *op = p;
+
+	return string_hash_func(op->key.group.value) * 31 +
+		string_hash_func(op->key.name.value);
+}
+
+static int batch_op_compare_func(const void *a, const void *b)
+{
+	const BuxtonBatchOp *x = a, *y = b;
+	int r;
+
+	r = strcmp(x->key.group.value, y->key.group.value);
+	if (r != 0) {
+		return r;
+	}
+
+	return strcmp(x->key.name.value, y->key.name.value);
+}
+
+bool handle_commit(BuxtonDaemon *self, client_list_item *client,
+		   uint32_t msgid, BuxtonData *list, size_t count)
+{
+	BuxtonControlMessage msg;
+	BuxtonBatchOp *op;
+	BuxtonData *value;
+	BuxtonData out;
+	Hashmap *last;
+	size_t pos = 0;
+	size_t n_ops = 0;
+	int32_t ret;
+	bool sent;
+
+	assert(self);
+	assert(client);
+
+	out.type = BUXTON_TYPE_INT32;
+	out.store.d_int32 = -1;
+
+	/* Operations borrow their keys and values from the request */
+	while (pos < count) {
+		if (!greedy_realloc((void **)&client->txn, &client->txn_alloc,
+				    sizeof(BuxtonBatchOp) * (n_ops + 1))) {
+			abort();
+		}
+		op = &client->txn[n_ops];
+		memzero(op, sizeof(BuxtonBatchOp));
+		if (!next_batch_op(list, count, &pos, &msg, &op->key, &value)) {
+			return send_reply(self, client, msgid, &out, 1, NULL);
+		}
+		if (msg == BUXTON_CONTROL_GET) {
+			return send_reply(self, client, msgid, &out, 1, NULL);
+		}
+		op->type = msg;
+		if (value) {
+			op->value = *value;
+		}
+		n_ops++;
+	}
+
+	buxton_debug("Daemon committing %zu operations\n", n_ops);
+
+	self->buxton.client.uid = client->cred.uid;
+	ret = buxton_direct_commit(&self->buxton, client->txn, n_ops,
+				   client->smack_label);
+	if (ret) {
+		buxton_debug("Commit failed: %s\n", strerror(ret));
+		return send_reply(self, client, msgid, &out, 1, NULL);
+	}
+
+	out.store.d_int32 = 0;
+	sent = send_reply(self, client, msgid, &out, 1, NULL);
+
+	/* Find the last change to each key */
+	last = hashmap_new(batch_op_hash_func, batch_op_compare_func);
+	if (!last) {
+		abort();
+	}
+	for (size_t i = 0; i < n_ops; i++) {
+		if (hashmap_replace(last, &client->txn[i], &client->txn[i]) < 0) {
+			abort();
+		}
+	}
+
+	/* Only tell everyone else once every change is in place, and
+	 * only about the last change to each key, even if the reply
+	 * didn't make it back */
+	for (size_t i = 0; i < n_ops; i++) {
+		op = &client->txn[i];
+		if (hashmap_get(last, op) != op) {
+			continue;
+		}
+		if (op->type == BUXTON_CONTROL_SET) {
+			buxtond_notify_clients(self, client, &op->key,
+					       &op->value);
+		} else {
+			buxtond_notify_clients(self, client, &op->key, NULL);
+		}
+	}
+	hashmap_free(last);
+
+	return sent;
+}
+
+bool buxtond_handle_message(BuxtonDaemon *self, client_list_item *client,
+			    uint8_t *message, size_t size)
 {
 	BuxtonControlMessage msg;
 	int32_t response;
-	BuxtonData *list = NULL;
 	_cleanup_buxton_data_ BuxtonData *data = NULL;
-	uint16_t i;
 	ssize_t p_count;
-	size_t response_len;
-	BuxtonData response_data, mdata;
+	BuxtonData out[2];
+	size_t n_out;
 	BuxtonData *value = NULL;
 	_BuxtonKey key = {{0}, {0}, {0}, 0};
-	BuxtonArray *out_list = NULL, *key_list = NULL;
-	_cleanup_free_ uint8_t *response_store = NULL;
+	BuxtonArray *key_list = NULL;
 	uid_t uid;
 	bool ret = false;
 	uint32_t msgid = 0;
@@ -236,14 +711,14 @@ bool buxtond_handle_message(BuxtonDaemon *self, client_list_item *client, size_t
 
 	assert(self);
 	assert(client);
+	assert(message);
 
 	uid = self->buxton.client.uid;
-	p_count = buxton_deserialize_message((uint8_t*)client->data, &msg, size,
-					     &msgid, &list);
+	/* Parameters borrow their strings from the receive buffer */
+	p_count = buxton_deserialize_message_view(message, &msg, size, &msgid,
+						  &client->params,
+						  &client->params_alloc);
 	if (p_count < 0) {
-		if (errno == ENOMEM) {
-			abort();
-		}
 		/* Todo: terminate the client due to invalid message */
 		buxton_debug("Failed to deserialize message\n");
 		goto end;
@@ -254,7 +729,18 @@ bool buxtond_handle_message(BuxtonDaemon *self, client_list_item *client, size_t
 		goto end;
 	}
 
-	if (!parse_list(msg, (size_t)p_count, list, &key, &value)) {
+	if (msg == BUXTON_CONTROL_BATCH) {
+		ret = handle_batch(self, client, msgid, client->params,
+				   (size_t)p_count);
+		goto end;
+	}
+	if (msg == BUXTON_CONTROL_COMMIT) {
+		ret = handle_commit(self, client, msgid, client->params,
+				    (size_t)p_count);
+		goto end;
+	}
+
+	if (!parse_list(msg, (size_t)p_count, client->params, &key, &value)) {
 		goto end;
 	}
 
@@ -289,7 +775,9 @@ bool buxtond_handle_message(BuxtonDaemon *self, client_list_item *client, size_t
 		key_list = list_names(self, client, &key, &response);
 		break;
 	case BUXTON_CONTROL_NOTIFY:
-		register_notification(self, client, &key, msgid, &response);
+		register_notification(self, client, &key, msgid,
+				      value ? value->store.d_uint32 : 0,
+				      &response);
 		break;
 	case BUXTON_CONTROL_UNNOTIFY:
 		n_msgid = unregister_notification(self, client, &key, &response);
@@ -297,220 +785,320 @@ bool buxtond_handle_message(BuxtonDaemon *self, client_list_item *client, size_t
 	default:
 		goto end;
 	}
-	/* Set a response code */
-	response_data.type = BUXTON_TYPE_INT32;
-	response_data.store.d_int32 = response;
-	out_list = buxton_array_new();
-	if (!out_list) {
-		abort();
-	}
-	if (!buxton_array_add(out_list, &response_data)) {
-		abort();
-	}
-
-
+	/* Set a response code, followed by any data being returned */
+	out[0].type = BUXTON_TYPE_INT32;
+	out[0].store.d_int32 = response;
+	n_out = 1;
 	switch (msg) {
-		/* TODO: Use cascading switch */
-	case BUXTON_CONTROL_SET:
-		response_len = buxton_serialize_message(&response_store,
-							BUXTON_CONTROL_STATUS,
-							msgid, out_list);
-		if (response_len == 0) {
-			if (errno == ENOMEM) {
-				abort();
-			}
-			buxton_log("Failed to serialize set response message\n");
-			abort();
-		}
-		break;
-	case BUXTON_CONTROL_SET_LABEL:
-		response_len = buxton_serialize_message(&response_store,
-							BUXTON_CONTROL_STATUS,
-							msgid, out_list);
-		if (response_len == 0) {
-			if (errno == ENOMEM) {
-				abort();
-			}
-			buxton_log("Failed to serialize set_label response message\n");
-			abort();
-		}
-		break;
-	case BUXTON_CONTROL_CREATE_GROUP:
-		response_len = buxton_serialize_message(&response_store,
-							BUXTON_CONTROL_STATUS,
-							msgid, out_list);
-		if (response_len == 0) {
-			if (errno == ENOMEM) {
-				abort();
-			}
-			buxton_log("Failed to serialize create_group response message\n");
-			abort();
-		}
-		break;
-	case BUXTON_CONTROL_REMOVE_GROUP:
-		response_len = buxton_serialize_message(&response_store,
-							BUXTON_CONTROL_STATUS,
-							msgid, out_list);
-		if (response_len == 0) {
-			if (errno == ENOMEM) {
-				abort();
-			}
-			buxton_log("Failed to serialize remove_group response message\n");
-			abort();
-		}
-		break;
 	case BUXTON_CONTROL_GET:
-		if (data && !buxton_array_add(out_list, data)) {
-			abort();
-		}
-		response_len = buxton_serialize_message(&response_store,
-							BUXTON_CONTROL_STATUS,
-							msgid, out_list);
-		if (response_len == 0) {
-			if (errno == ENOMEM) {
-				abort();
-			}
-			buxton_log("Failed to serialize get response message\n");
-			abort();
-		}
-		break;
 	case BUXTON_CONTROL_GET_LABEL:
-		if (data && !buxton_array_add(out_list, data)) {
-			abort();
-		}
-		response_len = buxton_serialize_message(&response_store,
-							BUXTON_CONTROL_STATUS,
-							msgid, out_list);
-		if (response_len == 0) {
-			if (errno == ENOMEM) {
-				abort();
-			}
-			buxton_log("Failed to serialize get_label response message\n");
-			abort();
+		if (data) {
+			out[n_out++] = *data;
 		}
 		break;
-	case BUXTON_CONTROL_UNSET:
-		response_len = buxton_serialize_message(&response_store,
-							BUXTON_CONTROL_STATUS,
-							msgid, out_list);
-		if (response_len == 0) {
-			if (errno == ENOMEM) {
-				abort();
-			}
-			buxton_log("Failed to serialize unset response message\n");
-			abort();
-		}
+	case BUXTON_CONTROL_UNNOTIFY:
+		out[n_out].type = BUXTON_TYPE_UINT32;
+		out[n_out].store.d_uint32 = n_msgid;
+		n_out++;
 		break;
-	case BUXTON_CONTROL_LIST:
-		if (key_list) {
-			for (i = 0; i < key_list->len; i++) {
-				if (!buxton_array_add(out_list, buxton_array_get(key_list, i))) {
-					abort();
-				}
-			}
-			buxton_array_free(&key_list, NULL);
-		}
-		response_len = buxton_serialize_message(&response_store,
-							BUXTON_CONTROL_STATUS,
-							msgid, out_list);
-		if (response_len == 0) {
-			if (errno == ENOMEM) {
-				abort();
-			}
-			buxton_log("Failed to serialize list response message\n");
-			abort();
-		}
+	default:
 		break;
-	case BUXTON_CONTROL_LIST_NAMES:
-		if (key_list) {
-			for (i = 0; i < key_list->len; i++) {
-				if (!buxton_array_add(out_list, buxton_array_get(key_list, i))) {
-					abort();
-				}
-			}
-			buxton_array_free(&key_list, NULL);
+	}
+
+	ret = send_reply(self, client, msgid, out, n_out, key_list);
+	if (key_list) {
+		buxton_array_free(&key_list, NULL);
+	}
+	if (ret) {
+		if (msg == BUXTON_CONTROL_SET && response == 0) {
+			buxtond_notify_clients(self, client, &key, value);
+		} else if (msg == BUXTON_CONTROL_UNSET && response == 0) {
+			buxtond_notify_clients(self, client, &key, NULL);
 		}
-		response_len = buxton_serialize_message(&response_store,
-							BUXTON_CONTROL_STATUS,
-							msgid, out_list);
-		if (response_len == 0) {
-			if (errno == ENOMEM) {
-				abort();
-			}
-			buxton_log("Failed to serialize list names response message\n");
-			abort();
-		}
-		break;
-	case BUXTON_CONTROL_NOTIFY:
-		response_len = buxton_serialize_message(&response_store,
-							BUXTON_CONTROL_STATUS,
-							msgid, out_list);
-		if (response_len == 0) {
-			if (errno == ENOMEM) {
-				abort();
-			}
-			buxton_log("Failed to serialize notify response message\n");
+	}
+
+end:
+	/* Restore our own UID */
+	self->buxton.client.uid = uid;
+	return ret;
+}
+
+/* Serialize a change notification, its message ID left to be filled */
+static size_t serialize_changed(uint8_t **response, size_t *response_alloc,
+				BuxtonData *params, size_t count)
+{
+	size_t response_len;
+
+	response_len = buxton_serialize_message_into(response, response_alloc,
+						     BUXTON_CONTROL_CHANGED, 0,
+						     params, count, NULL);
+	if (response_len == 0) {
+		if (errno == ENOMEM) {
 			abort();
 		}
-		break;
-	case BUXTON_CONTROL_UNNOTIFY:
-		mdata.type = BUXTON_TYPE_UINT32;
-		mdata.store.d_uint32 = n_msgid;
-		if (!buxton_array_add(out_list, &mdata)) {
-			abort();
+		buxton_log("Failed to serialize notification\n");
+		abort();
+	}
+
+	return response_len;
+}
+
+/* Get the label of a key just set, which wildcard watchers must be able
+ * to read, their access to its group being checked on registration */
+static bool changed_key_label(BuxtonDaemon *self, client_list_item *client,
+			      _BuxtonKey *key, BuxtonData *value,
+			      BuxtonLabelId *label)
+{
+	BuxtonData data;
+	BuxtonString data_label = { NULL, 0 };
+	uid_t uid = self->buxton.client.uid;
+	int ret;
+
+	*label = BUXTON_LABEL_NONE;
+	/* Unset keys have no label left, the group check stands */
+	if (!value || !buxton_smack_enabled()) {
+		return true;
+	}
+
+	self->buxton.client.uid = client->cred.uid;
+	ret = buxton_direct_get_value_for_layer(&self->buxton, key, &data,
+						&data_label, BUXTON_LABEL_NONE);
+	self->buxton.client.uid = uid;
+	if (ret) {
+		return false;
+	}
+	if (data.type == BUXTON_TYPE_STRING) {
+		free(data.store.d_string.value);
+	}
+	*label = buxton_label_intern(&data_label);
+	free(data_label.value);
+
+	return true;
+}
+
+/* Current time in ms, for notification windows and budgets */
+static uint64_t notify_now(BuxtonDaemon *self)
+{
+	struct timespec ts;
+
+	if (self->notify_clock) {
+		return self->notify_clock();
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* Time from which a key's changes may be sent to a subscriber again */
+static uint64_t notify_due(BuxtonDaemon *self, BuxtonNotification *nitem)
+{
+	client_list_item *cl = nitem->client;
+	uint64_t due = nitem->next;
+
+	if (self->notify_budget && cl->notify_sent >= self->notify_budget &&
+	    cl->notify_second + 1000 > due) {
+		due = cl->notify_second + 1000;
+	}
+
+	return due;
+}
+
+/* Hold a subscriber back until due, keeping notify_pending sorted. Most
+ * are due after all those already held back, so look from the end */
+static void hold_back(BuxtonDaemon *self, BuxtonNotification *nitem,
+		      uint64_t due)
+{
+	BuxtonNotification *prev = self->notify_pending_tail;
+
+	while (prev && prev->due > due) {
+		prev = prev->pending_prev;
+	}
+	nitem->due = due;
+	nitem->pending = true;
+	LIST_INSERT_AFTER(BuxtonNotification, pending, self->notify_pending,
+			  prev, nitem);
+	if (!nitem->pending_next) {
+		self->notify_pending_tail = nitem;
+	}
+}
+
+/* Take a subscriber off notify_pending */
+static void release(BuxtonDaemon *self, BuxtonNotification *nitem)
+{
+	if (self->notify_pending_tail == nitem) {
+		self->notify_pending_tail = nitem->pending_prev;
+	}
+	LIST_REMOVE(BuxtonNotification, pending, self->notify_pending, nitem);
+	nitem->pending = false;
+}
+
+/* Account a notification sent to a key watch subscriber */
+static void notified(BuxtonDaemon *self, BuxtonNotification *nitem,
+		     uint64_t now)
+{
+	client_list_item *cl = nitem->client;
+
+	if (now >= cl->notify_second + 1000) {
+		cl->notify_second = now;
+		cl->notify_sent = 0;
+	}
+	cl->notify_sent++;
+	nitem->next = now + nitem->window;
+}
+
+/* Send a serialized notification to one subscriber */
+static bool send_notification(BuxtonDaemon *self, BuxtonNotification *nitem,
+			      uint8_t *response, size_t response_len)
+{
+	memcpy(response + BUXTON_MSGID_OFFSET, &nitem->msgid,
+	       sizeof(uint32_t));
+	buxton_debug("Notification to %d of key change (msgid %u)\n",
+		     nitem->client->fd, nitem->msgid);
+
+	if (!buxtond_send(self, nitem->client, response, response_len)) {
+		buxton_log("Dropped notification to %d of key change (msgid %u)\n",
+			   nitem->client->fd, nitem->msgid);
+		return false;
+	}
+
+	return true;
+}
+
+/* Send a serialized notification to the subscribers of a watch which
+ * may read a key with the given label. Subscribers of key watches are
+ * held back while in their window or over budget, to be sent the key's
+ * latest change by buxtond_flush_notifications */
+static void notify_watch(BuxtonDaemon *self, BuxtonNotifyKey *nkey,
+			 uint8_t *response, size_t response_len,
+			 BuxtonLabelId label, bool coalesce)
+{
+	BuxtonNotification *nitem;
+	uint64_t now = coalesce ? notify_now(self) : 0;
+	uint64_t due;
+
+	LIST_FOREACH(by_key, nitem, nkey->subscribers) {
+		if (label != BUXTON_LABEL_NONE &&
+		    nitem->client->smack_label != BUXTON_LABEL_NONE &&
+		    !buxton_check_smack_access_id(nitem->client->smack_label,
+						  label, ACCESS_READ)) {
+			continue;
 		}
-		response_len = buxton_serialize_message(&response_store,
-							BUXTON_CONTROL_STATUS,
-							msgid, out_list);
-		if (response_len == 0) {
-			if (errno == ENOMEM) {
-				abort();
+
+		if (coalesce) {
+			if (nitem->pending) {
+				continue;
+			}
+			due = notify_due(self, nitem);
+			if (due > now) {
+				hold_back(self, nitem, due);
+				continue;
 			}
-			buxton_log("Failed to serialize unnotify response message\n");
-			abort();
 		}
-		break;
-	default:
-		goto end;
-	}
 
-	/* Now write the response */
-	ret = _write(client->fd, response_store, response_len);
-	if (ret) {
-		if (msg == BUXTON_CONTROL_SET && response == 0) {
-			buxtond_notify_clients(self, client, &key, value);
-		} else if (msg == BUXTON_CONTROL_UNSET && response == 0) {
-			buxtond_notify_clients(self, client, &key, NULL);
+		if (send_notification(self, nitem, response, response_len) &&
+		    coalesce) {
+			notified(self, nitem, now);
 		}
 	}
+}
 
-end:
-	/* Restore our own UID */
-	self->buxton.client.uid = uid;
-	if (out_list) {
-		buxton_array_free(&out_list, NULL);
+void buxtond_flush_notifications(BuxtonDaemon *self)
+{
+	BuxtonNotification *nitem;
+	uint64_t now, due;
+
+	if (!self->notify_pending) {
+		return;
 	}
-	if (list) {
-		for (i=0; i < p_count; i++) {
-			if (list[i].type == BUXTON_TYPE_STRING) {
-				free(list[i].store.d_string.value);
-			}
+
+	/* Subscribers due have missed a change. Those whose client spent
+	 * its budget on other watches meanwhile are held back further */
+	now = notify_now(self);
+	while ((nitem = self->notify_pending) && nitem->due <= now) {
+		release(self, nitem);
+		due = notify_due(self, nitem);
+		if (due > now) {
+			hold_back(self, nitem, due);
+			continue;
+		}
+		if (send_notification(self, nitem, nitem->key->frame,
+				      nitem->key->frame_len)) {
+			notified(self, nitem, now);
 		}
-		free(list);
 	}
-	return ret;
+}
+
+int buxtond_notify_timeout(BuxtonDaemon *self)
+{
+	uint64_t now, first;
+
+	if (!self->notify_pending) {
+		return -1;
+	}
+
+	now = notify_now(self);
+	first = self->notify_pending->due;
+	if (first <= now) {
+		return 0;
+	}
+
+	return first - now > INT_MAX ? INT_MAX : (int)(first - now);
+}
+
+/*
+ * Whether a key's new value differs from the one its subscribers saw,
+ * an unset key always counting as a change
+ */
+static bool notify_value_changed(BuxtonData *old, BuxtonData *value)
+{
+	if (!old || !value || old->type != value->type) {
+		return true;
+	}
+
+	switch (value->type) {
+	case BUXTON_TYPE_STRING:
+		if (old->store.d_string.length != value->store.d_string.length) {
+			return true;
+		}
+		return memcmp(old->store.d_string.value,
+			      value->store.d_string.value,
+			      value->store.d_string.length) != 0;
+	case BUXTON_TYPE_INT32:
+		return old->store.d_int32 != value->store.d_int32;
+	case BUXTON_TYPE_UINT32:
+		return old->store.d_uint32 != value->store.d_uint32;
+	case BUXTON_TYPE_INT64:
+		return old->store.d_int64 != value->store.d_int64;
+	case BUXTON_TYPE_UINT64:
+		return old->store.d_uint64 != value->store.d_uint64;
+	case BUXTON_TYPE_FLOAT:
+		return memcmp(&old->store.d_float, &value->store.d_float,
+			      sizeof(float)) != 0;
+	case BUXTON_TYPE_DOUBLE:
+		return memcmp(&old->store.d_double, &value->store.d_double,
+			      sizeof(double)) != 0;
+	case BUXTON_TYPE_BOOLEAN:
+		return old->store.d_boolean != value->store.d_boolean;
+	default:
+		buxton_log("Internal state corruption: Notification data type invalid\n");
+		abort();
+	}
 }
 
 void buxtond_notify_clients(BuxtonDaemon *self, client_list_item *client,
 			      _BuxtonKey *key, BuxtonData *value)
 {
-	BuxtonList *list = NULL;
-	BuxtonList *elem = NULL;
-	BuxtonNotification *nitem;
-	_cleanup_free_ uint8_t* response = NULL;
+	BuxtonNotifyKey *nkey;
+	BuxtonNotifyGroup *group;
+	BuxtonData params[2];
+	BuxtonLabelId label = BUXTON_LABEL_NONE;
+	_cleanup_free_ uint8_t *response = NULL;
+	size_t response_alloc = 0;
 	size_t response_len;
-	BuxtonArray *out_list = NULL;
-	_cleanup_free_ char *key_name;
+	_cleanup_free_ char *key_name = NULL;
+	_cleanup_free_ char *watch_name = NULL;
+	size_t group_len, name_len;
+	char *prefix;
 
 	assert(self);
 	assert(client);
@@ -520,110 +1108,83 @@ void buxtond_notify_clients(BuxtonDaemon *self, client_list_item *client,
 	if (!key_name) {
 		return;
 	}
-	list = hashmap_get(self->notify_mapping, key_name);
-	if (!list) {
-		return;
-	}
 
-	BUXTON_LIST_FOREACH(list, elem) {
-		nitem = elem->data;
-		int c = 1;
-		__attribute__((unused)) bool unused;
-		free(response);
-		response = NULL;
-
-		if (nitem->old_data && value) {
-			switch (value->type) {
-			case BUXTON_TYPE_STRING:
-				c = memcmp((const void *)
-					   (nitem->old_data->store.d_string.value),
-					   (const void *)(value->store.d_string.value),
-					   value->store.d_string.length);
-				break;
-			case BUXTON_TYPE_INT32:
-				c = memcmp((const void *)&(nitem->old_data->store.d_int32),
-					   (const void *)&(value->store.d_int32),
-					   sizeof(int32_t));
-				break;
-			case BUXTON_TYPE_UINT32:
-				c = memcmp((const void *)&(nitem->old_data->store.d_uint32),
-					   (const void *)&(value->store.d_uint32),
-					   sizeof(uint32_t));
-				break;
-			case BUXTON_TYPE_INT64:
-				c = memcmp((const void *)&(nitem->old_data->store.d_int64),
-					   (const void *)&(value->store.d_int64),
-					   sizeof(int64_t));
-				break;
-			case BUXTON_TYPE_UINT64:
-				c = memcmp((const void *)&(nitem->old_data->store.d_uint64),
-					   (const void *)&(value->store.d_uint64),
-					   sizeof(uint64_t));
-				break;
-			case BUXTON_TYPE_FLOAT:
-				c = memcmp((const void *)&(nitem->old_data->store.d_float),
-					   (const void *)&(value->store.d_float),
-					   sizeof(float));
-				break;
-			case BUXTON_TYPE_DOUBLE:
-				c = memcmp((const void *)&(nitem->old_data->store.d_double),
-					   (const void *)&(value->store.d_double),
-					   sizeof(double));
-				break;
-			case BUXTON_TYPE_BOOLEAN:
-				c = memcmp((const void *)&(nitem->old_data->store.d_boolean),
-					   (const void *)&(value->store.d_boolean),
-					   sizeof(bool));
-				break;
-			default:
-				buxton_log("Internal state corruption: Notification data type invalid\n");
+	/* Serialize once, only the message ID differs between subscribers.
+	 * The latest change of a key is kept for subscribers held back.
+	 * A name ending in '*' only ever matches wildcards, below */
+	nkey = NULL;
+	if (!is_wildcard_watch(key_name)) {
+		nkey = hashmap_get(self->notify_mapping, key_name);
+	}
+	/* All subscribers of a key saw the same value, storing it again is
+	 * no news to them */
+	if (nkey && notify_value_changed(nkey->value, value)) {
+		free_buxton_data(&nkey->value);
+		nkey->value = NULL;
+		if (value) {
+			nkey->value = malloc0(sizeof(BuxtonData));
+			if (!nkey->value) {
 				abort();
 			}
-		}
-
-		if (!c) {
-			continue;
-		}
-		if (nitem->old_data && (nitem->old_data->type == BUXTON_TYPE_STRING)) {
-			free(nitem->old_data->store.d_string.value);
-		}
-		free(nitem->old_data);
-
-		nitem->old_data = malloc0(sizeof(BuxtonData));
-		if (!nitem->old_data) {
-			abort();
-		}
-		if (value) {
-			if (!buxton_data_copy(value, nitem->old_data)) {
+			if (!buxton_data_copy(value, nkey->value)) {
 				abort();
 			}
 		}
+		nkey->frame_len = serialize_changed(&nkey->frame,
+						    &nkey->frame_alloc,
+						    value, value ? 1 : 0);
+		notify_watch(self, nkey, nkey->frame, nkey->frame_len,
+			     BUXTON_LABEL_NONE, true);
+	}
 
-		out_list = buxton_array_new();
-		if (!out_list) {
-			abort();
-		}
-		if (value) {
-			if (!buxton_array_add(out_list, value)) {
-				abort();
-			}
+	group = hashmap_get(self->notify_groups, key->group.value);
+	if (!group) {
+		return;
+	}
+
+	/* Wildcard watchers are told which key changed, ahead of its value */
+	params[0].type = BUXTON_TYPE_STRING;
+	params[0].store.d_string = key->name;
+	if (value) {
+		params[1] = *value;
+	}
+	response_len = 0;
+
+	/* Look up the watches of each prefix length in use in the group */
+	group_len = strlen(key->group.value);
+	name_len = strlen(key->name.value);
+	watch_name = malloc(group_len + name_len + 3);
+	if (!watch_name) {
+		abort();
+	}
+	memcpy(watch_name, key->group.value, group_len);
+	watch_name[group_len] = '\n';
+	prefix = watch_name + group_len + 1;
+
+	for (size_t len = 0; len < group->n_prefixes && len <= name_len; len++) {
+		if (group->prefixes[len] == 0) {
+			continue;
 		}
+		memcpy(prefix, key->name.value, len);
+		prefix[len] = '*';
+		prefix[len + 1] = '\0';
 
-		response_len = buxton_serialize_message(&response,
-							BUXTON_CONTROL_CHANGED,
-							nitem->msgid, out_list);
-		buxton_array_free(&out_list, NULL);
+		nkey = hashmap_get(self->notify_mapping, watch_name);
+		if (!nkey) {
+			continue;
+		}
 		if (response_len == 0) {
-			if (errno == ENOMEM) {
-				abort();
+			if (!changed_key_label(self, client, key, value, &label)) {
+				buxton_log("No label for key change (%s), wildcard watchers not notified\n",
+					   key_name);
+				return;
 			}
-			buxton_log("Failed to serialize notification\n");
-			abort();
+			response_len = serialize_changed(&response,
+							 &response_alloc,
+							 params,
+							 value ? 2 : 1);
 		}
-		buxton_debug("Notification to %d of key change (%s)\n", nitem->client->fd,
-			     key_name);
-
-		unused = _write(nitem->client->fd, response, response_len);
+		notify_watch(self, nkey, response, response_len, label, false);
 	}
 }
 
@@ -890,18 +1451,64 @@ BuxtonArray *list_names(BuxtonDaemon *self,  client_list_item *client,
 	return ret_list;
 }
 
+/* Drop a registration from its watch, its client and the daemon, and
+ * the watch with its last subscriber */
+static void remove_notification(BuxtonDaemon *self, BuxtonNotification *nitem)
+{
+	BuxtonNotifyKey *nkey = nitem->key;
+
+	if (nitem->pending) {
+		release(self, nitem);
+	}
+	LIST_REMOVE(BuxtonNotification, by_key, nkey->subscribers, nitem);
+	LIST_REMOVE(BuxtonNotification, by_client, nitem->client->notifications,
+		    nitem);
+	(void)hashmap_remove(self->notify_subscriptions, nitem);
+	free(nitem);
+
+	if (nkey->subscribers) {
+		return;
+	}
+	(void)hashmap_remove(self->notify_mapping, nkey->name);
+	if (is_wildcard_watch(nkey->name)) {
+		index_wildcard_watch(self, nkey->name, false);
+	}
+	free(nkey->name);
+	free(nkey->frame);
+	free_buxton_data(&nkey->value);
+	free(nkey);
+}
+
+unsigned notification_hash_func(const void *p)
+{
+	const BuxtonNotification *n = p;
+
+	return trivial_hash_func(n->client) * 31 + trivial_hash_func(n->key);
+}
+
+int notification_compare_func(const void *a, const void *b)
+{
+	const BuxtonNotification *x = a;
+	const BuxtonNotification *y = b;
+	int r;
+
+	r = trivial_compare_func(x->client, y->client);
+	if (r != 0) {
+		return r;
+	}
+	return trivial_compare_func(x->key, y->key);
+}
+
 void register_notification(BuxtonDaemon *self, client_list_item *client,
 			   _BuxtonKey *key, uint32_t msgid,
-			   int32_t *status)
+			   uint32_t window, int32_t *status)
 {
-	BuxtonList *n_list = NULL;
-	BuxtonList *key_list = NULL;
+	BuxtonNotifyKey *nkey;
 	BuxtonNotification *nitem;
-	BuxtonData *old_data = NULL;
+	BuxtonNotification lookup;
+	_cleanup_buxton_data_ BuxtonData *data = NULL;
 	int32_t key_status;
 	char *key_name;
-	uint64_t *fd = NULL;
-	char *key_name_copy = NULL;
 
 	assert(self);
 	assert(client);
@@ -910,68 +1517,77 @@ void register_notification(BuxtonDaemon *self, client_list_item *client,
 
 	*status = -1;
 
-	nitem = malloc0(sizeof(BuxtonNotification));
-	if (!nitem) {
-		abort();
-	}
-	nitem->client = client;
+	/* Only keys the client may read can be watched, which takes the
+	 * key's label from the backend along with its value. Wildcards cover
+	 * keys yet to be set, so their group must be readable, and each key
+	 * is checked as it changes */
+	if (buxton_key_is_wildcard(key)) {
+		_BuxtonKey group = *key;
 
-	/* Store data now, cheap */
-	old_data = get_value(self, client, key, &key_status);
+		group.name = (BuxtonString){ NULL, 0 };
+		group.type = BUXTON_TYPE_STRING;
+		data = get_value(self, client, &group, &key_status);
+	} else {
+		data = get_value(self, client, key, &key_status);
+	}
 	if (key_status != 0) {
-		free(nitem);
 		return;
 	}
-	nitem->old_data = old_data;
-	nitem->msgid = msgid;
 
-	/* May be null, but will append regardless */
 	key_name = notify_key_name(key);
 	if (!key_name) {
 		return;
 	}
 
-	key_name_copy = strdup(key_name);
-	if (!key_name_copy) {
-		abort();
-	}
-
-	n_list = hashmap_get(self->notify_mapping, key_name);
-	if (!n_list) {
-		if (!buxton_list_append(&n_list, nitem)) {
+	nkey = hashmap_get(self->notify_mapping, key_name);
+	if (!nkey) {
+		nkey = malloc0(sizeof(BuxtonNotifyKey));
+		if (!nkey) {
 			abort();
 		}
-
-		if (hashmap_put(self->notify_mapping, key_name, n_list) < 0) {
+		nkey->name = key_name;
+		if (hashmap_put(self->notify_mapping, nkey->name, nkey) < 0) {
 			abort();
 		}
+		if (is_wildcard_watch(nkey->name)) {
+			index_wildcard_watch(self, nkey->name, true);
+		} else {
+			/* Later subscribers share the value the first one saw */
+			nkey->value = data;
+			data = NULL;
+		}
 	} else {
 		free(key_name);
-		if (!buxton_list_append(&n_list, nitem)) {
-			abort();
-		}
-	}
-
-	fd = malloc0(sizeof(uint64_t));
-	if (!fd) {
-		abort();
 	}
-	*fd = (uint64_t)client->fd;
 
-	key_list = hashmap_get(self->client_key_mapping, fd);
-	if (!key_list) {
-		if (!buxton_list_append(&key_list, key_name_copy)) {
-			abort();
-		}
-		if(hashmap_put(self->client_key_mapping, fd, key_list) < 0) {
+	/* A client registers once per watch, registering again replaces
+	 * the message ID and window */
+	lookup.client = client;
+	lookup.key = nkey;
+	nitem = hashmap_get(self->notify_subscriptions, &lookup);
+	if (!nitem) {
+		nitem = malloc0(sizeof(BuxtonNotification));
+		if (!nitem) {
 			abort();
 		}
-	} else {
-		if (!buxton_list_append(&key_list, key_name_copy)) {
+		nitem->client = client;
+		nitem->key = nkey;
+		LIST_PREPEND(BuxtonNotification, by_key, nkey->subscribers, nitem);
+		LIST_PREPEND(BuxtonNotification, by_client, client->notifications,
+			     nitem);
+		if (hashmap_put(self->notify_subscriptions, nitem, nitem) < 0) {
 			abort();
 		}
-		free(fd);
 	}
+	nitem->msgid = msgid;
+
+	/* Changes from now on are news to the client, not one held back.
+	 * Wildcards cover several keys, so only the latest change of one
+	 * can't be kept */
+	if (nitem->pending) {
+		release(self, nitem);
+	}
+	nitem->window = is_wildcard_watch(nkey->name) ? 0 : window;
 
 	*status = 0;
 }
@@ -979,17 +1595,11 @@ void register_notification(BuxtonDaemon *self, client_list_item *client,
 uint32_t unregister_notification(BuxtonDaemon *self, client_list_item *client,
 				 _BuxtonKey *key, int32_t *status)
 {
-	BuxtonList *plist;
-	BuxtonList *n_list = NULL;
-	BuxtonList *key_list = NULL;
-	BuxtonList *elem = NULL;
-	BuxtonNotification *nitem, *citem = NULL;
+	BuxtonNotifyKey *nkey;
+	BuxtonNotification *citem;
+	BuxtonNotification lookup;
 	uint32_t msgid = 0;
 	_cleanup_free_ char *key_name = NULL;
-	void *old_key_name;
-	char *client_keyname = NULL;
-	uint64_t fd = 0;
-	void *old_fd = NULL;
 
 	assert(self);
 	assert(client);
@@ -1001,69 +1611,22 @@ uint32_t unregister_notification(BuxtonDaemon *self, client_list_item *client,
 	if (!key_name) {
 		return 0;
 	}
-	n_list = hashmap_get2(self->notify_mapping, key_name, &old_key_name);
+	nkey = hashmap_get(self->notify_mapping, key_name);
 	/* This key isn't actually registered for notifications */
-	if (!n_list) {
+	if (!nkey) {
 		return 0;
 	}
 
-	BUXTON_LIST_FOREACH(n_list, elem) {
-		nitem = elem->data;
-		/* Find the list item for this client */
-		if (nitem->client == client) {
-			citem = nitem;
-			break;
-		}
-	};
-
+	lookup.client = client;
+	lookup.key = nkey;
+	citem = hashmap_get(self->notify_subscriptions, &lookup);
 	/* Client hasn't registered for notifications on this key */
 	if (!citem) {
 		return 0;
 	}
 
-	fd = (uint64_t)client->fd;
-	/* Remove key name from client hashmap */
-	key_list = hashmap_get2(self->client_key_mapping, &fd, &old_fd);
-
-	if (!key_list || !old_fd) {
-		return 0;
-	}
-
-	BUXTON_LIST_FOREACH(key_list, elem) {
-		if (!strcmp(elem->data, key_name)) {
-			client_keyname = elem->data;
-			break;
-		}
-	};
-
-	if (client_keyname) {
-		plist = key_list;
-		buxton_list_remove(&key_list, client_keyname, true);
-		if (!key_list) {
-			hashmap_remove(self->client_key_mapping, &fd);
-			free(old_fd);
-		} else if (plist != key_list) {
-			if (hashmap_update(self->client_key_mapping, &fd, key_list) < 0) {
-				abort();
-			}
-		}
-	}
-
 	msgid = citem->msgid;
-	/* Remove client from notifications */
-	free_buxton_data(&(citem->old_data));
-	plist = n_list;
-	buxton_list_remove(&n_list, citem, true);
-
-	/* If we removed the last item, remove the mapping too */
-	if (!n_list) {
-		(void)hashmap_remove(self->notify_mapping, key_name);
-		free(old_key_name);
-	} else if (plist != n_list) {
-		if (hashmap_update(self->notify_mapping, key_name, n_list) < 0) {
-			abort();
-		}
-	}
+	remove_notification(self, citem);
 
 	*status = 0;
 
@@ -1107,7 +1670,7 @@ bool identify_client(client_list_item *cl)
 	msgh.msg_namelen = 0;
 
 	nr = recvmsg(cl->fd, &msgh, MSG_PEEK | MSG_DONTWAIT);
-	if (nr == -1) {
+	if (nr <= 0) {
 		return false;
 	}
 
@@ -1133,58 +1696,273 @@ bool identify_client(client_list_item *cl)
 	return true;
 }
 
-void add_pollfd(BuxtonDaemon *self, int fd, short events, bool a)
+bool add_pollfd(BuxtonDaemon *self, int fd, uint32_t events, bool a)
 {
+	struct epoll_event ev;
+
 	assert(self);
 	assert(fd >= 0);
 
-	if (!greedy_realloc((void **) &(self->pollfds), &(self->nfds_alloc),
-			    (size_t)((self->nfds + 1) * (sizeof(struct pollfd))))) {
-		abort();
+	/* The fd table is indexed directly by fd */
+	if ((size_t)fd >= self->pollfds_alloc) {
+		size_t n = (size_t)fd * 2 + 1;
+		BuxtonPollFd *p;
+
+		if (n < 64) {
+			n = 64;
+		}
+		p = realloc(self->pollfds, n * sizeof(BuxtonPollFd));
+		if (!p) {
+			abort();
+		}
+		memzero(p + self->pollfds_alloc,
+			(n - self->pollfds_alloc) * sizeof(BuxtonPollFd));
+		self->pollfds = p;
+		self->pollfds_alloc = n;
 	}
-	if (!greedy_realloc((void **) &(self->accepting), &(self->accepting_alloc),
-			    (size_t)((self->nfds + 1) * (sizeof(self->accepting))))) {
-		abort();
+
+	memzero(&ev, sizeof(struct epoll_event));
+	ev.events = events;
+	ev.data.fd = fd;
+	if (epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+		buxton_log("epoll_ctl(): %m\n");
+		return false;
 	}
-	self->pollfds[self->nfds].fd = fd;
-	self->pollfds[self->nfds].events = events;
-	self->pollfds[self->nfds].revents = 0;
-	self->accepting[self->nfds] = a;
+
+	self->pollfds[fd].registered = true;
+	self->pollfds[fd].accepting = a;
+	self->pollfds[fd].events = events;
 	self->nfds++;
 
 	buxton_debug("Added fd %d to our poll list (accepting=%d)\n", fd, a);
+
+	return true;
 }
 
-void del_pollfd(BuxtonDaemon *self, nfds_t i)
+void del_pollfd(BuxtonDaemon *self, int fd)
 {
 	assert(self);
-	assert(i < self->nfds);
-
-	buxton_debug("Removing fd %d from our list\n", self->pollfds[i].fd);
-
-	if (i != (self->nfds - 1)) {
-		memmove(&(self->pollfds[i]),
-			&(self->pollfds[i + 1]),
-			/*
-			 * nfds < max int because of kernel limit of
-			 * fds. i + 1 < nfds because of if and assert
-			 * so the casts below are always >= 0 and less
-			 * than long unsigned max int so no loss of
-			 * precision.
-			 */
-			(size_t)(self->nfds - i - 1) * sizeof(struct pollfd));
-		memmove(&(self->accepting[i]),
-			&(self->accepting[i + 1]),
-			(size_t)(self->nfds - i - 1) * sizeof(bool));
+	assert(fd >= 0);
+	assert((size_t)fd < self->pollfds_alloc);
+	assert(self->pollfds[fd].registered);
+
+	buxton_debug("Removing fd %d from our list\n", fd);
+
+	/* Only fails if the fd was already closed, which removes it too */
+	if (epoll_ctl(self->epoll_fd, EPOLL_CTL_DEL, fd, NULL) == -1) {
+		buxton_debug("epoll_ctl(): %m\n");
 	}
+
+	memzero(&(self->pollfds[fd]), sizeof(BuxtonPollFd));
 	self->nfds--;
 }
 
+/* Change the events a registered fd is waiting for */
+static bool update_pollfd(BuxtonDaemon *self, int fd, uint32_t events)
+{
+	struct epoll_event ev;
+
+	assert(self);
+	assert(fd >= 0);
+
+	if ((size_t)fd >= self->pollfds_alloc || !self->pollfds[fd].registered) {
+		return false;
+	}
+	if (self->pollfds[fd].events == events) {
+		return true;
+	}
+
+	memzero(&ev, sizeof(struct epoll_event));
+	ev.events = events;
+	ev.data.fd = fd;
+	if (epoll_ctl(self->epoll_fd, EPOLL_CTL_MOD, fd, &ev) == -1) {
+		buxton_log("epoll_ctl(): %m\n");
+		return false;
+	}
+	self->pollfds[fd].events = events;
+
+	return true;
+}
+
+/*
+ * Append data to the client's output ring. Messages are refused once the
+ * pending output reaches the high-water mark, but a message is never
+ * split, so the ring may exceed the mark by at most one message.
+ */
+static bool queue_output(BuxtonDaemon *self, client_list_item *cl,
+			 uint8_t *data, size_t len)
+{
+	size_t tail, first;
+
+	if (cl->out_len >= self->max_client_buffer) {
+		return false;
+	}
+
+	if (cl->out_len + len > cl->out_alloc) {
+		size_t n = cl->out_alloc ? cl->out_alloc * 2 : CLIENT_OUT_MIN;
+		uint8_t *out;
+
+		while (n < cl->out_len + len) {
+			n *= 2;
+		}
+
+		out = malloc(n);
+		if (!out) {
+			abort();
+		}
+		/* Unwrap the pending data to the start of the new buffer */
+		if (cl->out_len) {
+			first = cl->out_alloc - cl->out_head;
+			if (first > cl->out_len) {
+				first = cl->out_len;
+			}
+			memcpy(out, cl->out + cl->out_head, first);
+			memcpy(out + first, cl->out, cl->out_len - first);
+		}
+		free(cl->out);
+		cl->out = out;
+		cl->out_alloc = n;
+		cl->out_head = 0;
+	}
+
+	tail = (cl->out_head + cl->out_len) % cl->out_alloc;
+	first = cl->out_alloc - tail;
+	if (first > len) {
+		first = len;
+	}
+	memcpy(cl->out + tail, data, first);
+	memcpy(cl->out, data + first, len - first);
+	cl->out_len += len;
+
+	return true;
+}
+
+bool buxtond_send(BuxtonDaemon *self, client_list_item *client,
+		  uint8_t *data, size_t len)
+{
+	ssize_t l = 0;
+
+	assert(self);
+	assert(client);
+	assert(data);
+
+	/* Keep ordering: only write directly if nothing is pending */
+	if (!client->out_len) {
+		l = send(client->fd, data, len, MSG_NOSIGNAL);
+		if (l < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				buxton_debug("write error\n");
+				return false;
+			}
+			l = 0;
+		}
+		if ((size_t)l == len) {
+			return true;
+		}
+	}
+
+	if (!queue_output(self, client, data + l, len - (size_t)l)) {
+		buxton_log("Output limit reached for client %d\n", client->fd);
+		return false;
+	}
+
+	return update_pollfd(self, client->fd, EPOLLIN | EPOLLPRI | EPOLLOUT);
+}
+
+bool flush_client(BuxtonDaemon *self, client_list_item *client)
+{
+	struct iovec iov[2];
+	struct msghdr msg;
+	size_t first;
+	ssize_t l;
+
+	assert(self);
+	assert(client);
+
+	memzero(&msg, sizeof(struct msghdr));
+	msg.msg_iov = iov;
+
+	while (client->out_len) {
+		first = client->out_alloc - client->out_head;
+		if (first > client->out_len) {
+			first = client->out_len;
+		}
+		iov[0].iov_base = client->out + client->out_head;
+		iov[0].iov_len = first;
+		iov[1].iov_base = client->out;
+		iov[1].iov_len = client->out_len - first;
+
+		/* sendmsg() is writev() that does not raise SIGPIPE */
+		msg.msg_iovlen = iov[1].iov_len ? 2 : 1;
+		l = sendmsg(client->fd, &msg, MSG_NOSIGNAL);
+		if (l < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return true;
+			}
+			buxton_debug("sendmsg(): %m\n");
+			return false;
+		}
+
+		client->out_head = (client->out_head + (size_t)l) % client->out_alloc;
+		client->out_len -= (size_t)l;
+	}
+
+	/* Give back large buffers once a burst has been drained */
+	if (client->out_alloc > CLIENT_OUT_MIN) {
+		free(client->out);
+		client->out = NULL;
+		client->out_alloc = 0;
+	}
+	client->out_head = 0;
+
+	return update_pollfd(self, client->fd, EPOLLIN | EPOLLPRI);
+}
+
+client_list_item *add_client(BuxtonDaemon *self, int fd)
+{
+	client_list_item *cl;
+
+	assert(self);
+	assert(fd >= 0);
+
+	if (!add_pollfd(self, fd, EPOLLIN | EPOLLPRI, false)) {
+		return NULL;
+	}
+
+	cl = malloc0(sizeof(client_list_item));
+	if (!cl) {
+		abort();
+	}
+
+	LIST_INIT(client_list_item, item, cl);
+
+	cl->fd = fd;
+	cl->cred = (struct ucred) {0, 0, 0};
+	LIST_PREPEND(client_list_item, item, self->client_list, cl);
+	self->pollfds[fd].client = cl;
+
+	return cl;
+}
+
+client_list_item *find_client(BuxtonDaemon *self, int fd)
+{
+	assert(self);
+
+	if (fd < 0 || (size_t)fd >= self->pollfds_alloc) {
+		return NULL;
+	}
+
+	return self->pollfds[fd].client;
+}
+
 void handle_smack_label(client_list_item *cl)
 {
 	socklen_t slabel_len = 1;
-	char *buf = NULL;
-	BuxtonString *slabel = NULL;
+	_cleanup_free_ char *buf = NULL;
+	BuxtonString slabel;
 	int ret;
 
 	ret = getsockopt(cl->fd, SOL_SOCKET, SO_PEERSEC, NULL, &slabel_len);
@@ -1193,7 +1971,7 @@ void handle_smack_label(client_list_item *cl)
 		switch (errno) {
 		case ENOPROTOOPT:
 			/* If Smack is not enabled, do not set the client label */
-			cl->smack_label = NULL;
+			cl->smack_label = BUXTON_LABEL_NONE;
 			return;
 		default:
 			buxton_log("getsockopt(): %m\n");
@@ -1201,11 +1979,6 @@ void handle_smack_label(client_list_item *cl)
 		}
 	}
 
-	slabel = malloc0(sizeof(BuxtonString));
-	if (!slabel) {
-		abort();
-	}
-
 	/* already checked slabel_len positive above */
 	buf = malloc0((size_t)slabel_len + 1);
 	if (!buf) {
@@ -1218,184 +1991,170 @@ void handle_smack_label(client_list_item *cl)
 		exit(EXIT_FAILURE);
 	}
 
-	slabel->value = buf;
-	slabel->length = (uint32_t)slabel_len;
+	slabel.value = buf;
+	slabel.length = (uint32_t)slabel_len;
 
-	buxton_debug("getsockopt(): label=\"%s\"\n", slabel->value);
+	buxton_debug("getsockopt(): label=\"%s\"\n", slabel.value);
 
-	cl->smack_label = slabel;
+	/* Intern the label once, every access check of the client uses the id */
+	cl->smack_label = buxton_label_intern(&slabel);
 }
 
-bool handle_client(BuxtonDaemon *self, client_list_item *cl, nfds_t i)
+bool client_has_message(client_list_item *cl)
 {
-	ssize_t l;
-	uint16_t peek;
-	bool more_data = false;
-	int message_limit = 32;
+	size_t size;
 
-	assert(self);
 	assert(cl);
 
-	if (!cl->data) {
-		cl->data = malloc0(BUXTON_MESSAGE_HEADER_LENGTH);
-		cl->offset = 0;
-		cl->size = BUXTON_MESSAGE_HEADER_LENGTH;
-	}
-	if (!cl->data) {
-		abort();
+	if (!cl->data || cl->offset < BUXTON_MESSAGE_HEADER_LENGTH) {
+		return false;
 	}
-	/* client closed the connection, or some error occurred? */
-	if (recv(cl->fd, cl->data, cl->size, MSG_PEEK | MSG_DONTWAIT) <= 0) {
-		goto terminate;
+
+	size = buxton_get_message_size(cl->data, cl->offset);
+	if (size == 0 || size > BUXTON_MESSAGE_MAX_LENGTH) {
+		/* Let handle_client terminate the client */
+		return true;
 	}
 
-	/* need to authenticate the client? */
-	if ((cl->cred.uid == 0) || (cl->cred.pid == 0)) {
+	return cl->offset >= size;
+}
+
+bool handle_client(BuxtonDaemon *self, client_list_item *cl)
+{
+	ssize_t l;
+	size_t pos = 0;
+	size_t size;
+	int message_limit = 32;
+
+	assert(self);
+	assert(cl);
+
+	/* Authenticate once, buffered messages leave nothing to peek at */
+	if (!cl->identified) {
 		if (!identify_client(cl)) {
 			goto terminate;
 		}
 
 		handle_smack_label(cl);
+		cl->identified = true;
 	}
 
-	buxton_debug("New packet from UID %ld, PID %ld\n", cl->cred.uid, cl->cred.pid);
-
-	/* Hand off any read data */
-	do {
-		l = read(self->pollfds[i].fd, (cl->data) + cl->offset, cl->size - cl->offset);
-
-		/*
-		 * Close clients with read errors. If there isn't more
-		 * data and we don't have a complete message just
-		 * cleanup and let the client resend their request.
-		 */
-		if (l < 0) {
-			if (errno != EAGAIN) {
-				goto terminate;
-			} else {
-				goto cleanup;
-			}
-		} else if (l == 0) {
-			goto cleanup;
+	if (!cl->data) {
+		cl->data = malloc(CLIENT_IN_MIN);
+		if (!cl->data) {
+			abort();
 		}
+		cl->size = CLIENT_IN_MIN;
+		cl->offset = 0;
+	}
 
-		cl->offset += (size_t)l;
-		if (cl->offset < BUXTON_MESSAGE_HEADER_LENGTH) {
-			continue;
+	/*
+	 * Fill the buffer with whatever the socket holds, there is
+	 * always room as a partial message is kept at the start of
+	 * the buffer and the buffer is grown to fit it.
+	 */
+	l = read(cl->fd, cl->data + cl->offset, cl->size - cl->offset);
+	if (l < 0) {
+		if (errno != EAGAIN && errno != EINTR) {
+			goto terminate;
 		}
-		if (cl->size == BUXTON_MESSAGE_HEADER_LENGTH) {
-			cl->size = buxton_get_message_size(cl->data, cl->offset);
-			if (cl->size == 0 || cl->size > BUXTON_MESSAGE_MAX_LENGTH) {
-				goto terminate;
-			}
+	} else if (l == 0) {
+		/* client closed the connection */
+		goto terminate;
+	} else {
+		cl->offset += (size_t)l;
+		buxton_debug("New packet from UID %ld, PID %ld\n", cl->cred.uid, cl->cred.pid);
+	}
+
+	/* Hand off every complete message in the buffer */
+	while (message_limit) {
+		if (cl->offset - pos < BUXTON_MESSAGE_HEADER_LENGTH) {
+			break;
 		}
-		if (cl->size != BUXTON_MESSAGE_HEADER_LENGTH) {
-			cl->data = realloc(cl->data, cl->size);
-			if (!cl->data) {
-				abort();
-			}
+		size = buxton_get_message_size(cl->data + pos, cl->offset - pos);
+		if (size == 0 || size > BUXTON_MESSAGE_MAX_LENGTH) {
+			goto terminate;
 		}
-		if (cl->size > cl->offset) {
-			continue;
-		} else if (cl->size < cl->offset) {
-			buxton_log("Somehow read more bytes than from client requested\n");
-			abort();
+		if (cl->offset - pos < size) {
+			break;
 		}
-		if (!buxtond_handle_message(self, cl, cl->size)) {
+		if (!buxtond_handle_message(self, cl, cl->data + pos, size)) {
 			buxton_log("Communication failed with client %d\n", cl->fd);
 			goto terminate;
 		}
-
+		pos += size;
 		message_limit--;
-		if (message_limit) {
-			cl->size = BUXTON_MESSAGE_HEADER_LENGTH;
-			cl->offset = 0;
-			continue;
-		}
-		if (recv(cl->fd, &peek, sizeof(uint16_t), MSG_PEEK | MSG_DONTWAIT) > 0) {
-			more_data = true;
+	}
+
+	/* Move a partial message to the start of the buffer */
+	if (pos) {
+		cl->offset -= pos;
+		memmove(cl->data, cl->data + pos, cl->offset);
+	}
+
+	if (cl->offset >= BUXTON_MESSAGE_HEADER_LENGTH) {
+		size = buxton_get_message_size(cl->data, cl->offset);
+		if (size == 0 || size > BUXTON_MESSAGE_MAX_LENGTH) {
+			goto terminate;
 		}
-		goto cleanup;
-	} while (l > 0);
+		if (size > cl->size) {
+			uint8_t *p = realloc(cl->data, size);
+			if (!p) {
+				abort();
+			}
+			cl->data = p;
+			cl->size = size;
+		}
+	} else if (cl->offset == 0 && cl->size > CLIENT_IN_MIN) {
+		/* Don't hold on to a large buffer for an idle client */
+		free(cl->data);
+		cl->data = NULL;
+		cl->size = 0;
+	}
 
-cleanup:
-	free(cl->data);
-	cl->data = NULL;
-	cl->size = BUXTON_MESSAGE_HEADER_LENGTH;
-	cl->offset = 0;
-	return more_data;
+	/* epoll won't report messages that are already buffered, the
+	 * event loop serves the clients left with some on its own */
+	if (client_has_message(cl)) {
+		if (!cl->buffered) {
+			cl->buffered = true;
+			LIST_PREPEND(client_list_item, buffered,
+				     self->buffered_clients, cl);
+		}
+		return true;
+	}
+	if (cl->buffered) {
+		cl->buffered = false;
+		LIST_REMOVE(client_list_item, buffered, self->buffered_clients,
+			    cl);
+	}
+	return false;
 
 terminate:
-	terminate_client(self, cl, i);
-	return more_data;
+	terminate_client(self, cl);
+	return false;
 }
 
-void terminate_client(BuxtonDaemon *self, client_list_item *cl, nfds_t i)
+void terminate_client(BuxtonDaemon *self, client_list_item *cl)
 {
-	BuxtonList *key_list = NULL;
-	BuxtonList *elem, *notify_elem;
-	char *key_name;
-	void *old_key_name = NULL;
-	void *old_fd = NULL;
-	uint64_t fd = (uint64_t)cl->fd;
-
-	key_list = hashmap_get2(self->client_key_mapping, &fd, &old_fd);
-
-	if (key_list) {
+	if (cl->notifications) {
 		buxton_debug("Removing notifications for client before terminating\n");
-		BUXTON_LIST_FOREACH(key_list, elem) {
-			key_name = elem->data;
-			BuxtonList *n_list = NULL;
-
-			n_list = hashmap_get2(self->notify_mapping, key_name, &old_key_name);
-			if (!n_list || !old_key_name) {
-				abort();
-			}
-
-			BuxtonNotification *nitem, *citem = NULL;
-
-			BUXTON_LIST_FOREACH(n_list, notify_elem) {
-				nitem = notify_elem->data;
-				if (nitem->client == cl) {
-					citem = nitem;
-					break;
-				}
-			};
-
-			if (!citem) {
-				abort();
-			}
-
-			/* Remove client from notifications */
-			free_buxton_data(&(citem->old_data));
-
-			BuxtonList *old_n_list = n_list;
-
-			buxton_list_remove(&n_list, citem, true);
-
-			/* If n_list was changed, hashmap should be updated. */
-			if (n_list && n_list != old_n_list)
-				hashmap_update(self->notify_mapping, key_name, n_list);
-
-			/* If we removed the last item, remove the mapping too */
-			if (!n_list) {
-				(void)hashmap_remove(self->notify_mapping, key_name);
-				free(old_key_name);
-			}
-		};
-		/* Remove key from client hashmap */
-		hashmap_remove(self->client_key_mapping, &fd);
-		free(old_fd);
-		buxton_list_free_all(&key_list);
+	}
+	while (cl->notifications) {
+		remove_notification(self, cl->notifications);
 	}
 
-	del_pollfd(self, i);
-	close(cl->fd);
-	if (cl->smack_label) {
-		free(cl->smack_label->value);
+	if (cl->buffered) {
+		LIST_REMOVE(client_list_item, buffered, self->buffered_clients,
+			    cl);
 	}
-	free(cl->smack_label);
+	del_pollfd(self, cl->fd);
+	close(cl->fd);
 	free(cl->data);
+	free(cl->params);
+	free(cl->results);
+	free(cl->txn);
+	free(cl->reply);
+	free(cl->out);
 	buxton_debug("Closed connection from fd %d\n", cl->fd);
 	LIST_REMOVE(client_list_item, item, self->client_list, cl);
 	free(cl);
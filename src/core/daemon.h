@@ -20,53 +20,151 @@
 	#include "config.h"
 #endif
 
-#include <sys/poll.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 
 #include "buxton.h"
 #include "backend.h"
+#include "buxtonlabel.h"
 #include "hashmap.h"
 #include "list.h"
 #include "protocol.h"
 #include "serialize.h"
 
+struct BuxtonNotification;
+
 /**
  * List for daemon's clients
  */
 typedef struct client_list_item {
 	LIST_FIELDS(struct client_list_item, item); /**<List type */
+	LIST_FIELDS(struct client_list_item, buffered); /**<Clients with messages left buffered */
 	int fd; /**<File descriptor of connected client */
 	struct ucred cred; /**<Credentials of connected client */
-	BuxtonString *smack_label; /**<Smack label of connected client */
-	uint8_t *data; /**<Data buffer for the client */
-	size_t offset; /**<Current position to write to data buffer */
-	size_t size; /**<Size of the data buffer */
+	bool identified; /**<Whether cred and smack_label were read from the socket */
+	bool buffered; /**<Whether it is in BuxtonDaemon.buffered_clients */
+	BuxtonLabelId smack_label; /**<Interned Smack label of connected client */
+	uint8_t *data; /**<Receive buffer for the client */
+	size_t offset; /**<Number of bytes buffered in data */
+	size_t size; /**<Allocated size of the receive buffer */
+	BuxtonData *params; /**<Parameters of the message being handled */
+	size_t params_alloc; /**<Allocated size of params in bytes */
+	BuxtonData *results; /**<Results of the batch being handled */
+	size_t results_alloc; /**<Allocated size of results in bytes */
+	BuxtonBatchOp *txn; /**<Operations of the transaction being handled */
+	size_t txn_alloc; /**<Allocated size of txn in bytes */
+	uint8_t *reply; /**<Buffer replies to the client are serialized in */
+	size_t reply_alloc; /**<Allocated size of the reply buffer */
+	uint8_t *out; /**<Ring buffer of output pending for the client */
+	size_t out_alloc; /**<Allocated size of the output buffer */
+	size_t out_head; /**<Position of the first pending output byte */
+	size_t out_len; /**<Number of pending output bytes */
+	uint64_t notify_second; /**<Start in ms of the second notify_sent counts */
+	uint32_t notify_sent; /**<Notifications sent in the current second */
+	LIST_HEAD(struct BuxtonNotification, notifications); /**<Registrations of the client */
 } client_list_item;
 
+struct BuxtonNotifyKey;
+
 /**
  * Notification registration
+ *
+ * Each is linked into the list of its watch and the list of its client,
+ * so either can drop it without searching the other. Registrations are
+ * found by client and watch in BuxtonDaemon.notify_subscriptions.
  */
 typedef struct BuxtonNotification {
 	client_list_item *client; /**<Client */
-	BuxtonData *old_data; /**<Old value of a particular key*/
+	struct BuxtonNotifyKey *key; /**<Watch the registration is for */
+	LIST_FIELDS(struct BuxtonNotification, by_key); /**<Subscribers of the watch */
+	LIST_FIELDS(struct BuxtonNotification, by_client); /**<Registrations of the client */
+	LIST_FIELDS(struct BuxtonNotification, pending); /**<Subscribers held back */
+	uint64_t next; /**<Time in ms before which nothing more is sent */
+	uint64_t due; /**<Time in ms it is held back until, while pending */
+	uint32_t window; /**<Least time in ms between notifications, or 0 */
 	uint32_t msgid; /**<Message id from the client */
+	bool pending; /**<Whether it is in BuxtonDaemon.notify_pending */
 } BuxtonNotification;
 
+/**
+ * Notification registrations of a key, in BuxtonDaemon.notify_mapping
+ *
+ * Changes storing the value the subscribers last saw are not sent.
+ * Subscribers held back by their window or their client's budget are
+ * sent the key's latest change, kept in frame, when the event loop
+ * flushes them.
+ */
+typedef struct BuxtonNotifyKey {
+	char *name; /**<Name of the watch, the key in notify_mapping */
+	LIST_HEAD(BuxtonNotification, subscribers); /**<Registration of each client */
+	BuxtonData *value; /**<Value the subscribers last saw, NULL if unset or a wildcard */
+	uint8_t *frame; /**<Latest change notification, for key watches */
+	size_t frame_alloc; /**<Allocated size of frame in bytes */
+	size_t frame_len; /**<Length of the notification in frame */
+} BuxtonNotifyKey;
+
+/**
+ * Wildcard registrations of a group, in BuxtonDaemon.notify_groups
+ *
+ * Wildcard watches are kept in notify_mapping like those of keys, under
+ * their "prefix*" name. A changed key can only match watches whose prefix
+ * is no longer than its name, and only lengths watched are looked up.
+ */
+typedef struct BuxtonNotifyGroup {
+	char *name; /**<Name of the group, the key in notify_groups */
+	uint32_t *prefixes; /**<Number of wildcard watches by prefix length */
+	size_t prefixes_alloc; /**<Allocated size of prefixes in bytes */
+	size_t n_prefixes; /**<Longest watched prefix length plus one */
+	size_t n_watches; /**<Number of wildcard watches in the group */
+} BuxtonNotifyGroup;
+
+/**
+ * State of a file descriptor in the daemon's epoll set
+ */
+typedef struct BuxtonPollFd {
+	bool registered; /**<Whether the fd is in the epoll set */
+	bool accepting; /**<Whether the fd is a listening socket */
+	uint32_t events; /**<Epoll events the fd is waiting for */
+	client_list_item *client; /**<Client connected on the fd, if any */
+} BuxtonPollFd;
+
 /**
  * Global store of buxtond state
  */
 typedef struct BuxtonDaemon {
-	size_t nfds_alloc;
-	size_t accepting_alloc;
-	nfds_t nfds;
-	bool *accepting;
-	struct pollfd *pollfds;
+	int epoll_fd;
+	size_t nfds;
+	size_t pollfds_alloc;
+	BuxtonPollFd *pollfds;
+	size_t max_client_buffer;
 	client_list_item *client_list;
+	client_list_item *buffered_clients;
 	Hashmap *notify_mapping;
-	Hashmap *client_key_mapping;
+	Hashmap *notify_groups;
+	Hashmap *notify_subscriptions;
+	BuxtonNotification *notify_pending; /**<Held back subscribers, soonest due first */
+	BuxtonNotification *notify_pending_tail; /**<Last of notify_pending */
+	uint64_t (*notify_clock)(void); /**<Time in ms, CLOCK_MONOTONIC if NULL */
+	uint32_t notify_budget;
 	BuxtonControl buxton;
 } BuxtonDaemon;
 
+/**
+ * Hash a registration by its client and watch, for
+ * BuxtonDaemon.notify_subscriptions
+ * @param p The BuxtonNotification
+ * @return the hash of the registration
+ */
+unsigned notification_hash_func(const void *p) _pure_;
+
+/**
+ * Compare registrations by their client and watch
+ * @param a A BuxtonNotification
+ * @param b Another BuxtonNotification
+ * @return 0 if both are of the same client and watch
+ */
+int notification_compare_func(const void *a, const void *b) _pure_;
+
 /**
  * Take a BuxtonData array and set key, layer and value items
  * correctly
@@ -85,12 +183,41 @@ bool parse_list(BuxtonControlMessage msg, size_t count, BuxtonData *list,
  * Handle a message within buxtond
  * @param self Reference to BuxtonDaemon
  * @param client Current client
+ * @param message Start of the message within the client's receive buffer
  * @param size Size of the data being handled
  * @returns bool True if message was successfully handled
  */
 bool buxtond_handle_message(BuxtonDaemon *self,
 			      client_list_item *client,
-			      size_t size)
+			      uint8_t *message, size_t size)
+	__attribute__((warn_unused_result));
+
+/**
+ * Run the operations of a batch request in order and reply with
+ * the status of each, followed by the value of each successful get
+ * @param self Reference to BuxtonDaemon
+ * @param client Current client
+ * @param msgid Message id of the batch request
+ * @param list Parameters of the batch request
+ * @param count Number of parameters
+ * @returns bool True if the reply was sent
+ */
+bool handle_batch(BuxtonDaemon *self, client_list_item *client,
+		  uint32_t msgid, BuxtonData *list, size_t count)
+	__attribute__((warn_unused_result));
+
+/**
+ * Apply the sets and unsets of a commit request as one transaction,
+ * and notify clients of the changed keys once it is done
+ * @param self Reference to BuxtonDaemon
+ * @param client Current client
+ * @param msgid Message id of the commit request
+ * @param list Parameters of the commit request
+ * @param count Number of parameters
+ * @returns bool True if the reply was sent
+ */
+bool handle_commit(BuxtonDaemon *self, client_list_item *client,
+		   uint32_t msgid, BuxtonData *list, size_t count)
 	__attribute__((warn_unused_result));
 
 /**
@@ -103,6 +230,44 @@ bool buxtond_handle_message(BuxtonDaemon *self,
 void buxtond_notify_clients(BuxtonDaemon *self, client_list_item *client,
 			      _BuxtonKey* key, BuxtonData *value);
 
+/**
+ * Send the latest change of each key to subscribers it was held back
+ * from, whose window has passed and whose client has budget left
+ * @param self Reference to BuxtonDaemon
+ */
+void buxtond_flush_notifications(BuxtonDaemon *self);
+
+/**
+ * Get how long the event loop may wait before notifications are due
+ * @param self Reference to BuxtonDaemon
+ * @return milliseconds until held back notifications may be sent, or -1
+ * if none are held back
+ */
+int buxtond_notify_timeout(BuxtonDaemon *self)
+	__attribute__((warn_unused_result));
+
+/**
+ * Send data to a client without blocking
+ * @param self Reference to BuxtonDaemon
+ * @param client Client to send the data to
+ * @param data Data to send
+ * @param len Length of data
+ * @returns bool false if the data could not be queued because the
+ * client has too much pending output or the connection failed
+ */
+bool buxtond_send(BuxtonDaemon *self, client_list_item *client,
+		  uint8_t *data, size_t len)
+	__attribute__((warn_unused_result));
+
+/**
+ * Write as much of a client's pending output as the socket accepts
+ * @param self Reference to BuxtonDaemon
+ * @param client Client to flush
+ * @returns bool false if the connection failed
+ */
+bool flush_client(BuxtonDaemon *self, client_list_item *client)
+	__attribute__((warn_unused_result));
+
 /**
  * Buxton daemon function for setting a value
  * @param self buxtond instance being run
@@ -206,13 +371,17 @@ BuxtonArray *list_names(BuxtonDaemon *self, client_list_item *client,
  * Buxton daemon function for registering notifications on a given key
  * @param self buxtond instance being run
  * @param client Used to validate smack access
- * @param key Key to notify for changes on
+ * @param key Key to notify for changes on, or a wildcard name (see
+ * buxton_key_is_wildcard) to be notified of changes to the group's keys
  * @param msgid Message ID from the client
+ * @param window Least time in ms between notifications of a key, changes
+ * in between being coalesced, or 0 to be sent every change. Not used
+ * for wildcards
  * @param status Will be set with the int32_t result of the operation
  */
 void register_notification(BuxtonDaemon *self, client_list_item *client,
 			   _BuxtonKey *key, uint32_t msgid,
-			   int32_t *status);
+			   uint32_t window, int32_t *status);
 
 /**
  * Buxton daemon function for unregistering notifications from the given key
@@ -235,22 +404,41 @@ bool identify_client(client_list_item *cl)
 	__attribute__((warn_unused_result));
 
 /**
- * Add a fd to daemon's poll list
+ * Add a fd to daemon's epoll set
  * @param self buxtond instance being run
- * @param fd File descriptor to add to the poll list
- * @param events Priority mask for events
+ * @param fd File descriptor to add to the epoll set
+ * @param events Epoll event mask to wait for
  * @param a Accepting status of the fd
- * @return None
+ * @return a boolean value, indicating success of the operation
  */
-void add_pollfd(BuxtonDaemon *self, int fd, short events, bool a);
+bool add_pollfd(BuxtonDaemon *self, int fd, uint32_t events, bool a)
+	__attribute__((warn_unused_result));
 
 /**
- * Add a fd to daemon's poll list
+ * Remove a fd from daemon's epoll set
  * @param self buxtond instance being run
- * @param i File descriptor to remove from poll list
+ * @param fd File descriptor to remove from the epoll set
  * @return None
  */
-void del_pollfd(BuxtonDaemon *self, nfds_t i);
+void del_pollfd(BuxtonDaemon *self, int fd);
+
+/**
+ * Register a newly accepted client connection
+ * @param self buxtond instance being run
+ * @param fd File descriptor of the connected client
+ * @return the new client, or NULL if the fd could not be added
+ */
+client_list_item *add_client(BuxtonDaemon *self, int fd)
+	__attribute__((warn_unused_result));
+
+/**
+ * Look up the client connected on a file descriptor
+ * @param self buxtond instance being run
+ * @param fd File descriptor to look up
+ * @return the client, or NULL if no client is connected on fd
+ */
+client_list_item *find_client(BuxtonDaemon *self, int fd)
+	__attribute__((warn_unused_result));
 
 /**
  * Setup a client's smack label
@@ -259,23 +447,29 @@ void del_pollfd(BuxtonDaemon *self, nfds_t i);
  */
 void handle_smack_label(client_list_item *cl);
 
+/**
+ * Check whether a client has a complete message buffered
+ * @param cl Client to check
+ * @return bool true if a message can be handled without reading
+ */
+bool client_has_message(client_list_item *cl)
+	__attribute__((warn_unused_result));
+
 /**
  * Handle a client connection
  * @param self buxtond instance being run
  * @param cl The currently activate client
- * @param i The currently active file descriptor
  * @return bool indicating more data to process
  */
-bool handle_client(BuxtonDaemon *self, client_list_item *cl, nfds_t i)
+bool handle_client(BuxtonDaemon *self, client_list_item *cl)
 	__attribute__((warn_unused_result));
 
 /**
  * Terminate client connectoin
  * @param self buxtond instance being run
  * @param cl The client to terminate
- * @param i File descriptor to remove from poll list
  */
-void terminate_client(BuxtonDaemon *self, client_list_item *cl, nfds_t i);
+void terminate_client(BuxtonDaemon *self, client_list_item *cl);
 
 /*
  * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
@@ -21,8 +21,8 @@
 #include <errno.h>
 #include <getopt.h>
 #include <fcntl.h>
-#include <poll.h>
 #include <signal.h>
+#include <sys/epoll.h>
 #include <sys/signalfd.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -47,6 +47,7 @@
 #include "buxtonlist.h"
 
 #define SOCKET_TIMEOUT 5
+#define MAX_EVENTS 64
 
 static BuxtonDaemon self;
 
@@ -76,13 +77,14 @@ int main(int argc, char *argv[])
 	sigset_t mask;
 	int sigfd;
 	bool leftover_messages = false;
+	bool buffered;
 	struct stat st;
 	bool help = false;
-	BuxtonList *map_list = NULL;
+	BuxtonNotifyKey *nkey = NULL;
+	BuxtonNotification *nitem, *next;
+	BuxtonNotifyGroup *ngroup = NULL;
 	Iterator iter;
-	char *notify_key;
-	BuxtonList *key_list = NULL;
-	uint64_t *client_fd;
+	struct epoll_event events[MAX_EVENTS];
 
 	static struct option opts[] = {
 		{ "config-file", 1, NULL, 'c' },
@@ -133,9 +135,16 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	self.nfds_alloc = 0;
-	self.accepting_alloc = 0;
 	self.nfds = 0;
+	self.pollfds_alloc = 0;
+	self.pollfds = NULL;
+	self.max_client_buffer = buxton_max_client_buffer();
+	self.notify_budget = buxton_notify_budget();
+	self.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (self.epoll_fd == -1) {
+		buxton_log("epoll_create1(): %m\n");
+		exit(EXIT_FAILURE);
+	}
 	self.buxton.client.direct = true;
 	self.buxton.client.uid = geteuid();
 	if (!buxton_direct_open(&self.buxton)) {
@@ -166,12 +175,17 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	add_pollfd(&self, sigfd, POLLIN, false);
+	if (!add_pollfd(&self, sigfd, EPOLLIN, false)) {
+		exit(EXIT_FAILURE);
+	}
 
 	/* For client notifications */
 	self.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
-	/* For keeping track of keys a client is registered to*/
-	self.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
+	/* For finding the wildcard watches of a group */
+	self.notify_groups = hashmap_new(string_hash_func, string_compare_func);
+	/* For finding the registration of a client to a key */
+	self.notify_subscriptions = hashmap_new(notification_hash_func,
+						notification_compare_func);
 	/* Store a list of connected clients */
 	LIST_HEAD_INIT(client_list_item, self.client_list);
 
@@ -214,78 +228,86 @@ int main(int argc, char *argv[])
 			buxton_log("listen(): %m\n");
 			exit(EXIT_FAILURE);
 		}
-		add_pollfd(&self, fd, POLLIN | POLLPRI, true);
+		if (!add_pollfd(&self, fd, EPOLLIN | EPOLLPRI, true)) {
+			exit(EXIT_FAILURE);
+		}
 	} else {
 		/* systemd socket activation */
 		for (fd = SD_LISTEN_FDS_START + 0; fd < SD_LISTEN_FDS_START + descriptors; fd++) {
 			if (sd_is_fifo(fd, NULL)) {
-				add_pollfd(&self, fd, POLLIN, false);
+				if (!add_pollfd(&self, fd, EPOLLIN, false)) {
+					exit(EXIT_FAILURE);
+				}
 				buxton_debug("Added fd %d type FIFO\n", fd);
 			} else if (sd_is_socket_unix(fd, SOCK_STREAM, -1, buxton_socket(), 0)) {
-				add_pollfd(&self, fd, POLLIN | POLLPRI, true);
+				if (!add_pollfd(&self, fd, EPOLLIN | EPOLLPRI, true)) {
+					exit(EXIT_FAILURE);
+				}
 				buxton_debug("Added fd %d type UNIX\n", fd);
 			} else if (sd_is_socket(fd, AF_UNSPEC, 0, -1)) {
-				add_pollfd(&self, fd, POLLIN | POLLPRI, true);
+				if (!add_pollfd(&self, fd, EPOLLIN | EPOLLPRI, true)) {
+					exit(EXIT_FAILURE);
+				}
 				buxton_debug("Added fd %d type SOCKET\n", fd);
 			}
 		}
 	}
 
 	if (smackfd >= 0) {
-		/* add Smack rule fd to pollfds */
-		add_pollfd(&self, smackfd, POLLIN | POLLPRI, false);
+		/* add Smack rule fd to the epoll set */
+		if (!add_pollfd(&self, smackfd, EPOLLIN | EPOLLPRI, false)) {
+			exit(EXIT_FAILURE);
+		}
 	}
 
 	buxton_log("%s: Started\n", argv[0]);
 
 	/* Enter loop to accept clients */
 	for (;;) {
-		ret = poll(self.pollfds, self.nfds, leftover_messages ? 0 : -1);
+		ret = epoll_wait(self.epoll_fd, events, MAX_EVENTS,
+				 leftover_messages ? 0 :
+				 buxtond_notify_timeout(&self));
 
 		if (ret < 0) {
-			buxton_log("poll(): %m\n");
+			buxton_log("epoll_wait(): %m\n");
 			break;
 		}
+
+		/* send the changes held back from subscribers that are due */
+		buxtond_flush_notifications(&self);
 		if (ret == 0) {
 			if (!leftover_messages) {
 				continue;
 			}
 		}
 
+		buffered = leftover_messages;
 		leftover_messages = false;
 
-		/* check sigfd if the daemon was signaled */
-		if (self.pollfds[0].revents != 0) {
-			ssize_t sinfo;
-			struct signalfd_siginfo si;
-
-			sinfo = read(self.pollfds[0].fd, &si, sizeof(struct signalfd_siginfo));
-			if (sinfo != sizeof(struct signalfd_siginfo)) {
-				exit(EXIT_FAILURE);
-			}
-
-			if (si.ssi_signo == SIGINT || si.ssi_signo == SIGTERM) {
-				break;
-			}
-		}
-
-		for (nfds_t i = 1; i < self.nfds; i++) {
+		/* Only the descriptors that are ready are reported */
+		for (int i = 0; i < ret; i++) {
 			client_list_item *cl = NULL;
 			char discard[256];
+			int efd = events[i].data.fd;
 
-			if (self.pollfds[i].revents == 0) {
-				continue;
-			}
+			/* check sigfd if the daemon was signaled */
+			if (efd == sigfd) {
+				ssize_t sinfo;
+				struct signalfd_siginfo si;
+
+				sinfo = read(sigfd, &si, sizeof(struct signalfd_siginfo));
+				if (sinfo != sizeof(struct signalfd_siginfo)) {
+					exit(EXIT_FAILURE);
+				}
 
-			if (self.pollfds[i].fd == -1) {
-				/* TODO: Remove client from list  */
-				buxton_debug("Removing / Closing client for fd %d\n", self.pollfds[i].fd);
-				del_pollfd(&self, i);
+				if (si.ssi_signo == SIGINT || si.ssi_signo == SIGTERM) {
+					goto done;
+				}
 				continue;
 			}
 
 			if (smackfd >= 0) {
-				if (self.pollfds[i].fd == smackfd) {
+				if (efd == smackfd) {
 					if (!buxton_cache_smack_rules()) {
 						exit(EXIT_FAILURE);
 					}
@@ -296,40 +318,33 @@ int main(int argc, char *argv[])
 				}
 			}
 
-			if (self.accepting[i] == true) {
+			if (self.pollfds[efd].accepting == true) {
 				struct timeval tv;
 				int fd;
 				int on = 1;
 
 				addr_len = sizeof(remote);
 
-				if ((fd = accept(self.pollfds[i].fd,
+				if ((fd = accept(efd,
 						 (struct sockaddr *)&remote, &addr_len)) == -1) {
 					buxton_log("accept(): %m\n");
-					break;
+					continue;
 				}
 
-				buxton_debug("New client fd %d connected through fd %d\n", fd, self.pollfds[i].fd);
+				buxton_debug("New client fd %d connected through fd %d\n", fd, efd);
 
 				if (fcntl(fd, F_SETFL, O_NONBLOCK)) {
 					close(fd);
-					break;
+					continue;
 				}
 
-				cl = malloc0(sizeof(client_list_item));
+				/* wait for data on this new client as well */
+				cl = add_client(&self, fd);
 				if (!cl) {
-					exit(EXIT_FAILURE);
+					close(fd);
+					continue;
 				}
 
-				LIST_INIT(client_list_item, item, cl);
-
-				cl->fd = fd;
-				cl->cred = (struct ucred) {0, 0, 0};
-				LIST_PREPEND(client_list_item, item, self.client_list, cl);
-
-				/* poll for data on this new client as well */
-				add_pollfd(&self, cl->fd, POLLIN | POLLPRI, false);
-
 				/* Mark our packets as high prio */
 				if (setsockopt(cl->fd, SOL_SOCKET, SO_PRIORITY, &on, sizeof(on)) == -1) {
 					buxton_log("setsockopt(SO_PRIORITY): %m\n");
@@ -343,65 +358,86 @@ int main(int argc, char *argv[])
 					buxton_log("setsockopt(SO_RCVTIMEO): %m\n");
 				}
 
-				/* check if this is optimal or not */
-				break;
+				continue;
 			}
 
-			assert(self.accepting[i] == 0);
 			if (smackfd >= 0) {
-				assert(self.pollfds[i].fd != smackfd);
+				assert(efd != smackfd);
 			}
 
 			/* handle data on any connection */
-			/* TODO: Replace with hash table lookup */
-			LIST_FOREACH(item, cl, self.client_list)
-				if (self.pollfds[i].fd == cl->fd) {
-					break;
+			cl = find_client(&self, efd);
+			assert(cl);
+
+			/* send output queued while the socket was full */
+			if (events[i].events & EPOLLOUT) {
+				if (!flush_client(&self, cl)) {
+					terminate_client(&self, cl);
+					continue;
+				}
+				if (!(events[i].events & ~(uint32_t)EPOLLOUT)) {
+					continue;
 				}
+			}
 
-			assert(cl);
-			if (handle_client(&self, cl, i)) {
+			if (handle_client(&self, cl)) {
 				leftover_messages = true;
 			}
 		}
+
+		/* serve messages left in receive buffers by the message limit */
+		if (buffered) {
+			client_list_item *cl, *next;
+
+			LIST_FOREACH_SAFE(buffered, cl, next, self.buffered_clients) {
+				if (handle_client(&self, cl)) {
+					leftover_messages = true;
+				}
+			}
+		}
 	}
 
+done:
 	buxton_log("%s: Closing all connections\n", argv[0]);
 
 	if (manual_start) {
 		unlink(buxton_socket());
 	}
-	for (int i = 0; i < self.nfds; i++) {
-		close(self.pollfds[i].fd);
+	for (size_t i = 0; i < self.pollfds_alloc; i++) {
+		if (self.pollfds[i].registered) {
+			close((int)i);
+		}
 	}
+	free(self.pollfds);
+	close(self.epoll_fd);
 	for (client_list_item *i = self.client_list; i;) {
 		client_list_item *j = i->item_next;
 		free(i);
 		i = j;
 	}
 	/* Clean up notification lists */
-	HASHMAP_FOREACH_KEY(map_list, notify_key, self.notify_mapping, iter) {
-		hashmap_remove(self.notify_mapping, notify_key);
-		BuxtonList *elem;
-		BUXTON_LIST_FOREACH(map_list, elem) {
-			BuxtonNotification *notif = (BuxtonNotification*)elem->data;
-			if (notif->old_data) {
-				free_buxton_data(&(notif->old_data));
-			}
+	HASHMAP_FOREACH(nkey, self.notify_mapping, iter) {
+		hashmap_remove(self.notify_mapping, nkey->name);
+		LIST_FOREACH_SAFE(by_key, nitem, next, nkey->subscribers) {
+			free(nitem);
 		}
-		free(notify_key);
-		buxton_list_free_all(&map_list);
+		free(nkey->name);
+		free(nkey->frame);
+		free_buxton_data(&nkey->value);
+		free(nkey);
 	}
-
-	/* Clean up key lists */
-	HASHMAP_FOREACH_KEY(key_list, client_fd, self.client_key_mapping, iter) {
-		hashmap_remove(self.client_key_mapping, client_fd);
-		buxton_list_free_all(&key_list);
-		free(client_fd);
+	/* Clean up wildcard indexes */
+	HASHMAP_FOREACH(ngroup, self.notify_groups, iter) {
+		hashmap_remove(self.notify_groups, ngroup->name);
+		free(ngroup->name);
+		free(ngroup->prefixes);
+		free(ngroup);
 	}
 	hashmap_free(self.notify_mapping);
-	hashmap_free(self.client_key_mapping);
+	hashmap_free(self.notify_groups);
+	hashmap_free(self.notify_subscriptions);
 	buxton_direct_close(&self.buxton);
+	buxton_label_free_all();
 	return EXIT_SUCCESS;
 }
 
@@ -20,14 +20,37 @@
 #include <string.h>
 
 #include "log.h"
+#include "buxtonskiplist.h"
 #include "hashmap.h"
 #include "serialize.h"
 #include "util.h"
 
 /**
  * GDBM Database Module
+ *
+ * gdbm has no ordered traversal, so each open database keeps a sorted
+ * index of its groups and of the keys of every group. It is built by one
+ * pass over the file when the database is opened, and kept up to date by
+ * set and unset. Group removal visits only the keys of that group, and
+ * listing with a prefix only the names in its range, in order.
+ */
+
+/**
+ * A group and the names of its keys
  */
+typedef struct GdbmGroup {
+	char *name; /**<Name of the group */
+	bool exists; /**<The group record itself is stored */
+	BuxtonSkipList *keys; /**<Names of the group's keys, sorted */
+} GdbmGroup;
 
+/**
+ * An open database and its group index
+ */
+typedef struct GdbmResource {
+	GDBM_FILE db; /**<The gdbm handle */
+	BuxtonSkipList *groups; /**<GdbmGroups, sorted by name */
+} GdbmResource;
 
 static Hashmap *_resources = NULL;
 
@@ -47,6 +70,128 @@ static char *key_get_name(BuxtonString *key)
 	return c;
 }
 
+/* Get the index entry of a group, creating it if asked to */
+static GdbmGroup *index_get(GdbmResource *res, const char *name, bool create)
+{
+	GdbmGroup *group;
+	GdbmGroup find = { .name = (char *)name };
+
+	group = buxton_skiplist_get(res->groups, &find);
+	if (group || !create) {
+		return group;
+	}
+
+	group = malloc0(sizeof(GdbmGroup));
+	if (!group) {
+		abort();
+	}
+	group->name = strdup(name);
+	if (!group->name) {
+		abort();
+	}
+	group->keys = buxton_skiplist_new(string_compare_func);
+	if (!buxton_skiplist_insert(res->groups, group)) {
+		abort();
+	}
+
+	return group;
+}
+
+static int compare_group(const GdbmGroup *a, const GdbmGroup *b)
+{
+	return strcmp(a->name, b->name);
+}
+
+static void free_group(GdbmGroup *group)
+{
+	buxton_skiplist_free(&group->keys, free);
+	free(group->name);
+	free(group);
+}
+
+/* Drop a group from the index once nothing of it is stored */
+static void index_put(GdbmResource *res, GdbmGroup *group)
+{
+	if (group->exists || buxton_skiplist_size(group->keys)) {
+		return;
+	}
+
+	buxton_skiplist_remove(res->groups, group);
+	free_group(group);
+}
+
+/**
+ * Record a stored group or key in the index
+ * @param res An open resource
+ * @param record The key of the record, a group and maybe a name
+ * @param length Length of record
+ */
+static void index_add(GdbmResource *res, const char *record, size_t length)
+{
+	GdbmGroup *group;
+	size_t glen;
+	char *name;
+
+	group = index_get(res, record, true);
+	glen = strnlen(record, length) + 1;
+	if (glen >= length) {
+		group->exists = true;
+		return;
+	}
+	if (buxton_skiplist_get(group->keys, record + glen)) {
+		return;
+	}
+	name = strndup(record + glen, length - glen);
+	if (!name) {
+		abort();
+	}
+	if (!buxton_skiplist_insert(group->keys, name)) {
+		abort();
+	}
+}
+
+/* Forget a deleted key, or a group record, in the index */
+static void index_remove(GdbmResource *res, _BuxtonKey *key)
+{
+	GdbmGroup *group;
+	char *name;
+
+	group = index_get(res, key->group.value, false);
+	if (!group) {
+		return;
+	}
+	if (key->name.value) {
+		name = buxton_skiplist_remove(group->keys, key->name.value);
+		free(name);
+	} else {
+		group->exists = false;
+	}
+	index_put(res, group);
+}
+
+/* Build the index with one pass over the database */
+static void index_build(GdbmResource *res)
+{
+	datum key, nextkey;
+
+	key = gdbm_firstkey(res->db);
+	while (key.dptr) {
+		if (key.dsize > 0) {
+			index_add(res, key.dptr, (size_t)key.dsize);
+		}
+		nextkey = gdbm_nextkey(res->db, key);
+		free(key.dptr);
+		key = nextkey;
+	}
+}
+
+static void free_resource(GdbmResource *res)
+{
+	gdbm_close(res->db);
+	buxton_skiplist_free(&res->groups, (buxton_free_func)free_group);
+	free(res);
+}
+
 static GDBM_FILE try_open_database(char *path, const int oflag)
 {
 	GDBM_FILE db = gdbm_open(path, 0, oflag, S_IRUSR | S_IWUSR, NULL);
@@ -67,8 +212,9 @@ static GDBM_FILE try_open_database(char *path, const int oflag)
 }
 
 /* Open or create databases on the fly */
-static GDBM_FILE db_for_resource(BuxtonLayer *layer)
+static GdbmResource *db_for_resource(BuxtonLayer *layer)
 {
+	GdbmResource *res;
 	GDBM_FILE db;
 	_cleanup_free_ char *path = NULL;
 	char *name = NULL;
@@ -88,8 +234,8 @@ static GDBM_FILE db_for_resource(BuxtonLayer *layer)
 		abort();
 	}
 
-	db = hashmap_get(_resources, name);
-	if (!db) {
+	res = hashmap_get(_resources, name);
+	if (!res) {
 		path = get_layer_path(layer);
 		if (!path) {
 			abort();
@@ -100,19 +246,27 @@ static GDBM_FILE db_for_resource(BuxtonLayer *layer)
 		if (!db) {
 			free(name);
 			buxton_log("Couldn't create db for path: %s\n", path);
-			return 0;
+			return NULL;
+		}
+
+		res = malloc0(sizeof(GdbmResource));
+		if (!res) {
+			abort();
 		}
-		r = hashmap_put(_resources, name, db);
+		res->db = db;
+		res->groups = buxton_skiplist_new((buxton_compare_func)compare_group);
+		index_build(res);
+
+		r = hashmap_put(_resources, name, res);
 		if (r != 1) {
 			abort();
 		}
 	} else {
-		db = (GDBM_FILE) hashmap_get(_resources, name);
 		free(name);
 	}
 
 	errno = save_errno;
-	return db;
+	return res;
 }
 
 static void make_key_data(_BuxtonKey *key, datum *key_data)
@@ -145,6 +299,7 @@ static void make_key_data(_BuxtonKey *key, datum *key_data)
 static int set_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
 		      BuxtonString *label)
 {
+	GdbmResource *res;
 	GDBM_FILE db;
 	int ret = -1;
 	datum key_data;
@@ -161,11 +316,12 @@ static int set_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
 
 	make_key_data(key, &key_data);
 
-	db = db_for_resource(layer);
-	if (!db || errno) {
+	res = db_for_resource(layer);
+	if (!res || errno) {
 		ret = errno;
 		goto end;
 	}
+	db = res->db;
 
 	/* set_label will pass a NULL for data */
 	if (!data) {
@@ -192,6 +348,7 @@ static int set_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
 		goto end;
 	}
 	assert(ret == 0);
+	index_add(res, key_data.dptr, (size_t)key_data.dsize);
 
 end:
 	if (cdata.type == BUXTON_TYPE_STRING) {
@@ -206,7 +363,7 @@ end:
 static int get_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
 		      BuxtonString *label)
 {
-	GDBM_FILE db;
+	GdbmResource *res;
 	datum key_data;
 	datum value;
 	uint8_t *data_store = NULL;
@@ -217,8 +374,8 @@ static int get_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
 	make_key_data(key, &key_data);
 
 	memzero(&value, sizeof(datum));
-	db = db_for_resource(layer);
-	if (!db) {
+	res = db_for_resource(layer);
+	if (!res) {
 		/*
 		 * Set negative here to indicate layer not found
 		 * rather than key not found, optimization for
@@ -228,7 +385,7 @@ static int get_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
 		goto end;
 	}
 
-	value = gdbm_fetch(db, key_data);
+	value = gdbm_fetch(res->db, key_data);
 	if (value.dsize < 0 || value.dptr == NULL) {
 		ret = ENOENT;
 		goto end;
@@ -257,13 +414,31 @@ end:
 	return ret;
 }
 
+static int delete_key(GDBM_FILE db, datum key_data)
+{
+	if (!gdbm_delete(db, key_data)) {
+		return 0;
+	}
+	if (gdbm_errno == GDBM_READER_CANT_DELETE) {
+		return EROFS;
+	} else if (gdbm_errno == GDBM_ITEM_NOT_FOUND) {
+		return ENOENT;
+	}
+	abort();
+}
+
 static int unset_value(BuxtonLayer *layer,
 			_BuxtonKey *key,
 			__attribute__((unused)) BuxtonData *data,
 			__attribute__((unused)) BuxtonString *label)
 {
-	GDBM_FILE db;
+	GdbmResource *res;
+	GdbmGroup *group;
+	BuxtonSkipNode *node;
+	_BuxtonKey member;
 	datum key_data;
+	datum member_data;
+	char *name;
 	int ret;
 
 	assert(layer);
@@ -272,22 +447,37 @@ static int unset_value(BuxtonLayer *layer,
 	make_key_data(key, &key_data);
 
 	errno = 0;
-	db = db_for_resource(layer);
-	if (!db || gdbm_errno) {
+	gdbm_errno = GDBM_NO_ERROR;
+	res = db_for_resource(layer);
+	if (!res || gdbm_errno) {
 		ret = EROFS;
 		goto end;
 	}
 
-	ret = gdbm_delete(db, key_data);
+	ret = delete_key(res->db, key_data);
 	if (ret) {
-		if (gdbm_errno == GDBM_READER_CANT_DELETE) {
-			ret = EROFS;
-		} else if (gdbm_errno == GDBM_ITEM_NOT_FOUND) {
-			ret = ENOENT;
-		} else {
-			abort();
+		goto end;
+	}
+
+	/* Removing a group removes its keys, found through the index */
+	group = index_get(res, key->group.value, false);
+	if (!key->name.value && group) {
+		member = *key;
+		while ((node = buxton_skiplist_seek(group->keys, NULL))) {
+			name = node->data;
+			member.name = buxton_string_pack(name);
+			make_key_data(&member, &member_data);
+			ret = delete_key(res->db, member_data);
+			free(member_data.dptr);
+			if (ret && ret != ENOENT) {
+				goto end;
+			}
+			buxton_skiplist_remove(group->keys, name);
+			free(name);
 		}
+		ret = 0;
 	}
+	index_remove(res, key);
 
 end:
 	free(key_data.dptr);
@@ -295,9 +485,28 @@ end:
 	return ret;
 }
 
+static int commit(BuxtonLayer *layer,
+		  __attribute__((unused)) bool apply)
+{
+	GdbmResource *res;
+
+	assert(layer);
+
+	res = db_for_resource(layer);
+	if (!res) {
+		return EROFS;
+	}
+
+	/* Stores aren't synced on their own, so flush them all at once */
+	gdbm_sync(res->db);
+
+	return 0;
+}
+
 static bool list_keys(BuxtonLayer *layer,
 		      BuxtonArray **list)
 {
+	GdbmResource *res;
 	GDBM_FILE db;
 	datum key, nextkey;
 	BuxtonArray *k_list = NULL;
@@ -308,10 +517,11 @@ static bool list_keys(BuxtonLayer *layer,
 
 	assert(layer);
 
-	db = db_for_resource(layer);
-	if (!db) {
+	res = db_for_resource(layer);
+	if (!res) {
 		goto end;
 	}
+	db = res->db;
 
 	k_list = buxton_array_new();
 	key = gdbm_firstkey(db);
@@ -364,28 +574,47 @@ end:
 	return ret;
 }
 
+static bool add_name(BuxtonArray *list, char *value)
+{
+	BuxtonData *data;
+	char *copy;
+
+	data = malloc0(sizeof(BuxtonData));
+	copy = strdup(value);
+	if (!data || !copy || !buxton_array_add(list, data)) {
+		free(data);
+		free(copy);
+		return false;
+	}
+	data->type = BUXTON_TYPE_STRING;
+	data->store.d_string.value = copy;
+	data->store.d_string.length = (uint32_t)strlen(copy) + 1;
+
+	return true;
+}
+
+static inline bool has_prefix(const char *value, BuxtonString *prefix)
+{
+	return !prefix || !strncmp(value, prefix->value, prefix->length - 1);
+}
+
 static bool list_names(BuxtonLayer *layer,
 		       BuxtonString *group,
 		       BuxtonString *prefix,
 		       BuxtonArray **list)
 {
-	GDBM_FILE db;
-	datum key, nextkey;
+	GdbmResource *res;
+	GdbmGroup *g;
+	GdbmGroup find;
+	BuxtonSkipNode *node;
 	BuxtonArray *k_list = NULL;
-	BuxtonData *data = NULL;
-	char *gname;
-	char *value;
-	char *copy;
-	uint32_t glen;
-	uint32_t klen;
-	uint32_t length;
 	bool ret = false;
 
 	assert(layer);
 	assert(group);
 
-	db = db_for_resource(layer);
-	if (!db) {
+	res = db_for_resource(layer);
+	if (!res) {
 		goto end;
 	}
 
@@ -396,62 +625,40 @@ static bool list_names(BuxtonLayer *layer,
 		prefix = NULL;
 	}
 
-	value = NULL;
 	k_list = buxton_array_new();
-	key = gdbm_firstkey(db);
-	/* Iterate through all of the keys */
-	while (key.dptr) {
+	if (!k_list) {
+		abort();
+	}
 
-		/* get main data of the key */
-		gname = (char*)key.dptr;
-		glen = (uint32_t)strlen(gname) + 1;
-		assert(key.dsize >= (size_t)glen);
-		klen = (uint32_t)key.dsize - glen;
-		assert(!klen || klen == (uint32_t)strlen(gname+glen) + 1);
-
-		/* treat the key value if it*/
-		if (klen) {
-			/* it is a key */
-			if (group && glen == group->length
-				&& !strcmp(gname, group->value)) {
-				value = gname + glen;
-				length = klen;
+	/* Names come out sorted, starting from the first one in range */
+	if (!group) {
+		find.name = prefix ? prefix->value : NULL;
+		node = buxton_skiplist_seek(res->groups, prefix ? &find : NULL);
+		BUXTON_SKIPLIST_FOREACH(node, node) {
+			g = node->data;
+			if (!has_prefix(g->name, prefix)) {
+				break;
 			}
-		} else {
-			/* it is a group */
-			if (!group) {
-				value = gname;
-				length = glen;
+			/* Groups with keys but no record aren't listed */
+			if (g->exists && !add_name(k_list, g->name)) {
+				goto end;
 			}
 		}
-
-		/* treat a potential value */
-		if (value) {
-			/* check the prefix */
-			if (!prefix || !strncmp(value, prefix->value,
-				prefix->length - 1))  {
-				/* add the value */
-				data = malloc0(sizeof(BuxtonData));
-				copy = malloc(length);
-				if (data && copy
-				    && buxton_array_add(k_list, data)) {
-					data->type = BUXTON_TYPE_STRING;
-					data->store.d_string.value = copy;
-					data->store.d_string.length = length;
-					memcpy(copy, value, length);
-				} else {
-					free(data);
-					free(copy);
-					goto end;
-				}
+	} else {
+		g = index_get(res, group->value, false);
+		node = NULL;
+		if (g) {
+			node = buxton_skiplist_seek(g->keys,
+						    prefix ? prefix->value : NULL);
+		}
+		BUXTON_SKIPLIST_FOREACH(node, node) {
+			if (!has_prefix(node->data, prefix)) {
+				break;
+			}
+			if (!add_name(k_list, node->data)) {
+				goto end;
 			}
-			value = NULL;
 		}
-
-		/* Visit the next key */
-		nextkey = gdbm_nextkey(db, key);
-		free(key.dptr);
-		key = nextkey;
 	}
 
 	/* Pass ownership of the array to the caller */
@@ -469,12 +676,12 @@ _bx_export_ void buxton_module_destroy(void)
 {
 	const char *key;
 	Iterator iterator;
-	GDBM_FILE db;
+	GdbmResource *res;
 
 	/* close all gdbm handles */
-	HASHMAP_FOREACH_KEY(db, key, _resources, iterator) {
+	HASHMAP_FOREACH_KEY(res, key, _resources, iterator) {
 		hashmap_remove(_resources, key);
-		gdbm_close(db);
+		free_resource(res);
 		free((void *)key);
 	}
 	hashmap_free(_resources);
@@ -493,6 +700,7 @@ _bx_export_ bool buxton_module_init(BuxtonBackend *backend)
 	backend->list_names = &list_names;
 	backend->unset_value = &unset_value;
 	backend->create_db = (module_db_init_func) &db_for_resource;
+	backend->commit = &commit;
 
 	_resources = hashmap_new(string_hash_func, string_compare_func);
 	if (!_resources) {
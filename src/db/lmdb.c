@@ -0,0 +1,867 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2014 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <lmdb.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "log.h"
+#include "hashmap.h"
+#include "serialize.h"
+#include "util.h"
+
+/**
+ * LMDB Database Module
+ *
+ * Keys are stored as the group name and the key name, both with their
+ * terminating NUL, so a group's dummy record sorts right before its keys
+ * and a group's keys are one contiguous range of the B+tree.
+ */
+
+/* Address space first reserved for each database, doubled when full */
+#define LMDB_MAP_SIZE (64UL * 1024UL * 1024UL)
+
+/**
+ * An open LMDB environment
+ */
+typedef struct LmdbResource {
+	MDB_env *env; /**<The environment of the database file */
+	MDB_dbi dbi; /**<The main database of the environment */
+	MDB_txn *read_txn; /**<Read transaction, reset between reads */
+	MDB_txn *write_txn; /**<Write transaction of the open batch, if any */
+	bool batch; /**<Writes wait for commit() between begin() and it */
+	bool readonly; /**<The file could only be opened read-only */
+} LmdbResource;
+
+static Hashmap *_resources = NULL;
+
+static int lmdb_to_errno(int r)
+{
+	switch (r) {
+	case MDB_SUCCESS:
+		return 0;
+	case MDB_NOTFOUND:
+		return ENOENT;
+	case MDB_MAP_FULL:
+		return ENOSPC;
+	case MDB_BAD_VALSIZE:
+		return EINVAL;
+	case EACCES:
+		return EROFS;
+	default:
+		/* Any other LMDB specific error */
+		if (r < 0) {
+			return EIO;
+		}
+		return r;
+	}
+}
+
+static void free_resource(LmdbResource *res)
+{
+	if (!res) {
+		return;
+	}
+	if (res->write_txn) {
+		mdb_txn_abort(res->write_txn);
+	}
+	if (res->read_txn) {
+		mdb_txn_abort(res->read_txn);
+	}
+	mdb_env_close(res->env);
+	free(res);
+}
+
+static int open_environment(LmdbResource *res, char *path, bool readonly)
+{
+	unsigned int flags = MDB_NOSUBDIR | MDB_NOTLS;
+	MDB_txn *txn;
+	int r;
+
+	if (readonly) {
+		flags |= MDB_RDONLY;
+	}
+
+	r = mdb_env_create(&res->env);
+	if (r) {
+		abort();
+	}
+	r = mdb_env_set_mapsize(res->env, LMDB_MAP_SIZE);
+	if (r) {
+		goto fail;
+	}
+	r = mdb_env_open(res->env, path, flags, S_IRUSR | S_IWUSR);
+	if (r) {
+		goto fail;
+	}
+
+	r = mdb_txn_begin(res->env, NULL, readonly ? MDB_RDONLY : 0, &txn);
+	if (r) {
+		goto fail;
+	}
+	r = mdb_dbi_open(txn, NULL, 0, &res->dbi);
+	if (r) {
+		mdb_txn_abort(txn);
+		goto fail;
+	}
+	r = mdb_txn_commit(txn);
+	if (r) {
+		goto fail;
+	}
+
+	res->readonly = readonly;
+	return 0;
+
+fail:
+	/* A failed open leaves the environment unusable */
+	mdb_env_close(res->env);
+	res->env = NULL;
+	return r;
+}
+
+/* Open or create databases on the fly */
+static LmdbResource *db_for_resource(BuxtonLayer *layer)
+{
+	LmdbResource *res;
+	_cleanup_free_ char *path = NULL;
+	char *name = NULL;
+	int r;
+
+	assert(layer);
+	assert(_resources);
+
+	if (layer->type == LAYER_USER) {
+		r = asprintf(&name, "%s-%d", layer->name.value, layer->uid);
+	} else {
+		r = asprintf(&name, "%s", layer->name.value);
+	}
+	if (r == -1) {
+		abort();
+	}
+
+	res = hashmap_get(_resources, name);
+	if (res) {
+		free(name);
+		return res;
+	}
+
+	path = get_layer_path(layer);
+	if (!path) {
+		abort();
+	}
+
+	res = malloc0(sizeof(LmdbResource));
+	if (!res) {
+		abort();
+	}
+
+	r = open_environment(res, path, layer->readonly);
+	if (r == EACCES && !layer->readonly) {
+		/* Fall back to reading what we can't write, like gdbm */
+		buxton_debug("Attempting to fallback to opening db as read-only\n");
+		r = open_environment(res, path, true);
+	}
+	if (r) {
+		buxton_log("Couldn't open db for path %s: %s\n", path,
+			   mdb_strerror(r));
+		free(res);
+		free(name);
+		return NULL;
+	}
+
+	r = hashmap_put(_resources, name, res);
+	if (r != 1) {
+		abort();
+	}
+
+	return res;
+}
+
+/**
+ * Start a read, reusing the resource's transaction
+ * @param res An open resource
+ * @return a read transaction, or NULL on failure
+ */
+static MDB_txn *read_begin(LmdbResource *res)
+{
+	int r;
+
+	if (res->read_txn) {
+		r = mdb_txn_renew(res->read_txn);
+		if (!r) {
+			return res->read_txn;
+		}
+		mdb_txn_abort(res->read_txn);
+		res->read_txn = NULL;
+	}
+
+	r = mdb_txn_begin(res->env, NULL, MDB_RDONLY, &res->read_txn);
+	if (r) {
+		buxton_debug("Read transaction failed: %s\n", mdb_strerror(r));
+		res->read_txn = NULL;
+		return NULL;
+	}
+
+	return res->read_txn;
+}
+
+/**
+ * End a read started by read_begin, releasing its snapshot
+ * @param res The resource being read
+ */
+static void read_end(LmdbResource *res)
+{
+	mdb_txn_reset(res->read_txn);
+}
+
+/**
+ * Start a write, joining the transaction of an open batch
+ * @param res A writable resource
+ * @param txn Pointer to store the write transaction in
+ * @return an LMDB status code
+ */
+static int write_begin(LmdbResource *res, MDB_txn **txn)
+{
+	int r;
+
+	if (res->write_txn) {
+		*txn = res->write_txn;
+		return MDB_SUCCESS;
+	}
+
+	r = mdb_txn_begin(res->env, NULL, 0, txn);
+	if (r) {
+		return r;
+	}
+	if (res->batch) {
+		res->write_txn = *txn;
+	}
+
+	return MDB_SUCCESS;
+}
+
+/**
+ * End a write started by write_begin
+ * @param res The resource written to
+ * @param txn The write transaction
+ * @param r Status of the write
+ * @return an LMDB status code
+ *
+ * A failed write takes the whole transaction with it, a batch included,
+ * while a successful one outside a batch is durable once this returns.
+ */
+static int write_end(LmdbResource *res, MDB_txn *txn, int r)
+{
+	if (r) {
+		mdb_txn_abort(txn);
+		res->write_txn = NULL;
+		return r;
+	}
+	if (res->batch) {
+		return MDB_SUCCESS;
+	}
+
+	return mdb_txn_commit(txn);
+}
+
+/**
+ * Double the map of a resource after MDB_MAP_FULL
+ * @param res The resource that ran out of space
+ * @return true if the failed write can be run again
+ */
+static bool grow_map(LmdbResource *res)
+{
+	MDB_envinfo info;
+	int r;
+
+	/* Resizing needs every transaction of the environment closed */
+	if (res->read_txn) {
+		mdb_txn_abort(res->read_txn);
+		res->read_txn = NULL;
+	}
+
+	r = mdb_env_info(res->env, &info);
+	if (!r) {
+		r = mdb_env_set_mapsize(res->env, info.me_mapsize * 2);
+	}
+	if (r) {
+		buxton_log("Couldn't grow lmdb map: %s\n", mdb_strerror(r));
+		return false;
+	}
+	buxton_debug("Grew lmdb map to %zu bytes\n", info.me_mapsize * 2);
+
+	/* The earlier writes of a batch are lost with its transaction */
+	return !res->batch;
+}
+
+static void make_key_val(_BuxtonKey *key, MDB_val *key_val)
+{
+	size_t sz;
+	char *ptr;
+
+	sz = key->group.length;
+	if (key->name.value) {
+		sz += key->name.length;
+	}
+
+	ptr = malloc(sz);
+	if (!ptr) {
+		abort();
+	}
+
+	key_val->mv_size = sz;
+	key_val->mv_data = ptr;
+	memcpy(ptr, key->group.value, key->group.length);
+	if (key->name.value) {
+		memcpy(ptr + key->group.length, key->name.value,
+		       key->name.length);
+	}
+}
+
+/**
+ * Store a value in a write transaction
+ * @param res The resource written to
+ * @param txn The write transaction
+ * @param key_val The database key
+ * @param data The value to store, or NULL to keep the stored one
+ * @param label The label to store
+ * @return an LMDB status code
+ */
+static int put_value(LmdbResource *res, MDB_txn *txn, MDB_val *key_val,
+		     BuxtonData *data, BuxtonString *label)
+{
+	MDB_val value;
+	_cleanup_free_ uint8_t *data_store = NULL;
+	BuxtonData cdata = {0};
+	BuxtonString clabel;
+	int ret;
+
+	/* set_label will pass a NULL for data */
+	if (!data) {
+		ret = mdb_get(txn, res->dbi, key_val, &value);
+		if (ret) {
+			return ret;
+		}
+		buxton_deserialize(value.mv_data, &cdata, &clabel);
+		free(clabel.value);
+		data = &cdata;
+	}
+
+	value.mv_size = buxton_serialize(data, label, &data_store);
+	value.mv_data = data_store;
+	ret = mdb_put(txn, res->dbi, key_val, &value, 0);
+
+	if (cdata.type == BUXTON_TYPE_STRING) {
+		free(cdata.store.d_string.value);
+	}
+
+	return ret;
+}
+
+static int set_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
+		      BuxtonString *label)
+{
+	LmdbResource *res;
+	MDB_txn *txn;
+	MDB_val key_val;
+	int ret;
+
+	assert(layer);
+	assert(key);
+	assert(label);
+
+	make_key_val(key, &key_val);
+
+	res = db_for_resource(layer);
+	if (!res) {
+		ret = EIO;
+		goto end;
+	}
+	if (res->readonly) {
+		ret = EROFS;
+		goto end;
+	}
+
+	do {
+		ret = write_begin(res, &txn);
+		if (ret) {
+			break;
+		}
+		ret = write_end(res, txn, put_value(res, txn, &key_val, data,
+						    label));
+	} while (ret == MDB_MAP_FULL && grow_map(res));
+
+end:
+	free(key_val.mv_data);
+
+	return lmdb_to_errno(ret);
+}
+
+static int get_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
+		      BuxtonString *label)
+{
+	LmdbResource *res;
+	MDB_txn *txn;
+	MDB_val key_val;
+	MDB_val value;
+	int ret;
+
+	assert(layer);
+
+	make_key_val(key, &key_val);
+
+	res = db_for_resource(layer);
+	if (!res) {
+		/*
+		 * Set negative here to indicate layer not found
+		 * rather than key not found, optimization for
+		 * set value
+		 */
+		ret = -ENOENT;
+		goto end;
+	}
+
+	txn = read_begin(res);
+	if (!txn) {
+		ret = EIO;
+		goto end;
+	}
+
+	/* value points into the map, valid until the read ends */
+	ret = mdb_get(txn, res->dbi, &key_val, &value);
+	if (ret) {
+		read_end(res);
+		ret = lmdb_to_errno(ret);
+		goto end;
+	}
+	buxton_deserialize(value.mv_data, data, label);
+	read_end(res);
+
+	if (data->type != key->type && key->type != BUXTON_TYPE_UNSET) {
+		free(label->value);
+		label->value = NULL;
+		if (data->type == BUXTON_TYPE_STRING) {
+			free(data->store.d_string.value);
+			data->store.d_string.value = NULL;
+		}
+		ret = EINVAL;
+		goto end;
+	}
+	ret = 0;
+
+end:
+	free(key_val.mv_data);
+
+	return ret;
+}
+
+/**
+ * Remove a key, or a group and its keys, in a write transaction
+ * @param res The resource written to
+ * @param txn The write transaction
+ * @param key_val The database key
+ * @param group Whether the key is a group record
+ * @return an LMDB status code
+ */
+static int del_value(LmdbResource *res, MDB_txn *txn, MDB_val *key_val,
+		     bool group)
+{
+	MDB_cursor *cursor;
+	MDB_val k;
+	int ret;
+
+	ret = mdb_del(txn, res->dbi, key_val, NULL);
+	if (ret || !group) {
+		return ret;
+	}
+
+	/* Removing a group removes its keys in the same transaction */
+	ret = mdb_cursor_open(txn, res->dbi, &cursor);
+	if (ret) {
+		return ret;
+	}
+	k = *key_val;
+	ret = mdb_cursor_get(cursor, &k, NULL, MDB_SET_RANGE);
+	while (!ret && k.mv_size > key_val->mv_size &&
+	       !memcmp(k.mv_data, key_val->mv_data, key_val->mv_size)) {
+		ret = mdb_del(txn, res->dbi, &k, NULL);
+		if (ret) {
+			break;
+		}
+		k = *key_val;
+		ret = mdb_cursor_get(cursor, &k, NULL, MDB_SET_RANGE);
+	}
+	mdb_cursor_close(cursor);
+	if (ret == MDB_NOTFOUND) {
+		ret = MDB_SUCCESS;
+	}
+
+	return ret;
+}
+
+static int unset_value(BuxtonLayer *layer,
+			_BuxtonKey *key,
+			__attribute__((unused)) BuxtonData *data,
+			__attribute__((unused)) BuxtonString *label)
+{
+	LmdbResource *res;
+	MDB_txn *txn;
+	MDB_val key_val;
+	int ret;
+
+	assert(layer);
+	assert(key);
+
+	make_key_val(key, &key_val);
+
+	res = db_for_resource(layer);
+	if (!res || res->readonly) {
+		ret = EROFS;
+		goto end;
+	}
+
+	do {
+		ret = write_begin(res, &txn);
+		if (ret) {
+			break;
+		}
+		ret = write_end(res, txn, del_value(res, txn, &key_val,
+						    !key->name.value));
+	} while (ret == MDB_MAP_FULL && grow_map(res));
+
+end:
+	free(key_val.mv_data);
+
+	return lmdb_to_errno(ret);
+}
+
+static bool add_name(BuxtonArray *list, char *value, size_t length)
+{
+	BuxtonData *data;
+
+	data = malloc0(sizeof(BuxtonData));
+	if (!data) {
+		abort();
+	}
+	data->type = BUXTON_TYPE_STRING;
+	data->store.d_string.value = malloc(length);
+	if (!data->store.d_string.value) {
+		abort();
+	}
+	memcpy(data->store.d_string.value, value, length);
+	data->store.d_string.length = (uint32_t)length;
+
+	if (!buxton_array_add(list, data)) {
+		data_free(data);
+		return false;
+	}
+
+	return true;
+}
+
+static bool list_keys(BuxtonLayer *layer,
+		      BuxtonArray **list)
+{
+	LmdbResource *res;
+	MDB_txn *txn;
+	MDB_cursor *cursor = NULL;
+	MDB_val k;
+	BuxtonArray *k_list = NULL;
+	size_t glen;
+	bool ret = false;
+	int r;
+
+	assert(layer);
+
+	res = db_for_resource(layer);
+	if (!res) {
+		return false;
+	}
+	txn = read_begin(res);
+	if (!txn) {
+		return false;
+	}
+	if (mdb_cursor_open(txn, res->dbi, &cursor)) {
+		goto end;
+	}
+
+	k_list = buxton_array_new();
+	if (!k_list) {
+		abort();
+	}
+
+	for (r = mdb_cursor_get(cursor, &k, NULL, MDB_FIRST); !r;
+	     r = mdb_cursor_get(cursor, &k, NULL, MDB_NEXT)) {
+		/* Group records have no name after the group */
+		glen = strnlen(k.mv_data, k.mv_size) + 1;
+		if (glen >= k.mv_size) {
+			continue;
+		}
+		if (!add_name(k_list, (char *)k.mv_data + glen,
+			      k.mv_size - glen)) {
+			goto end;
+		}
+	}
+	if (r != MDB_NOTFOUND) {
+		goto end;
+	}
+
+	/* Pass ownership of the array to the caller */
+	*list = k_list;
+	ret = true;
+
+end:
+	if (cursor) {
+		mdb_cursor_close(cursor);
+	}
+	read_end(res);
+	if (!ret && k_list) {
+		buxton_array_free(&k_list, (buxton_free_func)data_free);
+	}
+	return ret;
+}
+
+static bool list_names(BuxtonLayer *layer,
+		       BuxtonString *group,
+		       BuxtonString *prefix,
+		       BuxtonArray **list)
+{
+	LmdbResource *res;
+	MDB_txn *txn;
+	MDB_cursor *cursor = NULL;
+	MDB_val k;
+	BuxtonArray *k_list = NULL;
+	_cleanup_free_ char *start = NULL;
+	_cleanup_free_ char *skip = NULL;
+	size_t start_len;
+	size_t skip_len = 0;
+	size_t plen = 0;
+	size_t glen;
+	bool ret = false;
+	int r;
+
+	assert(layer);
+	assert(group);
+
+	if (!group->length) {
+		group = NULL;
+	}
+	if (prefix && prefix->length) {
+		plen = prefix->length - 1;
+	}
+
+	res = db_for_resource(layer);
+	if (!res) {
+		return false;
+	}
+	txn = read_begin(res);
+	if (!txn) {
+		return false;
+	}
+	if (mdb_cursor_open(txn, res->dbi, &cursor)) {
+		goto end;
+	}
+
+	k_list = buxton_array_new();
+	if (!k_list) {
+		abort();
+	}
+
+	/* Every match sorts at or after the group and the prefix */
+	start_len = (group ? group->length : 0) + plen;
+	start = malloc(start_len + 1);
+	if (!start) {
+		abort();
+	}
+	if (group) {
+		memcpy(start, group->value, group->length);
+	}
+	if (plen) {
+		memcpy(start + (group ? group->length : 0), prefix->value, plen);
+	}
+
+	if (start_len) {
+		k.mv_data = start;
+		k.mv_size = start_len;
+		r = mdb_cursor_get(cursor, &k, NULL, MDB_SET_RANGE);
+	} else {
+		r = mdb_cursor_get(cursor, &k, NULL, MDB_FIRST);
+	}
+
+	while (!r) {
+		/* Stop at the first key outside the range */
+		if (k.mv_size < start_len ||
+		    memcmp(k.mv_data, start, start_len)) {
+			break;
+		}
+
+		glen = strnlen(k.mv_data, k.mv_size) + 1;
+		if (group) {
+			/* The group record itself isn't a name */
+			if (glen < k.mv_size &&
+			    !add_name(k_list, (char *)k.mv_data + glen,
+				      k.mv_size - glen)) {
+				goto end;
+			}
+			r = mdb_cursor_get(cursor, &k, NULL, MDB_NEXT);
+			continue;
+		}
+
+		if (glen == k.mv_size &&
+		    !add_name(k_list, k.mv_data, k.mv_size)) {
+			goto end;
+		}
+
+		/* Skip over the keys of this group, they sort below "group\1" */
+		if (glen > skip_len) {
+			free(skip);
+			skip = malloc(glen);
+			if (!skip) {
+				abort();
+			}
+			skip_len = glen;
+		}
+		memcpy(skip, k.mv_data, glen);
+		skip[glen - 1] = 1;
+		k.mv_data = skip;
+		k.mv_size = glen;
+		r = mdb_cursor_get(cursor, &k, NULL, MDB_SET_RANGE);
+	}
+	if (r && r != MDB_NOTFOUND) {
+		goto end;
+	}
+
+	/* Pass ownership of the array to the caller */
+	*list = k_list;
+	ret = true;
+
+end:
+	if (cursor) {
+		mdb_cursor_close(cursor);
+	}
+	read_end(res);
+	if (!ret && k_list) {
+		buxton_array_free(&k_list, (buxton_free_func)data_free);
+	}
+	return ret;
+}
+
+static int begin(BuxtonLayer *layer)
+{
+	LmdbResource *res;
+
+	assert(layer);
+
+	res = db_for_resource(layer);
+	if (!res) {
+		return EIO;
+	}
+	if (res->readonly) {
+		return EROFS;
+	}
+
+	/* The write transaction is opened by the first write */
+	res->batch = true;
+
+	return 0;
+}
+
+static int commit(BuxtonLayer *layer, bool apply)
+{
+	LmdbResource *res;
+	MDB_txn *txn;
+	int r;
+
+	assert(layer);
+
+	res = db_for_resource(layer);
+	if (!res) {
+		return EROFS;
+	}
+
+	res->batch = false;
+	txn = res->write_txn;
+	res->write_txn = NULL;
+	if (!txn) {
+		return 0;
+	}
+	if (!apply) {
+		mdb_txn_abort(txn);
+		return 0;
+	}
+
+	/* Every write of the batch is durable once the commit returns */
+	r = mdb_txn_commit(txn);
+	if (r == MDB_MAP_FULL) {
+		grow_map(res);
+	}
+
+	return lmdb_to_errno(r);
+}
+
+_bx_export_ void buxton_module_destroy(void)
+{
+	const char *key;
+	Iterator iterator;
+	LmdbResource *res;
+
+	/* close all environments */
+	HASHMAP_FOREACH_KEY(res, key, _resources, iterator) {
+		hashmap_remove(_resources, key);
+		free_resource(res);
+		free((void *)key);
+	}
+	hashmap_free(_resources);
+	_resources = NULL;
+}
+
+_bx_export_ bool buxton_module_init(BuxtonBackend *backend)
+{
+
+	assert(backend);
+
+	/* Point the struct methods back to our own */
+	backend->set_value = &set_value;
+	backend->get_value = &get_value;
+	backend->list_keys = &list_keys;
+	backend->list_names = &list_names;
+	backend->unset_value = &unset_value;
+	backend->create_db = (module_db_init_func) &db_for_resource;
+	backend->begin = &begin;
+	backend->commit = &commit;
+
+	_resources = hashmap_new(string_hash_func, string_compare_func);
+	if (!_resources) {
+		abort();
+	}
+
+	return true;
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -20,6 +20,8 @@
 #include "log.h"
 #include "buxton.h"
 #include "backend.h"
+#include "buxtonlabel.h"
+#include "buxtonskiplist.h"
 #include "util.h"
 
 /**
@@ -33,66 +35,153 @@
 
 static Hashmap *_resources;
 
-/* structure for storing keys */
+/* structure for looking up keys, pointing at their group and name */
 struct keyrec {
-	unsigned hash; /**< Precomputed hash  */
-	uint32_t size; /**< Key size in bytes */
-	char *value; /**< The key value */
+	unsigned hash; /**< Precomputed hash */
+	uint32_t group_size; /**< Group size in bytes, with its NUL */
+	uint32_t name_size; /**< Name size in bytes, 0 for a group record */
+	const char *group; /**< The group */
+	const char *name; /**< The name, or NULL for a group record */
 };
 
-/* structure for storing values */
-struct valrec {
-	BuxtonData data;    /**< Recorded data */
-	BuxtonString label; /**< Recorded label */
+/* structure for storing a key, its value and its label in one tile */
+struct record {
+	struct keyrec key; /**< The key, pointing into bytes */
+	BuxtonData data; /**< Recorded data, a string pointing into bytes */
+	BuxtonLabelId label; /**< Recorded label, interned */
+	uint32_t room; /**< Size of bytes */
+	uint8_t tile_size; /**< Index in tile_sizes, or TILE_MALLOC */
+	char bytes[]; /**< Group, name and string value */
 };
 
-/* creates a keyrec from the key */
-static struct keyrec *make_keyrec(_BuxtonKey *key)
+/*
+ * Records are cut from slabs of equally sized tiles, in the manner of
+ * the hashmap pools, so the many small records of the temp layer don't
+ * cost an allocation each and a freed tile goes to the next record of
+ * its size. Records too big for any tile are allocated on their own.
+ */
+#define SLAB_SIZE (64 * 1024)
+#define TILE_MALLOC UINT8_MAX
+
+static const uint32_t tile_sizes[] = {
+	96, 112, 128, 160, 192, 256, 384, 512, 768, 1024
+};
+
+#define N_TILE_SIZES (sizeof(tile_sizes) / sizeof(tile_sizes[0]))
+
+struct slab {
+	struct slab *next; /**< Previously filled slab */
+	uint32_t n_tiles; /**< Number of tiles in this slab */
+	uint32_t n_used; /**< Number of tiles handed out, freed or not */
+};
+
+struct tiles {
+	struct slab *slabs; /**< Slabs, the one being filled first */
+	void *free; /**< Freed tiles, linked through their first word */
+};
+
+static struct tiles _tiles[N_TILE_SIZES];
+
+/* takes a tile of the given size, from a freed one if possible */
+static void *take_tile(uint8_t size)
 {
-	uint32_t sz;
-	struct keyrec *result;
-        unsigned hash;
+	struct tiles *tiles = &_tiles[size];
+	struct slab *slab;
+	void *tile;
 
-	/* compute requested size */
-	sz = key->group.length;
-	if (key->name.value) {
-		sz += key->name.length;
+	if (tiles->free) {
+		tile = tiles->free;
+		tiles->free = *(void **)tile;
+		return tile;
 	}
 
-	/* allocate */
-	result = malloc(sizeof(struct keyrec));
-	if (!result) {
-		return NULL;
+	slab = tiles->slabs;
+	if (!slab || slab->n_used == slab->n_tiles) {
+		slab = malloc(SLAB_SIZE);
+		if (!slab) {
+			abort();
+		}
+		slab->next = tiles->slabs;
+		slab->n_tiles = (uint32_t)(SLAB_SIZE - sizeof(struct slab)) /
+			tile_sizes[size];
+		slab->n_used = 0;
+		tiles->slabs = slab;
 	}
-	result->value = malloc(sz);
-	if (!result->value) {
-		free(result);
-		return NULL;
+
+	return (char *)slab + sizeof(struct slab) +
+		slab->n_used++ * tile_sizes[size];
+}
+
+/* allocates a record with room for size bytes after its header */
+static struct record *alloc_record(uint32_t size)
+{
+	struct record *record;
+	size_t total = sizeof(struct record) + size;
+
+	for (uint8_t i = 0; i < N_TILE_SIZES; i++) {
+		if (total <= tile_sizes[i]) {
+			record = take_tile(i);
+			record->tile_size = i;
+			record->room = tile_sizes[i] -
+				(uint32_t)sizeof(struct record);
+			return record;
+		}
 	}
 
-	/* set */
-	result->size = sz;
-	memcpy(result->value, key->group.value, key->group.length);
-	if (key->name.value) {
-		memcpy(result->value + key->group.length, key->name.value,
-		       key->name.length);
+	record = malloc(total);
+	if (!record) {
+		abort();
 	}
+	record->tile_size = TILE_MALLOC;
+	record->room = size;
+
+	return record;
+}
 
-        /* DJB's hash function */
-        hash = 5381;
-        while (sz) {
-                hash = (hash << 5) + hash + (unsigned char)result->value[--sz];
+/* free the record item, returning its tile */
+static void free_record(struct record *item)
+{
+	if (!item) {
+		return;
+	}
+	if (item->tile_size == TILE_MALLOC) {
+		free(item);
+		return;
 	}
-	result->hash = hash;
+	*(void **)item = _tiles[item->tile_size].free;
+	_tiles[item->tile_size].free = item;
+}
+
+/* free every slab, once no record is left */
+static void free_tiles(void)
+{
+	struct slab *slab, *next;
 
-	return result;
+	for (unsigned i = 0; i < N_TILE_SIZES; i++) {
+		for (slab = _tiles[i].slabs; slab; slab = next) {
+			next = slab->next;
+			free(slab);
+		}
+		_tiles[i].slabs = NULL;
+		_tiles[i].free = NULL;
+	}
 }
 
-/* free the keyrec item */
-static inline void free_keyrec(struct keyrec *item)
+/* points a keyrec, usually on the stack, at the parts of the key */
+static void init_keyrec(struct keyrec *keyrec, _BuxtonKey *key)
 {
-	free(item->value);
-	free(item);
+	keyrec->group = key->group.value;
+	keyrec->group_size = key->group.length;
+	keyrec->hash = string_hash_func(key->group.value);
+	if (key->name.value) {
+		keyrec->name = key->name.value;
+		keyrec->name_size = key->name.length;
+		keyrec->hash = keyrec->hash * 31 +
+			string_hash_func(key->name.value);
+	} else {
+		keyrec->name = NULL;
+		keyrec->name_size = 0;
+	}
 }
 
 /* gets the hash code of the keyrec item */
@@ -104,77 +193,102 @@ static unsigned hash_keyrec(const struct keyrec *item)
 /* compares two keyrecs a and b */
 static int compare_keyrec(const struct keyrec *a, const struct keyrec *b)
 {
-	return a->size == b->size ? memcmp(a->value, b->value, a->size) :
-		a->size < b->size ? -1 : 1;
+	int r;
+
+	if (a->group_size != b->group_size) {
+		return a->group_size < b->group_size ? -1 : 1;
+	}
+	if (a->name_size != b->name_size) {
+		return a->name_size < b->name_size ? -1 : 1;
+	}
+	r = memcmp(a->group, b->group, a->group_size);
+	if (r || !a->name_size) {
+		return r;
+	}
+	return memcmp(a->name, b->name, a->name_size);
 }
 
-/* free the valrec item */
-static void free_valrec(struct valrec *item)
+/* bytes a string value takes in a record */
+static inline uint32_t string_size(BuxtonData *data)
 {
-	if (item) {
-		if (item->data.type == BUXTON_TYPE_STRING) {
-			free(item->data.store.d_string.value);
-		}
-		free(item->label.value);
-		free(item);
+	if (data->type != BUXTON_TYPE_STRING || !data->store.d_string.value) {
+		return 0;
 	}
+	return data->store.d_string.length;
 }
 
-static bool set_valrec(struct valrec *item, BuxtonData *data,
-			      BuxtonString *label)
+/*
+ * Lays out the string value of dst after its key, and records its label,
+ * taking data when given, and the value of src otherwise. dst and src
+ * may be the same record.
+ */
+static void fill_record(struct record *dst, struct record *src,
+			BuxtonData *data, BuxtonLabelId label)
 {
-	char *sdata;
-	char *slabel;
-
-	/* allocate data if needed */
-	if (data && data->type == BUXTON_TYPE_STRING &&
-	    data->store.d_string.value) {
-		sdata = malloc(data->store.d_string.length);
-		if (!sdata) {
-			return false;
-		}
-		memcpy(sdata, data->store.d_string.value,
-			data->store.d_string.length);
-	} else {
-		sdata = NULL;
-	}
+	BuxtonData newdata = data ? *data : src->data;
+	char *p = dst->bytes + dst->key.group_size + dst->key.name_size;
+	uint32_t ssize = string_size(&newdata);
 
-	/* allocate label if needed */
-	if (label && label->value) {
-		slabel = malloc(label->length);
-		if (!slabel) {
-			free(sdata);
-			return false;
-		}
-		memcpy(slabel, label->value, label->length);
-	} else {
-		slabel = NULL;
+	if (ssize) {
+		memmove(p, newdata.store.d_string.value, ssize);
+		newdata.store.d_string.value = p;
 	}
 
-	/* copy now */
-	if (data) {
-		if (item->data.type == BUXTON_TYPE_STRING) {
-			free(item->data.store.d_string.value);
-		}
-		item->data = *data;
-		if (data->type == BUXTON_TYPE_STRING) {
-			item->data.store.d_string.value = sdata;
-		}
-	}
+	dst->data = newdata;
+	dst->label = label;
+}
+
+/* creates a record holding a copy of the key and data, and the label */
+static struct record *new_record(struct keyrec *keyrec, BuxtonData *data,
+				 BuxtonLabelId label)
+{
+	struct record *record;
+
+	record = alloc_record(keyrec->group_size + keyrec->name_size +
+			      string_size(data));
 
-	if (label) {
-		free(item->label.value);
-		item->label.length = label->length;
-		item->label.value = slabel;
+	record->key = *keyrec;
+	record->key.group = record->bytes;
+	memcpy(record->bytes, keyrec->group, keyrec->group_size);
+	if (keyrec->name) {
+		record->key.name = record->bytes + keyrec->group_size;
+		memcpy(record->bytes + keyrec->group_size, keyrec->name,
+		       keyrec->name_size);
 	}
+	fill_record(record, record, data, label);
 
-	return true;
+	return record;
+}
+
+/* structure for a group and the keys stored in it */
+struct grouprec {
+	char *name; /**< Name of the group */
+	struct keyrec *record; /**< Key of the group record, if it is set */
+	BuxtonSkipList *keys; /**< keyrecs of the group's keys, by name */
+};
+
+/* structure for the records of one layer */
+struct memdb {
+	Hashmap *values; /**< keyrec to record of every record */
+	BuxtonSkipList *groups; /**< grouprecs, by name */
+};
+
+/* compares the key names of two keyrecs of one group */
+static int compare_keyrec_name(const struct keyrec *a, const struct keyrec *b)
+{
+	return strcmp(a->name, b->name);
 }
 
-/* Return existing hashmap or create new hashmap on the fly */
-static Hashmap *_db_for_resource(BuxtonLayer *layer)
+/* compares two grouprecs by name */
+static int compare_grouprec(const struct grouprec *a, const struct grouprec *b)
 {
-	Hashmap *db;
+	return strcmp(a->name, b->name);
+}
+
+/* Return existing database or create a new one on the fly */
+static struct memdb *_db_for_resource(BuxtonLayer *layer)
+{
+	struct memdb *db;
 	char *name = NULL;
 	int r;
 
@@ -192,8 +306,16 @@ static Hashmap *_db_for_resource(BuxtonLayer *layer)
 
 	db = hashmap_get(_resources, name);
 	if (!db) {
-		db = hashmap_new((hash_func_t)hash_keyrec,
-				 (compare_func_t)compare_keyrec);
+		db = malloc0(sizeof(struct memdb));
+		if (!db) {
+			abort();
+		}
+		db->values = hashmap_new((hash_func_t)hash_keyrec,
+					 (compare_func_t)compare_keyrec);
+		db->groups = buxton_skiplist_new((buxton_compare_func)compare_grouprec);
+		if (!db->values || !db->groups) {
+			abort();
+		}
 		hashmap_put(_resources, name, db);
 	} else {
 		free(name);
@@ -202,13 +324,106 @@ static Hashmap *_db_for_resource(BuxtonLayer *layer)
 	return db;
 }
 
+/* gets the group of a key, creating it if asked to */
+static struct grouprec *get_grouprec(struct memdb *db, _BuxtonKey *key,
+				     bool create)
+{
+	struct grouprec *group;
+	struct grouprec find = { .name = key->group.value };
+
+	group = buxton_skiplist_get(db->groups, &find);
+	if (group || !create) {
+		return group;
+	}
+
+	group = malloc0(sizeof(struct grouprec));
+	if (!group) {
+		abort();
+	}
+	group->name = strdup(key->group.value);
+	if (!group->name) {
+		abort();
+	}
+	group->keys = buxton_skiplist_new((buxton_compare_func)compare_keyrec_name);
+	if (!buxton_skiplist_insert(db->groups, group)) {
+		abort();
+	}
+
+	return group;
+}
+
+/* drops a group once it has neither a record nor keys */
+static void put_grouprec(struct memdb *db, struct grouprec *group)
+{
+	if (group->record || buxton_skiplist_size(group->keys)) {
+		return;
+	}
+
+	buxton_skiplist_remove(db->groups, group);
+	buxton_skiplist_free(&group->keys, NULL);
+	free(group->name);
+	free(group);
+}
+
+/* records a new keyrec in the index of its group */
+static void index_keyrec(struct memdb *db, _BuxtonKey *key,
+			 struct keyrec *keyrec)
+{
+	struct grouprec *group;
+
+	group = get_grouprec(db, key, true);
+	if (key->name.value) {
+		if (!buxton_skiplist_insert(group->keys, keyrec)) {
+			abort();
+		}
+	} else {
+		group->record = keyrec;
+	}
+}
+
+/* stores new data or a new label, moving the record if it outgrew its tile */
+static void update_record(struct memdb *db, _BuxtonKey *key,
+			  struct record *record, BuxtonData *data,
+			  BuxtonLabelId label)
+{
+	struct record *moved;
+	struct grouprec *group;
+	BuxtonSkipNode *node;
+	uint32_t size;
+
+	size = record->key.group_size + record->key.name_size +
+		string_size(data ? data : &record->data);
+	if (size <= record->room) {
+		fill_record(record, record, data, label);
+		return;
+	}
+
+	moved = new_record(&record->key, data ? data : &record->data, label);
+
+	/* Point the hashmap and the group index at the new record */
+	if (hashmap_replace(db->values, &moved->key, moved) != 0) {
+		abort();
+	}
+	group = get_grouprec(db, key, false);
+	assert(group);
+	if (key->name.value) {
+		node = buxton_skiplist_seek(group->keys, &record->key);
+		assert(node && node->data == &record->key);
+		node->data = &moved->key;
+	} else {
+		group->record = &moved->key;
+	}
+
+	free_record(record);
+}
+
 static int set_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
 		      BuxtonString *label)
 {
-	Hashmap *db;
+	struct memdb *db;
 	int ret;
-	struct keyrec *keyrec;
-	struct valrec *valrec;
+	struct keyrec keyrec;
+	struct record *record;
 
 	assert(layer);
 	assert(key);
@@ -220,30 +435,22 @@ static int set_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
 		goto end;
 	}
 
-	keyrec = make_keyrec(key);
-	if (!keyrec) {
-		abort();
-	}
+	init_keyrec(&keyrec, key);
 
-	valrec = hashmap_get(db, keyrec);
-	if (valrec) {
-		free_keyrec(keyrec);
-		if (!set_valrec(valrec, data, label)) {
-			abort();
-		}
+	record = hashmap_get(db->values, &keyrec);
+	if (record) {
+		update_record(db, key, record, data,
+			      buxton_label_intern(label));
 	} else {
 		if (!data) {
 			ret = ENOENT;
 			goto end;
 		}
-		valrec = calloc(1, sizeof * valrec);
-		if (!valrec) {
-			abort();
-		}
-		if (!set_valrec(valrec, data, label) ||
-		    hashmap_put(db, keyrec, valrec) != 1) {
+		record = new_record(&keyrec, data, buxton_label_intern(label));
+		if (hashmap_put(db->values, &record->key, record) != 1) {
 			abort();
 		}
+		index_keyrec(db, key, &record->key);
 	}
 
 	ret = 0;
@@ -255,10 +462,10 @@ end:
 static int get_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
 		      BuxtonString *label)
 {
-	Hashmap *db;
+	struct memdb *db;
 	int ret;
-	struct keyrec *keyrec;
-	struct valrec *valrec;
+	struct keyrec keyrec;
+	struct record *record;
 
 	assert(layer);
 	assert(key);
@@ -276,29 +483,26 @@ static int get_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
 		goto end;
 	}
 
-	keyrec = make_keyrec(key);
-	if (!keyrec) {
-		ret = ENOMEM;
-		goto end;
-	}
-
-	valrec = hashmap_get(db, keyrec);
-	free_keyrec(keyrec);
+	init_keyrec(&keyrec, key);
 
-	if (!valrec) {
+	record = hashmap_get(db->values, &keyrec);
+	if (!record) {
 		ret = ENOENT;
 		goto end;
 	}
-	if (valrec->data.type != key->type && key->type != BUXTON_TYPE_UNSET) {
+	if (record->data.type != key->type && key->type != BUXTON_TYPE_UNSET) {
 		ret = EINVAL;
 		goto end;
 	}
 
-	if (!buxton_data_copy(&valrec->data, data)) {
+	if (!buxton_data_copy(&record->data, data)) {
 		abort();
 	}
 
-	if (!buxton_string_copy(&valrec->label, label)) {
+	if (record->label == BUXTON_LABEL_NONE) {
+		memzero(label, sizeof(BuxtonString));
+	} else if (!buxton_string_copy(buxton_label_string(record->label),
+				       label)) {
 		abort();
 	}
 
@@ -311,11 +515,11 @@ end:
 static int unset_key(BuxtonLayer *layer,
 			_BuxtonKey *key)
 {
-	Hashmap *db;
+	struct memdb *db;
 	int ret;
-	struct keyrec *keyrec;
-	struct keyrec *remkey;
-	struct valrec *valrec;
+	struct keyrec keyrec;
+	struct record *record;
+	struct grouprec *group;
 
 	assert(layer);
 	assert(key);
@@ -327,23 +531,22 @@ static int unset_key(BuxtonLayer *layer,
 		goto end;
 	}
 
-	keyrec = make_keyrec(key);
-	if (!keyrec) {
-		ret = ENOMEM;
-		goto end;
-	}
+	init_keyrec(&keyrec, key);
 
 	/* test if the value exists */
-	valrec = hashmap_remove2(db, keyrec, (void**)&remkey);
-	free_keyrec(keyrec);
-	if (!valrec) {
+	record = hashmap_remove(db->values, &keyrec);
+	if (!record) {
 		ret = ENOENT;
 		goto end;
 	}
 
+	group = get_grouprec(db, key, false);
+	assert(group);
+	buxton_skiplist_remove(group->keys, &record->key);
+	put_grouprec(db, group);
+
 	/* free the data */
-	free_valrec(valrec);
-	free_keyrec(remkey);
+	free_record(record);
 
 	ret = 0;
 
@@ -354,11 +557,9 @@ end:
 static int unset_group(BuxtonLayer *layer,
 			_BuxtonKey *key)
 {
-	Hashmap *db;
-	int ret;
-	struct keyrec *keyrec;
-	struct valrec *valrec;
-	Iterator iterator;
+	struct memdb *db;
+	struct grouprec *group;
+	BuxtonSkipNode *node;
 
 	assert(layer);
 	assert(key);
@@ -366,26 +567,27 @@ static int unset_group(BuxtonLayer *layer,
 
 	db = _db_for_resource(layer);
 	if (!db) {
-		ret = EROFS;
-		goto end;
+		return EROFS;
 	}
 
-	ret = ENOENT;
-	/* Iterate through the keys and record matching keys in k_list */
-	HASHMAP_FOREACH_KEY(valrec, keyrec, db, iterator) {
+	group = get_grouprec(db, key, false);
+	if (!group) {
+		return ENOENT;
+	}
 
-		/* test if the key matches the group */
-		if (!strcmp(keyrec->value, key->group.value)) {
-			/* yes it matches */
-			hashmap_remove(db, keyrec);
-			free_valrec(valrec);
-			free_keyrec(keyrec);
-			ret = 0;
-		}
+	/* Only the group's own keys are visited */
+	BUXTON_SKIPLIST_FOREACH(node, buxton_skiplist_seek(group->keys, NULL)) {
+		free_record(hashmap_remove(db->values, node->data));
+	}
+	buxton_skiplist_free(&group->keys, NULL);
+	group->keys = buxton_skiplist_new((buxton_compare_func)compare_keyrec_name);
+	if (group->record) {
+		free_record(hashmap_remove(db->values, group->record));
+		group->record = NULL;
 	}
+	put_grouprec(db, group);
 
-end:
-	return ret;
+	return 0;
 }
 
 static int unset_value(BuxtonLayer *layer,
@@ -403,24 +605,46 @@ static int unset_value(BuxtonLayer *layer,
 	}
 }
 
+/* adds a copy of a name to the list */
+static bool add_name(BuxtonArray *list, const char *value, uint32_t length)
+{
+	BuxtonData *data;
+	char *copy;
+
+	data = malloc0(sizeof(BuxtonData));
+	copy = malloc(length);
+	if (!data || !copy || !buxton_array_add(list, data)) {
+		free(data);
+		free(copy);
+		return false;
+	}
+	data->type = BUXTON_TYPE_STRING;
+	data->store.d_string.value = copy;
+	data->store.d_string.length = length;
+	memcpy(copy, value, length);
+
+	return true;
+}
+
+/* tests if a name is in the range of a prefix */
+static inline bool has_prefix(const char *value, BuxtonString *prefix)
+{
+	return !prefix || !strncmp(value, prefix->value, prefix->length - 1);
+}
+
 static bool list_names(BuxtonLayer *layer,
 		       BuxtonString *group,
 		       BuxtonString *prefix,
 		       BuxtonArray **ret_list)
 {
-	Hashmap *db;
+	struct memdb *db;
+	struct grouprec *grouprec;
+	struct grouprec findgroup;
+	struct keyrec *keyrec;
+	struct keyrec start;
+	BuxtonSkipNode *node;
 	BuxtonArray *list = NULL;
-	BuxtonData *data;
-	Iterator iterator;
-	BuxtonArray *array;
-	char *gname;
-	char *value;
-	char *copy;
-	uint32_t glen;
-	uint32_t klen;
-	uint32_t length;
 	bool ret = false;
-	struct keyrec *keyrec;
 
 	assert(layer);
 
@@ -436,59 +660,50 @@ static bool list_names(BuxtonLayer *layer,
 		prefix = NULL;
 	}
 
-	value = NULL;
 	list = buxton_array_new();
+	if (!list) {
+		abort();
+	}
 
-	/* Iterate through all of the keys */
-	HASHMAP_FOREACH_KEY(array, keyrec, db, iterator) {
-
-		/* get main data of the key */
-		gname = (char*)keyrec->value;
-		glen = (uint32_t)strlen(gname) + 1;
-		assert(keyrec->size >= glen);
-		klen = keyrec->size - glen;
-		assert(!klen || klen == (uint32_t)strlen(gname+glen) + 1);
-
-		/* treat the key value if it*/
-		if (klen) {
-			/* it is a key */
-			if (group && glen == group->length
-				&& !strcmp(gname, group->value)) {
-				value = gname + glen;
-				length = klen;
+	/* Names come out sorted, starting from the first one in range */
+	if (!group) {
+		findgroup.name = prefix ? prefix->value : NULL;
+		node = buxton_skiplist_seek(db->groups,
+					    prefix ? &findgroup : NULL);
+		BUXTON_SKIPLIST_FOREACH(node, node) {
+			grouprec = node->data;
+			if (!has_prefix(grouprec->name, prefix)) {
+				break;
 			}
-		} else {
-			/* it is a group */
-			if (!group) {
-				value = gname;
-				length = glen;
+			/* Groups with keys but no record aren't listed */
+			if (grouprec->record &&
+			    !add_name(list, grouprec->name,
+				      grouprec->record->group_size)) {
+				goto end;
 			}
 		}
-
-		/* treat a potential value */
-		if (value) {
-			/* check the prefix */
-			if (!prefix || !strncmp(value, prefix->value,
-				prefix->length - 1))  {
-				/* add the value */
-				data = malloc0(sizeof(BuxtonData));
-				copy = malloc(length);
-				if (data && copy &&
-				    buxton_array_add(list, data)) {
-					data->type = BUXTON_TYPE_STRING;
-					data->store.d_string.value = copy;
-					data->store.d_string.length = length;
-					memcpy(copy, value, length);
-				} else {
-					free(data);
-					free(copy);
-					goto end;
-				}
+	} else {
+		findgroup.name = group->value;
+		grouprec = buxton_skiplist_get(db->groups, &findgroup);
+		if (!grouprec) {
+			goto done;
+		}
+		start.name = prefix ? prefix->value : NULL;
+		node = buxton_skiplist_seek(grouprec->keys,
+					    prefix ? &start : NULL);
+		BUXTON_SKIPLIST_FOREACH(node, node) {
+			keyrec = node->data;
+			if (!has_prefix(keyrec->name, prefix)) {
+				break;
+			}
+			if (!add_name(list, keyrec->name,
+				      keyrec->name_size)) {
+				goto end;
 			}
-			value = NULL;
 		}
 	}
 
+done:
 	/* Pass ownership of the array to the caller */
 	*ret_list = list;
 	ret = true;
@@ -503,24 +718,34 @@ end:
 _bx_export_ void buxton_module_destroy(void)
 {
 	char *klayer;
-	struct keyrec *keyrec;
-	struct valrec *valrec;
+	struct record *record;
+	struct grouprec *grouprec;
+	BuxtonSkipNode *node;
 	Iterator iteratori, iteratoro;
-	Hashmap *map;
-
-	/* free all hashmaps */
-	HASHMAP_FOREACH_KEY(map, klayer, _resources, iteratoro) {
-		HASHMAP_FOREACH_KEY(valrec, keyrec, map, iteratori) {
-			hashmap_remove(map, keyrec);
-			free_valrec(valrec);
-			free_keyrec(keyrec);
+	struct memdb *db;
+
+	/* free all databases */
+	HASHMAP_FOREACH_KEY(db, klayer, _resources, iteratoro) {
+		/* the group indexes point to the keyrecs, free them first */
+		BUXTON_SKIPLIST_FOREACH(node, buxton_skiplist_seek(db->groups,
+								   NULL)) {
+			grouprec = node->data;
+			buxton_skiplist_free(&grouprec->keys, NULL);
+			free(grouprec->name);
+			free(grouprec);
+		}
+		buxton_skiplist_free(&db->groups, NULL);
+		HASHMAP_FOREACH(record, db->values, iteratori) {
+			free_record(record);
 		}
 		hashmap_remove(_resources, klayer);
-		hashmap_free(map);
+		hashmap_free(db->values);
+		free(db);
 		free(klayer);
 	}
 	hashmap_free(_resources);
 	_resources = NULL;
+	free_tiles();
 }
 
 _bx_export_ bool buxton_module_init(BuxtonBackend *backend)
@@ -535,6 +760,8 @@ _bx_export_ bool buxton_module_init(BuxtonBackend *backend)
 	backend->list_keys = NULL;
 	backend->list_names = list_names;
 	backend->create_db = NULL;
+	backend->begin = NULL;
+	backend->commit = NULL;
 
 	_resources = hashmap_new(string_hash_func, string_compare_func);
 	if (!_resources) {
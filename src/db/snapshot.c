@@ -0,0 +1,613 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2014 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "hashmap.h"
+#include "serialize.h"
+#include "snapshot.h"
+#include "util.h"
+
+/**
+ * Snapshot Database Module
+ *
+ * Serves a layer compiled by buxtonctl compile-snapshot. The file is
+ * mapped read-only and validated once, after which a get is one perfect
+ * hash probe and a listing is a binary search over the sorted index,
+ * with no parsing and no allocation beyond the returned copies.
+ */
+
+/**
+ * A mapped snapshot file
+ */
+typedef struct SnapshotResource {
+	uint8_t *map; /**<The mapped file */
+	size_t size; /**<Size of the mapping */
+	uint32_t count; /**<Number of records */
+	uint32_t nbuckets; /**<Number of perfect hash buckets */
+	const uint32_t *index; /**<Record offsets, sorted by key */
+	const uint32_t *slots; /**<Record numbers, by hash slot */
+	const uint32_t *seeds; /**<Hash seeds, by bucket */
+} SnapshotResource;
+
+static Hashmap *_resources = NULL;
+
+static inline uint32_t read_u32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(uint32_t));
+	return v;
+}
+
+static inline uint32_t record_key_len(SnapshotResource *res, uint32_t rec)
+{
+	return read_u32(res->map + res->index[rec]);
+}
+
+static inline const uint8_t *record_key(SnapshotResource *res, uint32_t rec)
+{
+	return res->map + res->index[rec] + sizeof(uint32_t) * 2;
+}
+
+static inline uint8_t *record_value(SnapshotResource *res, uint32_t rec)
+{
+	return res->map + res->index[rec] + sizeof(uint32_t) * 2 +
+		record_key_len(res, rec);
+}
+
+/**
+ * Check a serialized value, which buxton_deserialize trusts
+ * @return a boolean value, indicating whether the value is well formed
+ */
+static bool check_value(const uint8_t *value, uint32_t len)
+{
+	BuxtonDataType type;
+	uint64_t need;
+	uint32_t label_len, data_len;
+
+	if (len < sizeof(BuxtonDataType) + sizeof(uint32_t) * 2) {
+		return false;
+	}
+	memcpy(&type, value, sizeof(BuxtonDataType));
+	label_len = read_u32(value + sizeof(BuxtonDataType));
+	data_len = read_u32(value + sizeof(BuxtonDataType) + sizeof(uint32_t));
+
+	if (type <= BUXTON_TYPE_MIN || type >= BUXTON_TYPE_UNSET) {
+		return false;
+	}
+	if (type != BUXTON_TYPE_STRING &&
+	    data_len < sizeof(((BuxtonData *)NULL)->store)) {
+		return false;
+	}
+	need = (uint64_t)sizeof(BuxtonDataType) + sizeof(uint32_t) * 2 +
+		label_len + data_len;
+
+	return need <= len;
+}
+
+/**
+ * Check every offset of a mapped snapshot once, so lookups need not
+ * @return a boolean value, indicating whether the snapshot is usable
+ */
+static bool check_snapshot(SnapshotResource *res)
+{
+	BuxtonSnapshotHeader header;
+	uint64_t end;
+	uint32_t off, key_len, value_len;
+
+	if (res->size < sizeof(BuxtonSnapshotHeader)) {
+		return false;
+	}
+	memcpy(&header, res->map, sizeof(BuxtonSnapshotHeader));
+	if (memcmp(header.magic, BUXTON_SNAPSHOT_MAGIC, sizeof(header.magic))) {
+		return false;
+	}
+	if (header.size != res->size || header.nbuckets == 0) {
+		return false;
+	}
+
+	/* The three tables are uint32_t arrays */
+	if (header.index_offset % 4 || header.slot_offset % 4 ||
+	    header.bucket_offset % 4) {
+		return false;
+	}
+	if ((uint64_t)header.index_offset + sizeof(uint32_t) * (uint64_t)header.count > res->size ||
+	    (uint64_t)header.slot_offset + sizeof(uint32_t) * (uint64_t)header.count > res->size ||
+	    (uint64_t)header.bucket_offset + sizeof(uint32_t) * (uint64_t)header.nbuckets > res->size) {
+		return false;
+	}
+
+	res->count = header.count;
+	res->nbuckets = header.nbuckets;
+	res->index = (const uint32_t *)(res->map + header.index_offset);
+	res->slots = (const uint32_t *)(res->map + header.slot_offset);
+	res->seeds = (const uint32_t *)(res->map + header.bucket_offset);
+
+	for (uint32_t i = 0; i < res->count; i++) {
+		if (res->slots[i] >= res->count) {
+			return false;
+		}
+
+		off = res->index[i];
+		if (off < sizeof(BuxtonSnapshotHeader) || off % 4 ||
+		    (uint64_t)off + sizeof(uint32_t) * 2 > header.index_offset) {
+			return false;
+		}
+		key_len = read_u32(res->map + off);
+		value_len = read_u32(res->map + off + sizeof(uint32_t));
+		end = (uint64_t)off + sizeof(uint32_t) * 2 + key_len + value_len;
+		if (end > header.index_offset) {
+			return false;
+		}
+
+		/* Keys are a NUL terminated group, then maybe a name */
+		if (key_len == 0 || !memchr(record_key(res, i), 0, key_len)) {
+			return false;
+		}
+		if (!check_value(record_value(res, i), value_len)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void free_resource(SnapshotResource *res)
+{
+	if (!res) {
+		return;
+	}
+	if (res->map) {
+		munmap(res->map, res->size);
+	}
+	free(res);
+}
+
+/* Map snapshots on first use */
+static SnapshotResource *db_for_resource(BuxtonLayer *layer)
+{
+	SnapshotResource *res;
+	_cleanup_free_ char *path = NULL;
+	char *name = NULL;
+	struct stat st;
+	int fd;
+	int r;
+
+	assert(layer);
+	assert(_resources);
+
+	if (layer->type == LAYER_USER) {
+		r = asprintf(&name, "%s-%d", layer->name.value, layer->uid);
+	} else {
+		r = asprintf(&name, "%s", layer->name.value);
+	}
+	if (r == -1) {
+		abort();
+	}
+
+	res = hashmap_get(_resources, name);
+	if (res) {
+		free(name);
+		return res;
+	}
+
+	path = get_layer_path(layer);
+	if (!path) {
+		abort();
+	}
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		buxton_debug("Couldn't open snapshot %s: %m\n", path);
+		free(name);
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+		buxton_log("Couldn't stat snapshot %s\n", path);
+		close(fd);
+		free(name);
+		return NULL;
+	}
+
+	res = malloc0(sizeof(SnapshotResource));
+	if (!res) {
+		abort();
+	}
+	res->size = (size_t)st.st_size;
+	res->map = mmap(NULL, res->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (res->map == MAP_FAILED) {
+		buxton_log("Couldn't map snapshot %s: %m\n", path);
+		res->map = NULL;
+		free_resource(res);
+		free(name);
+		return NULL;
+	}
+
+	if (!check_snapshot(res)) {
+		buxton_log("Snapshot %s is corrupt\n", path);
+		free_resource(res);
+		free(name);
+		return NULL;
+	}
+
+	r = hashmap_put(_resources, name, res);
+	if (r != 1) {
+		abort();
+	}
+
+	return res;
+}
+
+/**
+ * Find a record with one probe of the perfect hash
+ * @param res A mapped snapshot
+ * @param group Group of the key, with its NUL
+ * @param name Name of the key, with its NUL, or NULL for the group
+ * @return the record number, or -1 if the key isn't in the snapshot
+ */
+static int64_t find_record(SnapshotResource *res, BuxtonString *group,
+			   BuxtonString *name)
+{
+	const uint8_t *key;
+	uint32_t nlen = name ? name->length : 0;
+	uint32_t bucket, slot, rec;
+
+	if (!res->count) {
+		return -1;
+	}
+
+	bucket = buxton_snapshot_hash(0, group->value, group->length,
+				      name ? name->value : NULL, nlen) %
+		res->nbuckets;
+	slot = buxton_snapshot_hash(res->seeds[bucket], group->value,
+				    group->length, name ? name->value : NULL,
+				    nlen) % res->count;
+	rec = res->slots[slot];
+
+	/* Any key hashes to some slot, so check it is this one */
+	if (record_key_len(res, rec) != (uint64_t)group->length + nlen) {
+		return -1;
+	}
+	key = record_key(res, rec);
+	if (memcmp(key, group->value, group->length)) {
+		return -1;
+	}
+	if (nlen && memcmp(key + group->length, name->value, nlen)) {
+		return -1;
+	}
+
+	return rec;
+}
+
+/**
+ * Find the first record whose key sorts at or after a given key
+ * @param res A mapped snapshot
+ * @param start Key to search for
+ * @param len Length of start
+ * @return the record number, or res->count if there is none
+ */
+static uint32_t lower_bound(SnapshotResource *res, const char *start,
+			    size_t len)
+{
+	uint32_t lo = 0;
+	uint32_t hi = res->count;
+	uint32_t mid, klen;
+	int r;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		klen = record_key_len(res, mid);
+		r = memcmp(record_key(res, mid), start, klen < len ? klen : len);
+		if (r < 0 || (r == 0 && klen < len)) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+static int set_value(__attribute__((unused)) BuxtonLayer *layer,
+		     __attribute__((unused)) _BuxtonKey *key,
+		     __attribute__((unused)) BuxtonData *data,
+		     __attribute__((unused)) BuxtonString *label)
+{
+	/* Snapshots only change by being compiled again */
+	return EROFS;
+}
+
+static int get_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
+		      BuxtonString *label)
+{
+	SnapshotResource *res;
+	int64_t rec;
+
+	assert(layer);
+	assert(key);
+
+	res = db_for_resource(layer);
+	if (!res) {
+		/*
+		 * Set negative here to indicate layer not found
+		 * rather than key not found, optimization for
+		 * set value
+		 */
+		return -ENOENT;
+	}
+
+	rec = find_record(res, &key->group,
+			  key->name.value ? &key->name : NULL);
+	if (rec < 0) {
+		return ENOENT;
+	}
+	buxton_deserialize(record_value(res, (uint32_t)rec), data, label);
+
+	if (data->type != key->type && key->type != BUXTON_TYPE_UNSET) {
+		free(label->value);
+		label->value = NULL;
+		if (data->type == BUXTON_TYPE_STRING) {
+			free(data->store.d_string.value);
+			data->store.d_string.value = NULL;
+		}
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+static int unset_value(__attribute__((unused)) BuxtonLayer *layer,
+		       __attribute__((unused)) _BuxtonKey *key,
+		       __attribute__((unused)) BuxtonData *data,
+		       __attribute__((unused)) BuxtonString *label)
+{
+	return EROFS;
+}
+
+static bool add_name(BuxtonArray *list, const uint8_t *value, size_t length)
+{
+	BuxtonData *data;
+
+	data = malloc0(sizeof(BuxtonData));
+	if (!data) {
+		abort();
+	}
+	data->type = BUXTON_TYPE_STRING;
+	data->store.d_string.value = malloc(length);
+	if (!data->store.d_string.value) {
+		abort();
+	}
+	memcpy(data->store.d_string.value, value, length);
+	data->store.d_string.length = (uint32_t)length;
+
+	if (!buxton_array_add(list, data)) {
+		data_free(data);
+		return false;
+	}
+
+	return true;
+}
+
+static bool list_keys(BuxtonLayer *layer,
+		      BuxtonArray **list)
+{
+	SnapshotResource *res;
+	BuxtonArray *k_list = NULL;
+	const uint8_t *key;
+	uint32_t klen;
+	size_t glen;
+
+	assert(layer);
+
+	res = db_for_resource(layer);
+	if (!res) {
+		return false;
+	}
+
+	k_list = buxton_array_new();
+	if (!k_list) {
+		abort();
+	}
+
+	for (uint32_t i = 0; i < res->count; i++) {
+		key = record_key(res, i);
+		klen = record_key_len(res, i);
+		/* Group records have no name after the group */
+		glen = strnlen((const char *)key, klen) + 1;
+		if (glen >= klen) {
+			continue;
+		}
+		if (!add_name(k_list, key + glen, klen - glen)) {
+			buxton_array_free(&k_list, (buxton_free_func)data_free);
+			return false;
+		}
+	}
+
+	/* Pass ownership of the array to the caller */
+	*list = k_list;
+	return true;
+}
+
+static bool list_names(BuxtonLayer *layer,
+		       BuxtonString *group,
+		       BuxtonString *prefix,
+		       BuxtonArray **list)
+{
+	SnapshotResource *res;
+	BuxtonArray *k_list = NULL;
+	_cleanup_free_ char *start = NULL;
+	_cleanup_free_ char *skip = NULL;
+	const uint8_t *key;
+	size_t start_len;
+	size_t skip_len = 0;
+	size_t plen = 0;
+	size_t glen;
+	uint32_t klen;
+	uint32_t i;
+
+	assert(layer);
+	assert(group);
+
+	if (!group->length) {
+		group = NULL;
+	}
+	if (prefix && prefix->length) {
+		plen = prefix->length - 1;
+	}
+
+	res = db_for_resource(layer);
+	if (!res) {
+		return false;
+	}
+
+	k_list = buxton_array_new();
+	if (!k_list) {
+		abort();
+	}
+
+	/* Every match sorts at or after the group and the prefix */
+	start_len = (group ? group->length : 0) + plen;
+	start = malloc(start_len + 1);
+	if (!start) {
+		abort();
+	}
+	if (group) {
+		memcpy(start, group->value, group->length);
+	}
+	if (plen) {
+		memcpy(start + (group ? group->length : 0), prefix->value, plen);
+	}
+
+	i = lower_bound(res, start, start_len);
+	while (i < res->count) {
+		key = record_key(res, i);
+		klen = record_key_len(res, i);
+
+		/* Stop at the first key outside the range */
+		if (klen < start_len || memcmp(key, start, start_len)) {
+			break;
+		}
+
+		glen = strnlen((const char *)key, klen) + 1;
+		if (group) {
+			/* The group record itself isn't a name */
+			if (glen < klen &&
+			    !add_name(k_list, key + glen, klen - glen)) {
+				goto fail;
+			}
+			i++;
+			continue;
+		}
+
+		if (glen == klen && !add_name(k_list, key, klen)) {
+			goto fail;
+		}
+
+		/* Skip over the keys of this group, they sort below "group\1" */
+		if (glen > skip_len) {
+			free(skip);
+			skip = malloc(glen);
+			if (!skip) {
+				abort();
+			}
+			skip_len = glen;
+		}
+		memcpy(skip, key, glen);
+		skip[glen - 1] = 1;
+		i = lower_bound(res, skip, glen);
+	}
+
+	/* Pass ownership of the array to the caller */
+	*list = k_list;
+	return true;
+
+fail:
+	buxton_array_free(&k_list, (buxton_free_func)data_free);
+	return false;
+}
+
+static int commit(BuxtonLayer *layer,
+		  __attribute__((unused)) bool apply)
+{
+	assert(layer);
+
+	/* Nothing is ever written through the module */
+	if (!db_for_resource(layer)) {
+		return EROFS;
+	}
+
+	return 0;
+}
+
+_bx_export_ void buxton_module_destroy(void)
+{
+	const char *key;
+	Iterator iterator;
+	SnapshotResource *res;
+
+	/* unmap all snapshots */
+	HASHMAP_FOREACH_KEY(res, key, _resources, iterator) {
+		hashmap_remove(_resources, key);
+		free_resource(res);
+		free((void *)key);
+	}
+	hashmap_free(_resources);
+	_resources = NULL;
+}
+
+_bx_export_ bool buxton_module_init(BuxtonBackend *backend)
+{
+
+	assert(backend);
+
+	/* Point the struct methods back to our own */
+	backend->set_value = &set_value;
+	backend->get_value = &get_value;
+	backend->list_keys = &list_keys;
+	backend->list_names = &list_names;
+	backend->unset_value = &unset_value;
+	backend->create_db = (module_db_init_func) &db_for_resource;
+	backend->commit = &commit;
+
+	_resources = hashmap_new(string_hash_func, string_compare_func);
+	if (!_resources) {
+		abort();
+	}
+
+	return true;
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -75,6 +75,8 @@ typedef enum BuxtonControlMessage {
 	BUXTON_CONTROL_CHANGED, /**<A key changed in Buxton */
 	BUXTON_CONTROL_GET_LABEL, /**<Get a label from Buxton */
 	BUXTON_CONTROL_LIST_NAMES, /**<List names within Buxton */
+	BUXTON_CONTROL_BATCH, /**<Run several operations in one request */
+	BUXTON_CONTROL_COMMIT, /**<Apply several changes atomically */
 	BUXTON_CONTROL_MAX
 } BuxtonControlMessage;
 
@@ -93,6 +95,11 @@ typedef struct BuxtonKey *BuxtonKey;
  */
 typedef struct BuxtonResponse *BuxtonResponse;
 
+/**
+ * Represents operations sent to Buxton in a single request
+ */
+typedef struct BuxtonBatch *BuxtonBatch;
+
 /**
  * Prototype for callback functions
  *
@@ -251,7 +258,7 @@ _bx_export_ int buxton_client_list_keys(BuxtonClient client,
  * For listing groups, the group must be put to NULL.
  * Otherwise, if the group name is given, lists the keys of that group.
  * If a prefix is given, the returned list will only contain names
- * having the given prefix.
+ * having the given prefix. Names are returned in strcmp order.
  * @param client An open client connection
  * @param layer_name The layer of the query
  * @param group_name The group of the query or NUUL
@@ -272,6 +279,11 @@ _bx_export_ int buxton_list_names(BuxtonClient client,
 
 /**
  * Register for notifications on the given key in all layers
+ *
+ * A key name ending in '*' registers for changes to every key of the
+ * group whose name starts with what precedes the '*', or to the whole
+ * group for "*" alone. The key of each notification is then the key that
+ * changed, and the key type of the registration is not used.
  * @param client An open client connection
  * @param key The key to register interest with
  * @param callback A callback function to handle daemon reply
@@ -286,6 +298,28 @@ _bx_export_ int buxton_register_notification(BuxtonClient client,
 					     bool sync)
 	__attribute__((warn_unused_result));
 
+/**
+ * Register for notifications on the given key, at most one per window
+ *
+ * Changes made within the window after a notification are coalesced, and
+ * only the latest is notified once the window is over. Wildcard keys, as
+ * described for buxton_register_notification, are notified every change.
+ * @param client An open client connection
+ * @param key The key to register interest with
+ * @param window Least time in milliseconds between notifications
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @param sync Indicator for running a synchronous request
+ * @return An int value, indicating success of the operation
+ */
+_bx_export_ int buxton_register_notification_window(BuxtonClient client,
+						    BuxtonKey key,
+						    uint32_t window,
+						    BuxtonCallback callback,
+						    void *data,
+						    bool sync)
+	__attribute__((warn_unused_result));
+
 /**
  * Unregister from notifications on the given key in all layers
  * @param client An open client connection
@@ -318,6 +352,91 @@ _bx_export_ int buxton_unset_value(BuxtonClient client,
 				   bool sync)
 	__attribute__((warn_unused_result));
 
+/**
+ * Create an empty batch of operations
+ * @return A BuxtonBatch, or NULL on failure
+ */
+_bx_export_ BuxtonBatch buxton_batch_create(void)
+	__attribute__((warn_unused_result));
+
+/**
+ * Queue the retrieval of a value in a batch
+ * @param batch The batch to add to
+ * @param key The key to retrieve
+ * @return An int value, indicating success of the operation
+ */
+_bx_export_ int buxton_batch_get_value(BuxtonBatch batch, BuxtonKey key)
+	__attribute__((warn_unused_result));
+
+/**
+ * Queue setting a value in a batch
+ * @param batch The batch to add to
+ * @param key The key to set
+ * @param value A pointer to a supported data type, copied into the batch
+ * @return An int value, indicating success of the operation
+ */
+_bx_export_ int buxton_batch_set_value(BuxtonBatch batch, BuxtonKey key,
+				       const void *value)
+	__attribute__((warn_unused_result));
+
+/**
+ * Queue unsetting a value in a batch
+ * @param batch The batch to add to
+ * @param key The key to remove
+ * @return An int value, indicating success of the operation
+ */
+_bx_export_ int buxton_batch_unset_value(BuxtonBatch batch, BuxtonKey key)
+	__attribute__((warn_unused_result));
+
+/**
+ * Send every operation of a batch to Buxton in a single request
+ *
+ * The operations run in the order they were queued. The callback is
+ * called once per operation, in order, with a response that looks
+ * like the reply to the equivalent single request.
+ *
+ * @param client An open client connection
+ * @param batch The batch to send, which may be reused or freed after
+ * @param callback A callback function to handle each operation's reply
+ * @param data User data to be used with callback function
+ * @param sync Indicator for running a synchronous request
+ * @return An int value, indicating success of the operation
+ */
+_bx_export_ int buxton_batch_send(BuxtonClient client,
+				  BuxtonBatch batch,
+				  BuxtonCallback callback,
+				  void *data,
+				  bool sync)
+	__attribute__((warn_unused_result));
+
+/**
+ * Apply the sets and unsets of a batch to a single layer atomically
+ *
+ * Either every operation is applied or none is. Clients notified of
+ * the changed keys are only told once all of them are in place. The
+ * callback is called once per operation, in order, with the status of
+ * the whole transaction.
+ *
+ * @param client An open client connection
+ * @param batch The batch to commit, holding sets and unsets on one layer
+ * @param callback A callback function to handle each operation's reply
+ * @param data User data to be used with callback function
+ * @param sync Indicator for running a synchronous request
+ * @return An int value, indicating success of the operation
+ */
+_bx_export_ int buxton_batch_commit(BuxtonClient client,
+				    BuxtonBatch batch,
+				    BuxtonCallback callback,
+				    void *data,
+				    bool sync)
+	__attribute__((warn_unused_result));
+
+/**
+ * Free a batch and every operation queued in it
+ * @param batch A BuxtonBatch
+ */
+_bx_export_ void buxton_batch_free(BuxtonBatch batch);
+
 /**
  * Process messages on the socket
  * @note Will not block, useful after poll in client application
@@ -327,6 +446,46 @@ _bx_export_ int buxton_unset_value(BuxtonClient client,
 _bx_export_ ssize_t buxton_client_handle_response(BuxtonClient client)
 	__attribute__((warn_unused_result));
 
+/**
+ * Start queueing requests instead of sending them one by one
+ *
+ * Requests made while pipelined are only sent, all at once, when
+ * buxton_pipeline_flush, buxton_pipeline_end or buxton_wait_all is
+ * called, or before waiting for the reply to a synchronous request.
+ * Their callbacks are run as the replies come in, in any order.
+ *
+ * @param client An open client connection
+ * @return An int value, indicating success of the operation
+ */
+_bx_export_ int buxton_pipeline_begin(BuxtonClient client)
+	__attribute__((warn_unused_result));
+
+/**
+ * Send every queued request in a single write
+ * @param client An open client connection
+ * @return An int value, indicating success of the operation
+ */
+_bx_export_ int buxton_pipeline_flush(BuxtonClient client)
+	__attribute__((warn_unused_result));
+
+/**
+ * Send every queued request and stop queueing new ones
+ * @param client An open client connection
+ * @return An int value, indicating success of the operation
+ */
+_bx_export_ int buxton_pipeline_end(BuxtonClient client)
+	__attribute__((warn_unused_result));
+
+/**
+ * Send every queued request, then process responses until every
+ * request sent on the connection has been answered
+ * @param client An open client connection
+ * @param timeout Milliseconds to wait for, or -1 to wait as long as needed
+ * @return 0 once every request was answered, or a negative errno value
+ */
+_bx_export_ int buxton_wait_all(BuxtonClient client, int timeout)
+	__attribute__((warn_unused_result));
+
 /**
  * Create a key for item lookup in buxton
  * @param group Pointer to a character string representing a group
@@ -31,6 +31,7 @@
 #include <stdint.h>
 
 #include "buxton.h"
+#include "buxtonbatch.h"
 #include "buxtonclient.h"
 #include "buxtonkey.h"
 #include "buxtonresponse.h"
@@ -137,6 +138,9 @@ void buxton_close(BuxtonClient client)
 	close(c->fd);
 	c->direct = 0;
 	c->fd = -1;
+	buxton_wire_clear_queue(c);
+	free(c->queue);
+	free(c->send_buf);
 	free(c);
 }
 
@@ -177,6 +181,17 @@ int buxton_register_notification(BuxtonClient client,
 				 BuxtonCallback callback,
 				 void *data,
 				 bool sync)
+{
+	return buxton_register_notification_window(client, key, 0, callback,
+						   data, sync);
+}
+
+int buxton_register_notification_window(BuxtonClient client,
+					BuxtonKey key,
+					uint32_t window,
+					BuxtonCallback callback,
+					void *data,
+					bool sync)
 {
 	bool r;
 	int ret = 0;
@@ -188,7 +203,7 @@ int buxton_register_notification(BuxtonClient client,
 	}
 
 	r = buxton_wire_register_notification((_BuxtonClient *)client, k,
-					      callback, data);
+					      window, callback, data);
 	if (!r) {
 		return -1;
 	}
@@ -524,6 +539,179 @@ int buxton_unset_value(BuxtonClient client,
 	return ret;
 }
 
+BuxtonBatch buxton_batch_create(void)
+{
+	return (BuxtonBatch)malloc0(sizeof(_BuxtonBatch));
+}
+
+/**
+ * Append an operation on a copy of key to a batch
+ * @param batch The batch to add to
+ * @param type Type of the operation
+ * @param key The key the operation is about
+ * @return The new operation, or NULL on failure
+ */
+static BuxtonBatchOp *batch_add(_BuxtonBatch *batch, BuxtonControlMessage type,
+				_BuxtonKey *key)
+{
+	BuxtonBatchOp *op;
+
+	if (!greedy_realloc((void **)&batch->ops, &batch->allocated,
+			    sizeof(BuxtonBatchOp) * (batch->len + 1))) {
+		return NULL;
+	}
+
+	op = &batch->ops[batch->len];
+	memzero(op, sizeof(BuxtonBatchOp));
+	if (!buxton_key_copy(key, &op->key)) {
+		return NULL;
+	}
+	op->type = type;
+	batch->len++;
+
+	return op;
+}
+
+int buxton_batch_get_value(BuxtonBatch batch, BuxtonKey key)
+{
+	_BuxtonKey *k = (_BuxtonKey *)key;
+
+	if (!batch || !k || !(k->group.value) || !(k->name.value) ||
+	    k->type <= BUXTON_TYPE_MIN || k->type >= BUXTON_TYPE_MAX) {
+		return EINVAL;
+	}
+
+	if (!batch_add((_BuxtonBatch *)batch, BUXTON_CONTROL_GET, k)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+int buxton_batch_set_value(BuxtonBatch batch, BuxtonKey key,
+			   const void *value)
+{
+	_BuxtonKey *k = (_BuxtonKey *)key;
+	_BuxtonBatch *b = (_BuxtonBatch *)batch;
+	BuxtonBatchOp *op;
+	BuxtonData v;
+
+	if (!b || !k || !k->group.value || !k->name.value || !k->layer.value ||
+	    k->type <= BUXTON_TYPE_MIN || k->type >= BUXTON_TYPE_MAX ||
+	    k->type == BUXTON_TYPE_UNSET || !value) {
+		return EINVAL;
+	}
+
+	op = batch_add(b, BUXTON_CONTROL_SET, k);
+	if (!op) {
+		return -1;
+	}
+
+	buxton_value_to_data(k->type, value, &v);
+	if (!buxton_data_copy(&v, &op->value)) {
+		b->len--;
+		free(op->key.group.value);
+		free(op->key.name.value);
+		free(op->key.layer.value);
+		return -1;
+	}
+
+	return 0;
+}
+
+int buxton_batch_unset_value(BuxtonBatch batch, BuxtonKey key)
+{
+	_BuxtonKey *k = (_BuxtonKey *)key;
+
+	if (!batch || !k || !k->group.value || !k->name.value ||
+	    !k->layer.value || k->type <= BUXTON_TYPE_MIN ||
+	    k->type >= BUXTON_TYPE_MAX) {
+		return EINVAL;
+	}
+
+	if (!batch_add((_BuxtonBatch *)batch, BUXTON_CONTROL_UNSET, k)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+int buxton_batch_send(BuxtonClient client,
+		      BuxtonBatch batch,
+		      BuxtonCallback callback,
+		      void *data,
+		      bool sync)
+{
+	bool r;
+	int ret = 0;
+
+	if (!batch) {
+		return EINVAL;
+	}
+
+	r = buxton_wire_batch((_BuxtonClient *)client, (_BuxtonBatch *)batch,
+			      callback, data);
+	if (!r) {
+		return -1;
+	}
+
+	if (sync) {
+		ret = buxton_wire_get_response(client);
+		if (ret <= 0) {
+			ret = -1;
+		} else {
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
+int buxton_batch_commit(BuxtonClient client,
+			BuxtonBatch batch,
+			BuxtonCallback callback,
+			void *data,
+			bool sync)
+{
+	_BuxtonBatch *b = (_BuxtonBatch *)batch;
+	bool r;
+	int ret = 0;
+
+	if (!b || b->len == 0) {
+		return EINVAL;
+	}
+
+	/* A transaction only changes keys, within a single layer */
+	for (size_t i = 0; i < b->len; i++) {
+		if (b->ops[i].type == BUXTON_CONTROL_GET ||
+		    !streq(b->ops[i].key.layer.value,
+			   b->ops[0].key.layer.value)) {
+			return EINVAL;
+		}
+	}
+
+	r = buxton_wire_commit((_BuxtonClient *)client, b, callback, data);
+	if (!r) {
+		return -1;
+	}
+
+	if (sync) {
+		ret = buxton_wire_get_response(client);
+		if (ret <= 0) {
+			ret = -1;
+		} else {
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
+void buxton_batch_free(BuxtonBatch batch)
+{
+	batch_free((_BuxtonBatch *)batch);
+}
+
 BuxtonKey buxton_key_create(const char *group, const char *name,
 			    const char *layer, BuxtonDataType type)
 {
@@ -670,6 +858,51 @@ ssize_t buxton_client_handle_response(BuxtonClient client)
 	return buxton_wire_handle_response((_BuxtonClient *)client);
 }
 
+int buxton_pipeline_begin(BuxtonClient client)
+{
+	if (!client) {
+		return EINVAL;
+	}
+
+	((_BuxtonClient *)client)->pipelined = true;
+
+	return 0;
+}
+
+int buxton_pipeline_flush(BuxtonClient client)
+{
+	if (!client) {
+		return EINVAL;
+	}
+
+	if (!buxton_wire_flush((_BuxtonClient *)client)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+int buxton_pipeline_end(BuxtonClient client)
+{
+	int ret;
+
+	ret = buxton_pipeline_flush(client);
+	if (client) {
+		((_BuxtonClient *)client)->pipelined = false;
+	}
+
+	return ret;
+}
+
+int buxton_wait_all(BuxtonClient client, int timeout)
+{
+	if (!client) {
+		return -EINVAL;
+	}
+
+	return buxton_wire_wait_all((_BuxtonClient *)client, timeout);
+}
+
 BuxtonControlMessage buxton_response_type(BuxtonResponse response)
 {
 	_BuxtonResponse *r = (_BuxtonResponse *)response;
@@ -45,18 +45,16 @@ void sbuxton_set_group(char *group, char *layer)
 	/* In case a string is longer than MAX_LG_LEN, set the last byte to null */
 	_layer[MAX_LG_LEN -1] = '\0';
 	_group[MAX_LG_LEN -1] = '\0';
-	BuxtonKey g = buxton_key_create(_group, NULL, _layer, BUXTON_TYPE_STRING);
-	buxton_debug("buxton key group = %s\n", buxton_key_get_group(g));
-	if (buxton_create_group(client, g, _cg_cb, &status, true)
+	buxton_debug("buxton key group = %s\n", _group);
+	if (_client_request(BUXTON_CONTROL_CREATE_GROUP, _group, NULL, _layer,
+			    BUXTON_TYPE_STRING, NULL, _cg_cb, &status)
 		|| !status) {
 		buxton_debug("Create group call failed.\n");
 		errno = EBADMSG;
 	} else {
-		buxton_debug("Switched to group: %s, layer: %s.\n", buxton_key_get_group(g),
-	buxton_key_get_layer(g));
+		buxton_debug("Switched to group: %s, layer: %s.\n", _group, _layer);
 		errno = saved_errno;
 	}
-	_client_disconnect();
 }
 
 /* Set and get int32_t value for buxton key with type BUXTON_TYPE_INT32 */
@@ -67,15 +65,14 @@ void sbuxton_set_int32(char *key, int32_t value)
 		errno = ENOTCONN;
 		return;
 	}
-	/* create key  */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_INT32);
 	/* return value and status */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_INT32;
 	ret.val.i32val = value;
 	saved_errno = errno;
 	/* call buxton_set_value for type BUXTON_TYPE_INT32 */
-	if (buxton_set_value(client, _key, &value, _bs_cb, &ret, true)) {
+	if (_client_request(BUXTON_CONTROL_SET, _group, key, _layer,
+			    BUXTON_TYPE_INT32, &value, _bs_cb, &ret)) {
 		buxton_debug("Set int32_t call failed.\n");
 		return;
 	}
@@ -84,7 +81,6 @@ void sbuxton_set_int32(char *key, int32_t value)
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 }
 
 int32_t sbuxton_get_int32(char *key)
@@ -94,14 +90,13 @@ int32_t sbuxton_get_int32(char *key)
 		errno = ENOTCONN;
 		return -1;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_INT32);
 	/* return value */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_INT32;
 	saved_errno = errno;
 	/* get value */
-	if (buxton_get_value(client, _key, _bg_cb, &ret, true)) {
+	if (_client_request(BUXTON_CONTROL_GET, _group, key, _layer,
+			    BUXTON_TYPE_INT32, NULL, _bg_cb, &ret)) {
 		buxton_debug("Get int32_t call failed.\n");
 	}
 	if (!ret.status) {
@@ -109,7 +104,6 @@ int32_t sbuxton_get_int32(char *key)
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 	return ret.val.i32val;
 }
 
@@ -121,15 +115,14 @@ void sbuxton_set_string(char *key, char *value )
 		errno = ENOTCONN;
 		return;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_STRING);
 	/* return value and status */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_STRING;
 	ret.val.sval = value;
 	saved_errno = errno;
 	/* set value */
-	if (buxton_set_value(client, _key, value, _bs_cb, &ret, true)) {
+	if (_client_request(BUXTON_CONTROL_SET, _group, key, _layer,
+			    BUXTON_TYPE_STRING, value, _bs_cb, &ret)) {
 		buxton_debug("Set string call failed.\n");
 	}
 	if (!ret.status) {
@@ -137,7 +130,6 @@ void sbuxton_set_string(char *key, char *value )
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 }
 
 char* sbuxton_get_string(char *key)
@@ -147,14 +139,13 @@ char* sbuxton_get_string(char *key)
 		errno = ENOTCONN;
 		return NULL;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_STRING);
 	/* return value */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_STRING;
 	saved_errno = errno;
 	/* get value */
-	if (buxton_get_value(client, _key, _bg_cb, &ret, true)) {
+	if (_client_request(BUXTON_CONTROL_GET, _group, key, _layer,
+			    BUXTON_TYPE_STRING, NULL, _bg_cb, &ret)) {
 		buxton_debug("Get string call failed.\n");
 	}
 	if (!ret.status) {
@@ -162,7 +153,6 @@ char* sbuxton_get_string(char *key)
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 	return ret.val.sval;
 }
 
@@ -174,14 +164,13 @@ void sbuxton_set_uint32(char *key, uint32_t value)
 		errno = ENOTCONN;
 		return;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_UINT32);
 	/* return value and status */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_UINT32;
 	ret.val.ui32val = value;
 	saved_errno = errno;
-	if (buxton_set_value(client,_key, &value, _bs_cb, &ret, true)) {
+	if (_client_request(BUXTON_CONTROL_SET, _group, key, _layer,
+			    BUXTON_TYPE_UINT32, &value, _bs_cb, &ret)) {
 		buxton_debug("Set uint32_t call failed.\n");
 	}
 	if (!ret.status) {
@@ -189,7 +178,6 @@ void sbuxton_set_uint32(char *key, uint32_t value)
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 }
 
 uint32_t sbuxton_get_uint32(char *key)
@@ -199,14 +187,13 @@ uint32_t sbuxton_get_uint32(char *key)
 		errno = ENOTCONN;
 		return 0;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_UINT32);
 	/* return value */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_UINT32;
 	saved_errno = errno;
 	/* get value */
-	if (buxton_get_value(client, _key, _bg_cb, &ret, true)) {
+	if (_client_request(BUXTON_CONTROL_GET, _group, key, _layer,
+			    BUXTON_TYPE_UINT32, NULL, _bg_cb, &ret)) {
 		buxton_debug("Get uint32_t call failed.\n");
 	}
 	if (!ret.status) {
@@ -214,7 +201,6 @@ uint32_t sbuxton_get_uint32(char *key)
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 	return ret.val.ui32val;
 }
 
@@ -226,14 +212,13 @@ void sbuxton_set_int64(char *key, int64_t value)
 		errno = ENOTCONN;
 		return;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_INT64);
 	/* return value and status */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_INT64;
 	ret.val.i64val = value;
 	saved_errno = errno;
-	if (buxton_set_value(client, _key, &value, _bs_cb, &ret, true)) {
+	if (_client_request(BUXTON_CONTROL_SET, _group, key, _layer,
+			    BUXTON_TYPE_INT64, &value, _bs_cb, &ret)) {
 		buxton_debug("Set int64_t call failed.\n");
 	}
 	if (!ret.status) {
@@ -241,7 +226,6 @@ void sbuxton_set_int64(char *key, int64_t value)
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 }
 
 int64_t sbuxton_get_int64(char *key)
@@ -251,14 +235,13 @@ int64_t sbuxton_get_int64(char *key)
 		errno = ENOTCONN;
 		return -1;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_INT64);
 	/* return value */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_INT64;
 	saved_errno = errno;
 	/* get value */
-	if (buxton_get_value(client, _key, _bg_cb, &ret, true)) {
+	if (_client_request(BUXTON_CONTROL_GET, _group, key, _layer,
+			    BUXTON_TYPE_INT64, NULL, _bg_cb, &ret)) {
 		buxton_debug("Get int64_t call failed.\n");
 	}
 	if (!ret.status) {
@@ -266,7 +249,6 @@ int64_t sbuxton_get_int64(char *key)
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 	return ret.val.i64val;
 }
 
@@ -278,14 +260,13 @@ void sbuxton_set_uint64(char *key, uint64_t value)
 		errno = ENOTCONN;
 		return;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_UINT64);
 	/* return value and status */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_UINT64;
 	ret.val.ui64val = value;
 	saved_errno = errno;
-	if (buxton_set_value(client, _key, &value, _bs_cb, &ret, true)) {
+	if (_client_request(BUXTON_CONTROL_SET, _group, key, _layer,
+			    BUXTON_TYPE_UINT64, &value, _bs_cb, &ret)) {
 		buxton_debug("Set uint64_t call failed.\n");
 	}
 	if (!ret.status) {
@@ -293,7 +274,6 @@ void sbuxton_set_uint64(char *key, uint64_t value)
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 }
 
 uint64_t sbuxton_get_uint64(char *key)
@@ -303,14 +283,13 @@ uint64_t sbuxton_get_uint64(char *key)
 		errno = ENOTCONN;
 		return 0;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_UINT64);
 	/* return value */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_UINT64;
 	saved_errno = errno;
 	/* get value */
-	if (buxton_get_value(client, _key, _bg_cb, &ret, true)) {
+	if (_client_request(BUXTON_CONTROL_GET, _group, key, _layer,
+			    BUXTON_TYPE_UINT64, NULL, _bg_cb, &ret)) {
 		buxton_debug("Get uint64_t call failed.\n");
 	}
 	if (!ret.status) {
@@ -318,7 +297,6 @@ uint64_t sbuxton_get_uint64(char *key)
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 	return ret.val.ui64val;
 }
 
@@ -330,14 +308,13 @@ void sbuxton_set_float(char *key, float value)
 		errno = ENOTCONN;
 		return;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_FLOAT);
 	/* return value and status */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_FLOAT;
 	ret.val.fval = value;
 	saved_errno = errno;
-	if (buxton_set_value(client, _key, &value, _bs_cb, &ret, true)) {
+	if (_client_request(BUXTON_CONTROL_SET, _group, key, _layer,
+			    BUXTON_TYPE_FLOAT, &value, _bs_cb, &ret)) {
 		buxton_debug("Set float call failed.\n");
 	}
 	if (!ret.status) {
@@ -345,7 +322,6 @@ void sbuxton_set_float(char *key, float value)
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 }
 
 float sbuxton_get_float(char *key)
@@ -355,14 +331,13 @@ float sbuxton_get_float(char *key)
 		errno = ENOTCONN;
 		return -1;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_FLOAT);
 	/* return value */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_FLOAT;
 	saved_errno = errno;
 	/* get value */
-	if (buxton_get_value(client, _key, _bg_cb, &ret, true)) {
+	if (_client_request(BUXTON_CONTROL_GET, _group, key, _layer,
+			    BUXTON_TYPE_FLOAT, NULL, _bg_cb, &ret)) {
 		buxton_debug("Get float call failed.\n");
 	}
 	if (!ret.status) {
@@ -370,7 +345,6 @@ float sbuxton_get_float(char *key)
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 	return ret.val.fval;
 }
 
@@ -382,14 +356,13 @@ void sbuxton_set_double(char *key, double value)
 		errno = ENOTCONN;
 		return;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_DOUBLE);
 	/* return value and status */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_DOUBLE;
 	ret.val.dval = value;
 	saved_errno = errno;
-	if (buxton_set_value(client, _key, &value, _bs_cb, &ret, true)) {
+	if (_client_request(BUXTON_CONTROL_SET, _group, key, _layer,
+			    BUXTON_TYPE_DOUBLE, &value, _bs_cb, &ret)) {
 		buxton_debug("Set double call failed.\n");
 	}
 	if (!ret.status) {
@@ -397,7 +370,6 @@ void sbuxton_set_double(char *key, double value)
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 }
 
 double sbuxton_get_double(char *key)
@@ -407,14 +379,13 @@ double sbuxton_get_double(char *key)
 		errno = ENOTCONN;
 		return -1;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_DOUBLE);
 	/* return value */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_DOUBLE;
 	saved_errno = errno;
 	/* get value */
-	if (buxton_get_value(client, _key, _bg_cb, &ret, true)) {
+	if (_client_request(BUXTON_CONTROL_GET, _group, key, _layer,
+			    BUXTON_TYPE_DOUBLE, NULL, _bg_cb, &ret)) {
 		buxton_debug("Get double call failed.\n");
 	}
 	if (!ret.status) {
@@ -422,7 +393,6 @@ double sbuxton_get_double(char *key)
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 	return ret.val.dval;
 }
 
@@ -434,14 +404,13 @@ void sbuxton_set_bool(char *key, bool value)
 		errno = ENOTCONN;
 		return;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_BOOLEAN);
 	/* return value and status */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_BOOLEAN;
 	ret.val.bval = value;
 	saved_errno = errno;
-	if (buxton_set_value(client, _key, &value, _bs_cb, &ret, true)) {
+	if (_client_request(BUXTON_CONTROL_SET, _group, key, _layer,
+			    BUXTON_TYPE_BOOLEAN, &value, _bs_cb, &ret)) {
 		buxton_debug("Set bool call failed.\n");
 	}
 	if (!ret.status) {
@@ -449,7 +418,6 @@ void sbuxton_set_bool(char *key, bool value)
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 }
 
 bool sbuxton_get_bool(char *key)
@@ -459,14 +427,13 @@ bool sbuxton_get_bool(char *key)
 		errno = ENOTCONN;
 		return false;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_BOOLEAN);
 	/* return value */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_BOOLEAN;
 	saved_errno = errno;
 	/* get value */
-	if (buxton_get_value(client, _key, _bg_cb, &ret, true)) {
+	if (_client_request(BUXTON_CONTROL_GET, _group, key, _layer,
+			    BUXTON_TYPE_BOOLEAN, NULL, _bg_cb, &ret)) {
 		buxton_debug("Get bool call failed.\n");
 	}
 	if (!ret.status) {
@@ -474,7 +441,6 @@ bool sbuxton_get_bool(char *key)
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 	return ret.val.bval;
 }
 
@@ -487,9 +453,9 @@ void sbuxton_remove_group(char *group_name, char *layer)
 		return;
 	}
 	saved_errno = errno;
-	BuxtonKey group = _buxton_group_create(group_name, layer);
-	int status;
-	if (buxton_remove_group(client, group, _rg_cb, &status, true)) {
+	int status = 0;
+	if (_client_request(BUXTON_CONTROL_REMOVE_GROUP, group_name, NULL,
+			    layer, BUXTON_TYPE_STRING, NULL, _rg_cb, &status)) {
 		buxton_debug("Remove group call failed.\n");
 	}
 	if (!status) {
@@ -497,7 +463,6 @@ void sbuxton_remove_group(char *group_name, char *layer)
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 }
 
 /*
@@ -20,20 +20,168 @@
 
 #include "buxton.h"
 #include "buxtonkey.h"
+#include "buxtonlabel.h"
 #include "configurator.h"
 #include "direct.h"
-#include "hashmap.h"
 #include "log.h"
 #include "smack.h"
 #include "util.h"
 
-static Hashmap *_smackrules = NULL;
+/* The access of a subject to one object */
+struct smack_access {
+	BuxtonLabelId object;
+	BuxtonKeyAccessType access;
+};
+
+/* The rules of one subject, sorted by object */
+struct smack_row {
+	struct smack_access *objects;
+	size_t n_objects;
+};
+
+/* A rule read from the load file, before it is compiled */
+struct smack_rule {
+	BuxtonLabelId subject;
+	BuxtonLabelId object;
+	BuxtonKeyAccessType access;
+	size_t line;
+};
+
+/* Rows of the loaded rules, indexed by subject label identifier */
+static struct smack_row *_smackrows = NULL;
+static size_t _n_smackrows = 0;
+/* The objects of all rows, in one block */
+static struct smack_access *_smackobjects = NULL;
 /* set to true unless Smack support is not detected by the daemon */
 static bool have_smack = true;
 static bool permissive;
 
 #define smack_check() do { if (!have_smack) { return true; } } while (0);
 
+/* Identifiers of the labels with builtin rules */
+static BuxtonLabelId label_star = BUXTON_LABEL_NONE;
+static BuxtonLabelId label_at;
+static BuxtonLabelId label_floor;
+static BuxtonLabelId label_hat;
+
+static BuxtonLabelId intern_label(const char *value)
+{
+	BuxtonString label;
+
+	label.value = (char *)value;
+	label.length = (uint32_t)strlen(value) + 1;
+
+	return buxton_label_intern(&label);
+}
+
+static void intern_builtin_labels(void)
+{
+	if (label_star != BUXTON_LABEL_NONE) {
+		return;
+	}
+
+	label_star = intern_label("*");
+	label_at = intern_label("@");
+	label_floor = intern_label("_");
+	label_hat = intern_label("^");
+}
+
+/* Orders rules by subject then object, the first read winning ties */
+static int compare_rules(const void *a, const void *b)
+{
+	const struct smack_rule *x = a;
+	const struct smack_rule *y = b;
+
+	if (x->subject != y->subject) {
+		return x->subject < y->subject ? -1 : 1;
+	}
+	if (x->object != y->object) {
+		return x->object < y->object ? -1 : 1;
+	}
+	if (x->line != y->line) {
+		return x->line < y->line ? -1 : 1;
+	}
+	return 0;
+}
+
+static void free_smack_rules(void)
+{
+	free(_smackrows);
+	free(_smackobjects);
+	_smackrows = NULL;
+	_smackobjects = NULL;
+	_n_smackrows = 0;
+}
+
+/*
+ * Replaces the loaded rules with a row per subject, so a check indexes
+ * the subject's row and searches it for the object
+ */
+static void compile_smack_rules(struct smack_rule *rules, size_t n_rules)
+{
+	size_t n_objects = 0;
+
+	free_smack_rules();
+	if (!n_rules) {
+		return;
+	}
+
+	qsort(rules, n_rules, sizeof(struct smack_rule), compare_rules);
+
+	_n_smackrows = rules[n_rules - 1].subject + 1;
+	_smackrows = calloc(_n_smackrows, sizeof(struct smack_row));
+	_smackobjects = calloc(n_rules, sizeof(struct smack_access));
+	if (!_smackrows || !_smackobjects) {
+		abort();
+	}
+
+	for (size_t i = 0; i < n_rules; i++) {
+		struct smack_row *row = &_smackrows[rules[i].subject];
+
+		/* A duplicate pair keeps its first rule */
+		if (i > 0 && rules[i].subject == rules[i - 1].subject &&
+		    rules[i].object == rules[i - 1].object) {
+			continue;
+		}
+		if (!row->objects) {
+			row->objects = &_smackobjects[n_objects];
+		}
+		row->objects[row->n_objects].object = rules[i].object;
+		row->objects[row->n_objects].access = rules[i].access;
+		row->n_objects++;
+		n_objects++;
+	}
+}
+
+/* Finds the access a subject was granted to an object by a rule */
+static BuxtonKeyAccessType find_smack_access(BuxtonLabelId subject,
+					     BuxtonLabelId object)
+{
+	struct smack_row *row;
+	size_t low = 0;
+	size_t high;
+
+	if (subject >= _n_smackrows) {
+		return ACCESS_NONE;
+	}
+
+	row = &_smackrows[subject];
+	high = row->n_objects;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+
+		if (row->objects[mid].object == object) {
+			return row->objects[mid].access;
+		}
+		if (row->objects[mid].object < object) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	return ACCESS_NONE;
+}
 
 bool buxton_smack_enabled(void)
 {
@@ -66,20 +214,10 @@ bool buxton_cache_smack_rules(void)
 	smack_check();
 
 	FILE *load_file = NULL;
-	char *rule_pair = NULL;
 	int ret = true;
-	bool have_rules = false;
 	struct stat buf;
 
-	if (_smackrules) {
-		hashmap_free(_smackrules);
-	}
-
-	_smackrules = hashmap_new(string_hash_func, string_compare_func);
-
-	if (!_smackrules) {
-		abort();
-	}
+	free_smack_rules();
 
 	//FIXME: should check for a proper mount point instead
 	if ((stat(SMACK_MOUNT_DIR, &buf) == -1) || !S_ISDIR(buf.st_mode)) {
@@ -105,10 +243,28 @@ bool buxton_cache_smack_rules(void)
 		}
 	}
 
+	ret = buxton_compile_smack_rules(load_file);
+
+end:
+	if (load_file) {
+		fclose(load_file);
+	}
+
+	return ret;
+}
+
+bool buxton_compile_smack_rules(FILE *load_file)
+{
+	_cleanup_free_ struct smack_rule *rules = NULL;
+	size_t rules_alloc = 0;
+	size_t n_rules = 0;
+	bool ret = true;
+
+	assert(load_file);
+
 	do {
-		int r;
 		int chars;
-		BuxtonKeyAccessType *accesstype;
+		struct smack_rule *rule;
 
 		char subject[SMACK_LABEL_LEN+1] = { 0, };
 		char object[SMACK_LABEL_LEN+1] = { 0, };
@@ -123,7 +279,7 @@ bool buxton_cache_smack_rules(void)
 			goto end;
 		}
 
-		if (!have_rules && chars == EOF && feof(load_file)) {
+		if (!n_rules && chars == EOF && feof(load_file)) {
 			buxton_debug("No loaded Smack rules found\n");
 			goto end;
 		}
@@ -134,36 +290,29 @@ bool buxton_cache_smack_rules(void)
 			goto end;
 		}
 
-		have_rules = true;
-
-		r = asprintf(&rule_pair, "%s %s", subject, object);
-		if (r == -1) {
-			abort();
-		}
-
-		accesstype = malloc0(sizeof(BuxtonKeyAccessType));
-		if (!accesstype) {
+		if (!greedy_realloc((void **)&rules, &rules_alloc,
+				    sizeof(struct smack_rule) * (n_rules + 1))) {
 			abort();
 		}
-
-		*accesstype = ACCESS_NONE;
+		rule = &rules[n_rules];
+		rule->subject = intern_label(subject);
+		rule->object = intern_label(object);
+		rule->access = ACCESS_NONE;
+		rule->line = n_rules++;
 
 		if (strchr(access, 'r')) {
-			*accesstype |= ACCESS_READ;
+			rule->access |= ACCESS_READ;
 		}
 
 		if (strchr(access, 'w')) {
-			*accesstype |= ACCESS_WRITE;
+			rule->access |= ACCESS_WRITE;
 		}
 
-		hashmap_put(_smackrules, rule_pair, accesstype);
-
 	} while (!feof(load_file));
 
 end:
-	if (load_file) {
-		fclose(load_file);
-	}
+	/* Rules read before an error still apply, as they always have */
+	compile_smack_rules(rules, n_rules);
 
 	return ret;
 }
@@ -172,79 +321,70 @@ bool buxton_check_smack_access(BuxtonString *subject, BuxtonString *object, Buxt
 {
 	smack_check();
 
-	_cleanup_free_ char *key = NULL;
-	int r;
-	BuxtonKeyAccessType *access;
-
 	assert(subject);
 	assert(object);
+
+	return buxton_check_smack_access_id(buxton_label_intern(subject),
+					    buxton_label_intern(object),
+					    request);
+}
+
+bool buxton_check_smack_access_id(BuxtonLabelId subject, BuxtonLabelId object, BuxtonKeyAccessType request)
+{
+	smack_check();
+
+	BuxtonKeyAccessType access;
+
+	assert(subject != BUXTON_LABEL_NONE);
+	assert(object != BUXTON_LABEL_NONE);
 	assert((request == ACCESS_READ) || (request == ACCESS_WRITE));
-	assert(_smackrules);
 
-	buxton_debug("Subject: %s\n", subject->value);
-	buxton_debug("Object: %s\n", object->value);
+	buxton_debug("Subject: %s\n", buxton_label_string(subject)->value);
+	buxton_debug("Object: %s\n", buxton_label_string(object)->value);
 
 	/* permissive mode */
 	if (permissive)
 		return true;
 
+	intern_builtin_labels();
+
 	/* check the builtin Smack rules first */
-	if (streq(subject->value, "*")) {
+	if (subject == label_star) {
 		return false;
 	}
 
-	if (streq(object->value, "@") || streq(subject->value, "@")) {
+	if (object == label_at || subject == label_at) {
 		return true;
 	}
 
-	if (streq(object->value, "*")) {
+	if (object == label_star) {
 		return true;
 	}
 
-	if (streq(subject->value, object->value)) {
+	if (subject == object) {
 		return true;
 	}
 
 	if (request == ACCESS_READ) {
-		if (streq(object->value, "_")) {
+		if (object == label_floor) {
 			return true;
 		}
-		if (streq(subject->value, "^")) {
+		if (subject == label_hat) {
 			return true;
 		}
 	}
 
 	/* finally, check the loaded rules */
-	r = asprintf(&key, "%s %s", subject->value, object->value);
-	if (r == -1) {
-		abort();
-	}
+	access = find_smack_access(subject, object);
 
-	buxton_debug("Key: %s\n", key);
-
-	access = hashmap_get(_smackrules, key);
-	if (!access) {
-		/* A null value is not an error, since clients may try to
-		 * read/write keys with labels that are not in the loaded
-		 * rule set. In this situation, access is simply denied,
-		 * because there are no further rules to consider.
-		 */
-		buxton_debug("Value of key '%s' is NULL\n", key);
-		return false;
-	}
-
-	/* After debugging, change this code to: */
-	/* return ((*access) & request); */
-	if (access) {
-		buxton_debug("Value: %x\n", *access);
-	}
+	buxton_debug("Value: %x\n", access);
 
-	if (request == ACCESS_READ && (*access) & request) {
+	if (request == ACCESS_READ && access & request) {
 		buxton_debug("Read access granted!\n");
 		return true;
 	}
 
-	if (request == ACCESS_WRITE && ((*access) & ACCESS_READ && (*access) & ACCESS_WRITE)) {
+	if (request == ACCESS_WRITE && (access & ACCESS_READ && access & ACCESS_WRITE)) {
 		buxton_debug("Write access granted!\n");
 		return true;
 	}
@@ -15,8 +15,11 @@
 	#include "config.h"
 #endif
 
+#include <stdio.h>
+
 #include "backend.h"
 #include "buxton.h"
+#include "buxtonlabel.h"
 
 /**
  * Maximum length for a Smack label
@@ -62,6 +65,17 @@ bool buxton_smack_enabled(void)
 bool buxton_cache_smack_rules(void)
 	__attribute__((warn_unused_result));
 
+/**
+ * Replace the cached Smack rules with rules in the load2 format
+ *
+ * Rules are compiled into a row of objects per subject label, so that
+ * checks need neither allocations nor string comparisons.
+ * @param load_file Stream to read the rules from
+ * @return a boolean value, indicating success of the operation
+ */
+bool buxton_compile_smack_rules(FILE *load_file)
+	__attribute__((warn_unused_result));
+
 /**
  * Check whether the smack access matches the buxton client access
  * @param subject Smack subject label
@@ -74,6 +88,18 @@ bool buxton_check_smack_access(BuxtonString *subject,
 			       BuxtonKeyAccessType request)
 	__attribute__((warn_unused_result));
 
+/**
+ * Check whether the smack access matches the buxton client access
+ * @param subject Identifier of the interned Smack subject label
+ * @param object Identifier of the interned Smack object label
+ * @param request The buxton access type being queried
+ * @return true if the smack access matches the given request, otherwise false
+ */
+bool buxton_check_smack_access_id(BuxtonLabelId subject,
+				  BuxtonLabelId object,
+				  BuxtonKeyAccessType request)
+	__attribute__((warn_unused_result));
+
 /**
  * Set up inotify to track Smack rule file for changes
  * @return an exit code for the operation
@@ -35,6 +35,27 @@
  */
 static BuxtonLayer *buxton_layer_new(ConfigLayer *conf_layer);
 
+/**
+ * Order layers the way a get without a layer resolves them
+ *
+ * System layers shadow user layers, and within a type the higher
+ * priority wins.
+ */
+static int layer_order_compare(const void *a, const void *b)
+{
+	const BuxtonLayer *x = *(BuxtonLayer * const *)a;
+	const BuxtonLayer *y = *(BuxtonLayer * const *)b;
+
+	if (x->type != y->type) {
+		return x->type == LAYER_SYSTEM ? -1 : 1;
+	}
+	if (x->priority != y->priority) {
+		return x->priority > y->priority ? -1 : 1;
+	}
+
+	return strcmp(x->name.value, y->name.value);
+}
+
 /* Load layer configurations from disk */
 void buxton_init_layers(BuxtonConfig *config)
 {
@@ -48,6 +69,15 @@ void buxton_init_layers(BuxtonConfig *config)
 	if (!layers) {
 		abort();
 	}
+	config->nlayers = 0;
+	config->layer_order = NULL;
+	if (nlayers > 0) {
+		config->layer_order = malloc0(sizeof(BuxtonLayer *) *
+					      (size_t)nlayers);
+		if (!config->layer_order) {
+			abort();
+		}
+	}
 
 	for (int n = 0; n < nlayers; n++) {
 		BuxtonLayer *layer;
@@ -61,8 +91,12 @@ void buxton_init_layers(BuxtonConfig *config)
 		if (r != 1) {
 			abort();
 		}
+		config->layer_order[config->nlayers++] = layer;
 	}
 
+	qsort(config->layer_order, config->nlayers, sizeof(BuxtonLayer *),
+	      layer_order_compare);
+
 	config->layers = layers;
 	free(config_layers);
 }
@@ -104,6 +138,10 @@ static BuxtonLayer *buxton_layer_new(ConfigLayer *conf_layer)
 		out->backend = BACKEND_GDBM;
 	} else if (strcmp(conf_layer->backend, "memory") == 0) {
 		out->backend = BACKEND_MEMORY;
+	} else if (strcmp(conf_layer->backend, "lmdb") == 0) {
+		out->backend = BACKEND_LMDB;
+	} else if (strcmp(conf_layer->backend, "snapshot") == 0) {
+		out->backend = BACKEND_SNAPSHOT;
 	} else {
 		buxton_log("Layer %s has unknown database: %s\n", conf_layer->name, conf_layer->backend);
 		goto fail;
@@ -116,7 +154,9 @@ static BuxtonLayer *buxton_layer_new(ConfigLayer *conf_layer)
 		}
 	}
 
-	out->readonly = is_read_only(conf_layer);
+	/* Snapshots are only written by buxtonctl compile-snapshot */
+	out->readonly = is_read_only(conf_layer) ||
+		out->backend == BACKEND_SNAPSHOT;
 	out->priority = conf_layer->priority;
 	return out;
 fail:
@@ -147,6 +187,10 @@ static void init_backend(BuxtonConfig *config,
 		name = "gdbm";
 	} else if (layer->backend == BACKEND_MEMORY) {
 		name = "memory";
+	} else if (layer->backend == BACKEND_LMDB) {
+		name = "lmdb";
+	} else if (layer->backend == BACKEND_SNAPSHOT) {
+		name = "snapshot";
 	} else {
 		buxton_log("Invalid backend type for layer: %s\n", layer->name);
 		abort();
@@ -253,6 +297,8 @@ void destroy_backend(BuxtonBackend *backend)
 	backend->list_keys = NULL;
 	backend->list_names = NULL;
 	backend->unset_value = NULL;
+	backend->begin = NULL;
+	backend->commit = NULL;
 	backend->destroy();
 	dlclose(backend->module);
 	free(backend);
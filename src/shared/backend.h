@@ -35,6 +35,8 @@ typedef enum BuxtonBackendType {
 	BACKEND_UNSET = 0, /**<No backend set */
 	BACKEND_GDBM, /**<GDBM backend */
 	BACKEND_MEMORY, /**<Memory backend */
+	BACKEND_LMDB, /**<LMDB backend */
+	BACKEND_SNAPSHOT, /**<Read-only compiled snapshot */
 	BACKEND_MAXTYPES
 } BuxtonBackendType;
 
@@ -62,6 +64,7 @@ typedef struct BuxtonLayer {
 	int priority; /**<Priority of this layer */
 	char *description; /**<Description of this layer */
 	bool readonly; /**<Layer is readonly or not */
+	Hashmap *groups; /**<Labels of known groups, by group name */
 } BuxtonLayer;
 
 /**
@@ -101,6 +104,28 @@ typedef bool (*module_list_names_func) (BuxtonLayer *layer, BuxtonString *group,
  */
 typedef void *(*module_db_init_func) (BuxtonLayer *layer);
 
+/**
+ * Backend begin function, starting a transaction
+ *
+ * Every set and unset on the layer until the next commit belongs to the
+ * transaction, and is only applied by that commit.
+ * @param layer The layer the transaction changes
+ * @return 0 on success, or an errno value
+ */
+typedef int (*module_begin_func) (BuxtonLayer *layer);
+
+/**
+ * Backend commit function, ending a transaction
+ *
+ * Backends without a begin function apply changes as they are made, and
+ * only flush them here.
+ * @param layer The layer the transaction changed
+ * @param apply False to discard the changes of a transaction started by
+ * the begin function
+ * @return 0 on success, or an errno value
+ */
+typedef int (*module_commit_func) (BuxtonLayer *layer, bool apply);
+
 /**
  * Destroy (or shutdown) a backend module
  */
@@ -120,6 +145,8 @@ typedef struct BuxtonBackend {
 	module_list_names_func list_names; /**<List names function */
 	module_value_func unset_value; /**<Unset value function */
 	module_db_init_func create_db; /**<DB file creation function */
+	module_begin_func begin; /**<Transaction begin function, optional */
+	module_commit_func commit; /**<Transaction commit function, required with begin */
 } BuxtonBackend;
 
 /**
@@ -129,6 +156,8 @@ typedef struct BuxtonConfig {
 	Hashmap *databases; /**<Database mapping */
 	Hashmap *layers; /**<Global layer configuration */
 	Hashmap *backends; /**<Backend mapping */
+	BuxtonLayer **layer_order; /**<Layers in lookup order, best first */
+	size_t nlayers; /**<Number of layers in layer_order */
 } BuxtonConfig;
 
 /**
@@ -0,0 +1,53 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2014 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <stddef.h>
+
+#include "buxton.h"
+#include "buxtondata.h"
+#include "buxtonkey.h"
+
+/**
+ * An operation queued in a batch
+ */
+typedef struct BuxtonBatchOp {
+	BuxtonControlMessage type; /**<Type of the operation */
+	_BuxtonKey key; /**<Key the operation is about */
+	BuxtonData value; /**<Value to set, for set operations */
+} BuxtonBatchOp;
+
+/**
+ * Operations sent to Buxton in a single request
+ */
+typedef struct BuxtonBatch {
+	BuxtonBatchOp *ops; /**<Queued operations, in order */
+	size_t len; /**<Number of queued operations */
+	size_t allocated; /**<Allocated size of ops in bytes */
+} _BuxtonBatch;
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
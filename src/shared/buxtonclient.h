@@ -21,6 +21,9 @@
 #endif
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
 
 /**
  * Used to communicate with Buxton
@@ -30,6 +33,13 @@ typedef struct BuxtonClient {
 	bool direct; /**<Only used for direction connections */
 	pid_t pid; /**<Process ID, used within libbuxton */
 	uid_t uid; /**<User ID of currently using user */
+	uint8_t *send_buf; /**<Buffer requests are serialized in */
+	size_t send_alloc; /**<Allocated size of the send buffer */
+	bool pipelined; /**<Queue requests until flushed */
+	struct iovec *queue; /**<Requests queued in pipelined mode */
+	size_t queue_len; /**<Number of queued requests */
+	size_t queue_alloc; /**<Allocated size of queue in bytes */
+	size_t outstanding; /**<Number of requests waiting for a reply */
 } _BuxtonClient;
 
 /*
@@ -0,0 +1,122 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2014 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "buxtonlabel.h"
+#include "hashmap.h"
+#include "util.h"
+
+/* Identifiers by label content */
+static Hashmap *_by_value = NULL;
+/* Identifiers by address of the interned BuxtonString */
+static Hashmap *_by_string = NULL;
+/* Interned labels, by identifier */
+static BuxtonString **_labels = NULL;
+static size_t _labels_alloc = 0;
+static BuxtonLabelId _n_labels = 0;
+
+BuxtonLabelId buxton_label_intern(BuxtonString *label)
+{
+	BuxtonString *copy;
+	size_t size;
+	void *id;
+
+	if (!label || !label->value) {
+		return BUXTON_LABEL_NONE;
+	}
+
+	if (!_by_value) {
+		_by_value = hashmap_new(string_hash_func, string_compare_func);
+		_by_string = hashmap_new(trivial_hash_func,
+					 trivial_compare_func);
+		if (!_by_value || !_by_string) {
+			abort();
+		}
+	}
+
+	/* Labels passed around by the daemon are mostly interned already */
+	id = hashmap_get(_by_string, label);
+	if (id) {
+		return PTR_TO_UINT(id);
+	}
+	id = hashmap_get(_by_value, label->value);
+	if (id) {
+		return PTR_TO_UINT(id);
+	}
+
+	if (!greedy_realloc((void **)&_labels, &_labels_alloc,
+			    sizeof(BuxtonString *) * (_n_labels + 2))) {
+		abort();
+	}
+
+	/* The string and its content in one block */
+	size = strlen(label->value) + 1;
+	copy = malloc(sizeof(BuxtonString) + size);
+	if (!copy) {
+		abort();
+	}
+	copy->value = (char *)(copy + 1);
+	copy->length = (uint32_t)size;
+	memcpy(copy->value, label->value, size);
+
+	/* Identifiers start at 1, leaving BUXTON_LABEL_NONE */
+	_labels[++_n_labels] = copy;
+	if (hashmap_put(_by_value, copy->value, UINT_TO_PTR(_n_labels)) < 0 ||
+	    hashmap_put(_by_string, copy, UINT_TO_PTR(_n_labels)) < 0) {
+		abort();
+	}
+
+	return _n_labels;
+}
+
+BuxtonString *buxton_label_string(BuxtonLabelId id)
+{
+	if (id == BUXTON_LABEL_NONE || id > _n_labels) {
+		return NULL;
+	}
+
+	return _labels[id];
+}
+
+void buxton_label_free_all(void)
+{
+	for (BuxtonLabelId id = 1; id <= _n_labels; id++) {
+		free(_labels[id]);
+	}
+	free(_labels);
+	_labels = NULL;
+	_labels_alloc = 0;
+	_n_labels = 0;
+
+	hashmap_free(_by_value);
+	hashmap_free(_by_string);
+	_by_value = NULL;
+	_by_string = NULL;
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
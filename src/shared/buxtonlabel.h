@@ -0,0 +1,78 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2014 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+/**
+ * \file buxtonlabel.h Internal header
+ * This file is used internally by buxton to share Smack labels
+ *
+ * Every distinct label is stored once, until buxton_label_free_all, and
+ * known by a small integer. Labels compare equal exactly when their
+ * identifiers do.
+ */
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <stdint.h>
+
+#include "buxtonstring.h"
+
+/**
+ * Identifier of an interned label
+ */
+typedef uint32_t BuxtonLabelId;
+
+/**
+ * Identifier standing for no label at all
+ */
+#define BUXTON_LABEL_NONE ((BuxtonLabelId)0)
+
+/**
+ * Get the identifier of a label, interning it if it is new
+ *
+ * Interned strings, as returned by buxton_label_string, are recognized
+ * without hashing their content.
+ * @param label The label, may be NULL
+ * @return the label's identifier, or BUXTON_LABEL_NONE for a NULL label
+ */
+BuxtonLabelId buxton_label_intern(BuxtonString *label)
+	__attribute__((warn_unused_result));
+
+/**
+ * Get the shared copy of an interned label
+ * @param id Identifier of the label
+ * @return the interned label, valid until buxton_label_free_all, or
+ * NULL for BUXTON_LABEL_NONE
+ */
+BuxtonString *buxton_label_string(BuxtonLabelId id)
+	__attribute__((warn_unused_result));
+
+/**
+ * Free every interned label
+ * Identifiers and interned strings handed out before are invalid
+ * afterwards, so this is only meant for shutting down.
+ */
+void buxton_label_free_all(void);
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -9,17 +9,63 @@
  * of the license, or (at your option) any later version.
  */
 
+#include <errno.h>
 #include <inttypes.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "buxton.h"
+#include "buxtonclient.h"
+#include "buxtonkey.h"
 #include "buxtonsimple-internals.h"
+#include "hashmap.h"
 #include "log.h"
 
 BuxtonClient client = NULL;
 
+/* Keys already created on the open connection */
+static Hashmap *key_cache = NULL;
+
+static unsigned key_hash_func(const void *p)
+{
+	const _BuxtonKey *k = p;
+	unsigned hash = (unsigned)k->type;
+
+	hash = hash * 31 + string_hash_func(k->group.value);
+	hash = hash * 31 + string_hash_func(k->layer.value);
+	if (k->name.value) {
+		hash = hash * 31 + string_hash_func(k->name.value);
+	}
+
+	return hash;
+}
+
+static int key_compare_func(const void *a, const void *b)
+{
+	const _BuxtonKey *x = a;
+	const _BuxtonKey *y = b;
+	int r;
+
+	if (x->type != y->type) {
+		return x->type < y->type ? -1 : 1;
+	}
+	r = strcmp(x->group.value, y->group.value);
+	if (r) {
+		return r;
+	}
+	r = strcmp(x->layer.value, y->layer.value);
+	if (r) {
+		return r;
+	}
+	if (!x->name.value || !y->name.value) {
+		return (x->name.value != NULL) - (y->name.value != NULL);
+	}
+
+	return strcmp(x->name.value, y->name.value);
+}
+
 /* Make sure client connection is open */
 int _client_connection(void)
 {
@@ -38,6 +84,17 @@ int _client_connection(void)
 /* Close an open client connection */
 void _client_disconnect(void)
 {
+	BuxtonKey key;
+
+	/* Cached keys belong to this connection */
+	if (key_cache) {
+		while ((key = hashmap_steal_first(key_cache))) {
+			buxton_key_free(key);
+		}
+		hashmap_free(key_cache);
+		key_cache = NULL;
+	}
+
 	/* Only attempt to close the client if it != NULL */
 	if (client) {
 		/* Close the connection */
@@ -47,6 +104,118 @@ void _client_disconnect(void)
 	}
 }
 
+/* Release the connection when the library is unloaded */
+__attribute__ ((destructor)) static void client_cleanup(void)
+{
+	_client_disconnect();
+}
+
+/* Look up or create a key for the open connection */
+BuxtonKey _client_key(char *group, char *name, char *layer,
+		      BuxtonDataType type)
+{
+	_BuxtonKey probe;
+	BuxtonKey key;
+
+	if (!group || !layer) {
+		return NULL;
+	}
+
+	if (!key_cache) {
+		key_cache = hashmap_new(key_hash_func, key_compare_func);
+		if (!key_cache) {
+			abort();
+		}
+	}
+
+	probe.group.value = group;
+	probe.name.value = name;
+	probe.layer.value = layer;
+	probe.type = type;
+	key = hashmap_get(key_cache, &probe);
+	if (key) {
+		return key;
+	}
+
+	key = buxton_key_create(group, name, layer, type);
+	if (!key) {
+		return NULL;
+	}
+	if (hashmap_put(key_cache, key, key) < 0) {
+		abort();
+	}
+
+	return key;
+}
+
+/* Whether the daemon closed the open connection */
+static bool _client_hung_up(void)
+{
+	struct pollfd pfd;
+
+	pfd.fd = ((_BuxtonClient *)client)->fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, 0) < 0) {
+		return false;
+	}
+
+	return (pfd.revents & (POLLHUP | POLLERR)) != 0;
+}
+
+/* Send a request, reconnecting once if the connection was lost */
+int _client_request(BuxtonControlMessage msg, char *group, char *name,
+		    char *layer, BuxtonDataType type, void *value,
+		    BuxtonCallback callback, void *data)
+{
+	BuxtonKey key;
+	int ret = -1;
+	int attempt;
+
+	for (attempt = 0; attempt < 2; attempt++) {
+		if (!_client_connection()) {
+			return -1;
+		}
+		key = _client_key(group, name, layer, type);
+		if (!key) {
+			return -1;
+		}
+
+		switch (msg) {
+		case BUXTON_CONTROL_SET:
+			ret = buxton_set_value(client, key, value, callback,
+					       data, true);
+			break;
+		case BUXTON_CONTROL_GET:
+			ret = buxton_get_value(client, key, callback, data,
+					       true);
+			break;
+		case BUXTON_CONTROL_CREATE_GROUP:
+			ret = buxton_create_group(client, key, callback, data,
+						  true);
+			break;
+		case BUXTON_CONTROL_REMOVE_GROUP:
+			ret = buxton_remove_group(client, key, callback, data,
+						  true);
+			break;
+		default:
+			return EINVAL;
+		}
+
+		/*
+		 * A request that timed out may still be applied, so only
+		 * retry when the daemon is gone. Other errors are final.
+		 */
+		if (ret != -1 || !_client_hung_up()) {
+			break;
+		}
+		buxton_debug("Request failed, reconnecting.\n");
+		_client_disconnect();
+	}
+
+	return ret;
+}
+
 /* Create group callback */
 void _cg_cb(BuxtonResponse response, void *data)
 {
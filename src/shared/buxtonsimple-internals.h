@@ -93,10 +93,41 @@ extern BuxtonClient client;
 int _client_connection(void);
 
 /**
- * Checks for client connections and closes it if client connection is open
+ * Checks for client connections and closes it if client connection is open,
+ * dropping every key cached for it
  */
 void _client_disconnect(void);
 
+/**
+ * Returns the key cached for the connection, creating it on first use
+ * @param group A group name
+ * @param name A key name, or NULL for the group itself
+ * @param layer A layer name
+ * @param type The BuxtonDataType of the key
+ * @return A BuxtonKey owned by the cache, or NULL on failure
+ */
+BuxtonKey _client_key(char *group, char *name, char *layer,
+		      BuxtonDataType type);
+
+/**
+ * Runs a synchronous request on the persistent connection, reconnecting
+ * once if the daemon closed the connection. A request that timed out
+ * is not sent again, as the daemon may still apply it.
+ * @param msg One of BUXTON_CONTROL_SET, BUXTON_CONTROL_GET,
+ *            BUXTON_CONTROL_CREATE_GROUP or BUXTON_CONTROL_REMOVE_GROUP
+ * @param group A group name
+ * @param name A key name, or NULL for group requests
+ * @param layer A layer name
+ * @param type The BuxtonDataType of the key
+ * @param value The value to set (BUXTON_CONTROL_SET only)
+ * @param callback A callback function to handle the daemon reply
+ * @param data User data passed to callback
+ * @return 0 on success, a non-zero value otherwise
+ */
+int _client_request(BuxtonControlMessage msg, char *group, char *name,
+		    char *layer, BuxtonDataType type, void *value,
+		    BuxtonCallback callback, void *data);
+
 /**
  * Create group callback
  * @param response BuxtonResponse
@@ -0,0 +1,217 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2014 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buxtonskiplist.h"
+#include "util.h"
+
+/* Enough levels for 4^16 items at the 1/4 promotion rate */
+#define SKIPLIST_MAX_LEVEL 16
+
+struct BuxtonSkipList {
+	buxton_compare_func compare; /**<Ordering of the items */
+	uint32_t random; /**<State of the level generator */
+	unsigned int level; /**<Number of levels in use */
+	size_t size; /**<Number of items */
+	BuxtonSkipNode *head[SKIPLIST_MAX_LEVEL]; /**<First node of each level */
+};
+
+/* Pick the level of a new node, each level a quarter as likely */
+static unsigned int random_level(BuxtonSkipList *list)
+{
+	unsigned int level = 1;
+	uint32_t r;
+
+	/* xorshift32, which needs no seeding beyond a non-zero state */
+	r = list->random;
+	r ^= r << 13;
+	r ^= r >> 17;
+	r ^= r << 5;
+	list->random = r;
+
+	while (level < SKIPLIST_MAX_LEVEL && (r & 3) == 0) {
+		level++;
+		r >>= 2;
+	}
+
+	return level;
+}
+
+/**
+ * Find, on every level, the last link before the first item not sorting
+ * before data
+ * @param list A valid skip list
+ * @param data Item to look for
+ * @param update Set to the link to follow on each level
+ * @return the first node not sorting before data, or NULL
+ */
+static BuxtonSkipNode *find(BuxtonSkipList *list, const void *data,
+			    BuxtonSkipNode ***update)
+{
+	BuxtonSkipNode **links = list->head;
+	unsigned int i = list->level;
+
+	while (i-- > 0) {
+		while (links[i] && list->compare(links[i]->data, data) < 0) {
+			links = links[i]->next;
+		}
+		update[i] = links;
+	}
+
+	return list->level ? links[0] : NULL;
+}
+
+BuxtonSkipList *buxton_skiplist_new(buxton_compare_func compare)
+{
+	BuxtonSkipList *list;
+
+	assert(compare);
+
+	list = calloc(1, sizeof(BuxtonSkipList));
+	if (!list) {
+		abort();
+	}
+	list->compare = compare;
+	list->random = 2463534242U;
+
+	return list;
+}
+
+void buxton_skiplist_free(BuxtonSkipList **list,
+			  buxton_free_func free_method)
+{
+	BuxtonSkipNode *node, *next;
+
+	if (!list || !*list) {
+		return;
+	}
+
+	for (node = (*list)->head[0]; node; node = next) {
+		next = node->next[0];
+		if (free_method) {
+			free_method(node->data);
+		}
+		free(node);
+	}
+	free(*list);
+	*list = NULL;
+}
+
+bool buxton_skiplist_insert(BuxtonSkipList *list, void *data)
+{
+	BuxtonSkipNode **update[SKIPLIST_MAX_LEVEL];
+	BuxtonSkipNode *node;
+	unsigned int level;
+
+	assert(list);
+
+	node = find(list, data, update);
+	if (node && list->compare(node->data, data) == 0) {
+		return false;
+	}
+
+	level = random_level(list);
+	while (list->level < level) {
+		update[list->level++] = list->head;
+	}
+
+	node = malloc(sizeof(BuxtonSkipNode) +
+		      sizeof(BuxtonSkipNode *) * level);
+	if (!node) {
+		abort();
+	}
+	node->data = data;
+	for (unsigned int i = 0; i < level; i++) {
+		node->next[i] = update[i][i];
+		update[i][i] = node;
+	}
+	list->size++;
+
+	return true;
+}
+
+void *buxton_skiplist_get(BuxtonSkipList *list, const void *data)
+{
+	BuxtonSkipNode **update[SKIPLIST_MAX_LEVEL];
+	BuxtonSkipNode *node;
+
+	assert(list);
+
+	node = find(list, data, update);
+	if (!node || list->compare(node->data, data) != 0) {
+		return NULL;
+	}
+
+	return node->data;
+}
+
+void *buxton_skiplist_remove(BuxtonSkipList *list, const void *data)
+{
+	BuxtonSkipNode **update[SKIPLIST_MAX_LEVEL];
+	BuxtonSkipNode *node;
+	void *ret;
+
+	assert(list);
+
+	node = find(list, data, update);
+	if (!node || list->compare(node->data, data) != 0) {
+		return NULL;
+	}
+
+	for (unsigned int i = 0; i < list->level && update[i][i] == node; i++) {
+		update[i][i] = node->next[i];
+	}
+	while (list->level > 0 && !list->head[list->level - 1]) {
+		list->level--;
+	}
+
+	ret = node->data;
+	free(node);
+	list->size--;
+
+	return ret;
+}
+
+BuxtonSkipNode *buxton_skiplist_seek(BuxtonSkipList *list, const void *data)
+{
+	BuxtonSkipNode **update[SKIPLIST_MAX_LEVEL];
+
+	assert(list);
+
+	if (!data) {
+		return list->head[0];
+	}
+
+	return find(list, data, update);
+}
+
+size_t buxton_skiplist_size(BuxtonSkipList *list)
+{
+	assert(list);
+
+	return list->size;
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
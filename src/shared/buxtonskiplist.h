@@ -0,0 +1,120 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2014 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "buxtonarray.h"
+
+/**
+ * Ordering of two items of a skip list, as with strcmp
+ * @param a First item
+ * @param b Second item
+ * @return negative, zero or positive as a sorts before, with or after b
+ */
+typedef int (*buxton_compare_func) (const void *a, const void *b);
+
+/**
+ * A node of a skip list
+ */
+typedef struct BuxtonSkipNode {
+	void *data; /**<Item stored in this node */
+	struct BuxtonSkipNode *next[]; /**<Next node on each level */
+} BuxtonSkipNode;
+
+/**
+ * A sorted set, kept as a skip list
+ *
+ * Lookups, inserts and removals take O(log n), and iterating from any
+ * point visits the items in order.
+ */
+typedef struct BuxtonSkipList BuxtonSkipList;
+
+#define BUXTON_SKIPLIST_FOREACH(node, start)				\
+	for ((node) = (start); (node) != NULL; (node) = (node)->next[0])
+
+/**
+ * Create a new, empty skip list
+ * @param compare Function ordering the items
+ * @return a newly allocated skip list
+ */
+BuxtonSkipList *buxton_skiplist_new(buxton_compare_func compare)
+	__attribute__((warn_unused_result));
+
+/**
+ * Free a skip list, and optionally its items
+ * @param list Pointer to a skip list, set to NULL
+ * @param free_method Function to call on every item, or NULL to leave them
+ */
+void buxton_skiplist_free(BuxtonSkipList **list,
+			  buxton_free_func free_method);
+
+/**
+ * Add an item to a skip list
+ * @param list A valid skip list
+ * @param data Item to add
+ * @return a boolean value, false if an equal item is already stored
+ */
+bool buxton_skiplist_insert(BuxtonSkipList *list, void *data);
+
+/**
+ * Find the stored item equal to the given one
+ * @param list A valid skip list
+ * @param data Item to look for
+ * @return the stored item, or NULL
+ */
+void *buxton_skiplist_get(BuxtonSkipList *list, const void *data)
+	__attribute__((warn_unused_result));
+
+/**
+ * Remove the stored item equal to the given one
+ * @param list A valid skip list
+ * @param data Item to look for
+ * @return the removed item, or NULL if there was none
+ */
+void *buxton_skiplist_remove(BuxtonSkipList *list, const void *data);
+
+/**
+ * Find the first node whose item sorts at or after the given one
+ * @param list A valid skip list
+ * @param data Item to look for, or NULL for the first node
+ * @return the node, or NULL if every item sorts before data
+ */
+BuxtonSkipNode *buxton_skiplist_seek(BuxtonSkipList *list, const void *data)
+	__attribute__((warn_unused_result));
+
+/**
+ * Get the number of items of a skip list
+ * @param list A valid skip list
+ * @return the number of items
+ */
+size_t buxton_skiplist_size(BuxtonSkipList *list)
+	__attribute__((warn_unused_result));
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -14,9 +14,11 @@
 #endif
 
 #include <assert.h>
+#include <errno.h>
 #include <iniparser.h>
 #include <linux/limits.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,6 +31,16 @@
  */
 #define CONFIG_SECTION "Configuration"
 
+/**
+ * Default limit in bytes of output queued for a single client
+ */
+#define DEFAULT_MAX_CLIENT_BUFFER "1048576"
+
+/**
+ * Default number of notifications sent to a client each second, unlimited
+ */
+#define DEFAULT_NOTIFY_BUDGET "0"
+
 #ifndef HAVE_SECURE_GETENV
 #  ifdef HAVE___SECURE_GETENV
 #    define secure_getenv __secure_getenv
@@ -63,7 +75,9 @@ static const char *KS[CONFIG_MAX] = {
 	"BUXTON_DB_PATH",
 	"BUXTON_SMACK_LOAD_FILE",
 	"BUXTON_BUXTON_SOCKET",
-	"BUXTON_SMACK_PERMISSIVE"
+	"BUXTON_SMACK_PERMISSIVE",
+	"BUXTON_MAX_CLIENT_BUFFER",
+	"BUXTON_NOTIFY_BUDGET"
 };
 
 /**
@@ -77,7 +91,9 @@ static const char *config_keys[CONFIG_MAX] = {
 	"DatabasePath",
 	"SmackLoadFile",
 	"SocketPath",
-	"SmackPermissive"
+	"SmackPermissive",
+	"MaxClientBuffer",
+	"NotifyBudget"
 };
 
 static const char *COMPILE_DEFAULT[CONFIG_MAX] = {
@@ -87,7 +103,9 @@ static const char *COMPILE_DEFAULT[CONFIG_MAX] = {
 	_DB_PATH,
 	_SMACK_LOAD_FILE,
 	_BUXTON_SOCKET,
-	_SMACK_PERMISSIVE
+	_SMACK_PERMISSIVE,
+	DEFAULT_MAX_CLIENT_BUFFER,
+	DEFAULT_NOTIFY_BUDGET
 };
 
 /**
@@ -291,6 +309,42 @@ const char* buxton_socket(void)
 	return (const char*)conf.keys[CONFIG_BUXTON_SOCKET];
 }
 
+size_t buxton_max_client_buffer(void)
+{
+	char *end;
+	unsigned long long size;
+
+	initialize();
+	errno = 0;
+	size = strtoull(conf.keys[CONFIG_MAX_CLIENT_BUFFER], &end, 10);
+	if (errno || end == conf.keys[CONFIG_MAX_CLIENT_BUFFER] || *end ||
+	    size == 0 || size > SIZE_MAX) {
+		buxton_log("Invalid client buffer size '%s', using default\n",
+			   conf.keys[CONFIG_MAX_CLIENT_BUFFER]);
+		size = strtoull(DEFAULT_MAX_CLIENT_BUFFER, NULL, 10);
+	}
+
+	return (size_t)size;
+}
+
+uint32_t buxton_notify_budget(void)
+{
+	char *end;
+	unsigned long long budget;
+
+	initialize();
+	errno = 0;
+	budget = strtoull(conf.keys[CONFIG_NOTIFY_BUDGET], &end, 10);
+	if (errno || end == conf.keys[CONFIG_NOTIFY_BUDGET] || *end ||
+	    budget > UINT32_MAX) {
+		buxton_log("Invalid notification budget '%s', using default\n",
+			   conf.keys[CONFIG_NOTIFY_BUDGET]);
+		budget = strtoull(DEFAULT_NOTIFY_BUDGET, NULL, 10);
+	}
+
+	return (uint32_t)budget;
+}
+
 int buxton_key_get_layers(ConfigLayer **layers)
 {
 	ConfigLayer *_layers;
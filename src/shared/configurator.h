@@ -20,6 +20,9 @@
 	#include "config.h"
 #endif
 
+#include <stddef.h>
+#include <stdint.h>
+
 typedef enum ConfigKey {
 	CONFIG_MIN = 0,
 	CONFIG_CONF_FILE,
@@ -28,6 +31,8 @@ typedef enum ConfigKey {
 	CONFIG_SMACK_LOAD_FILE,
 	CONFIG_BUXTON_SOCKET,
 	CONFIG_SMACK_PERMISSIVE,
+	CONFIG_MAX_CLIENT_BUFFER,
+	CONFIG_NOTIFY_BUDGET,
 	CONFIG_MAX
 } ConfigKey;
 
@@ -117,6 +122,26 @@ const char *buxton_smack_permissive(void)
 const char *buxton_socket(void)
 	__attribute__((warn_unused_result));
 
+/**
+ * @internal
+ * @brief Get the limit of output buxtond queues for a single client
+ *
+ * @return the number of bytes that may be pending for a client before
+ * buxtond stops queueing data for it
+ */
+size_t buxton_max_client_buffer(void)
+	__attribute__((warn_unused_result));
+
+/**
+ * @internal
+ * @brief Get the number of notifications buxtond sends a client each second
+ *
+ * @return the number of key notifications sent to a client in a second
+ * before further changes are held back and coalesced, or 0 for no limit
+ */
+uint32_t buxton_notify_budget(void)
+	__attribute__((warn_unused_result));
+
 /**
  * @internal
  * @brief Get an array of ConfigLayers from the conf file
@@ -24,6 +24,119 @@
 
 #define BUXTON_ROOT_CHECK_ENV "BUXTON_ROOT_CHECK"
 
+/**
+ * A group known to exist in a layer
+ */
+struct group_entry {
+	char *name; /**<Name of the group, key in BuxtonLayer.groups */
+	BuxtonLabelId label; /**<Interned label of the group */
+	uid_t uid; /**<Owner of the database, for user layers */
+};
+
+static void free_group_entry(struct group_entry *e)
+{
+	if (!e) {
+		return;
+	}
+	free(e->name);
+	free(e);
+}
+
+/**
+ * Drop a group from its layer's cache, after it was changed
+ * @param control An initialized control structure
+ * @param key A key of the group
+ */
+static void forget_group(BuxtonControl *control, _BuxtonKey *key)
+{
+	BuxtonLayer *layer;
+
+	layer = hashmap_get(control->config.layers, key->layer.value);
+	if (!layer || !layer->groups) {
+		return;
+	}
+
+	free_group_entry(hashmap_remove(layer->groups, key->group.value));
+}
+
+/**
+ * Find the label of a key's group, which also proves the group exists
+ *
+ * Only groups that exist are cached, so a client asking for missing groups
+ * can't make the cache grow.
+ * @param control An initialized control structure
+ * @param key A key with a group and a layer
+ * @param label Set to the identifier of the group's interned label
+ * @return 0 on success, or an errno value
+ */
+static int get_group_label(BuxtonControl *control, _BuxtonKey *key,
+			   BuxtonLabelId *label)
+{
+	BuxtonLayer *layer;
+	struct group_entry *e;
+	_BuxtonKey group;
+	BuxtonData g;
+	BuxtonString glabel;
+	int ret;
+
+	layer = hashmap_get(control->config.layers, key->layer.value);
+	if (!layer) {
+		return EINVAL;
+	}
+
+	if (!layer->groups) {
+		layer->groups = hashmap_new(string_hash_func,
+					    string_compare_func);
+		if (!layer->groups) {
+			abort();
+		}
+	}
+
+	/* User layers have a database per user */
+	e = hashmap_get(layer->groups, key->group.value);
+	if (e && (layer->type != LAYER_USER ||
+		  e->uid == control->client.uid)) {
+		*label = e->label;
+		return 0;
+	}
+
+	memzero(&g, sizeof(BuxtonData));
+	memzero(&glabel, sizeof(BuxtonString));
+	group.group = key->group;
+	group.name = (BuxtonString){ NULL, 0 };
+	group.layer = key->layer;
+	group.type = BUXTON_TYPE_STRING;
+	ret = buxton_direct_get_value_for_layer(control, &group, &g, &glabel,
+						BUXTON_LABEL_NONE);
+	if (g.type == BUXTON_TYPE_STRING) {
+		free(g.store.d_string.value);
+	}
+	if (ret) {
+		free(glabel.value);
+		return ret;
+	}
+
+	if (!e) {
+		e = malloc0(sizeof(struct group_entry));
+		if (!e) {
+			abort();
+		}
+		e->name = strdup(key->group.value);
+		if (!e->name) {
+			abort();
+		}
+		if (hashmap_put(layer->groups, e->name, e) < 0) {
+			abort();
+		}
+	}
+	e->label = buxton_label_intern(&glabel);
+	free(glabel.value);
+	e->uid = control->client.uid;
+
+	*label = e->label;
+	return 0;
+}
+
 bool buxton_direct_open(BuxtonControl *control)
 {
 
@@ -40,17 +153,11 @@ bool buxton_direct_open(BuxtonControl *control)
 
 int32_t buxton_direct_get_value(BuxtonControl *control, _BuxtonKey *key,
 			     BuxtonData *data, BuxtonString *data_label,
-			     BuxtonString *client_label)
+			     BuxtonLabelId client_label)
 {
 	/* Handle direct manipulation */
-	BuxtonLayer *l;
 	BuxtonConfig *config;
-	BuxtonString layer = (BuxtonString){ NULL, 0 };
-	Iterator i;
-	BuxtonData d;
-	int priority = 0;
 	int32_t ret;
-	BuxtonLayerType layer_origin = -1;
 
 	assert(control);
 	assert(key);
@@ -64,66 +171,40 @@ int32_t buxton_direct_get_value(BuxtonControl *control, _BuxtonKey *key,
 
 	config = &control->config;
 
-	HASHMAP_FOREACH(l, config->layers, i) {
+	/* layer_order is sorted best first, so the first hit is the value */
+	ret = ENOENT;
+	for (size_t n = 0; n < config->nlayers; n++) {
+		BuxtonLayer *l = config->layer_order[n];
+
 		key->layer.value = l->name.value;
 		key->layer.length = l->name.length;
 		ret = (int32_t)buxton_direct_get_value_for_layer(control,
 						      key,
-						      &d,
+						      data,
 						      data_label,
 						      client_label);
 		if (!ret) {
-			free(data_label->value);
-			data_label->value = NULL;
-			data_label->length = 0;
-			if (d.type == BUXTON_TYPE_STRING) {
-				free(d.store.d_string.value);
-			}
-
-			if ((l->type == LAYER_SYSTEM && (layer_origin != LAYER_SYSTEM ||
-							 priority <= l->priority)) ||
-			    (l->type == LAYER_USER && layer_origin != LAYER_SYSTEM &&
-			     priority <= l->priority)) {
-				if (l->type == LAYER_SYSTEM) {
-					layer_origin = LAYER_SYSTEM;
-				} else {
-					layer_origin = LAYER_USER;
-				}
-				priority = l->priority;
-				layer.value = l->name.value;
-				layer.length = l->name.length;
-			}
+			break;
 		}
+		ret = ENOENT;
 	}
-	if (layer.value) {
-		key->layer.value = layer.value;
-		key->layer.length = layer.length;
-		ret = (int32_t)buxton_direct_get_value_for_layer(control,
-						      key,
-						      data,
-						      data_label,
-						      client_label);
-		key->layer.value = NULL;
-		key->layer.length = 0;
+	key->layer.value = NULL;
+	key->layer.length = 0;
 
-		return ret;
-	}
-	return ENOENT;
+	return ret;
 }
 
 int buxton_direct_get_value_for_layer(BuxtonControl *control,
 				       _BuxtonKey *key,
 				       BuxtonData *data,
 				       BuxtonString *data_label,
-				       BuxtonString *client_label)
+				       BuxtonLabelId client_label)
 {
 	/* Handle direct manipulation */
 	BuxtonBackend *backend = NULL;
 	BuxtonLayer *layer = NULL;
 	BuxtonConfig *config;
-	BuxtonData g;
-	_BuxtonKey group;
-	BuxtonString group_label;
+	BuxtonLabelId group_label = BUXTON_LABEL_NONE;
 	int ret;
 
 	assert(control);
@@ -133,10 +214,6 @@ int buxton_direct_get_value_for_layer(BuxtonControl *control,
 	buxton_debug("get_value '%s:%s' for layer '%s' start\n",
 		     key->group.value, key->name.value, key->layer.value);
 
-	memzero(&g, sizeof(BuxtonData));
-	memzero(&group, sizeof(_BuxtonKey));
-	memzero(&group_label, sizeof(BuxtonString));
-
 	if (!key->layer.value) {
 		ret = EINVAL;
 		goto fail;
@@ -154,10 +231,7 @@ int buxton_direct_get_value_for_layer(BuxtonControl *control,
 
 	/* Groups must be created first, so bail if this key's group doesn't exist */
 	if (key->name.value) {
-		if (!buxton_copy_key_group(key, &group)) {
-			abort();
-		}
-		ret = buxton_direct_get_value_for_layer(control, &group, &g, &group_label, NULL);
+		ret = get_group_label(control, key, &group_label);
 		if (ret) {
 			buxton_debug("Group %s for name %s missing for get value\n", key->group.value, key->name.value);
 			goto fail;
@@ -165,8 +239,9 @@ int buxton_direct_get_value_for_layer(BuxtonControl *control,
 	}
 
 	/* The group checks are only needed for key lookups, or we recurse endlessly */
-	if (key->name.value && client_label) {
-		if (!buxton_check_smack_access(client_label, &group_label, ACCESS_READ)) {
+	if (key->name.value && client_label != BUXTON_LABEL_NONE) {
+		if (!buxton_check_smack_access_id(client_label, group_label,
+						  ACCESS_READ)) {
 			ret = EPERM;
 			goto fail;
 		}
@@ -174,9 +249,11 @@ int buxton_direct_get_value_for_layer(BuxtonControl *control,
 
 	ret = backend->get_value(layer, key, data, data_label);
 	if (!ret) {
-		/* Access checks are not needed for direct clients, where client_label is NULL */
-		if (data_label->value && client_label && client_label->value &&
-		    !buxton_check_smack_access(client_label, data_label, ACCESS_READ)) {
+		/* Access checks are not needed for direct clients, where client_label is BUXTON_LABEL_NONE */
+		if (data_label->value && client_label != BUXTON_LABEL_NONE &&
+		    !buxton_check_smack_access_id(client_label,
+						  buxton_label_intern(data_label),
+						  ACCESS_READ)) {
 			/* Client lacks permission to read the value */
 			free(data_label->value);
 			data_label->value = NULL;
@@ -186,11 +263,6 @@ int buxton_direct_get_value_for_layer(BuxtonControl *control,
 	}
 
 fail:
-	free(g.store.d_string.value);
-	free(group.group.value);
-	free(group.name.value);
-	free(group.layer.value);
-	free(group_label.value);
 	buxton_debug("get_value '%s:%s' for layer '%s' end\n",
 		     key->group.value, key->name.value, key->layer.value);
 	return ret;
@@ -199,7 +271,7 @@ fail:
 bool buxton_direct_set_value(BuxtonControl *control,
 			     _BuxtonKey *key,
 			     BuxtonData *data,
-			     BuxtonString *label)
+			     BuxtonLabelId label)
 {
 	BuxtonDataType memo_type;
 	BuxtonBackend *backend;
@@ -207,11 +279,9 @@ bool buxton_direct_set_value(BuxtonControl *control,
 	BuxtonConfig *config;
 	BuxtonString default_label = buxton_string_pack("_");
 	BuxtonString *l;
+	BuxtonLabelId group_label = BUXTON_LABEL_NONE;
 	_cleanup_buxton_data_ BuxtonData *d = NULL;
-	_cleanup_buxton_data_ BuxtonData *g = NULL;
-	_cleanup_buxton_key_ _BuxtonKey *group = NULL;
 	_cleanup_buxton_string_ BuxtonString *data_label = NULL;
-	_cleanup_buxton_string_ BuxtonString *group_label = NULL;
 	bool r = false;
 	int ret;
 
@@ -221,19 +291,6 @@ bool buxton_direct_set_value(BuxtonControl *control,
 
 	buxton_debug("set_value start\n");
 
-	group = malloc0(sizeof(_BuxtonKey));
-	if (!group) {
-		abort();
-	}
-	g = malloc0(sizeof(BuxtonData));
-	if (!g) {
-		abort();
-	}
-	group_label = malloc0(sizeof(BuxtonString));
-	if (!group_label) {
-		abort();
-	}
-
 	d = malloc0(sizeof(BuxtonData));
 	if (!d) {
 		abort();
@@ -244,42 +301,43 @@ bool buxton_direct_set_value(BuxtonControl *control,
 	}
 
 	/* Groups must be created first, so bail if this key's group doesn't exist */
-	if (!buxton_copy_key_group(key, group)) {
-		abort();
-	}
-
-	ret = buxton_direct_get_value_for_layer(control, group, g, group_label, NULL);
+	ret = get_group_label(control, key, &group_label);
 	if (ret) {
 		buxton_debug("Error(%d): %s\n", ret, strerror(ret));
 		buxton_debug("Group %s for name %s missing for set value\n", key->group.value, key->name.value);
 		goto fail;
 	}
 
-	/* Access checks are not needed for direct clients, where label is NULL */
-	if (label) {
-		if (!buxton_check_smack_access(label, group_label, ACCESS_WRITE)) {
+	/* Access checks are not needed for direct clients, where label is BUXTON_LABEL_NONE */
+	if (label != BUXTON_LABEL_NONE) {
+		if (!buxton_check_smack_access_id(label, group_label,
+						  ACCESS_WRITE)) {
 			goto fail;
 		}
 
 		memo_type = key->type;
 		key->type = BUXTON_TYPE_UNSET;
-		ret = buxton_direct_get_value_for_layer(control, key, d, data_label, NULL);
+		ret = buxton_direct_get_value_for_layer(control, key, d, data_label,
+							BUXTON_LABEL_NONE);
 		key->type = memo_type;
 		if (ret == -ENOENT || ret == EINVAL) {
 			goto fail;
 		}
 		if (!ret) {
-			if (!buxton_check_smack_access(label, data_label, ACCESS_WRITE)) {
+			if (!buxton_check_smack_access_id(label,
+							  buxton_label_intern(data_label),
+							  ACCESS_WRITE)) {
 				goto fail;
 			}
 			l = data_label;
 		} else {
-			l = label;
+			l = buxton_label_string(label);
 		}
 	} else {
 		memo_type = key->type;
 		key->type = BUXTON_TYPE_UNSET;
-		ret = buxton_direct_get_value_for_layer(control, key, d, data_label, NULL);
+		ret = buxton_direct_get_value_for_layer(control, key, d, data_label,
+							BUXTON_LABEL_NONE);
 		key->type = memo_type;
 		if (ret == -ENOENT || ret == EINVAL) {
 			goto fail;
@@ -365,6 +423,9 @@ bool buxton_direct_set_label(BuxtonControl *control,
 	} else {
 		r = true;
 	}
+	if (!key->name.value) {
+		forget_group(control, key);
+	}
 
 fail:
 	return r;
@@ -372,7 +433,7 @@ fail:
 
 bool buxton_direct_create_group(BuxtonControl *control,
 				_BuxtonKey *key,
-				BuxtonString *label)
+				BuxtonLabelId label)
 {
 	BuxtonBackend *backend;
 	BuxtonLayer *layer;
@@ -427,7 +488,8 @@ bool buxton_direct_create_group(BuxtonControl *control,
 		}
 	}
 
-	if (buxton_direct_get_value_for_layer(control, key, group, glabel, NULL) != ENOENT) {
+	if (buxton_direct_get_value_for_layer(control, key, group, glabel,
+					      BUXTON_LABEL_NONE) != ENOENT) {
 		buxton_debug("Group '%s' already exists\n", key->group.value);
 		goto fail;
 	}
@@ -442,8 +504,8 @@ bool buxton_direct_create_group(BuxtonControl *control,
 		abort();
 	}
 
-	if (label) {
-		if (!buxton_string_copy(label, dlabel)) {
+	if (label != BUXTON_LABEL_NONE) {
+		if (!buxton_string_copy(buxton_label_string(label), dlabel)) {
 			abort();
 		}
 	} else {
@@ -461,6 +523,7 @@ bool buxton_direct_create_group(BuxtonControl *control,
 	} else {
 		r = true;
 	}
+	forget_group(control, key);
 
 fail:
 	return r;
@@ -468,7 +531,7 @@ fail:
 
 bool buxton_direct_remove_group(BuxtonControl *control,
 				_BuxtonKey *key,
-				BuxtonString *client_label)
+				BuxtonLabelId client_label)
 {
 	BuxtonBackend *backend;
 	BuxtonLayer *layer;
@@ -512,13 +575,17 @@ bool buxton_direct_remove_group(BuxtonControl *control,
 		}
 	}
 
-	if (buxton_direct_get_value_for_layer(control, key, group, glabel, NULL)) {
+	if (buxton_direct_get_value_for_layer(control, key, group, glabel,
+					      BUXTON_LABEL_NONE)) {
 		buxton_debug("Group '%s' doesn't exist\n", key->group.value);
 		goto fail;
 	}
 
 	if (layer->type == LAYER_USER) {
-		if (client_label && !buxton_check_smack_access(client_label, glabel, ACCESS_WRITE)) {
+		if (client_label != BUXTON_LABEL_NONE &&
+		    !buxton_check_smack_access_id(client_label,
+						  buxton_label_intern(glabel),
+						  ACCESS_WRITE)) {
 			goto fail;
 		}
 	}
@@ -534,6 +601,7 @@ bool buxton_direct_remove_group(BuxtonControl *control,
 	} else {
 		r = true;
 	}
+	forget_group(control, key);
 
 fail:
 	return r;
@@ -589,35 +657,20 @@ bool buxton_direct_list_names(BuxtonControl *control,
 
 bool buxton_direct_unset_value(BuxtonControl *control,
 			       _BuxtonKey *key,
-			       BuxtonString *label)
+			       BuxtonLabelId label)
 {
 	BuxtonBackend *backend;
 	BuxtonLayer *layer;
 	BuxtonConfig *config;
 	_cleanup_buxton_string_ BuxtonString *data_label = NULL;
-	_cleanup_buxton_string_ BuxtonString *group_label = NULL;
 	_cleanup_buxton_data_ BuxtonData *d = NULL;
-	_cleanup_buxton_data_ BuxtonData *g = NULL;
-	_cleanup_buxton_key_ _BuxtonKey *group = NULL;
+	BuxtonLabelId group_label = BUXTON_LABEL_NONE;
 	int ret;
 	bool r = false;
 
 	assert(control);
 	assert(key);
 
-	group = malloc0(sizeof(_BuxtonKey));
-	if (!group) {
-		abort();
-	}
-	g = malloc0(sizeof(BuxtonData));
-	if (!g) {
-		abort();
-	}
-	group_label = malloc0(sizeof(BuxtonString));
-	if (!group_label) {
-		abort();
-	}
-
 	d = malloc0(sizeof(BuxtonData));
 	if (!d) {
 		abort();
@@ -627,22 +680,22 @@ bool buxton_direct_unset_value(BuxtonControl *control,
 		abort();
 	}
 
-	if (!buxton_copy_key_group(key, group)) {
-		abort();
-	}
-
-	if (buxton_direct_get_value_for_layer(control, group, g, group_label, NULL)) {
+	if (get_group_label(control, key, &group_label)) {
 		buxton_debug("Group %s for name %s missing for unset value\n", key->group.value, key->name.value);
 		goto fail;
 	}
 
-	/* Access checks are not needed for direct clients, where label is NULL */
-	if (label) {
-		if (!buxton_check_smack_access(label, group_label, ACCESS_WRITE)) {
+	/* Access checks are not needed for direct clients, where label is BUXTON_LABEL_NONE */
+	if (label != BUXTON_LABEL_NONE) {
+		if (!buxton_check_smack_access_id(label, group_label,
+						  ACCESS_WRITE)) {
 			goto fail;
 		}
-		if (!buxton_direct_get_value_for_layer(control, key, d, data_label, NULL)) {
-			if (!buxton_check_smack_access(label, data_label, ACCESS_WRITE)) {
+		if (!buxton_direct_get_value_for_layer(control, key, d, data_label,
+						       BUXTON_LABEL_NONE)) {
+			if (!buxton_check_smack_access_id(label,
+							  buxton_label_intern(data_label),
+							  ACCESS_WRITE)) {
 				goto fail;
 			}
 		} else {
@@ -675,6 +728,228 @@ fail:
 	return r;
 }
 
+/**
+ * State of a key before a transaction changed it
+ */
+struct txn_undo {
+	BuxtonData data; /**<Previous value of the key */
+	BuxtonString label; /**<Previous label of the key */
+	bool existed; /**<Whether the key had a value */
+};
+
+/**
+ * Check an operation of a transaction may run, and save the state of its key
+ * @param control An initialized control structure
+ * @param op The operation to check
+ * @param label The Smack label of the client
+ * @param undo Set to the current state of the operation's key
+ * @return 0 if the operation may run, or an errno value
+ */
+static int32_t check_transaction_op(BuxtonControl *control, BuxtonBatchOp *op,
+				    BuxtonLabelId label, struct txn_undo *undo)
+{
+	BuxtonDataType memo_type;
+	BuxtonLabelId group_label = BUXTON_LABEL_NONE;
+	int ret;
+
+	if (!op->key.name.value) {
+		ret = EINVAL;
+		goto end;
+	}
+
+	/* Groups must be created first, so bail if this key's group doesn't exist */
+	ret = get_group_label(control, &op->key, &group_label);
+	if (ret) {
+		buxton_debug("Group %s for name %s missing for transaction\n",
+			     op->key.group.value, op->key.name.value);
+		goto end;
+	}
+
+	/* Access checks are not needed for direct clients, where label is BUXTON_LABEL_NONE */
+	if (label != BUXTON_LABEL_NONE &&
+	    !buxton_check_smack_access_id(label, group_label, ACCESS_WRITE)) {
+		ret = EPERM;
+		goto end;
+	}
+
+	memo_type = op->key.type;
+	if (op->type == BUXTON_CONTROL_SET) {
+		op->key.type = BUXTON_TYPE_UNSET;
+	}
+	ret = buxton_direct_get_value_for_layer(control, &op->key, &undo->data,
+						&undo->label, BUXTON_LABEL_NONE);
+	op->key.type = memo_type;
+	if (ret == -ENOENT || ret == EINVAL) {
+		ret = EINVAL;
+		goto end;
+	}
+	undo->existed = (ret == 0);
+
+	if (op->type == BUXTON_CONTROL_UNSET && !undo->existed) {
+		buxton_debug("Key %s not found, so unset fails\n",
+			     op->key.name.value);
+		ret = ENOENT;
+		goto end;
+	}
+	if (label != BUXTON_LABEL_NONE && undo->existed &&
+	    !buxton_check_smack_access_id(label, buxton_label_intern(&undo->label),
+					  ACCESS_WRITE)) {
+		ret = EPERM;
+		goto end;
+	}
+	ret = 0;
+
+end:
+	return ret;
+}
+
+int32_t buxton_direct_commit(BuxtonControl *control, BuxtonBatchOp *ops,
+			     size_t len, BuxtonLabelId label)
+{
+	BuxtonBackend *backend;
+	BuxtonLayer *layer;
+	BuxtonConfig *config;
+	BuxtonString default_label = buxton_string_pack("_");
+	BuxtonString *l;
+	struct txn_undo *undo = NULL;
+	size_t done = 0;
+	int32_t ret = 0;
+
+	assert(control);
+	assert(ops || len == 0);
+
+	buxton_debug("commit of %zu operations start\n", len);
+
+	if (len == 0) {
+		return 0;
+	}
+
+	config = &control->config;
+	layer = NULL;
+	if (ops[0].key.layer.value) {
+		layer = hashmap_get(config->layers, ops[0].key.layer.value);
+	}
+	if (!layer) {
+		return EINVAL;
+	}
+	if (layer->readonly) {
+		buxton_debug("Read-only layer!\n");
+		return EROFS;
+	}
+	backend = backend_for_layer(config, layer);
+	assert(backend);
+
+	undo = malloc0(sizeof(struct txn_undo) * len);
+	if (!undo) {
+		abort();
+	}
+
+	/* Check every operation before changing anything */
+	for (size_t i = 0; i < len; i++) {
+		if (ops[i].type != BUXTON_CONTROL_SET &&
+		    ops[i].type != BUXTON_CONTROL_UNSET) {
+			ret = EINVAL;
+			goto end;
+		}
+		if (!ops[i].key.layer.value ||
+		    !streq(ops[i].key.layer.value, layer->name.value)) {
+			buxton_debug("Transaction spans several layers\n");
+			ret = EINVAL;
+			goto end;
+		}
+		ret = check_transaction_op(control, &ops[i], label, &undo[i]);
+		if (ret) {
+			goto end;
+		}
+	}
+
+	layer->uid = control->client.uid;
+	if (backend->begin) {
+		ret = backend->begin(layer);
+		if (ret) {
+			goto end;
+		}
+	}
+	for (done = 0; done < len; done++) {
+		if (ops[done].type == BUXTON_CONTROL_UNSET) {
+			ret = backend->unset_value(layer, &ops[done].key, NULL,
+						   NULL);
+			if (ret) {
+				break;
+			}
+			continue;
+		}
+
+		/* Keys keep their label, new keys get the client's */
+		if (undo[done].existed) {
+			l = &undo[done].label;
+		} else if (label != BUXTON_LABEL_NONE) {
+			l = buxton_label_string(label);
+		} else {
+			l = &default_label;
+		}
+		ret = backend->set_value(layer, &ops[done].key,
+					 &ops[done].value, l);
+		if (ret) {
+			break;
+		}
+	}
+
+	if (ret && backend->begin) {
+		buxton_debug("Transaction failed: %s\n", strerror(ret));
+
+		/* The backend drops every change since begin */
+		if (backend->commit(layer, false)) {
+			buxton_log("Failed to discard transaction on layer %s\n",
+				   layer->name.value);
+			ret = ENOTRECOVERABLE;
+		}
+		goto end;
+	}
+
+	if (ret) {
+		buxton_debug("Transaction failed: %s\n", strerror(ret));
+
+		/* Put back what was changed, latest first */
+		while (done-- > 0) {
+			int r;
+
+			if (undo[done].existed) {
+				r = backend->set_value(layer, &ops[done].key,
+						       &undo[done].data,
+						       &undo[done].label);
+			} else {
+				r = backend->unset_value(layer, &ops[done].key,
+							 NULL, NULL);
+			}
+			if (r) {
+				buxton_log("Failed to roll back %s:%s on layer %s: %s\n",
+					   ops[done].key.group.value,
+					   ops[done].key.name.value,
+					   layer->name.value, strerror(r));
+				ret = ENOTRECOVERABLE;
+			}
+		}
+	}
+
+	if (backend->commit) {
+		if (backend->commit(layer, true) && !ret) {
+			ret = EIO;
+		}
+	}
+
+end:
+	for (size_t i = 0; i < len; i++) {
+		if (undo[i].data.type == BUXTON_TYPE_STRING) {
+			free(undo[i].data.store.d_string.value);
+		}
+		free(undo[i].label.value);
+	}
+	free(undo);
+	buxton_debug("commit end\n");
+	return ret;
+}
+
 bool buxton_direct_init_db(BuxtonControl *control, BuxtonString *layer_name)
 {
 	BuxtonBackend *backend;
@@ -725,17 +1000,28 @@ void buxton_direct_close(BuxtonControl *control)
 	hashmap_free(control->config.databases);
 
 	HASHMAP_FOREACH_KEY(layer, key, control->config.layers, iterator) {
+		struct group_entry *e;
+
 		hashmap_remove(control->config.layers, key);
+		if (layer->groups) {
+			while ((e = hashmap_steal_first(layer->groups))) {
+				free_group_entry(e);
+			}
+			hashmap_free(layer->groups);
+		}
 		free(layer->name.value);
 		free(layer->description);
 		free(layer);
 	}
 	hashmap_free(control->config.layers);
+	free(control->config.layer_order);
 
 	control->client.direct = false;
 	control->config.backends = NULL;
 	control->config.databases = NULL;
 	control->config.layers = NULL;
+	control->config.layer_order = NULL;
+	control->config.nlayers = 0;
 }
 
 /*
@@ -22,6 +22,8 @@
 
 #include <backend.h>
 #include "buxton.h"
+#include "buxtonbatch.h"
+#include "buxtonlabel.h"
 #include "hashmap.h"
 
 /**
@@ -65,24 +67,26 @@ bool buxton_direct_set_label(BuxtonControl *control,
  * Create a group within Buxton
  * @param control An initialized control structure
  * @param key The key struct with group and layer members initialized
- * @param label The Smack label of the client
+ * @param label The interned Smack label of the client, or
+ * BUXTON_LABEL_NONE for direct clients
  * @return A boolean value, indicating success of the operation
  */
 bool buxton_direct_create_group(BuxtonControl *control,
 				_BuxtonKey *key,
-				BuxtonString *label)
+				BuxtonLabelId label)
 	__attribute__((warn_unused_result));
 
 /**
  * Remove a group within Buxton
  * @param control An initialized control structure
  * @param key The key struct with group and layer members initialized
- * @param client_label The Smack label of the client
+ * @param client_label The interned Smack label of the client, or
+ * BUXTON_LABEL_NONE for direct clients
  * @return A boolean value, indicating success of the operation
  */
 bool buxton_direct_remove_group(BuxtonControl *control,
 				_BuxtonKey *key,
-				BuxtonString *client_label)
+				BuxtonLabelId client_label)
 	__attribute__((warn_unused_result));
 
 /**
@@ -90,13 +94,14 @@ bool buxton_direct_remove_group(BuxtonControl *control,
  * @param control An initialized control structure
  * @param key The key struct
  * @param data A struct containing the data to set
- * @param label The Smack label for the client
+ * @param label The interned Smack label for the client, or
+ * BUXTON_LABEL_NONE for direct clients
  * @return A boolean value, indicating success of the operation
  */
 bool buxton_direct_set_value(BuxtonControl *control,
 			     _BuxtonKey *key,
 			     BuxtonData *data,
-			     BuxtonString *label)
+			     BuxtonLabelId label)
 	__attribute__((warn_unused_result));
 
 /**
@@ -105,14 +110,15 @@ bool buxton_direct_set_value(BuxtonControl *control,
  * @param key The key to retrieve
  * @param data An empty BuxtonData, where data is stored
  * @param data_label The Smack label of the data
- * @param client_label The Smack label of the client
+ * @param client_label The interned Smack label of the client, or
+ * BUXTON_LABEL_NONE for direct clients
  * @return A int32_t value, indicating success of the operation
  */
 int32_t buxton_direct_get_value(BuxtonControl *control,
 			     _BuxtonKey *key,
 			     BuxtonData *data,
 			     BuxtonString *data_label,
-			     BuxtonString *client_label)
+			     BuxtonLabelId client_label)
 	__attribute__((warn_unused_result));
 
 /**
@@ -121,14 +127,15 @@ int32_t buxton_direct_get_value(BuxtonControl *control,
  * @param key The key to retrieve
  * @param data An empty BuxtonData, where data is stored
  * @param data_label The Smack label of the data
- * @param client_label The Smack label of the client
+ * @param client_label The interned Smack label of the client, or
+ * BUXTON_LABEL_NONE for direct clients
  * @return An int value, indicating success of the operation
  */
 int buxton_direct_get_value_for_layer(BuxtonControl *control,
 				       _BuxtonKey *key,
 				       BuxtonData *data,
 				       BuxtonString *data_label,
-				       BuxtonString *client_label)
+				       BuxtonLabelId client_label)
 	__attribute__((warn_unused_result));
 
 /**
@@ -164,12 +171,35 @@ bool buxton_direct_list_names(BuxtonControl *control,
  * Unset a value by key in the given BuxtonLayer
  * @param control An initialized control structure
  * @param key The key to remove
- * @param label The Smack label of the client
+ * @param label The interned Smack label of the client, or
+ * BUXTON_LABEL_NONE for direct clients
  * @return a boolean value, indicating success of the operation
  */
 bool buxton_direct_unset_value(BuxtonControl *control,
 			       _BuxtonKey *key,
-			       BuxtonString *label)
+			       BuxtonLabelId label)
+	__attribute__((warn_unused_result));
+
+/**
+ * Apply sets and unsets to a single layer as one transaction
+ *
+ * Every operation is checked against the layer as it was before the
+ * transaction, and none of them is applied unless all may be. Backends
+ * with a begin function apply the operations together, others have
+ * them put back if one fails, and flush their changes once, after the
+ * last operation.
+ *
+ * @param control An initialized control structure
+ * @param ops The operations to apply, in order, all on the same layer
+ * @param len Number of operations
+ * @param label The interned Smack label of the client, or
+ * BUXTON_LABEL_NONE for direct clients
+ * @return 0 on success, ENOTRECOVERABLE if a failed transaction couldn't
+ * be put back and left the layer partly changed, or another errno value
+ * if nothing was changed
+ */
+int32_t buxton_direct_commit(BuxtonControl *control, BuxtonBatchOp *ops,
+			     size_t len, BuxtonLabelId label)
 	__attribute__((warn_unused_result));
 
 /*
@@ -27,28 +27,69 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
+#include <stdint.h>
 
 #include "util.h"
 #include "hashmap.h"
 #include "macro.h"
 
-#define INITIAL_N_BUCKETS 31
+/* The index starts with 8 slots and always has a power of two of them */
+#define INITIAL_N_BITS 3
+#define INITIAL_N_ENTRIES 6
+
+/* Old index slots moved to the new index by every lookup, insertion or
+ * removal while the index grows */
+#define MIGRATE_STEP 8
+
+/* Entry positions moved over by every insertion or removal while holes
+ * are squeezed out */
+#define COMPACT_STEP 8
 
 struct hashmap_entry {
         const void *key;
         void *value;
-        struct hashmap_entry *bucket_next, *bucket_previous;
-        struct hashmap_entry *iterate_next, *iterate_previous;
+        unsigned hash;
+        /* Insertion number, which removed entries keep */
+        unsigned seq;
+        bool used;
+};
+
+struct hashmap_slot {
+        /* Position of the entry plus one, or 0 for an empty slot */
+        unsigned entry;
+        unsigned hash;
 };
 
 struct Hashmap {
         hash_func_t hash_func;
         compare_func_t compare_func;
 
-        struct hashmap_entry *iterate_list_head, *iterate_list_tail;
+        /* Entries in insertion order. Removed entries stay behind as
+         * holes until the array is compacted. */
+        struct hashmap_entry *entries;
+        unsigned n_allocated, n_used, n_entries, first;
+
+        /* Compaction moves the entries from compact_from on down to
+         * compact_to, a few per insertion or removal, leaving holes in
+         * between. */
+        unsigned compact_to, compact_from;
+        bool compacting;
+
+        /* Entries are numbered as they are inserted, and iterators hold
+         * the number to continue from, so they stay valid wherever
+         * compaction moves the entries. The position an iteration last
+         * returned spares the next step a search. */
+        unsigned seq, iter_seq, iter_pos;
 
-        struct hashmap_entry ** buckets;
-        unsigned n_buckets, n_entries;
+        /* Robin Hood open addressing index into the entries */
+        struct hashmap_slot *slots;
+        unsigned n_bits;
+
+        /* The index being replaced while it is moved over, a few slots
+         * at a time, so no single insertion pays for a whole rehash */
+        struct hashmap_slot *old_slots;
+        unsigned old_bits, migrated;
 
         bool from_pool;
 };
@@ -62,9 +103,6 @@ struct pool {
 static struct pool *first_hashmap_pool = NULL;
 static void *first_hashmap_tile = NULL;
 
-static struct pool *first_entry_pool = NULL;
-static void *first_entry_tile = NULL;
-
 static void* allocate_tile(struct pool **first_pool, void **first_tile, size_t tile_size) {
         unsigned i;
 
@@ -127,21 +165,46 @@ __attribute__((destructor)) static void cleanup_pool(void) {
         /* Be nice to valgrind */
 
         drop_pool(first_hashmap_pool);
-        drop_pool(first_entry_pool);
 }
 
 #endif
 
+static inline uint64_t rotl64(uint64_t x, unsigned r) {
+        return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t mix_word(uint64_t w) {
+        return rotl64(w * 0x87c37b91114253d5ULL, 31) * 0x4cf5ad432745937fULL;
+}
+
 unsigned string_hash_func(const void *p) {
-        unsigned hash = 5381;
-        const signed char *c;
+        const uint8_t *c = p;
+        size_t n = strlen(p);
+        uint64_t hash, w;
 
-        /* DJB's hash function */
+        /* MurmurHash3 style mixing of eight bytes at a time, with its
+         * finalizer so every input bit reaches the high bits the index
+         * uses */
 
-        for (c = p; *c; c++)
-                hash = (hash << 5) + hash + (unsigned) *c;
+        hash = 0x9e3779b97f4a7c15ULL ^ n;
 
-        return hash;
+        for (; n >= sizeof(w); n -= sizeof(w), c += sizeof(w)) {
+                memcpy(&w, c, sizeof(w));
+                hash ^= mix_word(w);
+                hash = rotl64(hash, 27) * 5 + 0x52dce729;
+        }
+
+        w = 0;
+        memcpy(&w, c, n);
+        hash ^= mix_word(w);
+
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+        hash *= 0xc4ceb9fe1a85ec53ULL;
+        hash ^= hash >> 33;
+
+        return (unsigned) (hash ^ (hash >> 32));
 }
 
 int string_compare_func(const void *a, const void *b) {
@@ -175,113 +238,346 @@ int uint64_compare_func(const void *_a, const void *_b) {
         return a < b ? -1 : (a > b ? 1 : 0);
 }
 
-Hashmap *hashmap_new(hash_func_t hash_func, compare_func_t compare_func) {
-        Hashmap *h;
-        size_t size;
+static inline unsigned slot_home(unsigned hash, unsigned bits) {
+        /* Fibonacci hashing takes the slot from the high bits of the
+         * product, so pointers, whose low bits are always zero, still
+         * spread over the whole index */
+        return (unsigned) ((uint32_t) (hash * 2654435769U) >> (32 - bits));
+}
 
-        size = ALIGN(sizeof(Hashmap)) + INITIAL_N_BUCKETS * sizeof(struct hashmap_entry*);
+static inline unsigned slot_distance(const struct hashmap_slot *slots, unsigned bits, unsigned i) {
+        return (i - slot_home(slots[i].hash, bits)) & ((1U << bits) - 1);
+}
 
-        h = allocate_tile(&first_hashmap_pool, &first_hashmap_tile, size);
-        if (!h)
+static struct hashmap_slot *index_find(Hashmap *h, struct hashmap_slot *slots, unsigned bits,
+                                       unsigned hash, const void *key) {
+        unsigned mask = (1U << bits) - 1, i, d;
+
+        for (i = slot_home(hash, bits), d = 0;; i = (i + 1) & mask, d++) {
+                struct hashmap_entry *e;
+
+                if (slots[i].entry == 0)
+                        return NULL;
+
+                if (slots[i].hash == hash) {
+                        e = &h->entries[slots[i].entry - 1];
+                        if (e->used && h->compare_func(e->key, key) == 0)
+                                return &slots[i];
+                }
+
+                /* Robin Hood keeps every run sorted by distance from
+                 * home, so a slot closer to home than us ends the
+                 * search */
+                if (slot_distance(slots, bits, i) < d)
+                        return NULL;
+        }
+}
+
+static struct hashmap_slot *index_find_entry(struct hashmap_slot *slots, unsigned bits,
+                                             unsigned hash, unsigned entry) {
+        unsigned mask = (1U << bits) - 1, i, d;
+
+        for (i = slot_home(hash, bits), d = 0;; i = (i + 1) & mask, d++) {
+                if (slots[i].entry == 0 || slot_distance(slots, bits, i) < d)
+                        return NULL;
+
+                if (slots[i].entry == entry)
+                        return &slots[i];
+        }
+}
+
+static void index_insert(struct hashmap_slot *slots, unsigned bits, unsigned entry, unsigned hash) {
+        struct hashmap_slot carry = { entry, hash };
+        unsigned mask = (1U << bits) - 1, i, d;
+
+        for (i = slot_home(hash, bits), d = 0;; i = (i + 1) & mask, d++) {
+                struct hashmap_slot t;
+                unsigned sd;
+
+                if (slots[i].entry == 0) {
+                        slots[i] = carry;
+                        return;
+                }
+
+                /* Take the slot from an entry nearer its home */
+                sd = slot_distance(slots, bits, i);
+                if (sd < d) {
+                        t = slots[i];
+                        slots[i] = carry;
+                        carry = t;
+                        d = sd;
+                }
+        }
+}
+
+static void index_delete(struct hashmap_slot *slots, unsigned bits, struct hashmap_slot *s) {
+        unsigned mask = (1U << bits) - 1, i, j;
+
+        /* Shift the rest of the run back instead of leaving a
+         * tombstone, so lookups never probe further than needed */
+        for (i = (unsigned) (s - slots);; i = j) {
+                j = (i + 1) & mask;
+                if (slots[j].entry == 0 || slot_distance(slots, bits, j) == 0)
+                        break;
+                slots[i] = slots[j];
+        }
+
+        slots[i].entry = 0;
+}
+
+static void migrate(Hashmap *h, unsigned n) {
+        unsigned old_size;
+
+        if (!h->old_slots)
+                return;
+
+        /* The old index is only read while it is migrated, so the
+         * slots already moved keep lookups of unmoved entries
+         * working. Removed entries are skipped by their used flag. */
+        old_size = 1U << h->old_bits;
+        for (; n > 0 && h->migrated < old_size; n--, h->migrated++) {
+                struct hashmap_slot *s = &h->old_slots[h->migrated];
+
+                if (s->entry != 0 && h->entries[s->entry - 1].used)
+                        index_insert(h->slots, h->n_bits, s->entry, s->hash);
+        }
+
+        if (h->migrated >= old_size) {
+                free(h->old_slots);
+                h->old_slots = NULL;
+        }
+}
+
+static struct hashmap_entry *find_entry(Hashmap *h, unsigned hash, const void *key,
+                                        struct hashmap_slot **slot) {
+        struct hashmap_slot *s;
+
+        if (slot)
+                *slot = NULL;
+
+        if (!h->slots)
                 return NULL;
 
-        h->hash_func = hash_func ? hash_func : trivial_hash_func;
-        h->compare_func = compare_func ? compare_func : trivial_compare_func;
+        /* Lookups help the migration along too, so a map that stops
+         * changing soon needs a single probe again */
+        migrate(h, MIGRATE_STEP);
 
-        h->n_buckets = INITIAL_N_BUCKETS;
-        h->n_entries = 0;
-        h->iterate_list_head = h->iterate_list_tail = NULL;
+        s = index_find(h, h->slots, h->n_bits, hash, key);
+        if (s) {
+                if (slot)
+                        *slot = s;
+                return &h->entries[s->entry - 1];
+        }
 
-	h->buckets = (struct hashmap_entry**) ((uint8_t*) h + ALIGN(sizeof(Hashmap)));
-        h->from_pool = true;
+        /* Entries still live in the old index have not been moved yet */
+        if (h->old_slots) {
+                s = index_find(h, h->old_slots, h->old_bits, hash, key);
+                if (s)
+                        return &h->entries[s->entry - 1];
+        }
 
-        return h;
+        return NULL;
 }
 
-int hashmap_ensure_allocated(Hashmap **h, hash_func_t hash_func, compare_func_t compare_func) {
-        Hashmap *q;
+static void reset(Hashmap *h) {
+        free(h->old_slots);
+        h->old_slots = NULL;
 
-        assert(h);
+        if (h->slots)
+                memset(h->slots, 0, sizeof(struct hashmap_slot) << h->n_bits);
 
-        if (*h)
-                return 0;
+        h->n_used = h->n_entries = h->first = 0;
+        h->compacting = false;
+}
 
-        q = hashmap_new(hash_func, compare_func);
-        if (!q)
-                return -ENOMEM;
-        *h = q;
-        return 0;
+static void compact(Hashmap *h, unsigned n) {
+
+        /* Removed entries may still be named by the old index, so
+         * their positions are only reused once it is gone */
+        if (!h->compacting || h->old_slots)
+                return;
+
+        for (; n > 0 && h->compact_from < h->n_used; n--, h->compact_from++) {
+                struct hashmap_entry *e = &h->entries[h->compact_from];
+                struct hashmap_slot *s;
+
+                if (!e->used)
+                        continue;
+
+                if (h->compact_from != h->compact_to) {
+                        s = index_find_entry(h->slots, h->n_bits, e->hash, h->compact_from + 1);
+                        assert(s);
+                        s->entry = h->compact_to + 1;
+
+                        h->entries[h->compact_to] = *e;
+                        e->used = false;
+                        e->key = e->value = NULL;
+
+                        if (h->compact_to < h->first)
+                                h->first = h->compact_to;
+                        if (h->iter_pos == h->compact_from)
+                                h->iter_pos = h->compact_to;
+                }
+
+                h->compact_to++;
+        }
+
+        /* Everything past the last moved entry is a hole now */
+        if (h->compact_from >= h->n_used) {
+                h->n_used = MIN(h->n_used, h->compact_to);
+                h->compacting = false;
+        }
 }
 
-static void link_entry(Hashmap *h, struct hashmap_entry *e, unsigned hash) {
+static void remove_entry(Hashmap *h, struct hashmap_entry *e, struct hashmap_slot *slot) {
+        unsigned p;
+
         assert(h);
         assert(e);
+        assert(e->used);
+
+        p = (unsigned) (e - h->entries);
+
+        if (!slot)
+                slot = index_find_entry(h->slots, h->n_bits, e->hash, p + 1);
+        if (slot)
+                index_delete(h->slots, h->n_bits, slot);
+
+        e->used = false;
+        e->key = e->value = NULL;
+
+        assert(h->n_entries >= 1);
+        h->n_entries--;
 
-        /* Insert into hash table */
-        e->bucket_next = h->buckets[hash];
-        e->bucket_previous = NULL;
-        if (h->buckets[hash])
-                h->buckets[hash]->bucket_previous = e;
-        h->buckets[hash] = e;
-
-        /* Insert into iteration list */
-        e->iterate_previous = h->iterate_list_tail;
-        e->iterate_next = NULL;
-        if (h->iterate_list_tail) {
-                assert(h->iterate_list_head);
-                h->iterate_list_tail->iterate_next = e;
-        } else {
-                assert(!h->iterate_list_head);
-                h->iterate_list_head = e;
+        if (h->n_entries == 0) {
+                reset(h);
+                return;
+        }
+
+        if (p == h->first)
+                while (!h->entries[h->first].used)
+                        h->first++;
+
+        /* Positions named by the old index must stay put until it is
+         * gone, otherwise trailing holes can be given back */
+        if (!h->old_slots)
+                while (!h->entries[h->n_used - 1].used)
+                        h->n_used--;
+
+        /* Start squeezing out the holes once they make up half of the
+         * entries, the leading ones need no moves at all */
+        if (!h->compacting && h->n_entries * 2 <= h->n_used) {
+                h->compacting = true;
+                h->compact_to = 0;
+                h->compact_from = h->first;
         }
-        h->iterate_list_tail = e;
 
+        migrate(h, MIGRATE_STEP);
+        compact(h, COMPACT_STEP);
+}
+
+static bool reserve(Hashmap *h) {
+        struct hashmap_entry *e;
+        unsigned m;
+
+        /* Keep the index at most three quarters full */
+        if (!h->slots) {
+                h->slots = new0(struct hashmap_slot, 1U << INITIAL_N_BITS);
+                if (!h->slots)
+                        return false;
+                h->n_bits = INITIAL_N_BITS;
+        } else if (_unlikely_((h->n_entries + 1) * 4 > 3U << h->n_bits)) {
+                struct hashmap_slot *n;
+
+                migrate(h, UINT_MAX);
+
+                n = new0(struct hashmap_slot, 2U << h->n_bits);
+                if (!n)
+                        return false;
+
+                h->old_slots = h->slots;
+                h->old_bits = h->n_bits;
+                h->migrated = 0;
+
+                h->slots = n;
+                h->n_bits++;
+        }
+
+        if (_likely_(h->n_used < h->n_allocated))
+                return true;
+
+        /* Holes are given back by compact() as it goes, so a full
+         * array always doubles */
+        m = MAX((unsigned) INITIAL_N_ENTRIES, h->n_allocated * 2);
+        e = realloc(h->entries, m * sizeof(struct hashmap_entry));
+        if (!e)
+                return false;
+
+        h->entries = e;
+        h->n_allocated = m;
+
+        return true;
+}
+
+static int append_entry(Hashmap *h, const void *key, void *value, unsigned hash) {
+        struct hashmap_entry *e;
+
+        if (!reserve(h))
+                return -ENOMEM;
+
+        /* Iterators hold numbers up to two past an insertion number,
+         * which must not be taken for ITERATOR_LAST */
+        h->seq = h->seq >= UINT_MAX - 3 ? 1 : h->seq + 1;
+
+        e = &h->entries[h->n_used++];
+        e->key = key;
+        e->value = value;
+        e->hash = hash;
+        e->seq = h->seq;
+        e->used = true;
+
+        index_insert(h->slots, h->n_bits, h->n_used, hash);
         h->n_entries++;
-        assert(h->n_entries >= 1);
+
+        migrate(h, MIGRATE_STEP);
+        compact(h, COMPACT_STEP);
+
+        return 1;
 }
 
-static void unlink_entry(Hashmap *h, struct hashmap_entry *e, unsigned hash) {
-        assert(h);
-        assert(e);
+Hashmap *hashmap_new(hash_func_t hash_func, compare_func_t compare_func) {
+        Hashmap *h;
 
-        /* Remove from iteration list */
-        if (e->iterate_next)
-                e->iterate_next->iterate_previous = e->iterate_previous;
-        else
-                h->iterate_list_tail = e->iterate_previous;
+        h = allocate_tile(&first_hashmap_pool, &first_hashmap_tile, sizeof(Hashmap));
+        if (!h)
+                return NULL;
 
-        if (e->iterate_previous)
-                e->iterate_previous->iterate_next = e->iterate_next;
-        else
-                h->iterate_list_head = e->iterate_next;
+        /* Tiles are recycled, so set every field */
+        memset(h, 0, sizeof(Hashmap));
 
-        /* Remove from hash table bucket list */
-        if (e->bucket_next)
-                e->bucket_next->bucket_previous = e->bucket_previous;
+        h->hash_func = hash_func ? hash_func : trivial_hash_func;
+        h->compare_func = compare_func ? compare_func : trivial_compare_func;
 
-        if (e->bucket_previous)
-                e->bucket_previous->bucket_next = e->bucket_next;
-        else
-                h->buckets[hash] = e->bucket_next;
+        /* The entries and the index are allocated on the first
+         * insertion */
+        h->from_pool = true;
 
-        assert(h->n_entries >= 1);
-        h->n_entries--;
+        return h;
 }
 
-static void remove_entry(Hashmap *h, struct hashmap_entry *e) {
-        unsigned hash;
+int hashmap_ensure_allocated(Hashmap **h, hash_func_t hash_func, compare_func_t compare_func) {
+        Hashmap *q;
 
         assert(h);
-        assert(e);
 
-        hash = h->hash_func(e->key) % h->n_buckets;
-
-        unlink_entry(h, e, hash);
+        if (*h)
+                return 0;
 
-        if (h->from_pool)
-                deallocate_tile(&first_entry_tile, e);
-        else
-                free(e);
+        q = hashmap_new(hash_func, compare_func);
+        if (!q)
+                return -ENOMEM;
+        *h = q;
+        return 0;
 }
 
 void hashmap_free(Hashmap*h) {
@@ -291,10 +587,9 @@ void hashmap_free(Hashmap*h) {
         if (!h)
                 return;
 
-        hashmap_clear(h);
-
-        if (h->buckets != (struct hashmap_entry**) ((uint8_t*) h + ALIGN(sizeof(Hashmap))))
-                free(h->buckets);
+        free(h->entries);
+        free(h->slots);
+        free(h->old_slots);
 
         if (h->from_pool)
                 deallocate_tile(&first_hashmap_tile, h);
@@ -329,96 +624,35 @@ void hashmap_clear(Hashmap *h) {
         if (!h)
                 return;
 
-        while (h->iterate_list_head)
-                remove_entry(h, h->iterate_list_head);
+        reset(h);
 }
 
 void hashmap_clear_free(Hashmap *h) {
-        void *p;
+        unsigned i;
 
         if (!h)
                 return;
 
-        while ((p = hashmap_steal_first(h)))
-                free(p);
+        for (i = 0; i < h->n_used; i++)
+                if (h->entries[i].used)
+                        free(h->entries[i].value);
+
+        reset(h);
 }
 
 void hashmap_clear_free_free(Hashmap *h) {
+        unsigned i;
+
         if (!h)
                 return;
 
-        while (h->iterate_list_head) {
-                void *a, *b;
-
-                a = h->iterate_list_head->value;
-                b = (void*) h->iterate_list_head->key;
-                remove_entry(h, h->iterate_list_head);
-                free(a);
-                free(b);
-        }
-}
-
-
-static struct hashmap_entry *hash_scan(Hashmap *h, unsigned hash, const void *key) {
-        struct hashmap_entry *e;
-        assert(h);
-        assert(hash < h->n_buckets);
-
-        for (e = h->buckets[hash]; e; e = e->bucket_next)
-                if (h->compare_func(e->key, key) == 0)
-                        return e;
+        for (i = 0; i < h->n_used; i++)
+                if (h->entries[i].used) {
+                        free(h->entries[i].value);
+                        free((void*) h->entries[i].key);
+                }
 
-        return NULL;
-}
-
-static bool resize_buckets(Hashmap *h) {
-        unsigned m;
-        struct hashmap_entry **n, *i;
-
-        assert(h);
-
-        if (_likely_(h->n_entries*4 < h->n_buckets*3))
-                return false;
-
-        /* Increase by four */
-        m = (h->n_entries+1)*4-1;
-
-        /* If we hit OOM we simply risk packed hashmaps... */
-        n = new0(struct hashmap_entry*, m);
-        if (!n)
-                return false;
-
-        for (i = h->iterate_list_head; i; i = i->iterate_next) {
-                unsigned hash, x;
-
-                hash = h->hash_func(i->key);
-
-                /* First, drop from old bucket table */
-                if (i->bucket_next)
-                        i->bucket_next->bucket_previous = i->bucket_previous;
-
-                if (i->bucket_previous)
-                        i->bucket_previous->bucket_next = i->bucket_next;
-                else
-                        h->buckets[hash % h->n_buckets] = i->bucket_next;
-
-                /* Then, add to new backet table */
-                x = hash % m;
-
-                i->bucket_next = n[x];
-                i->bucket_previous = NULL;
-                if (n[x])
-                        n[x]->bucket_previous = i;
-                n[x] = i;
-        }
-
-        if (h->buckets != (struct hashmap_entry**) ((uint8_t*) h + ALIGN(sizeof(Hashmap))))
-                free(h->buckets);
-
-        h->buckets = n;
-        h->n_buckets = m;
-
-        return true;
+        reset(h);
 }
 
 int hashmap_put(Hashmap *h, const void *key, void *value) {
@@ -427,31 +661,15 @@ int hashmap_put(Hashmap *h, const void *key, void *value) {
 
         assert(h);
 
-        hash = h->hash_func(key) % h->n_buckets;
-        e = hash_scan(h, hash, key);
+        hash = h->hash_func(key);
+        e = find_entry(h, hash, key, NULL);
         if (e) {
                 if (e->value == value)
                         return 0;
                 return -EEXIST;
         }
 
-        if (resize_buckets(h))
-                hash = h->hash_func(key) % h->n_buckets;
-
-        if (h->from_pool)
-                e = allocate_tile(&first_entry_pool, &first_entry_tile, sizeof(struct hashmap_entry));
-        else
-                e = new(struct hashmap_entry, 1);
-
-        if (!e)
-                return -ENOMEM;
-
-        e->key = key;
-        e->value = value;
-
-        link_entry(h, e, hash);
-
-        return 1;
+        return append_entry(h, key, value, hash);
 }
 
 int hashmap_replace(Hashmap *h, const void *key, void *value) {
@@ -460,25 +678,23 @@ int hashmap_replace(Hashmap *h, const void *key, void *value) {
 
         assert(h);
 
-        hash = h->hash_func(key) % h->n_buckets;
-        e = hash_scan(h, hash, key);
+        hash = h->hash_func(key);
+        e = find_entry(h, hash, key, NULL);
         if (e) {
                 e->key = key;
                 e->value = value;
                 return 0;
         }
 
-        return hashmap_put(h, key, value);
+        return append_entry(h, key, value, hash);
 }
 
 int hashmap_update(Hashmap *h, const void *key, void *value) {
         struct hashmap_entry *e;
-        unsigned hash;
 
         assert(h);
 
-        hash = h->hash_func(key) % h->n_buckets;
-        e = hash_scan(h, hash, key);
+        e = find_entry(h, h->hash_func(key), key, NULL);
         if (!e)
                 return -ENOENT;
 
@@ -487,14 +703,12 @@ int hashmap_update(Hashmap *h, const void *key, void *value) {
 }
 
 void* hashmap_get(Hashmap *h, const void *key) {
-        unsigned hash;
         struct hashmap_entry *e;
 
         if (!h)
                 return NULL;
 
-        hash = h->hash_func(key) % h->n_buckets;
-        e = hash_scan(h, hash, key);
+        e = find_entry(h, h->hash_func(key), key, NULL);
         if (!e)
                 return NULL;
 
@@ -502,14 +716,12 @@ void* hashmap_get(Hashmap *h, const void *key) {
 }
 
 void* hashmap_get2(Hashmap *h, const void *key, void **key2) {
-        unsigned hash;
         struct hashmap_entry *e;
 
         if (!h)
                 return NULL;
 
-        hash = h->hash_func(key) % h->n_buckets;
-        e = hash_scan(h, hash, key);
+        e = find_entry(h, h->hash_func(key), key, NULL);
         if (!e)
                 return NULL;
 
@@ -520,133 +732,176 @@ void* hashmap_get2(Hashmap *h, const void *key, void **key2) {
 }
 
 bool hashmap_contains(Hashmap *h, const void *key) {
-        unsigned hash;
 
         if (!h)
                 return false;
 
-        hash = h->hash_func(key) % h->n_buckets;
-
-        if (!hash_scan(h, hash, key))
-                return false;
-
-        return true;
+        return find_entry(h, h->hash_func(key), key, NULL) != NULL;
 }
 
 void* hashmap_remove(Hashmap *h, const void *key) {
         struct hashmap_entry *e;
-        unsigned hash;
+        struct hashmap_slot *s;
         void *data;
 
         if (!h)
                 return NULL;
 
-        hash = h->hash_func(key) % h->n_buckets;
-
-        if (!(e = hash_scan(h, hash, key)))
+        if (!(e = find_entry(h, h->hash_func(key), key, &s)))
                 return NULL;
 
         data = e->value;
-        remove_entry(h, e);
+        remove_entry(h, e, s);
 
         return data;
 }
 
 void* hashmap_remove2(Hashmap *h, const void *key, void **remkey) {
         struct hashmap_entry *e;
-        unsigned hash;
+        struct hashmap_slot *s;
         void *data;
 
         if (!h)
                 return NULL;
 
-        hash = h->hash_func(key) % h->n_buckets;
-
-        if (!(e = hash_scan(h, hash, key)))
+        if (!(e = find_entry(h, h->hash_func(key), key, &s)))
                 return NULL;
 
         data = e->value;
-	if (remkey)
-		*remkey = (void*)e->key;
-        remove_entry(h, e);
+        if (remkey)
+                *remkey = (void*)e->key;
+        remove_entry(h, e, s);
 
         return data;
 }
 
-int hashmap_remove_and_put(Hashmap *h, const void *old_key, const void *new_key, void *value) {
+static int rekey_entry(Hashmap *h, const void *old_key, unsigned old_hash,
+                       const void *new_key, unsigned new_hash, void *value) {
         struct hashmap_entry *e;
+        struct hashmap_slot *s;
+
+        /* Make room first, so a failure leaves the old entry alone */
+        if (!reserve(h))
+                return -ENOMEM;
+
+        e = find_entry(h, old_hash, old_key, &s);
+        assert(e);
+        remove_entry(h, e, s);
+
+        /* Like before, the renamed entry moves to the end of the
+         * iteration order */
+        return append_entry(h, new_key, value, new_hash) < 0 ? -ENOMEM : 0;
+}
+
+int hashmap_remove_and_put(Hashmap *h, const void *old_key, const void *new_key, void *value) {
         unsigned old_hash, new_hash;
 
         if (!h)
                 return -ENOENT;
 
-        old_hash = h->hash_func(old_key) % h->n_buckets;
-        if (!(e = hash_scan(h, old_hash, old_key)))
+        old_hash = h->hash_func(old_key);
+        if (!find_entry(h, old_hash, old_key, NULL))
                 return -ENOENT;
 
-        new_hash = h->hash_func(new_key) % h->n_buckets;
-        if (hash_scan(h, new_hash, new_key))
+        new_hash = h->hash_func(new_key);
+        if (find_entry(h, new_hash, new_key, NULL))
                 return -EEXIST;
 
-        unlink_entry(h, e, old_hash);
-
-        e->key = new_key;
-        e->value = value;
-
-        link_entry(h, e, new_hash);
-
-        return 0;
+        return rekey_entry(h, old_key, old_hash, new_key, new_hash, value);
 }
 
 int hashmap_remove_and_replace(Hashmap *h, const void *old_key, const void *new_key, void *value) {
         struct hashmap_entry *e, *k;
+        struct hashmap_slot *s;
         unsigned old_hash, new_hash;
 
         if (!h)
                 return -ENOENT;
 
-        old_hash = h->hash_func(old_key) % h->n_buckets;
-        if (!(e = hash_scan(h, old_hash, old_key)))
+        old_hash = h->hash_func(old_key);
+        if (!(e = find_entry(h, old_hash, old_key, NULL)))
                 return -ENOENT;
 
-        new_hash = h->hash_func(new_key) % h->n_buckets;
-        if ((k = hash_scan(h, new_hash, new_key)))
+        new_hash = h->hash_func(new_key);
+        if ((k = find_entry(h, new_hash, new_key, &s)))
                 if (e != k)
-                        remove_entry(h, k);
+                        remove_entry(h, k, s);
 
-        unlink_entry(h, e, old_hash);
-
-        e->key = new_key;
-        e->value = value;
-
-        link_entry(h, e, new_hash);
-
-        return 0;
+        return rekey_entry(h, old_key, old_hash, new_key, new_hash, value);
 }
 
 void* hashmap_remove_value(Hashmap *h, const void *key, void *value) {
         struct hashmap_entry *e;
-        unsigned hash;
+        struct hashmap_slot *s;
 
         if (!h)
                 return NULL;
 
-        hash = h->hash_func(key) % h->n_buckets;
-
-        e = hash_scan(h, hash, key);
+        e = find_entry(h, h->hash_func(key), key, &s);
         if (!e)
                 return NULL;
 
         if (e->value != value)
                 return NULL;
 
-        remove_entry(h, e);
+        remove_entry(h, e, s);
 
         return value;
 }
 
+/* Iterators hold the insertion number to continue from, plus one going
+ * forwards, leaving 0 for ITERATOR_FIRST. Entries keep their order when
+ * compaction moves them, so an iteration finds its place again by its
+ * number, and entries may be removed or added while iterating. */
+
+static inline unsigned seq_order(Hashmap *h, unsigned seq) {
+        /* Numbers wrap around, order them from the oldest one an
+         * iterator may hold to the one after the newest */
+        return seq - h->seq - 2;
+}
+
+static inline bool in_gap(Hashmap *h, unsigned p) {
+        return h->compacting && p >= h->compact_to && p < h->compact_from;
+}
+
+static unsigned seek_seq(Hashmap *h, unsigned seq) {
+        unsigned gap_start = 0, gap_len = 0, lo = 0, hi, v, p;
+
+        /* The holes compaction moves entries across may hold any
+         * number, every other position is in insertion order, holes
+         * included */
+        if (h->compacting && h->compact_to < h->n_used) {
+                gap_start = h->compact_to;
+                gap_len = MIN(h->compact_from, h->n_used) - gap_start;
+        }
+
+        /* Find the first position not inserted before seq */
+        hi = h->n_used - gap_len;
+        while (lo < hi) {
+                v = lo + (hi - lo) / 2;
+                p = v < gap_start ? v : v + gap_len;
+                if (seq_order(h, h->entries[p].seq) < seq_order(h, seq))
+                        lo = v + 1;
+                else
+                        hi = v;
+        }
+
+        return lo < gap_start ? lo : lo + gap_len;
+}
+
+static inline bool at_last_returned(Hashmap *h, unsigned seq) {
+        return h->iter_seq == seq && h->iter_pos < h->n_used &&
+                h->entries[h->iter_pos].seq == seq && !in_gap(h, h->iter_pos);
+}
+
+static inline void returned(Hashmap *h, unsigned p) {
+        h->iter_pos = p;
+        h->iter_seq = h->entries[p].seq;
+}
+
 void *hashmap_iterate(Hashmap *h, Iterator *i, const void **key) {
         struct hashmap_entry *e;
+        unsigned p, seq;
 
         assert(i);
 
@@ -656,20 +911,29 @@ void *hashmap_iterate(Hashmap *h, Iterator *i, const void **key) {
         if (*i == ITERATOR_LAST)
                 goto at_end;
 
-        if (*i == ITERATOR_FIRST && !h->iterate_list_head)
-                goto at_end;
+        if (*i == ITERATOR_FIRST)
+                p = h->first;
+        else {
+                seq = PTR_TO_UINT(*i) - 1;
+                if (at_last_returned(h, seq - 1))
+                        p = h->iter_pos + 1;
+                else
+                        p = seek_seq(h, seq);
+        }
 
-        e = *i == ITERATOR_FIRST ? h->iterate_list_head : (struct hashmap_entry*) *i;
+        for (; p < h->n_used; p++) {
+                e = &h->entries[p];
+                if (!e->used)
+                        continue;
 
-        if (e->iterate_next)
-                *i = (Iterator) e->iterate_next;
-        else
-                *i = ITERATOR_LAST;
+                *i = (Iterator) UINT_TO_PTR(e->seq + 2);
+                returned(h, p);
 
-        if (key)
-                *key = e->key;
+                if (key)
+                        *key = e->key;
 
-        return e->value;
+                return e->value;
+        }
 
 at_end:
         *i = ITERATOR_LAST;
@@ -682,6 +946,7 @@ at_end:
 
 void *hashmap_iterate_backwards(Hashmap *h, Iterator *i, const void **key) {
         struct hashmap_entry *e;
+        unsigned p, seq;
 
         assert(i);
 
@@ -691,20 +956,30 @@ void *hashmap_iterate_backwards(Hashmap *h, Iterator *i, const void **key) {
         if (*i == ITERATOR_FIRST)
                 goto at_beginning;
 
-        if (*i == ITERATOR_LAST && !h->iterate_list_tail)
-                goto at_beginning;
+        /* p is one past the position to continue from */
+        if (*i == ITERATOR_LAST)
+                p = h->n_used;
+        else {
+                seq = PTR_TO_UINT(*i);
+                if (at_last_returned(h, seq))
+                        p = h->iter_pos;
+                else
+                        p = seek_seq(h, seq);
+        }
 
-        e = *i == ITERATOR_LAST ? h->iterate_list_tail : (struct hashmap_entry*) *i;
+        while (p > 0) {
+                e = &h->entries[--p];
+                if (!e->used)
+                        continue;
 
-        if (e->iterate_previous)
-                *i = (Iterator) e->iterate_previous;
-        else
-                *i = ITERATOR_FIRST;
+                *i = (Iterator) UINT_TO_PTR(e->seq);
+                returned(h, p);
 
-        if (key)
-                *key = e->key;
+                if (key)
+                        *key = e->key;
 
-        return e->value;
+                return e->value;
+        }
 
 at_beginning:
         *i = ITERATOR_FIRST;
@@ -716,19 +991,17 @@ at_beginning:
 }
 
 void *hashmap_iterate_skip(Hashmap *h, const void *key, Iterator *i) {
-        unsigned hash;
         struct hashmap_entry *e;
 
         if (!h)
                 return NULL;
 
-        hash = h->hash_func(key) % h->n_buckets;
-
-        e = hash_scan(h, hash, key);
+        e = find_entry(h, h->hash_func(key), key, NULL);
         if (!e)
                 return NULL;
 
-        *i = (Iterator) e;
+        /* Continue from the entry itself */
+        *i = (Iterator) UINT_TO_PTR(e->seq + 1);
 
         return e->value;
 }
@@ -738,10 +1011,10 @@ void* hashmap_first(Hashmap *h) {
         if (!h)
                 return NULL;
 
-        if (!h->iterate_list_head)
+        if (h->n_entries == 0)
                 return NULL;
 
-        return h->iterate_list_head->value;
+        return h->entries[h->first].value;
 }
 
 void* hashmap_first_key(Hashmap *h) {
@@ -749,21 +1022,25 @@ void* hashmap_first_key(Hashmap *h) {
         if (!h)
                 return NULL;
 
-        if (!h->iterate_list_head)
+        if (h->n_entries == 0)
                 return NULL;
 
-        return (void*) h->iterate_list_head->key;
+        return (void*) h->entries[h->first].key;
 }
 
 void* hashmap_last(Hashmap *h) {
+        unsigned p;
 
         if (!h)
                 return NULL;
 
-        if (!h->iterate_list_tail)
+        if (h->n_entries == 0)
                 return NULL;
 
-        return h->iterate_list_tail->value;
+        for (p = h->n_used - 1; !h->entries[p].used; p--)
+                ;
+
+        return h->entries[p].value;
 }
 
 void* hashmap_steal_first(Hashmap *h) {
@@ -772,11 +1049,11 @@ void* hashmap_steal_first(Hashmap *h) {
         if (!h)
                 return NULL;
 
-        if (!h->iterate_list_head)
+        if (h->n_entries == 0)
                 return NULL;
 
-        data = h->iterate_list_head->value;
-        remove_entry(h, h->iterate_list_head);
+        data = h->entries[h->first].value;
+        remove_entry(h, &h->entries[h->first], NULL);
 
         return data;
 }
@@ -787,11 +1064,11 @@ void* hashmap_steal_first_key(Hashmap *h) {
         if (!h)
                 return NULL;
 
-        if (!h->iterate_list_head)
+        if (h->n_entries == 0)
                 return NULL;
 
-        key = (void*) h->iterate_list_head->key;
-        remove_entry(h, h->iterate_list_head);
+        key = (void*) h->entries[h->first].key;
+        remove_entry(h, &h->entries[h->first], NULL);
 
         return key;
 }
@@ -806,10 +1083,18 @@ unsigned hashmap_size(Hashmap *h) {
 
 unsigned hashmap_buckets(Hashmap *h) {
 
+        if (!h || !h->slots)
+                return 0;
+
+        return 1U << h->n_bits;
+}
+
+unsigned hashmap_allocated(Hashmap *h) {
+
         if (!h)
                 return 0;
 
-        return h->n_buckets;
+        return h->n_allocated;
 }
 
 bool hashmap_isempty(Hashmap *h) {
@@ -821,17 +1106,20 @@ bool hashmap_isempty(Hashmap *h) {
 }
 
 int hashmap_merge(Hashmap *h, Hashmap *other) {
-        struct hashmap_entry *e;
+        unsigned i;
 
         assert(h);
 
         if (!other)
                 return 0;
 
-        for (e = other->iterate_list_head; e; e = e->iterate_next) {
+        for (i = 0; i < other->n_used; i++) {
                 int r;
 
-                if ((r = hashmap_put(h, e->key, e->value)) < 0)
+                if (!other->entries[i].used)
+                        continue;
+
+                if ((r = hashmap_put(h, other->entries[i].key, other->entries[i].value)) < 0)
                         if (r != -EEXIST)
                                 return r;
         }
@@ -840,53 +1128,57 @@ int hashmap_merge(Hashmap *h, Hashmap *other) {
 }
 
 void hashmap_move(Hashmap *h, Hashmap *other) {
-        struct hashmap_entry *e, *n;
+        Iterator i;
+        const void *key;
+        void *value;
 
         assert(h);
 
         /* The same as hashmap_merge(), but every new item from other
-         * is moved to h. This function is guaranteed to succeed. */
+         * is moved to h. Items h has no room for stay in other. */
 
         if (!other)
                 return;
 
-        for (e = other->iterate_list_head; e; e = n) {
-                unsigned h_hash, other_hash;
-
-                n = e->iterate_next;
-
-                h_hash = h->hash_func(e->key) % h->n_buckets;
+        /* Removals compact other, so walk it with an iterator */
+        HASHMAP_FOREACH_KEY(value, key, other, i) {
+                unsigned hash;
 
-                if (hash_scan(h, h_hash, e->key))
+                hash = h->hash_func(key);
+                if (find_entry(h, hash, key, NULL))
                         continue;
 
-                other_hash = other->hash_func(e->key) % other->n_buckets;
+                if (append_entry(h, key, value, hash) < 0)
+                        continue;
 
-                unlink_entry(other, e, other_hash);
-                link_entry(h, e, h_hash);
+                remove_entry(other, &other->entries[other->iter_pos], NULL);
         }
 }
 
 int hashmap_move_one(Hashmap *h, Hashmap *other, const void *key) {
-        unsigned h_hash, other_hash;
         struct hashmap_entry *e;
+        struct hashmap_slot *s;
+        unsigned hash;
+        int r;
 
         if (!other)
                 return 0;
 
         assert(h);
 
-        h_hash = h->hash_func(key) % h->n_buckets;
-        if (hash_scan(h, h_hash, key))
+        hash = h->hash_func(key);
+        if (find_entry(h, hash, key, NULL))
                 return -EEXIST;
 
-        other_hash = other->hash_func(key) % other->n_buckets;
-        e = hash_scan(other, other_hash, key);
+        e = find_entry(other, other->hash_func(key), key, &s);
         if (!e)
                 return -ENOENT;
 
-        unlink_entry(other, e, other_hash);
-        link_entry(h, e, h_hash);
+        r = append_entry(h, e->key, e->value, hash);
+        if (r < 0)
+                return r;
+
+        remove_entry(other, e, s);
 
         return 0;
 }
@@ -927,8 +1219,8 @@ char **hashmap_get_strv(Hashmap *h) {
 }
 
 void *hashmap_next(Hashmap *h, const void *key) {
-        unsigned hash;
         struct hashmap_entry *e;
+        unsigned p;
 
         assert(h);
         assert(key);
@@ -936,14 +1228,13 @@ void *hashmap_next(Hashmap *h, const void *key) {
         if (!h)
                 return NULL;
 
-        hash = h->hash_func(key) % h->n_buckets;
-        e = hash_scan(h, hash, key);
+        e = find_entry(h, h->hash_func(key), key, NULL);
         if (!e)
                 return NULL;
 
-        e = e->iterate_next;
-        if (!e)
-                return NULL;
+        for (p = (unsigned) (e - h->entries) + 1; p < h->n_used; p++)
+                if (h->entries[p].used)
+                        return h->entries[p].value;
 
-        return e->value;
+        return NULL;
 }
@@ -29,10 +29,17 @@
 
 #include "macro.h"
 
-/* Pretty straightforward hash table implementation. As a minor
- * optimization a NULL hashmap object will be treated as empty hashmap
- * for all read operations. That way it is not necessary to
- * instantiate an object for each Hashmap use. */
+/* Open addressing hash table with Robin Hood probing over an array of
+ * entries kept in insertion order, which is also the iteration order.
+ * The index grows and the holes left by removals are squeezed out
+ * incrementally, a few slots or entries per insertion or removal.
+ * Entries may be removed or added while iterating, added ones are
+ * visited too, and iterators stay valid while holes are squeezed out,
+ * also when an iteration is left before its end. As a
+ * minor optimization a NULL hashmap object
+ * will be treated as empty hashmap for all read operations. That way
+ * it is not necessary to instantiate an object for each Hashmap
+ * use. */
 
 typedef struct Hashmap Hashmap;
 typedef struct _IteratorStruct _IteratorStruct;
@@ -82,6 +89,7 @@ int hashmap_move_one(Hashmap *h, Hashmap *other, const void *key);
 unsigned hashmap_size(Hashmap *h) _pure_;
 bool hashmap_isempty(Hashmap *h) _pure_;
 unsigned hashmap_buckets(Hashmap *h) _pure_;
+unsigned hashmap_allocated(Hashmap *h) _pure_;
 
 void *hashmap_iterate(Hashmap *h, Iterator *i, const void **key);
 void *hashmap_iterate_backwards(Hashmap *h, Iterator *i, const void **key);
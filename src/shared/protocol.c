@@ -17,9 +17,14 @@
 #include <errno.h>
 #include <poll.h>
 #include <pthread.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 
+#include "buxtonbatch.h"
 #include "buxtonclient.h"
 #include "buxtonkey.h"
 #include "buxtonresponse.h"
@@ -42,6 +47,8 @@ struct notify_value {
 	struct timeval tv;
 	BuxtonControlMessage type;
 	_BuxtonKey *key;
+	_BuxtonBatch *batch;
+	_BuxtonClient *client;
 };
 
 static uint32_t get_msgid(void)
@@ -49,6 +56,13 @@ static uint32_t get_msgid(void)
 	return __sync_fetch_and_add(&_msgid, 1);
 }
 
+static void free_notify_value(struct notify_value *nv)
+{
+	key_free(nv->key);
+	batch_free(nv->batch);
+	free(nv);
+}
+
 bool setup_callbacks(void)
 {
 	bool r = false;
@@ -100,8 +114,8 @@ void cleanup_callbacks(void)
 	if (callbacks) {
 		HASHMAP_FOREACH_KEY(nvi, hkey, callbacks, it) {
 			(void)hashmap_remove(callbacks, (void *)hkey);
-			key_free(nvi->key);
-			free(nvi);
+			nvi->client->outstanding--;
+			free_notify_value(nvi);
 		}
 		hashmap_free(callbacks);
 	}
@@ -110,8 +124,7 @@ void cleanup_callbacks(void)
 	if (notify_callbacks) {
 		HASHMAP_FOREACH_KEY(nvi, hkey, notify_callbacks, it) {
 			(void)hashmap_remove(notify_callbacks, (void *)hkey);
-			key_free(nvi->key);
-			free(nvi);
+			free_notify_value(nvi);
 		}
 		hashmap_free(notify_callbacks);
 	}
@@ -166,41 +179,264 @@ void reap_callbacks(void)
 	HASHMAP_FOREACH_KEY(nvi, hkey, callbacks, it) {
 		if (tv.tv_sec - nvi->tv.tv_sec > TIMEOUT) {
 			(void)hashmap_remove(callbacks, (void *)hkey);
-			key_free(nvi->key);
-			free(nvi);
+			nvi->client->outstanding--;
+			free_notify_value(nvi);
 		}
 	}
 }
 
-bool send_message(_BuxtonClient *client, uint8_t *send, size_t send_len,
-		  BuxtonCallback callback, void *data, uint32_t msgid,
-		  BuxtonControlMessage type, _BuxtonKey *key)
+/**
+ * Forget the callback of a request that couldn't be sent
+ * @param msgid Message id of the request
+ */
+static void drop_request(uint32_t msgid)
 {
 	struct notify_value *nv;
-	_BuxtonKey *k = NULL;
-	int s;
-	bool r = false;
 
-	nv = malloc0(sizeof(struct notify_value));
-	if (!nv) {
-		goto fail;
+	if (pthread_mutex_lock(&callback_guard)) {
+		return;
 	}
+#if UINTPTR_MAX == 0xffffffffffffffff
+	nv = hashmap_remove(callbacks, (void *)((uint64_t)msgid));
+#else
+	nv = hashmap_remove(callbacks, (void *)msgid);
+#endif
+	if (nv) {
+		nv->client->outstanding--;
+		free_notify_value(nv);
+	}
+	(void)pthread_mutex_unlock(&callback_guard);
+}
 
-	if (key) {
-		k = malloc0(sizeof(_BuxtonKey));
-		if (!k) {
-			goto fail;
+/**
+ * Add a serialized request to the client's queue
+ * @param client A client in pipelined mode
+ * @param send Serialized request, taken over if it is the send buffer
+ * @param send_len Size of send
+ * @return a boolean value, indicating success of the operation
+ */
+static bool push_request(_BuxtonClient *client, uint8_t *send,
+			 size_t send_len)
+{
+	struct iovec *iov;
+
+	if (!greedy_realloc((void **)&client->queue, &client->queue_alloc,
+			    sizeof(struct iovec) * (client->queue_len + 1))) {
+		return false;
+	}
+	iov = &client->queue[client->queue_len];
+
+	if (send == client->send_buf) {
+		/* The next request gets serialized into a new buffer */
+		client->send_buf = NULL;
+		client->send_alloc = 0;
+	} else {
+		iov->iov_base = malloc(send_len);
+		if (!iov->iov_base) {
+			return false;
 		}
-		if (!buxton_key_copy(key, k)) {
-			goto fail;
+		memcpy(iov->iov_base, send, send_len);
+		send = iov->iov_base;
+	}
+	iov->iov_base = send;
+	iov->iov_len = send_len;
+	client->queue_len++;
+
+	/* Don't let the queue grow past what a single writev takes */
+	if (client->queue_len >= IOV_MAX) {
+		return buxton_wire_flush(client);
+	}
+
+	return true;
+}
+
+bool buxton_wire_flush(_BuxtonClient *client)
+{
+	struct iovec iov[IOV_MAX];
+	struct msghdr msg;
+	struct pollfd pfd;
+	size_t done = 0;
+	size_t first = 0;
+	size_t n;
+	ssize_t b;
+	bool ret = true;
+
+	assert(client);
+
+	memzero(&msg, sizeof(struct msghdr));
+
+	while (ret && done < client->queue_len) {
+		n = client->queue_len - done;
+		if (n > IOV_MAX) {
+			n = IOV_MAX;
 		}
+		memcpy(iov, client->queue + done, sizeof(struct iovec) * n);
+
+		first = 0;
+		while (first < n) {
+			/* sendmsg() is writev() that does not raise SIGPIPE */
+			msg.msg_iov = iov + first;
+			msg.msg_iovlen = n - first;
+			b = sendmsg(client->fd, &msg, MSG_NOSIGNAL);
+			if (b < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				if (errno != EAGAIN) {
+					buxton_debug("sendmsg error\n");
+					ret = false;
+					break;
+				}
+				/* Wait for the daemon to catch up */
+				pfd.fd = client->fd;
+				pfd.events = POLLOUT;
+				pfd.revents = 0;
+				if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+					ret = false;
+					break;
+				}
+				continue;
+			}
+
+			/* Skip what was written, which may end mid-request */
+			while (first < n && (size_t)b >= iov[first].iov_len) {
+				b -= (ssize_t)iov[first].iov_len;
+				first++;
+			}
+			if (first < n) {
+				iov[first].iov_base = (uint8_t *)iov[first].iov_base + b;
+				iov[first].iov_len -= (size_t)b;
+			}
+		}
+		done += first;
+	}
+
+	/* Requests that didn't go out whole will never be answered */
+	for (size_t i = done; i < client->queue_len; i++) {
+		uint32_t msgid;
+
+		memcpy(&msgid, (uint8_t *)client->queue[i].iov_base +
+		       BUXTON_MSGID_OFFSET, sizeof(uint32_t));
+		drop_request(msgid);
+	}
+
+	buxton_wire_clear_queue(client);
+
+	return ret;
+}
+
+void buxton_wire_clear_queue(_BuxtonClient *client)
+{
+	assert(client);
+
+	for (size_t i = 0; i < client->queue_len; i++) {
+		free(client->queue[i].iov_base);
+	}
+	client->queue_len = 0;
+}
+
+int buxton_wire_wait_all(_BuxtonClient *client, int timeout)
+{
+	struct pollfd pfd;
+	struct timeval start, now;
+	size_t outstanding;
+	int wait = timeout;
+	int r;
+
+	assert(client);
+
+	if (client->queue_len && !buxton_wire_flush(client)) {
+		return -EIO;
 	}
 
+	(void)gettimeofday(&start, NULL);
+	while (true) {
+		r = pthread_mutex_lock(&callback_guard);
+		if (r) {
+			return -r;
+		}
+		outstanding = client->outstanding;
+		(void)pthread_mutex_unlock(&callback_guard);
+		if (outstanding == 0) {
+			return 0;
+		}
+
+		if (timeout >= 0) {
+			(void)gettimeofday(&now, NULL);
+			wait = timeout - (int)((now.tv_sec - start.tv_sec) * 1000 +
+					       (now.tv_usec - start.tv_usec) / 1000);
+			if (wait < 0) {
+				wait = 0;
+			}
+		}
+
+		pfd.fd = client->fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		r = poll(&pfd, 1, wait);
+		if (r == 0) {
+			return -ETIME;
+		} else if (r < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -errno;
+		}
+
+		if (buxton_wire_handle_response(client) < 0) {
+			return -EBADMSG;
+		}
+		if (pfd.revents & (POLLHUP | POLLERR)) {
+			return -EPIPE;
+		}
+	}
+}
+
+/**
+ * Write a whole request to the daemon
+ * @param fd Socket connected to the daemon
+ * @param buf Serialized request
+ * @param len Length of buf
+ * @return a boolean value, false with errno set (EPIPE if the daemon is gone)
+ */
+static bool send_all(int fd, uint8_t *buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t b;
+
+	while (done < len) {
+		/* Unlike write(), a closed connection can't kill the client */
+		b = send(fd, buf + done, len - done, MSG_NOSIGNAL);
+		if (b < 0) {
+			if (errno != EINTR && errno != EAGAIN) {
+				buxton_debug("send error\n");
+				return false;
+			}
+			continue;
+		}
+		done += (size_t)b;
+	}
+
+	return true;
+}
+
+/**
+ * Register the callback for a request and write the request out
+ * @param client An open client connection
+ * @param send Serialized request
+ * @param send_len Size of send
+ * @param msgid Message id of the request
+ * @param nv Callback for the reply, freed if it can't be registered
+ * @return a boolean value, indicating success of the operation
+ */
+static bool queue_request(_BuxtonClient *client, uint8_t *send,
+			  size_t send_len, uint32_t msgid,
+			  struct notify_value *nv)
+{
+	int s;
+
 	(void)gettimeofday(&nv->tv, NULL);
-	nv->cb = callback;
-	nv->data = data;
-	nv->type = type;
-	nv->key = k;
+	nv->client = client;
 
 	s = pthread_mutex_lock(&callback_guard);
 	if (s) {
@@ -214,29 +450,67 @@ bool send_message(_BuxtonClient *client, uint8_t *send, size_t send_len,
 #else
 	s = hashmap_put(callbacks, (void *)msgid, nv);
 #endif
-	(void)pthread_mutex_unlock(&callback_guard);
 
 	if (s < 1) {
+		(void)pthread_mutex_unlock(&callback_guard);
 		buxton_debug("Error adding callback for msgid: %llu\n", msgid);
 		goto fail;
 	}
+	client->outstanding++;
+	(void)pthread_mutex_unlock(&callback_guard);
+
+	if (client->pipelined) {
+		if (!push_request(client, send, send_len)) {
+			drop_request(msgid);
+			return false;
+		}
+		return true;
+	}
 
 	/* Now write it off */
-	if (!_write(client->fd, send, send_len)) {
+	if (!send_all(client->fd, send, send_len)) {
 		buxton_debug("Write failed for msgid: %llu\n", msgid);
-		r = false;
-	} else {
-		r = true;
+		drop_request(msgid);
+		return false;
 	}
 
-	return r;
+	return true;
 
 fail:
-	free(nv);
-	key_free(k);
+	free_notify_value(nv);
 	return false;
 }
 
+bool send_message(_BuxtonClient *client, uint8_t *send, size_t send_len,
+		  BuxtonCallback callback, void *data, uint32_t msgid,
+		  BuxtonControlMessage type, _BuxtonKey *key)
+{
+	struct notify_value *nv;
+
+	nv = malloc0(sizeof(struct notify_value));
+	if (!nv) {
+		return false;
+	}
+
+	if (key) {
+		nv->key = malloc0(sizeof(_BuxtonKey));
+		if (!nv->key) {
+			free(nv);
+			return false;
+		}
+		if (!buxton_key_copy(key, nv->key)) {
+			free_notify_value(nv);
+			return false;
+		}
+	}
+
+	nv->cb = callback;
+	nv->data = data;
+	nv->type = type;
+
+	return queue_request(client, send, send_len, msgid, nv);
+}
+
 void lock_mutex(void)
 {
 	buxton_debug("Value of mutex %d", callback_guard.__data.__lock);
@@ -248,10 +522,58 @@ void unlock_mutex(void)
 	pthread_mutex_unlock(&callback_guard);
 }
 
+/**
+ * Run the callback of a batch once for each of its operations
+ * @param nv Callback of the batch
+ * @param list Reply to the batch
+ * @param count Number of elements in list
+ */
+static void run_batch_callbacks(struct notify_value *nv, BuxtonData *list,
+				size_t count)
+{
+	BuxtonData failed;
+	BuxtonBatchOp *op;
+	size_t pos = 1;
+	size_t n;
+
+	failed.type = BUXTON_TYPE_INT32;
+	failed.store.d_int32 = -1;
+
+	for (size_t i = 0; i < nv->batch->len; i++) {
+		op = &nv->batch->ops[i];
+
+		/* The daemon rejected the whole batch, or a commit's
+		 * operations share its status */
+		if (list[0].store.d_int32 != 0 ||
+		    nv->type == BUXTON_CONTROL_COMMIT) {
+			run_callback((BuxtonCallback)(nv->cb), nv->data, 1,
+				     list, op->type, &op->key);
+			continue;
+		}
+		if (pos >= count || list[pos].type != BUXTON_TYPE_INT32) {
+			run_callback((BuxtonCallback)(nv->cb), nv->data, 1,
+				     &failed, op->type, &op->key);
+			continue;
+		}
+
+		/* Successful gets are followed by their value */
+		n = 1;
+		if (op->type == BUXTON_CONTROL_GET &&
+		    list[pos].store.d_int32 == 0 && pos + 1 < count) {
+			n = 2;
+		}
+		run_callback((BuxtonCallback)(nv->cb), nv->data, n, &list[pos],
+			     op->type, &op->key);
+		pos += n;
+	}
+}
+
 void handle_callback_response(BuxtonControlMessage msg, uint32_t msgid,
 			      BuxtonData *list, size_t count)
 {
 	struct notify_value *nv;
+	_BuxtonKey *key;
+	_BuxtonKey changed;
 
 	/* use notification callbacks for notification messages */
 	if (msg == BUXTON_CONTROL_CHANGED) {
@@ -264,13 +586,30 @@ void handle_callback_response(BuxtonControlMessage msg, uint32_t msgid,
 			return;
 		}
 
+		/* Wildcard notifications name the key changed, ahead of
+		 * its value, which is passed on as the key's own */
+		key = nv->key;
+		if (buxton_key_is_wildcard(key)) {
+			if (count < 1 || list[0].type != BUXTON_TYPE_STRING) {
+				return;
+			}
+			changed = *key;
+			changed.name = list[0].store.d_string;
+			if (count > 1) {
+				changed.type = list[1].type;
+			}
+			key = &changed;
+			list++;
+			count--;
+		}
+
 		/*
 		* unlocking mutex to be able to call other client api's
 		* in notification callbacks
 		*/
 		(void)pthread_mutex_unlock(&callback_guard);
 		run_callback((BuxtonCallback)(nv->cb), nv->data, count, list,
-			     BUXTON_CONTROL_CHANGED, nv->key);
+			     BUXTON_CONTROL_CHANGED, key);
 		(void)pthread_mutex_lock(&callback_guard);
 		return;
 	}
@@ -283,6 +622,7 @@ void handle_callback_response(BuxtonControlMessage msg, uint32_t msgid,
 	if (!nv) {
 		return;
 	}
+	nv->client->outstanding--;
 
 	if (nv->type == BUXTON_CONTROL_NOTIFY) {
 		if (list[0].type == BUXTON_TYPE_INT32 &&
@@ -312,11 +652,15 @@ void handle_callback_response(BuxtonControlMessage msg, uint32_t msgid,
 
 	/* callback should be run on notfiy or unnotify failure */
 	/* and on any other server message we are waiting for */
-	run_callback((BuxtonCallback)(nv->cb), nv->data, count, list, nv->type,
-		     nv->key);
+	if (nv->type == BUXTON_CONTROL_BATCH ||
+	    nv->type == BUXTON_CONTROL_COMMIT) {
+		run_batch_callbacks(nv, list, count);
+	} else {
+		run_callback((BuxtonCallback)(nv->cb), nv->data, count, list,
+			     nv->type, nv->key);
+	}
 
-	key_free(nv->key);
-	free(nv);
+	free_notify_value(nv);
 }
 
 ssize_t buxton_wire_handle_response(_BuxtonClient *client)
@@ -413,6 +757,11 @@ int buxton_wire_get_response(_BuxtonClient *client)
 	int r;
 	ssize_t processed;
 
+	/* Requests queued in pipelined mode must go out before waiting */
+	if (client->queue_len && !buxton_wire_flush(client)) {
+		return -EIO;
+	}
+
 	pfd[0].fd = client->fd;
 	pfd[0].events = POLLIN;
 	pfd[0].revents = 0;
@@ -429,90 +778,49 @@ int buxton_wire_get_response(_BuxtonClient *client)
 	return (int)processed;
 }
 
-bool buxton_wire_set_value(_BuxtonClient *client, _BuxtonKey *key,
-			   const void *value, BuxtonCallback callback,
-			   void *data)
+/**
+ * Serialize a request into the client's send buffer and send it
+ * @param client An open client connection
+ * @param type The type of request
+ * @param params Parameters of the request
+ * @param count Number of parameters
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @param key Key the request is about, or NULL
+ * @return a boolean value, indicating success of the operation
+ */
+static bool send_request(_BuxtonClient *client, BuxtonControlMessage type,
+			 BuxtonData *params, size_t count,
+			 BuxtonCallback callback, void *data, _BuxtonKey *key)
 {
-	_cleanup_free_ uint8_t *send = NULL;
-	bool ret = false;
-	size_t send_len = 0;
-	BuxtonArray *list = NULL;
-	BuxtonData d_layer;
-	BuxtonData d_group;
-	BuxtonData d_name;
-	BuxtonData d_value;
+	size_t send_len;
 	uint32_t msgid = get_msgid();
 
-	buxton_string_to_data(&key->layer, &d_layer);
-	buxton_string_to_data(&key->group, &d_group);
-	buxton_string_to_data(&key->name, &d_name);
-	d_value.type = key->type;
-	switch (key->type) {
-	case BUXTON_TYPE_STRING:
-		/* cast until BuxtonString is updated */
-		d_value.store.d_string.value = (char *)value;
-		d_value.store.d_string.length = (uint32_t)strlen((char *)value) + 1;
-		break;
-	case BUXTON_TYPE_INT32:
-		d_value.store.d_int32 = *(const int32_t *)value;
-		break;
-	case BUXTON_TYPE_INT64:
-		d_value.store.d_int64 = *(const int64_t *)value;
-		break;
-	case BUXTON_TYPE_UINT32:
-		d_value.store.d_uint32 = *(const uint32_t *)value;
-		break;
-	case BUXTON_TYPE_UINT64:
-		d_value.store.d_uint64 = *(const uint64_t *)value;
-		break;
-	case BUXTON_TYPE_FLOAT:
-		d_value.store.d_float = *(const float *)value;
-		break;
-	case BUXTON_TYPE_DOUBLE:
-		memcpy(&d_value.store.d_double, value, sizeof(double));
-		break;
-	case BUXTON_TYPE_BOOLEAN:
-		d_value.store.d_boolean = *(const bool *)value;
-		break;
-	default:
-		break;
-	}
-
-	list = buxton_array_new();
-	if (!buxton_array_add(list, &d_layer)) {
-		buxton_log("Failed to add layer to set_value array\n");
-		goto end;
-	}
-	if (!buxton_array_add(list, &d_group)) {
-		buxton_log("Failed to add group to set_value array\n");
-		goto end;
-	}
-	if (!buxton_array_add(list, &d_name)) {
-		buxton_log("Failed to add name to set_value array\n");
-		goto end;
-	}
-	if (!buxton_array_add(list, &d_value)) {
-		buxton_log("Failed to add value to set_value array\n");
-		goto end;
-	}
-
-	send_len = buxton_serialize_message(&send, BUXTON_CONTROL_SET, msgid, list);
-
+	send_len = buxton_serialize_message_into(&client->send_buf,
+						 &client->send_alloc, type,
+						 msgid, params, count, NULL);
 	if (send_len == 0) {
-		goto end;
+		buxton_log("Failed to serialize request message\n");
+		return false;
 	}
 
+	return send_message(client, client->send_buf, send_len, callback,
+			    data, msgid, type, key);
+}
 
-	if (!send_message(client, send, send_len, callback, data, msgid,
-			  BUXTON_CONTROL_SET, key)) {
-		goto end;
-	}
+bool buxton_wire_set_value(_BuxtonClient *client, _BuxtonKey *key,
+			   const void *value, BuxtonCallback callback,
+			   void *data)
+{
+	BuxtonData params[4];
 
-	ret = true;
+	buxton_string_to_data(&key->layer, &params[0]);
+	buxton_string_to_data(&key->group, &params[1]);
+	buxton_string_to_data(&key->name, &params[2]);
+	buxton_value_to_data(key->type, value, &params[3]);
 
-end:
-	buxton_array_free(&list, NULL);
-	return ret;
+	return send_request(client, BUXTON_CONTROL_SET, params, 4, callback,
+			    data, key);
 }
 
 bool buxton_wire_set_label(_BuxtonClient *client,
@@ -523,57 +831,18 @@ bool buxton_wire_set_label(_BuxtonClient *client,
 	assert(key);
 	assert(value);
 
-	_cleanup_free_ uint8_t *send = NULL;
-	bool ret = false;
-	size_t send_len = 0;
-	BuxtonArray *list = NULL;
-	BuxtonData d_layer;
-	BuxtonData d_group;
-	BuxtonData d_name;
-	BuxtonData d_value;
-	uint32_t msgid = get_msgid();
-
-	buxton_string_to_data(&key->layer, &d_layer);
-	buxton_string_to_data(&key->group, &d_group);
-	buxton_string_to_data(value, &d_value);
+	BuxtonData params[4];
+	size_t count = 0;
 
-	list = buxton_array_new();
-	if (!buxton_array_add(list, &d_layer)) {
-		buxton_log("Failed to add layer to set_label array\n");
-		goto end;
-	}
-	if (!buxton_array_add(list, &d_group)) {
-		buxton_log("Failed to add group to set_label array\n");
-		goto end;
-	}
+	buxton_string_to_data(&key->layer, &params[count++]);
+	buxton_string_to_data(&key->group, &params[count++]);
 	if (key->name.value) {
-		buxton_string_to_data(&key->name, &d_name);
-		if (!buxton_array_add(list, &d_name)) {
-			buxton_log("Failed to add name to set_label array\n");
-			goto end;
-		}
-	}
-	if (!buxton_array_add(list, &d_value)) {
-		buxton_log("Failed to add value to set_label array\n");
-		goto end;
-	}
-
-	send_len = buxton_serialize_message(&send, BUXTON_CONTROL_SET_LABEL, msgid, list);
-
-	if (send_len == 0) {
-		goto end;
-	}
-
-	if (!send_message(client, send, send_len, callback, data, msgid,
-			  BUXTON_CONTROL_SET_LABEL, key)) {
-		goto end;
+		buxton_string_to_data(&key->name, &params[count++]);
 	}
+	buxton_string_to_data(value, &params[count++]);
 
-	ret = true;
-
-end:
-	buxton_array_free(&list, NULL);
-	return ret;
+	return send_request(client, BUXTON_CONTROL_SET_LABEL, params, count,
+			    callback, data, key);
 }
 
 bool buxton_wire_create_group(_BuxtonClient *client, _BuxtonKey *key,
@@ -582,43 +851,13 @@ bool buxton_wire_create_group(_BuxtonClient *client, _BuxtonKey *key,
 	assert(client);
 	assert(key);
 
-	_cleanup_free_ uint8_t *send = NULL;
-	bool ret = false;
-	size_t send_len = 0;
-	BuxtonArray *list = NULL;
-	BuxtonData d_layer;
-	BuxtonData d_group;
-	uint32_t msgid = get_msgid();
-
-	buxton_string_to_data(&key->layer, &d_layer);
-	buxton_string_to_data(&key->group, &d_group);
+	BuxtonData params[2];
 
-	list = buxton_array_new();
-	if (!buxton_array_add(list, &d_layer)) {
-		buxton_log("Failed to add layer to create_group array\n");
-		goto end;
-	}
-	if (!buxton_array_add(list, &d_group)) {
-		buxton_log("Failed to add group to create_group array\n");
-		goto end;
-	}
-
-	send_len = buxton_serialize_message(&send, BUXTON_CONTROL_CREATE_GROUP, msgid, list);
-
-	if (send_len == 0) {
-		goto end;
-	}
+	buxton_string_to_data(&key->layer, &params[0]);
+	buxton_string_to_data(&key->group, &params[1]);
 
-	if (!send_message(client, send, send_len, callback, data, msgid,
-			  BUXTON_CONTROL_CREATE_GROUP, key)) {
-		goto end;
-	}
-
-	ret = true;
-
-end:
-	buxton_array_free(&list, NULL);
-	return ret;
+	return send_request(client, BUXTON_CONTROL_CREATE_GROUP, params, 2,
+			    callback, data, key);
 }
 
 bool buxton_wire_remove_group(_BuxtonClient *client, _BuxtonKey *key,
@@ -627,100 +866,31 @@ bool buxton_wire_remove_group(_BuxtonClient *client, _BuxtonKey *key,
 	assert(client);
 	assert(key);
 
-	_cleanup_free_ uint8_t *send = NULL;
-	bool ret = false;
-	size_t send_len = 0;
-	BuxtonArray *list = NULL;
-	BuxtonData d_layer;
-	BuxtonData d_group;
-	uint32_t msgid = get_msgid();
-
-	buxton_string_to_data(&key->layer, &d_layer);
-	buxton_string_to_data(&key->group, &d_group);
-
-	list = buxton_array_new();
-	if (!buxton_array_add(list, &d_layer)) {
-		buxton_log("Failed to add layer to remove_group array\n");
-		goto end;
-	}
-	if (!buxton_array_add(list, &d_group)) {
-		buxton_log("Failed to add group to remove_group array\n");
-		goto end;
-	}
+	BuxtonData params[2];
 
-	send_len = buxton_serialize_message(&send, BUXTON_CONTROL_REMOVE_GROUP, msgid, list);
+	buxton_string_to_data(&key->layer, &params[0]);
+	buxton_string_to_data(&key->group, &params[1]);
 
-	if (send_len == 0) {
-		goto end;
-	}
-
-	if (!send_message(client, send, send_len, callback, data, msgid,
-			  BUXTON_CONTROL_REMOVE_GROUP, key)) {
-		goto end;
-	}
-
-	ret = true;
-
-end:
-	buxton_array_free(&list, NULL);
-	return ret;
+	return send_request(client, BUXTON_CONTROL_REMOVE_GROUP, params, 2,
+			    callback, data, key);
 }
 
 bool buxton_wire_get_value(_BuxtonClient *client, _BuxtonKey *key,
 			   BuxtonCallback callback, void *data)
 {
-	bool ret = false;
-	size_t send_len = 0;
-	_cleanup_free_ uint8_t *send = NULL;
-	BuxtonArray *list = NULL;
-	BuxtonData d_layer;
-	BuxtonData d_group;
-	BuxtonData d_name;
-	BuxtonData d_type;
-	uint32_t msgid = get_msgid();
+	BuxtonData params[4];
+	size_t count = 0;
 
-	buxton_string_to_data(&key->group, &d_group);
-	buxton_string_to_data(&key->name, &d_name);
-	d_type.type = BUXTON_TYPE_UINT32;
-	d_type.store.d_int32 = key->type;
-
-	list = buxton_array_new();
 	if (key->layer.value) {
-		buxton_string_to_data(&key->layer, &d_layer);
-		if (!buxton_array_add(list, &d_layer)) {
-			buxton_log("Unable to prepare get_value message\n");
-			goto end;
-		}
+		buxton_string_to_data(&key->layer, &params[count++]);
 	}
-	if (!buxton_array_add(list, &d_group)) {
-		buxton_log("Failed to add group to get_value array\n");
-		goto end;
-	}
-	if (!buxton_array_add(list, &d_name)) {
-		buxton_log("Failed to add name to get_value array\n");
-		goto end;
-	}
-	if (!buxton_array_add(list, &d_type)) {
-		buxton_log("Failed to add type to get_value array\n");
-		goto end;
-	}
-
-	send_len = buxton_serialize_message(&send, BUXTON_CONTROL_GET, msgid, list);
-
-	if (send_len == 0) {
-		goto end;
-	}
-
-	if (!send_message(client, send, send_len, callback, data, msgid,
-			  BUXTON_CONTROL_GET, key)) {
-		goto end;
-	}
-
-	ret = true;
+	buxton_string_to_data(&key->group, &params[count++]);
+	buxton_string_to_data(&key->name, &params[count++]);
+	params[count].type = BUXTON_TYPE_UINT32;
+	params[count++].store.d_int32 = key->type;
 
-end:
-	buxton_array_free(&list, NULL);
-	return ret;
+	return send_request(client, BUXTON_CONTROL_GET, params, count,
+			    callback, data, key);
 }
 
 bool buxton_wire_get_label(_BuxtonClient *client, _BuxtonKey *key,
@@ -729,51 +899,17 @@ bool buxton_wire_get_label(_BuxtonClient *client, _BuxtonKey *key,
 	assert(client);
 	assert(key);
 
-	_cleanup_free_ uint8_t *send = NULL;
-	bool ret = false;
-	size_t send_len = 0;
-	BuxtonArray *list = NULL;
-	BuxtonData d_layer;
-	BuxtonData d_group;
-	BuxtonData d_name;
-	uint32_t msgid = get_msgid();
-
-	buxton_string_to_data(&key->layer, &d_layer);
-	buxton_string_to_data(&key->group, &d_group);
+	BuxtonData params[3];
+	size_t count = 0;
 
-	list = buxton_array_new();
-	if (!buxton_array_add(list, &d_layer)) {
-		buxton_log("Failed to add layer to get_label array\n");
-		goto end;
-	}
-	if (!buxton_array_add(list, &d_group)) {
-		buxton_log("Failed to add group to get_label array\n");
-		goto end;
-	}
+	buxton_string_to_data(&key->layer, &params[count++]);
+	buxton_string_to_data(&key->group, &params[count++]);
 	if (key->name.value) {
-		buxton_string_to_data(&key->name, &d_name);
-		if (!buxton_array_add(list, &d_name)) {
-			buxton_log("Failed to add name to get_label array\n");
-			goto end;
-		}
-	}
-
-	send_len = buxton_serialize_message(&send, BUXTON_CONTROL_GET_LABEL, msgid, list);
-
-	if (send_len == 0) {
-		goto end;
+		buxton_string_to_data(&key->name, &params[count++]);
 	}
 
-	if (!send_message(client, send, send_len, callback, data, msgid,
-			  BUXTON_CONTROL_GET_LABEL, key)) {
-		goto end;
-	}
-
-	ret = true;
-
-end:
-	buxton_array_free(&list, NULL);
-	return ret;
+	return send_request(client, BUXTON_CONTROL_GET_LABEL, params, count,
+			    callback, data, key);
 }
 
 bool buxton_wire_unset_value(_BuxtonClient *client,
@@ -784,57 +920,16 @@ bool buxton_wire_unset_value(_BuxtonClient *client,
 	assert(client);
 	assert(key);
 
-	_cleanup_free_ uint8_t *send = NULL;
-	size_t send_len = 0;
-	BuxtonArray *list = NULL;
-	BuxtonData d_group;
-	BuxtonData d_name;
-	BuxtonData d_layer;
-	BuxtonData d_type;
-	bool ret = false;
-	uint32_t msgid = get_msgid();
+	BuxtonData params[4];
 
-	buxton_string_to_data(&key->group, &d_group);
-	buxton_string_to_data(&key->name, &d_name);
-	buxton_string_to_data(&key->layer, &d_layer);
-	d_type.type = BUXTON_TYPE_UINT32;
-	d_type.store.d_int32 = key->type;
+	buxton_string_to_data(&key->layer, &params[0]);
+	buxton_string_to_data(&key->group, &params[1]);
+	buxton_string_to_data(&key->name, &params[2]);
+	params[3].type = BUXTON_TYPE_UINT32;
+	params[3].store.d_int32 = key->type;
 
-	list = buxton_array_new();
-	if (!buxton_array_add(list, &d_layer)) {
-		buxton_log("Failed to add layer to set_value array\n");
-		goto end;
-	}
-	if (!buxton_array_add(list, &d_group)) {
-		buxton_log("Failed to add group to set_value array\n");
-		goto end;
-	}
-	if (!buxton_array_add(list, &d_name)) {
-		buxton_log("Failed to add name to set_value array\n");
-		goto end;
-	}
-	if (!buxton_array_add(list, &d_type)) {
-		buxton_log("Failed to add type to set_value array\n");
-		goto end;
-	}
-
-	send_len = buxton_serialize_message(&send, BUXTON_CONTROL_UNSET,
-					    msgid, list);
-
-	if (send_len == 0) {
-		goto end;
-	}
-
-	if (!send_message(client, send, send_len, callback, data, msgid,
-			  BUXTON_CONTROL_UNSET, key)) {
-		goto end;
-	}
-
-	ret = true;
-
-end:
-	buxton_array_free(&list, NULL);
-	return ret;
+	return send_request(client, BUXTON_CONTROL_UNSET, params, 4,
+			    callback, data, key);
 }
 
 bool buxton_wire_list_keys(_BuxtonClient *client,
@@ -845,39 +940,12 @@ bool buxton_wire_list_keys(_BuxtonClient *client,
 	assert(client);
 	assert(layer);
 
-	_cleanup_free_ uint8_t *send = NULL;
-	size_t send_len = 0;
-	BuxtonArray *list = NULL;
 	BuxtonData d_layer;
-	bool ret = false;
-	uint32_t msgid = get_msgid();
 
 	buxton_string_to_data(layer, &d_layer);
 
-	list = buxton_array_new();
-	if (!buxton_array_add(list, &d_layer)) {
-		buxton_log("Unable to add layer to list_keys array\n");
-		goto end;
-	}
-
-	send_len = buxton_serialize_message(&send, BUXTON_CONTROL_LIST, msgid,
-					    list);
-
-	if (send_len == 0) {
-		goto end;
-	}
-
-	if (!send_message(client, send, send_len, callback, data, msgid,
-			  BUXTON_CONTROL_LIST, NULL)) {
-		goto end;
-	}
-
-	ret = true;
-
-end:
-	buxton_array_free(&list, NULL);
-
-	return ret;
+	return send_request(client, BUXTON_CONTROL_LIST, &d_layer, 1,
+			    callback, data, NULL);
 }
 
 bool buxton_wire_list_names(_BuxtonClient *client,
@@ -890,106 +958,37 @@ bool buxton_wire_list_names(_BuxtonClient *client,
 	assert(client);
 	assert(layer);
 
-	_cleanup_free_ uint8_t *send = NULL;
-	size_t send_len = 0;
-	BuxtonArray *list = NULL;
-	BuxtonData d_layer;
-	BuxtonData d_group;
-	BuxtonData d_prefix;
-	bool ret = false;
-	uint32_t msgid = get_msgid();
-
-	buxton_string_to_data(layer, &d_layer);
-	buxton_string_to_data(group, &d_group);
-	buxton_string_to_data(prefix, &d_prefix);
+	BuxtonData params[3];
 
-	list = buxton_array_new();
-	if (!buxton_array_add(list, &d_layer)) {
-		buxton_log("Unable to add layer to list_names array\n");
-		goto end;
-	}
-	if (!buxton_array_add(list, &d_group)) {
-		buxton_log("Unable to add group to list_names array\n");
-		goto end;
-	}
-	if (!buxton_array_add(list, &d_prefix)) {
-		buxton_log("Unable to add prefix to list_names array\n");
-		goto end;
-	}
-
-	send_len = buxton_serialize_message(&send, BUXTON_CONTROL_LIST_NAMES, msgid,
-					    list);
-
-	if (send_len == 0) {
-		goto end;
-	}
+	buxton_string_to_data(layer, &params[0]);
+	buxton_string_to_data(group, &params[1]);
+	buxton_string_to_data(prefix, &params[2]);
 
-	if (!send_message(client, send, send_len, callback, data, msgid,
-			  BUXTON_CONTROL_LIST_NAMES, NULL)) {
-		goto end;
-	}
-
-	ret = true;
-
-end:
-	buxton_array_free(&list, NULL);
-
-	return ret;
+	return send_request(client, BUXTON_CONTROL_LIST_NAMES, params, 3,
+			    callback, data, NULL);
 }
 
 bool buxton_wire_register_notification(_BuxtonClient *client,
 				       _BuxtonKey *key,
+				       uint32_t window,
 				       BuxtonCallback callback,
 				       void *data)
 {
 	assert(client);
 	assert(key);
 
-	_cleanup_free_ uint8_t *send = NULL;
-	size_t send_len = 0;
-	BuxtonArray *list = NULL;
-	BuxtonData d_group;
-	BuxtonData d_name;
-	BuxtonData d_type;
-	bool ret = false;
-	uint32_t msgid = get_msgid();
-
-	buxton_string_to_data(&key->group, &d_group);
-	buxton_string_to_data(&key->name, &d_name);
-	d_type.type = BUXTON_TYPE_UINT32;
-	d_type.store.d_int32 = key->type;
-
-	list = buxton_array_new();
-	if (!buxton_array_add(list, &d_group)) {
-		buxton_log("Failed to add group to set_value array\n");
-		goto end;
-	}
-	if (!buxton_array_add(list, &d_name)) {
-		buxton_log("Failed to add name to set_value array\n");
-		goto end;
-	}
-	if (!buxton_array_add(list, &d_type)) {
-		buxton_log("Failed to add type to set_value array\n");
-		goto end;
-	}
-
-	send_len = buxton_serialize_message(&send, BUXTON_CONTROL_NOTIFY, msgid,
-					    list);
-
-	if (send_len == 0) {
-		goto end;
-	}
+	BuxtonData params[4];
 
-	if (!send_message(client, send, send_len, callback, data, msgid,
-			  BUXTON_CONTROL_NOTIFY, key)) {
-		goto end;
-	}
+	buxton_string_to_data(&key->group, &params[0]);
+	buxton_string_to_data(&key->name, &params[1]);
+	params[2].type = BUXTON_TYPE_UINT32;
+	params[2].store.d_int32 = key->type;
+	/* The window is left out when unused, as older daemons expect */
+	params[3].type = BUXTON_TYPE_UINT32;
+	params[3].store.d_uint32 = window;
 
-	ret = true;
-
-end:
-	buxton_array_free(&list, NULL);
-	return ret;
+	return send_request(client, BUXTON_CONTROL_NOTIFY, params,
+			    window ? 4 : 3, callback, data, key);
 }
 
 bool buxton_wire_unregister_notification(_BuxtonClient *client,
@@ -1000,51 +999,124 @@ bool buxton_wire_unregister_notification(_BuxtonClient *client,
 	assert(client);
 	assert(key);
 
-	_cleanup_free_ uint8_t *send = NULL;
-	size_t send_len = 0;
-	BuxtonArray *list = NULL;
-	BuxtonData d_group;
-	BuxtonData d_name;
-	BuxtonData d_type;
-	bool ret = false;
-	uint32_t msgid = get_msgid();
+	BuxtonData params[3];
 
-	buxton_string_to_data(&key->group, &d_group);
-	buxton_string_to_data(&key->name, &d_name);
-	d_type.type = BUXTON_TYPE_UINT32;
-	d_type.store.d_int32 = key->type;
+	buxton_string_to_data(&key->group, &params[0]);
+	buxton_string_to_data(&key->name, &params[1]);
+	params[2].type = BUXTON_TYPE_UINT32;
+	params[2].store.d_int32 = key->type;
+
+	return send_request(client, BUXTON_CONTROL_UNNOTIFY, params, 3,
+			    callback, data, key);
+}
 
-	list = buxton_array_new();
-	if (!buxton_array_add(list, &d_group)) {
-		buxton_log("Failed to add group to set_value array\n");
-		goto end;
+/**
+ * Send the operations of a batch in a single request
+ * @param client An open client connection
+ * @param type BUXTON_CONTROL_BATCH or BUXTON_CONTROL_COMMIT
+ * @param batch Operations to send
+ * @param callback A callback function called once per operation
+ * @param data User data to be used with callback function
+ * @return a boolean value, indicating success of the operation
+ */
+static bool send_batch(_BuxtonClient *client, BuxtonControlMessage type,
+		       _BuxtonBatch *batch, BuxtonCallback callback,
+		       void *data)
+{
+	assert(client);
+	assert(batch);
+
+	_cleanup_free_ BuxtonData *params = NULL;
+	struct notify_value *nv;
+	BuxtonBatchOp *op;
+	size_t count = 0;
+	size_t n_gets = 0;
+	size_t n, start;
+	size_t send_len;
+	uint32_t msgid;
+
+	/* The reply carries the value of each get, and has to fit in a
+	 * message as well */
+	for (size_t i = 0; i < batch->len; i++) {
+		if (batch->ops[i].type == BUXTON_CONTROL_GET) {
+			n_gets++;
+		}
 	}
-	if (!buxton_array_add(list, &d_name)) {
-		buxton_log("Failed to add name to set_value array\n");
-		goto end;
+	if (n_gets > BUXTON_BATCH_MAX_GETS) {
+		buxton_log("Batch of %zu gets is too large\n", n_gets);
+		return false;
 	}
-	if (!buxton_array_add(list, &d_type)) {
-		buxton_log("Failed to add type to set_value array\n");
-		goto end;
+
+	/* Each operation is its type and parameter count, then at most
+	 * four parameters */
+	params = malloc(sizeof(BuxtonData) * batch->len * 6);
+	if (batch->len && !params) {
+		return false;
 	}
 
-	send_len = buxton_serialize_message(&send, BUXTON_CONTROL_UNNOTIFY,
-					    msgid, list);
+	for (size_t i = 0; i < batch->len; i++) {
+		op = &batch->ops[i];
+		params[count].type = BUXTON_TYPE_UINT32;
+		params[count++].store.d_uint32 = op->type;
+		n = count++;
+		start = count;
+
+		if (op->key.layer.value || op->type != BUXTON_CONTROL_GET) {
+			buxton_string_to_data(&op->key.layer, &params[count++]);
+		}
+		buxton_string_to_data(&op->key.group, &params[count++]);
+		buxton_string_to_data(&op->key.name, &params[count++]);
+		if (op->type == BUXTON_CONTROL_SET) {
+			params[count++] = op->value;
+		} else {
+			params[count].type = BUXTON_TYPE_UINT32;
+			params[count++].store.d_uint32 = op->key.type;
+		}
+
+		params[n].type = BUXTON_TYPE_UINT32;
+		params[n].store.d_uint32 = (uint32_t)(count - start);
+	}
 
+	msgid = get_msgid();
+	send_len = buxton_serialize_message_into(&client->send_buf,
+						 &client->send_alloc,
+						 type, msgid,
+						 params, count, NULL);
 	if (send_len == 0) {
-		goto end;
+		buxton_log("Failed to serialize batch message\n");
+		return false;
+	}
+	if (send_len > BUXTON_MESSAGE_MAX_LENGTH) {
+		buxton_log("Batch of %zu operations is too large\n", batch->len);
+		return false;
 	}
 
-	if (!send_message(client, send, send_len, callback, data, msgid,
-			  BUXTON_CONTROL_UNNOTIFY, key)) {
-		goto end;
+	nv = malloc0(sizeof(struct notify_value));
+	if (!nv) {
+		return false;
 	}
+	nv->cb = callback;
+	nv->data = data;
+	nv->type = type;
+	nv->batch = batch_copy_keys(batch);
+	if (!nv->batch) {
+		free(nv);
+		return false;
+	}
+
+	return queue_request(client, client->send_buf, send_len, msgid, nv);
+}
 
-	ret = true;
+bool buxton_wire_batch(_BuxtonClient *client, _BuxtonBatch *batch,
+		       BuxtonCallback callback, void *data)
+{
+	return send_batch(client, BUXTON_CONTROL_BATCH, batch, callback, data);
+}
 
-end:
-	buxton_array_free(&list, NULL);
-	return ret;
+bool buxton_wire_commit(_BuxtonClient *client, _BuxtonBatch *batch,
+			BuxtonCallback callback, void *data)
+{
+	return send_batch(client, BUXTON_CONTROL_COMMIT, batch, callback, data);
 }
 
 void include_protocol(void)
@@ -21,6 +21,7 @@
 #endif
 
 #include "buxton.h"
+#include "buxtonbatch.h"
 #include "buxtonclient.h"
 #include "buxtonkey.h"
 #include "list.h"
@@ -99,6 +100,32 @@ ssize_t buxton_wire_handle_response(_BuxtonClient *client)
  */
 int buxton_wire_get_response(_BuxtonClient *client);
 
+/**
+ * Send every request queued in pipelined mode with a single writev
+ *
+ * The callbacks of requests that couldn't be sent are dropped.
+ * @param client Client connection
+ * @return a boolean value, indicating success of the operation
+ */
+bool buxton_wire_flush(_BuxtonClient *client)
+	__attribute__((warn_unused_result));
+
+/**
+ * Drop the requests queued in pipelined mode without sending them
+ * @param client Client connection
+ */
+void buxton_wire_clear_queue(_BuxtonClient *client);
+
+/**
+ * Flush queued requests, then handle responses until none of the
+ * client's requests is outstanding
+ * @param client Client connection
+ * @param timeout Milliseconds to wait for, or -1 to wait as long as needed
+ * @return 0 once every response was handled, or a negative errno value
+ */
+int buxton_wire_wait_all(_BuxtonClient *client, int timeout)
+	__attribute__((warn_unused_result));
+
 /**
  * Send a SET message over the wire protocol, return the response
  * @param client Client connection
@@ -206,12 +233,14 @@ bool buxton_wire_unset_value(_BuxtonClient *client,
  * Send a NOTIFY message over the protocol, register for events
  * @param client Client connection
  * @param key _BuxtonKey pointer
+ * @param window Least time in ms between notifications, or 0
  * @param callback A callback function to handle daemon reply
  * @param data User data to be used with callback function
  * @return a boolean value, indicating success of the operation
  */
 bool buxton_wire_register_notification(_BuxtonClient *client,
 				       _BuxtonKey *key,
+				       uint32_t window,
 				       BuxtonCallback callback,
 				       void *data)
 	__attribute__((warn_unused_result));
@@ -262,6 +291,30 @@ bool buxton_wire_unregister_notification(_BuxtonClient *client,
 					 void *data)
 	__attribute__((warn_unused_result));
 
+/**
+ * Send a BATCH message over the protocol, run several operations
+ * @param client Client connection
+ * @param batch Operations to run, in order
+ * @param callback A callback function called once per operation
+ * @param data User data to be used with callback function
+ * @return a boolean value, indicating success of the operation
+ */
+bool buxton_wire_batch(_BuxtonClient *client, _BuxtonBatch *batch,
+		       BuxtonCallback callback, void *data)
+	__attribute__((warn_unused_result));
+
+/**
+ * Send a COMMIT message over the protocol, apply changes atomically
+ * @param client Client connection
+ * @param batch Sets and unsets to apply, all on the same layer
+ * @param callback A callback function called once per operation
+ * @param data User data to be used with callback function
+ * @return a boolean value, indicating success of the operation
+ */
+bool buxton_wire_commit(_BuxtonClient *client, _BuxtonBatch *batch,
+			BuxtonCallback callback, void *data)
+	__attribute__((warn_unused_result));
+
 void include_protocol(void);
 
 /**
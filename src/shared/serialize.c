@@ -186,43 +186,177 @@ void buxton_deserialize(uint8_t *source, BuxtonData *target,
 	target->type = type;
 }
 
-size_t buxton_serialize_message(uint8_t **dest, BuxtonControlMessage message,
-				uint32_t msgid, BuxtonArray *list)
+/**
+ * Get the wire length of a message parameter's value
+ * @param param Parameter to measure
+ * @param length Set to the length of the value
+ * @return a boolean value, false if the parameter type is invalid
+ */
+static bool param_length(BuxtonData *param, size_t *length)
 {
-	uint16_t i = 0;
-	uint8_t *data = NULL;
-	size_t ret = 0;
+	switch (param->type) {
+	case BUXTON_TYPE_STRING:
+		*length = param->store.d_string.length;
+		break;
+	case BUXTON_TYPE_INT32:
+		*length = sizeof(int32_t);
+		break;
+	case BUXTON_TYPE_UINT32:
+		*length = sizeof(uint32_t);
+		break;
+	case BUXTON_TYPE_INT64:
+		*length = sizeof(int64_t);
+		break;
+	case BUXTON_TYPE_UINT64:
+		*length = sizeof(uint64_t);
+		break;
+	case BUXTON_TYPE_FLOAT:
+		*length = sizeof(float);
+		break;
+	case BUXTON_TYPE_DOUBLE:
+		*length = sizeof(double);
+		break;
+	case BUXTON_TYPE_BOOLEAN:
+		*length = sizeof(bool);
+		break;
+	default:
+		buxton_log("Invalid parameter type %lu\n", param->type);
+		return false;
+	}
+
+	return true;
+}
+
+size_t buxton_serialized_param_length(BuxtonData *param)
+{
+	size_t length;
+
+	assert(param);
+
+	if (!param_length(param, &length)) {
+		return 0;
+	}
+
+	return sizeof(uint16_t) + sizeof(uint32_t) + length;
+}
+
+/**
+ * Write a message parameter
+ * @param data Where to write the parameter
+ * @param param Parameter to write
+ * @param length Length of the value, from param_length
+ * @return the number of bytes written
+ */
+static size_t write_param(uint8_t *data, BuxtonData *param, size_t length)
+{
+	size_t offset = 0;
+	uint16_t type = (uint16_t)param->type;
+	uint32_t p_length = (uint32_t)length;
+
+	/* Copy data type */
+	memcpy(data+offset, &type, sizeof(uint16_t));
+	offset += sizeof(uint16_t);
+
+	/* Write out the length of value */
+	memcpy(data+offset, &p_length, sizeof(uint32_t));
+	offset += sizeof(uint32_t);
+
+	switch (param->type) {
+	case BUXTON_TYPE_STRING:
+		memcpy(data+offset, param->store.d_string.value, length);
+		break;
+	case BUXTON_TYPE_INT32:
+		memcpy(data+offset, &(param->store.d_int32), sizeof(int32_t));
+		break;
+	case BUXTON_TYPE_UINT32:
+		memcpy(data+offset, &(param->store.d_uint32), sizeof(uint32_t));
+		break;
+	case BUXTON_TYPE_INT64:
+		memcpy(data+offset, &(param->store.d_int64), sizeof(int64_t));
+		break;
+	case BUXTON_TYPE_UINT64:
+		memcpy(data+offset, &(param->store.d_uint64), sizeof(uint64_t));
+		break;
+	case BUXTON_TYPE_FLOAT:
+		memcpy(data+offset, &(param->store.d_float), sizeof(float));
+		break;
+	case BUXTON_TYPE_DOUBLE:
+		memcpy(data+offset, &(param->store.d_double), sizeof(double));
+		break;
+	case BUXTON_TYPE_BOOLEAN:
+		memcpy(data+offset, &(param->store.d_boolean), sizeof(bool));
+		break;
+	default:
+		/* already tested by param_length, can't get here
+		 * normally */
+		assert(0);
+	}
+
+	return offset + length;
+}
+
+size_t buxton_serialize_message_into(uint8_t **dest, size_t *allocated,
+				     BuxtonControlMessage message,
+				     uint32_t msgid, BuxtonData *params,
+				     size_t count, BuxtonArray *tail)
+{
+	uint8_t *data;
 	size_t offset = 0;
-	size_t size = 0;
-	size_t curSize = 0;
+	size_t size;
+	size_t length;
+	size_t n_params;
 	uint16_t control, msg;
+	uint32_t value;
+	BuxtonData *param;
 
 	assert(dest);
+	assert(allocated);
+	assert(params || count == 0);
 
 	buxton_debug("Serializing message...\n");
 
-	if (list->len > BUXTON_MESSAGE_MAX_PARAMS) {
+	n_params = count + (tail ? tail->len : 0);
+	if (n_params > BUXTON_MESSAGE_MAX_PARAMS) {
 		errno = EINVAL;
-		return ret;
+		return 0;
 	}
 
 	if (message >= BUXTON_CONTROL_MAX || message < BUXTON_CONTROL_SET) {
 		errno = EINVAL;
-		return ret;
+		return 0;
 	}
 
 	/*
-	 * initial size =
+	 * size =
 	 * control code + control message (uint16_t * 2) +
 	 * message size (uint32_t) +
 	 * message id (uint32_t) +
-	 * param count (uint32_t)
+	 * param count (uint32_t) +
+	 * type (uint16_t) + length (uint32_t) + value for each param
 	 */
-	data = malloc0(sizeof(uint32_t) + sizeof(uint32_t) + sizeof(uint32_t) +
-		       sizeof(uint32_t));
+	size = BUXTON_MESSAGE_EMPTY_LENGTH;
+	for (size_t i = 0; i < n_params; i++) {
+		param = i < count ? &params[i] : buxton_array_get(tail, (uint16_t)(i - count));
+		if (!param) {
+			errno = EINVAL;
+			return 0;
+		}
+		if (!param_length(param, &length)) {
+			errno = EINVAL;
+			return 0;
+		}
+		size += sizeof(uint16_t) + sizeof(uint32_t) + length;
+	}
+
+	if (size > UINT32_MAX) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	data = greedy_realloc((void **)dest, allocated, size);
 	if (!data) {
 		errno = ENOMEM;
-		goto end;
+		return 0;
 	}
 
 	control = BUXTON_CONTROL_CODE;
@@ -233,155 +367,73 @@ size_t buxton_serialize_message(uint8_t **dest, BuxtonControlMessage message,
 	memcpy(data+offset, &msg, sizeof(uint16_t));
 	offset += sizeof(uint16_t);
 
-	/* Save room for final size */
+	value = (uint32_t)size;
+	memcpy(data+offset, &value, sizeof(uint32_t));
 	offset += sizeof(uint32_t);
 
 	memcpy(data+offset, &msgid, sizeof(uint32_t));
 	offset += sizeof(uint32_t);
 
 	/* Now write the parameter count */
-	memcpy(data+offset, &(list->len), sizeof(uint32_t));
+	value = (uint32_t)n_params;
+	memcpy(data+offset, &value, sizeof(uint32_t));
 	offset += sizeof(uint32_t);
 
-	size = offset;
-
 	/* Deal with parameters */
-	BuxtonData *param;
-	size_t p_length = 0;
-	for (i=0; i < list->len; i++) {
-		param = buxton_array_get(list, i);
-		if (!param) {
-			errno = EINVAL;
-			goto fail;
-		}
-
-		switch (param->type) {
-		case BUXTON_TYPE_STRING:
-			p_length = param->store.d_string.length;
-			break;
-		case BUXTON_TYPE_INT32:
-			p_length = sizeof(int32_t);
-			break;
-		case BUXTON_TYPE_UINT32:
-			p_length = sizeof(uint32_t);
-			break;
-		case BUXTON_TYPE_INT64:
-			p_length = sizeof(int64_t);
-			break;
-		case BUXTON_TYPE_UINT64:
-			p_length = sizeof(uint64_t);
-			break;
-		case BUXTON_TYPE_FLOAT:
-			p_length = sizeof(float);
-			break;
-		case BUXTON_TYPE_DOUBLE:
-			p_length = sizeof(double);
-			break;
-		case BUXTON_TYPE_BOOLEAN:
-			p_length = sizeof(bool);
-			break;
-		default:
-			errno = EINVAL;
-			buxton_log("Invalid parameter type %lu\n", param->type);
-			goto fail;
-		};
-
+	for (size_t i = 0; i < n_params; i++) {
+		param = i < count ? &params[i] : buxton_array_get(tail, (uint16_t)(i - count));
+		(void)param_length(param, &length);
 		buxton_debug("offset: %lu\n", offset);
-		buxton_debug("value length: %lu\n", p_length);
-
-		/* Need to allocate enough room to hold this data */
-		size += sizeof(uint16_t) + sizeof(uint32_t) + p_length;
-
-		if (curSize < size) {
-			if (!(data = greedy_realloc((void**)&data, &curSize, size))) {
-				errno = ENOMEM;
-				goto fail;
-			}
-			memzero(data+offset, size - offset);
-		}
-
-		/* Copy data type */
-		memcpy(data+offset, &(param->type), sizeof(uint16_t));
-		offset += sizeof(uint16_t);
+		buxton_debug("value length: %lu\n", length);
+		offset += write_param(data+offset, param, length);
+	}
 
-		/* Write out the length of value */
-		memcpy(data+offset, &p_length, sizeof(uint32_t));
-		offset += sizeof(uint32_t);
+	assert(offset == size);
 
-		switch (param->type) {
-		case BUXTON_TYPE_STRING:
-			memcpy(data+offset, param->store.d_string.value, p_length);
-			break;
-		case BUXTON_TYPE_INT32:
-			memcpy(data+offset, &(param->store.d_int32), sizeof(int32_t));
-			break;
-		case BUXTON_TYPE_UINT32:
-			memcpy(data+offset, &(param->store.d_uint32), sizeof(uint32_t));
-			break;
-		case BUXTON_TYPE_INT64:
-			memcpy(data+offset, &(param->store.d_int64), sizeof(int64_t));
-			break;
-		case BUXTON_TYPE_UINT64:
-			memcpy(data+offset, &(param->store.d_uint64), sizeof(uint64_t));
-			break;
-		case BUXTON_TYPE_FLOAT:
-			memcpy(data+offset, &(param->store.d_float), sizeof(float));
-			break;
-		case BUXTON_TYPE_DOUBLE:
-			memcpy(data+offset, &(param->store.d_double), sizeof(double));
-			break;
-		case BUXTON_TYPE_BOOLEAN:
-			memcpy(data+offset, &(param->store.d_boolean), sizeof(bool));
-			break;
-		default:
-			/* already tested this above, can't get here
-			 * normally */
-			assert(0);
-		};
-		offset += p_length;
-		p_length = 0;
-	}
+	buxton_debug("Serializing returned:%lu\n", size);
+	return size;
+}
 
-	memcpy(data+BUXTON_LENGTH_OFFSET, &offset, sizeof(uint32_t));
+size_t buxton_serialize_message(uint8_t **dest, BuxtonControlMessage message,
+				uint32_t msgid, BuxtonArray *list)
+{
+	uint8_t *data = NULL;
+	size_t allocated = 0;
+	size_t ret;
 
-	ret = offset;
-	*dest = data;
+	assert(dest);
+	assert(list);
 
-fail:
-	/* Clean up */
+	ret = buxton_serialize_message_into(&data, &allocated, message, msgid,
+					    NULL, 0, list);
 	if (ret == 0) {
 		free(data);
+		return 0;
 	}
-end:
-	buxton_debug("Serializing returned:%lu\n", ret);
+
+	*dest = data;
 	return ret;
 }
 
-ssize_t buxton_deserialize_message(uint8_t *data,
+/**
+ * Parse the header of a message
+ * @param data The source data to be deserialized
+ * @param size The size of the data being deserialized
+ * @param r_message Set to the message type
+ * @param r_msgid Set to the message ID
+ * @return the number of parameters, or -1 with errno set on failure
+ */
+static ssize_t deserialize_header(uint8_t *data, size_t size,
 				  BuxtonControlMessage *r_message,
-				  size_t size, uint32_t *r_msgid,
-				  BuxtonData **list)
+				  uint32_t *r_msgid)
 {
 	size_t offset = 0;
-	ssize_t ret = -1;
-	size_t min_length = BUXTON_MESSAGE_HEADER_LENGTH;
 	uint16_t control, message;
-	size_t n_params, c_param, c_length;
-	BuxtonDataType c_type = 0;
-	BuxtonData *k_list = NULL;
-	BuxtonData c_data;
-	uint32_t msgid;
-
-	assert(data);
-	assert(r_message);
-	assert(list);
-
-	buxton_debug("Deserializing message...\n");
-	buxton_debug("size=%lu\n", size);
+	size_t n_params;
 
-	if (size < min_length) {
+	if (size < BUXTON_MESSAGE_HEADER_LENGTH) {
 		errno = EINVAL;
-		goto end;
+		return -1;
 	}
 
 	/* Copy the control code */
@@ -391,7 +443,7 @@ ssize_t buxton_deserialize_message(uint8_t *data,
 	/* Check this is a valid buxton message */
 	if (control != BUXTON_CONTROL_CODE) {
 		errno = EINVAL;
-		goto end;
+		return -1;
 	}
 
 	/* Obtain the control message */
@@ -401,31 +453,51 @@ ssize_t buxton_deserialize_message(uint8_t *data,
 	/* Ensure control message is in valid range */
 	if (message <= BUXTON_CONTROL_MIN || message >= BUXTON_CONTROL_MAX) {
 		errno = EINVAL;
-		goto end;
+		return -1;
 	}
 
 	/* Skip size since our caller got this already */
 	offset += sizeof(uint32_t);
 
+	/* Don't read the message id and count past the end of the buffer */
+	if (offset + sizeof(uint32_t) * 2 > size) {
+		errno = EINVAL;
+		return -1;
+	}
+
 	/* Obtain the message id */
-	msgid = *(uint32_t*)(data+offset);
+	*r_msgid = *(uint32_t*)(data+offset);
 	offset += sizeof(uint32_t);
 
 	/* Obtain number of parameters */
 	n_params = *(uint32_t*)(data+offset);
-	offset += sizeof(uint32_t);
 	buxton_debug("total params: %d\n", n_params);
 
 	if (n_params > BUXTON_MESSAGE_MAX_PARAMS) {
 		errno = EINVAL;
-		goto end;
+		return -1;
 	}
 
-	k_list = malloc0(sizeof(BuxtonData)*n_params);
-	if (n_params && !k_list) {
-		errno = ENOMEM;
-		goto end;
-	}
+	*r_message = message;
+	return (ssize_t)n_params;
+}
+
+/**
+ * Parse the parameters of a message into a BuxtonData array
+ * @param data The source data to be deserialized
+ * @param size The size of the data being deserialized
+ * @param n_params Number of parameters in the message
+ * @param list Array of at least n_params entries to fill out
+ * @param borrow Whether strings point into data rather than being copied
+ * @return a boolean value, indicating success of the operation
+ */
+static bool deserialize_params(uint8_t *data, size_t size, size_t n_params,
+			       BuxtonData *list, bool borrow)
+{
+	size_t offset = BUXTON_MESSAGE_HEADER_LENGTH + sizeof(uint32_t) * 2;
+	size_t c_param, c_length;
+	BuxtonDataType c_type = 0;
+	BuxtonData c_data;
 
 	memzero(&c_data, sizeof(BuxtonData));
 
@@ -434,8 +506,7 @@ ssize_t buxton_deserialize_message(uint8_t *data,
 		buxton_debug("offset=%lu\n", offset);
 		/* Don't read past the end of the buffer */
 		if (offset + sizeof(uint16_t) + sizeof(uint32_t) > size) {
-			errno = EINVAL;
-			goto end;
+			goto fail;
 		}
 
 		/* Now unpack type */
@@ -443,41 +514,39 @@ ssize_t buxton_deserialize_message(uint8_t *data,
 		offset += sizeof(uint16_t);
 
 		if (c_type >= BUXTON_TYPE_MAX || c_type <= BUXTON_TYPE_MIN) {
-			errno = EINVAL;
-			goto end;
+			goto fail;
 		}
 
 		/* Retrieve the length of the value */
 		c_length = *(uint32_t*)(data+offset);
 		if (c_length == 0 && c_type != BUXTON_TYPE_STRING) {
-			errno = EINVAL;
-			goto end;
+			goto fail;
 		}
 		offset += sizeof(uint32_t);
 		buxton_debug("value length: %lu\n", c_length);
 
 		/* Don't try to read past the end of our buffer */
 		if (offset + c_length > size) {
-			errno = EINVAL;
-			goto end;
+			goto fail;
 		}
 
 		switch (c_type) {
 		case BUXTON_TYPE_STRING:
 			if (c_length) {
-				c_data.store.d_string.value = malloc(c_length);
-				if (!c_data.store.d_string.value) {
-					errno = ENOMEM;
-					goto end;
-				}
-				memcpy(c_data.store.d_string.value, data+offset, c_length);
-				c_data.store.d_string.length = (uint32_t)c_length;
-				if (c_data.store.d_string.value[c_length-1] != 0x00) {
-					errno = EINVAL;
+				if (data[offset + c_length - 1] != 0x00) {
 					buxton_debug("buxton_deserialize_message(): Garbage message\n");
-					free(c_data.store.d_string.value);
-					goto end;
+					goto fail;
 				}
+				if (borrow) {
+					c_data.store.d_string.value = (char *)(data+offset);
+				} else {
+					c_data.store.d_string.value = malloc(c_length);
+					if (!c_data.store.d_string.value) {
+						abort();
+					}
+					memcpy(c_data.store.d_string.value, data+offset, c_length);
+				}
+				c_data.store.d_string.length = (uint32_t)c_length;
 			} else {
 				c_data.store.d_string.value = NULL;
 				c_data.store.d_string.length = 0;
@@ -505,30 +574,103 @@ ssize_t buxton_deserialize_message(uint8_t *data,
 			c_data.store.d_boolean = *(bool*)(data+offset);
 			break;
 		default:
-			errno = EINVAL;
-			goto end;
+			goto fail;
 		}
 		c_data.type = c_type;
-		k_list[c_param] = c_data;
+		list[c_param] = c_data;
 		memzero(&c_data, sizeof(BuxtonData));
 		offset += c_length;
 	}
+
+	return true;
+
+fail:
+	if (!borrow) {
+		for (size_t i = 0; i < c_param; i++) {
+			if (list[i].type == BUXTON_TYPE_STRING) {
+				free(list[i].store.d_string.value);
+			}
+		}
+	}
+	errno = EINVAL;
+	return false;
+}
+
+ssize_t buxton_deserialize_message(uint8_t *data,
+				  BuxtonControlMessage *r_message,
+				  size_t size, uint32_t *r_msgid,
+				  BuxtonData **list)
+{
+	ssize_t ret;
+	BuxtonControlMessage message;
+	uint32_t msgid;
+	BuxtonData *k_list = NULL;
+
+	assert(data);
+	assert(r_message);
+	assert(list);
+
+	buxton_debug("Deserializing message...\n");
+	buxton_debug("size=%lu\n", size);
+
+	ret = deserialize_header(data, size, &message, &msgid);
+	if (ret < 0) {
+		goto end;
+	}
+
+	if (ret > 0) {
+		k_list = malloc0(sizeof(BuxtonData) * (size_t)ret);
+		if (!k_list) {
+			errno = ENOMEM;
+			ret = -1;
+			goto end;
+		}
+		if (!deserialize_params(data, size, (size_t)ret, k_list, false)) {
+			free(k_list);
+			ret = -1;
+			goto end;
+		}
+	}
+
 	*r_message = message;
 	*r_msgid = msgid;
-	if (n_params == 0) {
-		*list = NULL;
-		free(k_list);
-		k_list = NULL;
-	} else {
-		*list = k_list;
-	}
-	ret = (ssize_t)n_params;
+	*list = k_list;
 end:
-	if (ret <= 0) {
-		free(k_list);
+	buxton_debug("Deserializing returned:%i\n", ret);
+	return ret;
+}
+
+ssize_t buxton_deserialize_message_view(uint8_t *data,
+				       BuxtonControlMessage *r_message,
+				       size_t size, uint32_t *r_msgid,
+				       BuxtonData **list, size_t *allocated)
+{
+	ssize_t ret;
+	BuxtonControlMessage message;
+	uint32_t msgid;
+
+	assert(data);
+	assert(r_message);
+	assert(list);
+	assert(allocated);
+
+	ret = deserialize_header(data, size, &message, &msgid);
+	if (ret < 0) {
+		return -1;
 	}
 
-	buxton_debug("Deserializing returned:%i\n", ret);
+	if (ret > 0) {
+		if (!greedy_realloc((void **)list, allocated,
+				    sizeof(BuxtonData) * (size_t)ret)) {
+			abort();
+		}
+		if (!deserialize_params(data, size, (size_t)ret, *list, true)) {
+			return -1;
+		}
+	}
+
+	*r_message = message;
+	*r_msgid = msgid;
 	return ret;
 }
 
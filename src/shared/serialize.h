@@ -35,6 +35,11 @@
  */
 #define BUXTON_LENGTH_OFFSET sizeof(uint32_t)
 
+/**
+ * Location of the message ID in serialized message data
+ */
+#define BUXTON_MSGID_OFFSET (sizeof(uint32_t) * 2)
+
 /**
  * Minimum size of serialized BuxtonData
  * 2 is the minimum number of characters in a valid SMACK label
@@ -59,6 +64,17 @@
  */
 #define BUXTON_MESSAGE_MAX_PARAMS 4096
 
+/**
+ * Length of a message without parameters
+ */
+#define BUXTON_MESSAGE_EMPTY_LENGTH (sizeof(uint32_t) * 4)
+
+/**
+ * Maximum count of gets in a batch message, whose reply carries the
+ * value of each and must fit in BUXTON_MESSAGE_MAX_LENGTH as well
+ */
+#define BUXTON_BATCH_MAX_GETS 256
+
 /**
  * Serialize data internally for backend consumption
  * @param source Data to be serialized
@@ -93,6 +109,31 @@ size_t buxton_serialize_message(uint8_t **dest,
 				BuxtonArray *list)
 	__attribute__((warn_unused_result));
 
+/**
+ * Get the length of a parameter in a serialized message
+ * @param param Parameter to measure
+ * @return a size_t, 0 if the parameter type is invalid
+ */
+size_t buxton_serialized_param_length(BuxtonData *param)
+	__attribute__((warn_unused_result));
+
+/**
+ * Serialize an internal buxton message into a reusable buffer
+ * @param dest Buffer to store the serialized message in, grown as needed
+ * @param allocated Allocated size of dest in bytes
+ * @param message The type of message to be serialized
+ * @param msgid The message ID to be serialized
+ * @param params Array of BuxtonData's to be serialized first
+ * @param count Number of entries in params
+ * @param tail Optional BuxtonArray serialized after params, may be NULL
+ * @return a size_t, 0 indicates failure otherwise size of the message
+ */
+size_t buxton_serialize_message_into(uint8_t **dest, size_t *allocated,
+				     BuxtonControlMessage message,
+				     uint32_t msgid, BuxtonData *params,
+				     size_t count, BuxtonArray *tail)
+	__attribute__((warn_unused_result));
+
 /**
  * Deserialize the given data into an array of BuxtonData structs
  * @param data The source data to be deserialized
@@ -108,6 +149,24 @@ ssize_t buxton_deserialize_message(uint8_t *data,
 				  BuxtonData **list)
 	__attribute__((warn_unused_result));
 
+/**
+ * Deserialize the given data without copying it
+ * @param data The source data to be deserialized
+ * @param r_message An empty pointer that will be set to the message type
+ * @param size The size of the data being deserialized
+ * @param r_msgid The message ID being deserialized
+ * @param list Reusable array of BuxtonData structs, grown as needed
+ * @param allocated Allocated size of list in bytes
+ * @return the number of parameters, or -1 if deserialization failed
+ * @note String parameters point into data and stay valid only as
+ * long as data does, they must not be freed
+ */
+ssize_t buxton_deserialize_message_view(uint8_t *data,
+				       BuxtonControlMessage *r_message,
+				       size_t size, uint32_t *r_msgid,
+				       BuxtonData **list, size_t *allocated)
+	__attribute__((warn_unused_result));
+
 /**
  * Get size of a buxton message data stream
  * @param data The source data stream
@@ -0,0 +1,474 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2014 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "direct.h"
+#include "log.h"
+#include "serialize.h"
+#include "snapshot.h"
+#include "util.h"
+
+/* Seeds tried for one bucket before using more buckets */
+#define SNAPSHOT_MAX_SEED 65536
+
+/**
+ * A record to be written to a snapshot
+ */
+struct snapshot_record {
+	uint8_t *key; /**<Group and name, with their NULs */
+	uint32_t key_len; /**<Length of key */
+	uint8_t *value; /**<Serialized value and label */
+	uint32_t value_len; /**<Length of value */
+	uint32_t offset; /**<Offset of the record in the file */
+};
+
+static int record_compare(const void *a, const void *b)
+{
+	const struct snapshot_record *x = a;
+	const struct snapshot_record *y = b;
+	int r;
+
+	r = memcmp(x->key, y->key, x->key_len < y->key_len ? x->key_len : y->key_len);
+	if (r) {
+		return r;
+	}
+	if (x->key_len == y->key_len) {
+		return 0;
+	}
+
+	return x->key_len < y->key_len ? -1 : 1;
+}
+
+/**
+ * A bucket of the hash, in the order buckets are placed
+ */
+struct snapshot_bucket {
+	uint32_t bucket; /**<Number of the bucket */
+	uint32_t size; /**<Number of records in the bucket */
+};
+
+/* Largest buckets first, by number among buckets of a size */
+static int bucket_compare(const void *a, const void *b)
+{
+	const struct snapshot_bucket *x = a;
+	const struct snapshot_bucket *y = b;
+
+	if (x->size != y->size) {
+		return x->size > y->size ? -1 : 1;
+	}
+	if (x->bucket != y->bucket) {
+		return x->bucket < y->bucket ? -1 : 1;
+	}
+
+	return 0;
+}
+
+static void free_records(struct snapshot_record *records, size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		free(records[i].key);
+		free(records[i].value);
+	}
+	free(records);
+}
+
+/**
+ * Read a group or key of the layer and append it to the records
+ * @return 0 on success, or an errno value
+ */
+static int add_record(BuxtonControl *control, _BuxtonKey *key,
+		      struct snapshot_record **records, size_t *len,
+		      size_t *allocated)
+{
+	struct snapshot_record *r;
+	BuxtonData data;
+	BuxtonString label;
+	size_t size;
+	int ret;
+
+	memzero(&data, sizeof(BuxtonData));
+	memzero(&label, sizeof(BuxtonString));
+	ret = buxton_direct_get_value_for_layer(control, key, &data, &label,
+						BUXTON_LABEL_NONE);
+	if (ret) {
+		return ret;
+	}
+
+	if (!greedy_realloc((void **)records, allocated,
+			    (*len + 1) * sizeof(struct snapshot_record))) {
+		abort();
+	}
+	r = &(*records)[*len];
+	memzero(r, sizeof(struct snapshot_record));
+
+	r->key_len = key->group.length;
+	if (key->name.value) {
+		r->key_len += key->name.length;
+	}
+	r->key = malloc(r->key_len);
+	if (!r->key) {
+		abort();
+	}
+	memcpy(r->key, key->group.value, key->group.length);
+	if (key->name.value) {
+		memcpy(r->key + key->group.length, key->name.value,
+		       key->name.length);
+	}
+
+	size = buxton_serialize(&data, &label, &r->value);
+	r->value_len = (uint32_t)size;
+	(*len)++;
+
+	if (data.type == BUXTON_TYPE_STRING) {
+		free(data.store.d_string.value);
+	}
+	free(label.value);
+
+	return 0;
+}
+
+/**
+ * Read every group and key of a layer
+ * @return a boolean value, indicating success of the operation
+ */
+static bool collect_records(BuxtonControl *control, BuxtonString *layer_name,
+			    struct snapshot_record **records, size_t *len)
+{
+	BuxtonArray *groups = NULL;
+	BuxtonArray *names = NULL;
+	BuxtonString empty = { NULL, 0 };
+	BuxtonData *g, *n;
+	_BuxtonKey key;
+	size_t allocated = 0;
+	bool ret = false;
+
+	*records = NULL;
+	*len = 0;
+
+	if (!buxton_direct_list_names(control, layer_name, &empty, NULL,
+				      &groups)) {
+		goto end;
+	}
+
+	key.layer = *layer_name;
+	key.type = BUXTON_TYPE_UNSET;
+	for (uint16_t i = 0; i < groups->len; i++) {
+		g = buxton_array_get(groups, i);
+		key.group = g->store.d_string;
+		key.name = (BuxtonString){ NULL, 0 };
+		if (add_record(control, &key, records, len, &allocated)) {
+			goto end;
+		}
+
+		if (!buxton_direct_list_names(control, layer_name,
+					      &g->store.d_string, NULL,
+					      &names)) {
+			goto end;
+		}
+		for (uint16_t j = 0; j < names->len; j++) {
+			n = buxton_array_get(names, j);
+			key.name = n->store.d_string;
+			if (add_record(control, &key, records, len,
+				       &allocated)) {
+				goto end;
+			}
+		}
+		buxton_array_free(&names, (buxton_free_func)data_free);
+	}
+	ret = true;
+
+end:
+	if (names) {
+		buxton_array_free(&names, (buxton_free_func)data_free);
+	}
+	if (groups) {
+		buxton_array_free(&groups, (buxton_free_func)data_free);
+	}
+	if (!ret) {
+		free_records(*records, *len);
+		*records = NULL;
+		*len = 0;
+	}
+	return ret;
+}
+
+/**
+ * Find a seed for every bucket, so that no two keys share a slot
+ *
+ * Buckets are placed largest first, which is when free slots are easiest
+ * to find.
+ * @param records Records, in their final order
+ * @param count Number of records
+ * @param nbuckets Number of buckets
+ * @param seeds Set to the seed of each bucket
+ * @param slots Set to the record number in each slot
+ * @return a boolean value, false if a bucket had no working seed
+ */
+static bool place_buckets(struct snapshot_record *records, uint32_t count,
+			  uint32_t nbuckets, uint32_t *seeds, uint32_t *slots)
+{
+	_cleanup_free_ uint32_t *start = NULL;
+	_cleanup_free_ uint32_t *members = NULL;
+	_cleanup_free_ struct snapshot_bucket *order = NULL;
+	_cleanup_free_ uint32_t *fill = NULL;
+	_cleanup_free_ uint32_t *tried = NULL;
+	_cleanup_free_ bool *used = NULL;
+	uint32_t b, size, seed, slot;
+	uint32_t i, j, k;
+
+	start = calloc(nbuckets + 1, sizeof(uint32_t));
+	members = calloc(count, sizeof(uint32_t));
+	order = calloc(nbuckets, sizeof(struct snapshot_bucket));
+	fill = calloc(nbuckets, sizeof(uint32_t));
+	tried = calloc(count, sizeof(uint32_t));
+	used = calloc(count, sizeof(bool));
+	if (!start || !members || !order || !fill || !tried || !used) {
+		abort();
+	}
+
+	/* Group the records by bucket */
+	for (i = 0; i < count; i++) {
+		b = buxton_snapshot_hash(0, records[i].key, records[i].key_len,
+					 NULL, 0) % nbuckets;
+		start[b + 1]++;
+	}
+	for (b = 0; b < nbuckets; b++) {
+		start[b + 1] += start[b];
+	}
+	for (i = 0; i < count; i++) {
+		b = buxton_snapshot_hash(0, records[i].key, records[i].key_len,
+					 NULL, 0) % nbuckets;
+		members[start[b] + fill[b]++] = i;
+	}
+
+	for (b = 0; b < nbuckets; b++) {
+		order[b].bucket = b;
+		order[b].size = start[b + 1] - start[b];
+	}
+	qsort(order, nbuckets, sizeof(struct snapshot_bucket), bucket_compare);
+
+	for (i = 0; i < nbuckets; i++) {
+		b = order[i].bucket;
+		size = order[i].size;
+		if (size == 0) {
+			break;
+		}
+
+		for (seed = 1; seed < SNAPSHOT_MAX_SEED; seed++) {
+			for (j = 0; j < size; j++) {
+				k = members[start[b] + j];
+				slot = buxton_snapshot_hash(seed, records[k].key,
+							    records[k].key_len,
+							    NULL, 0) % count;
+				/* tried marks slots taken by this attempt */
+				if (used[slot] || tried[slot] == seed) {
+					break;
+				}
+				tried[slot] = seed;
+			}
+			if (j == size) {
+				break;
+			}
+			/* Forget the slots of the failed attempt */
+			for (k = 0; k < j; k++) {
+				slot = buxton_snapshot_hash(seed,
+							    records[members[start[b] + k]].key,
+							    records[members[start[b] + k]].key_len,
+							    NULL, 0) % count;
+				tried[slot] = 0;
+			}
+		}
+		if (seed == SNAPSHOT_MAX_SEED) {
+			return false;
+		}
+
+		seeds[b] = seed;
+		for (j = 0; j < size; j++) {
+			k = members[start[b] + j];
+			slot = buxton_snapshot_hash(seed, records[k].key,
+						    records[k].key_len,
+						    NULL, 0) % count;
+			used[slot] = true;
+			slots[slot] = k;
+		}
+	}
+
+	return true;
+}
+
+static bool write_all(FILE *f, const void *buf, size_t len)
+{
+	return fwrite(buf, 1, len, f) == len;
+}
+
+bool buxton_snapshot_compile(BuxtonControl *control, BuxtonString *layer_name,
+			     const char *path)
+{
+	struct snapshot_record *records = NULL;
+	BuxtonSnapshotHeader header;
+	_cleanup_free_ uint32_t *seeds = NULL;
+	_cleanup_free_ uint32_t *slots = NULL;
+	_cleanup_free_ uint32_t *index = NULL;
+	_cleanup_free_ char *tmp = NULL;
+	uint8_t pad[4] = { 0, 0, 0, 0 };
+	uint64_t offset;
+	uint32_t count;
+	uint32_t nbuckets;
+	size_t len;
+	FILE *f = NULL;
+	bool ret = false;
+
+	assert(control);
+	assert(layer_name);
+	assert(path);
+
+	if (!collect_records(control, layer_name, &records, &len)) {
+		buxton_log("Failed to read layer %s\n", layer_name->value);
+		return false;
+	}
+	if (len > UINT32_MAX / 4) {
+		goto end;
+	}
+	count = (uint32_t)len;
+	qsort(records, len, sizeof(struct snapshot_record), record_compare);
+
+	/* Lay out the records, then the three tables */
+	offset = sizeof(BuxtonSnapshotHeader);
+	index = calloc(count + 1, sizeof(uint32_t));
+	if (!index) {
+		abort();
+	}
+	for (uint32_t i = 0; i < count; i++) {
+		records[i].offset = (uint32_t)offset;
+		index[i] = (uint32_t)offset;
+		offset += sizeof(uint32_t) * 2 + records[i].key_len +
+			records[i].value_len;
+		offset = (offset + 3) & ~(uint64_t)3;
+		if (offset > UINT32_MAX) {
+			buxton_log("Layer %s is too large for a snapshot\n",
+				   layer_name->value);
+			goto end;
+		}
+	}
+
+	slots = calloc(count + 1, sizeof(uint32_t));
+	if (!slots) {
+		abort();
+	}
+	for (nbuckets = count / 2 + 1; ; nbuckets *= 2) {
+		free(seeds);
+		seeds = calloc(nbuckets, sizeof(uint32_t));
+		if (!seeds) {
+			abort();
+		}
+		if (count == 0 ||
+		    place_buckets(records, count, nbuckets, seeds, slots)) {
+			break;
+		}
+		if (nbuckets > count * 4) {
+			buxton_log("Failed to build a perfect hash for %s\n",
+				   layer_name->value);
+			goto end;
+		}
+	}
+
+	memzero(&header, sizeof(BuxtonSnapshotHeader));
+	memcpy(header.magic, BUXTON_SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.count = count;
+	header.nbuckets = nbuckets;
+	header.index_offset = (uint32_t)offset;
+	offset += sizeof(uint32_t) * count;
+	header.slot_offset = (uint32_t)offset;
+	offset += sizeof(uint32_t) * count;
+	header.bucket_offset = (uint32_t)offset;
+	offset += sizeof(uint32_t) * nbuckets;
+	if (offset > UINT32_MAX) {
+		goto end;
+	}
+	header.size = (uint32_t)offset;
+
+	if (asprintf(&tmp, "%s.tmp", path) == -1) {
+		abort();
+	}
+	f = fopen(tmp, "w");
+	if (!f) {
+		buxton_log("Failed to create %s: %m\n", tmp);
+		goto end;
+	}
+
+	if (!write_all(f, &header, sizeof(BuxtonSnapshotHeader))) {
+		goto end;
+	}
+	for (uint32_t i = 0; i < count; i++) {
+		size_t size = sizeof(uint32_t) * 2 + records[i].key_len +
+			records[i].value_len;
+
+		if (!write_all(f, &records[i].key_len, sizeof(uint32_t)) ||
+		    !write_all(f, &records[i].value_len, sizeof(uint32_t)) ||
+		    !write_all(f, records[i].key, records[i].key_len) ||
+		    !write_all(f, records[i].value, records[i].value_len) ||
+		    !write_all(f, pad, (4 - size % 4) % 4)) {
+			goto end;
+		}
+	}
+	if (!write_all(f, index, sizeof(uint32_t) * count) ||
+	    !write_all(f, slots, sizeof(uint32_t) * count) ||
+	    !write_all(f, seeds, sizeof(uint32_t) * nbuckets)) {
+		goto end;
+	}
+
+	/* The new snapshot must be complete on disk before it replaces one */
+	if (fflush(f) || fsync(fileno(f))) {
+		goto end;
+	}
+	if (fclose(f)) {
+		f = NULL;
+		goto end;
+	}
+	f = NULL;
+	if (rename(tmp, path)) {
+		buxton_log("Failed to rename %s to %s: %m\n", tmp, path);
+		goto end;
+	}
+	ret = true;
+
+end:
+	if (f) {
+		fclose(f);
+	}
+	if (!ret && tmp) {
+		unlink(tmp);
+	}
+	free_records(records, len);
+	return ret;
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -0,0 +1,109 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2014 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+/**
+ * \file snapshot.h Internal header
+ * This file is used internally by buxton to describe the on-disk format
+ * of compiled read-only layers
+ *
+ * A snapshot file starts with a BuxtonSnapshotHeader. Records follow,
+ * each one a uint32_t key length, a uint32_t value length, the key
+ * (group and name with their terminating NULs, like the gdbm backend)
+ * and the serialized value, padded to 4 bytes. Three uint32_t arrays
+ * complete the file: record offsets sorted by key, record numbers by
+ * perfect hash slot, and a hash seed for each bucket.
+ */
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <stdint.h>
+
+#include "backend.h"
+#include "buxtonstring.h"
+
+/**
+ * Magic at the start of every snapshot, including the format version
+ */
+#define BUXTON_SNAPSHOT_MAGIC "BXSNAP01"
+
+/**
+ * Header of a snapshot file
+ */
+typedef struct BuxtonSnapshotHeader {
+	char magic[8]; /**<BUXTON_SNAPSHOT_MAGIC, without its NUL */
+	uint32_t count; /**<Number of records */
+	uint32_t nbuckets; /**<Number of perfect hash buckets */
+	uint32_t index_offset; /**<Record offsets, sorted by key */
+	uint32_t slot_offset; /**<Record numbers, by hash slot */
+	uint32_t bucket_offset; /**<Hash seeds, by bucket */
+	uint32_t size; /**<Size of the whole file */
+} BuxtonSnapshotHeader;
+
+/**
+ * Hash a key given as two parts, with FNV-1a
+ * @param seed Seed selecting one of the hash functions
+ * @param a First part of the key
+ * @param alen Length of a
+ * @param b Second part of the key, may be NULL
+ * @param blen Length of b
+ * @return the hash of the concatenated key
+ */
+static inline uint32_t buxton_snapshot_hash(uint32_t seed, const void *a,
+					    size_t alen, const void *b,
+					    size_t blen)
+{
+	const uint8_t *p;
+	uint32_t h = 2166136261U ^ (seed * 16777619U);
+
+	for (p = a; p < (const uint8_t *)a + alen; p++) {
+		h = (h ^ *p) * 16777619U;
+	}
+	for (p = b; b && p < (const uint8_t *)b + blen; p++) {
+		h = (h ^ *p) * 16777619U;
+	}
+
+	/* Mix the low bits, which pick the slot */
+	h ^= h >> 15;
+	h *= 0x2c1b3c6dU;
+	h ^= h >> 12;
+
+	return h;
+}
+
+/**
+ * Compile every group and key of a layer into a snapshot file
+ *
+ * The file is written next to path and renamed over it, so a snapshot
+ * already mapped by buxtond stays valid.
+ * @param control An initialized control structure
+ * @param layer_name Name of the layer to read
+ * @param path Path of the snapshot to write
+ * @return a boolean value, indicating success of the operation
+ */
+bool buxton_snapshot_compile(BuxtonControl *control, BuxtonString *layer_name,
+			     const char *path)
+	__attribute__((warn_unused_result));
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -144,6 +144,45 @@ fail:
 	return false;
 }
 
+void buxton_value_to_data(BuxtonDataType type, const void *value,
+			  BuxtonData *data)
+{
+	assert(value);
+	assert(data);
+
+	data->type = type;
+	switch (type) {
+	case BUXTON_TYPE_STRING:
+		/* cast until BuxtonString is updated */
+		data->store.d_string.value = (char *)value;
+		data->store.d_string.length = (uint32_t)strlen((char *)value) + 1;
+		break;
+	case BUXTON_TYPE_INT32:
+		data->store.d_int32 = *(const int32_t *)value;
+		break;
+	case BUXTON_TYPE_INT64:
+		data->store.d_int64 = *(const int64_t *)value;
+		break;
+	case BUXTON_TYPE_UINT32:
+		data->store.d_uint32 = *(const uint32_t *)value;
+		break;
+	case BUXTON_TYPE_UINT64:
+		data->store.d_uint64 = *(const uint64_t *)value;
+		break;
+	case BUXTON_TYPE_FLOAT:
+		data->store.d_float = *(const float *)value;
+		break;
+	case BUXTON_TYPE_DOUBLE:
+		memcpy(&data->store.d_double, value, sizeof(double));
+		break;
+	case BUXTON_TYPE_BOOLEAN:
+		data->store.d_boolean = *(const bool *)value;
+		break;
+	default:
+		break;
+	}
+}
+
 bool buxton_string_copy(BuxtonString *original, BuxtonString *copy)
 {
 	if (!original || !copy) {
@@ -234,6 +273,18 @@ fail:
 	return false;
 }
 
+bool buxton_key_is_wildcard(_BuxtonKey *key)
+{
+	size_t len;
+
+	if (!key || !key->name.value) {
+		return false;
+	}
+
+	len = strlen(key->name.value);
+	return len > 0 && key->name.value[len - 1] == '*';
+}
+
 void data_free(BuxtonData *data)
 {
 	if (!data) {
@@ -270,6 +321,60 @@ void key_free(_BuxtonKey *key)
 	free(key);
 }
 
+void batch_free(_BuxtonBatch *batch)
+{
+	BuxtonBatchOp *op;
+
+	if (!batch) {
+		return;
+	}
+
+	for (size_t i = 0; i < batch->len; i++) {
+		op = &batch->ops[i];
+		free(op->key.group.value);
+		free(op->key.name.value);
+		free(op->key.layer.value);
+		if (op->value.type == BUXTON_TYPE_STRING) {
+			free(op->value.store.d_string.value);
+		}
+	}
+	free(batch->ops);
+	free(batch);
+}
+
+_BuxtonBatch *batch_copy_keys(_BuxtonBatch *batch)
+{
+	_BuxtonBatch *copy;
+
+	assert(batch);
+
+	copy = malloc0(sizeof(_BuxtonBatch));
+	if (!copy) {
+		return NULL;
+	}
+	if (batch->len == 0) {
+		return copy;
+	}
+
+	copy->ops = malloc0(sizeof(BuxtonBatchOp) * batch->len);
+	if (!copy->ops) {
+		free(copy);
+		return NULL;
+	}
+	copy->allocated = sizeof(BuxtonBatchOp) * batch->len;
+
+	for (size_t i = 0; i < batch->len; i++) {
+		copy->ops[i].type = batch->ops[i].type;
+		if (!buxton_key_copy(&batch->ops[i].key, &copy->ops[i].key)) {
+			batch_free(copy);
+			return NULL;
+		}
+		copy->len++;
+	}
+
+	return copy;
+}
+
 const char* buxton_type_as_string(BuxtonDataType type)
 {
 	switch (type) {
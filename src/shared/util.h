@@ -46,6 +46,7 @@
 
 #include "macro.h"
 #include "buxton.h"
+#include "buxtonbatch.h"
 #include "buxtonkey.h"
 #include "backend.h"
 
@@ -148,6 +149,15 @@ char* get_layer_path(BuxtonLayer *layer)
  */
 bool buxton_data_copy(BuxtonData *original, BuxtonData *copy);
 
+/**
+ * Fill out a BuxtonData from a pointer to a value
+ * @param type The type of the value
+ * @param value Pointer to a value of the given type
+ * @param data Pointer to the BuxtonData to fill out, strings aren't copied
+ */
+void buxton_value_to_data(BuxtonDataType type, const void *value,
+			  BuxtonData *data);
+
 /**
  * Perform a deep copy of one BuxtonString to another
  * @param original The BuxtonString being copied
@@ -172,6 +182,17 @@ bool buxton_key_copy(_BuxtonKey *original, _BuxtonKey *copy)
 bool buxton_copy_key_group(_BuxtonKey *original, _BuxtonKey *group)
 	__attribute__((warn_unused_result));
 
+/**
+ * Check whether a key watches a group for notifications rather than a key
+ *
+ * A name ending in '*' stands for every name of the group starting with
+ * what precedes it, so "*" alone stands for the whole group.
+ * @param key The _BuxtonKey to check
+ * @return true if the key's name is a wildcard
+ */
+bool buxton_key_is_wildcard(_BuxtonKey *key)
+	__attribute__((warn_unused_result));
+
 /**
  * Perform a deep free of BuxtonData
  * @param data The BuxtonData being free'd
@@ -190,6 +211,20 @@ void string_free(BuxtonString *string);
  */
 void key_free(_BuxtonKey *key);
 
+/**
+ * Perform a deep free of _BuxtonBatch
+ * @param batch The _BuxtonBatch being free'd
+ */
+void batch_free(_BuxtonBatch *batch);
+
+/**
+ * Copy the operation types and keys of a batch, without the values
+ * @param batch The _BuxtonBatch being copied
+ * @return A new _BuxtonBatch, or NULL on failure
+ */
+_BuxtonBatch *batch_copy_keys(_BuxtonBatch *batch)
+	__attribute__((warn_unused_result));
+
 /**
  * Get the group portion of a buxton key
  * @param key Pointer to _BuxtonKey
@@ -29,6 +29,7 @@
 #include "direct.h"
 #include "protocol.h"
 #include "serialize.h"
+#include "snapshot.h"
 #include "util.h"
 
 #ifdef NDEBUG
@@ -87,7 +88,7 @@ START_TEST(buxton_direct_create_group_check)
 	group.group = buxton_string_pack("tgroup");
 	group.name = (BuxtonString){ NULL, 0 };
 	group.type = BUXTON_TYPE_STRING;
-	fail_if(!buxton_direct_create_group(&c, &group, NULL),
+	fail_if(!buxton_direct_create_group(&c, &group, BUXTON_LABEL_NONE),
 		"Create group failed");
 }
 END_TEST
@@ -103,7 +104,7 @@ START_TEST(buxton_direct_remove_group_check)
 	group.group = buxton_string_pack("tgroup");
 	group.name = (BuxtonString){ NULL, 0 };
 	group.type = BUXTON_TYPE_STRING;
-	fail_if(!buxton_direct_remove_group(&c, &group, NULL),
+	fail_if(!buxton_direct_remove_group(&c, &group, BUXTON_LABEL_NONE),
 		"Failed to remove group");
 }
 END_TEST
@@ -130,13 +131,13 @@ START_TEST(buxton_direct_set_value_check)
 	key.type = BUXTON_TYPE_STRING;
 
 	c.client.uid = getuid();
-	fail_if(buxton_direct_create_group(&c, &group, NULL) == false,
+	fail_if(buxton_direct_create_group(&c, &group, BUXTON_LABEL_NONE) == false,
 		"Creating group failed.");
 	fail_if(buxton_direct_set_label(&c, &group, &glabel) == false,
 		"Setting group label failed.");
 	data.type = BUXTON_TYPE_STRING;
 	data.store.d_string = buxton_string_pack("bxt_test_value");
-	fail_if(buxton_direct_set_value(&c, &key, &data, NULL) == false,
+	fail_if(buxton_direct_set_value(&c, &key, &data, BUXTON_LABEL_NONE) == false,
 		"Setting value in buxton directly failed.");
 	buxton_direct_close(&c);
 }
@@ -157,7 +158,7 @@ START_TEST(buxton_direct_get_value_for_layer_check)
 	c.client.uid = getuid();
 	fail_if(buxton_direct_open(&c) == false,
 		"Direct open failed without daemon.");
-	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel, NULL),
+	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel, BUXTON_LABEL_NONE),
 		"Retrieving value from buxton gdbm backend failed.");
 	fail_if(result.type != BUXTON_TYPE_STRING,
 		"Buxton gdbm backend returned incorrect result type.");
@@ -189,9 +190,9 @@ START_TEST(buxton_direct_get_value_check)
 	data.store.d_string = buxton_string_pack("bxt_test_value2");
 	fail_if(data.store.d_string.value == NULL,
 		"Failed to allocate test string.");
-	fail_if(buxton_direct_set_value(&c, &key, &data, NULL) == false,
+	fail_if(buxton_direct_set_value(&c, &key, &data, BUXTON_LABEL_NONE) == false,
 		"Failed to set second value.");
-	fail_if(buxton_direct_get_value(&c, &key, &result, &dlabel, NULL) == -1,
+	fail_if(buxton_direct_get_value(&c, &key, &result, &dlabel, BUXTON_LABEL_NONE) == -1,
 		"Retrieving value from buxton gdbm backend failed.");
 	fail_if(result.type != BUXTON_TYPE_STRING,
 		"Buxton gdbm backend returned incorrect result type.");
@@ -201,7 +202,7 @@ START_TEST(buxton_direct_get_value_check)
 	if (result.store.d_string.value)
 		free(result.store.d_string.value);
 	key.type = BUXTON_TYPE_UNSET;
-	fail_if(buxton_direct_get_value(&c, &key, &result, &dlabel, NULL) == -1,
+	fail_if(buxton_direct_get_value(&c, &key, &result, &dlabel, BUXTON_LABEL_NONE) == -1,
 		"Retrieving value from buxton gdbm backend failed.");
 	fail_if(result.type != BUXTON_TYPE_STRING,
 		"Buxton gdbm backend returned incorrect result type.");
@@ -213,6 +214,280 @@ START_TEST(buxton_direct_get_value_check)
 }
 END_TEST
 
+START_TEST(buxton_direct_get_value_layer_order_check)
+{
+	BuxtonControl c;
+	BuxtonData data, result;
+	BuxtonString dlabel;
+	_BuxtonKey group, key;
+	char *layers[] = { "test-gdbm", "test-memory", "test-gdbm-user" };
+
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+	c.client.uid = getuid();
+
+	fail_if(c.config.nlayers != hashmap_size(c.config.layers),
+		"Layer order doesn't hold every layer");
+	fail_if(strcmp(c.config.layer_order[0]->name.value, "test-memory") != 0,
+		"Highest priority system layer isn't looked up first");
+	fail_if(c.config.layer_order[c.config.nlayers - 1]->type != LAYER_USER,
+		"User layer looked up before a system layer");
+
+	group.group = buxton_string_pack("bxt_order_group");
+	group.name = (BuxtonString){ NULL, 0 };
+	group.type = BUXTON_TYPE_STRING;
+	key.group = group.group;
+	key.name = buxton_string_pack("bxt_order_key");
+	key.type = BUXTON_TYPE_STRING;
+	data.type = BUXTON_TYPE_STRING;
+	for (int n = 0; n < 3; n++) {
+		group.layer = buxton_string_pack(layers[n]);
+		fail_if(!buxton_direct_create_group(&c, &group, BUXTON_LABEL_NONE),
+			"Failed to create group in %s", layers[n]);
+		key.layer = group.layer;
+		data.store.d_string = buxton_string_pack(layers[n]);
+		fail_if(!buxton_direct_set_value(&c, &key, &data, BUXTON_LABEL_NONE),
+			"Failed to set value in %s", layers[n]);
+	}
+
+	/* Every layer has the key, the best system layer must win */
+	key.layer = (BuxtonString){ NULL, 0 };
+	memzero(&dlabel, sizeof(BuxtonString));
+	fail_if(buxton_direct_get_value(&c, &key, &result, &dlabel, BUXTON_LABEL_NONE),
+		"Layerless get failed");
+	fail_if(key.layer.value, "Key layer was not reset");
+	fail_if(strcmp(result.store.d_string.value, "test-memory") != 0,
+		"Got value from the wrong layer");
+	free(result.store.d_string.value);
+	free(dlabel.value);
+
+	/* Without it in system layers, the user layer is used */
+	for (int n = 0; n < 2; n++) {
+		key.layer = buxton_string_pack(layers[n]);
+		fail_if(!buxton_direct_unset_value(&c, &key, BUXTON_LABEL_NONE),
+			"Failed to unset value in %s", layers[n]);
+	}
+	key.layer = (BuxtonString){ NULL, 0 };
+	memzero(&dlabel, sizeof(BuxtonString));
+	fail_if(buxton_direct_get_value(&c, &key, &result, &dlabel, BUXTON_LABEL_NONE),
+		"Layerless get of user value failed");
+	fail_if(strcmp(result.store.d_string.value, "test-gdbm-user") != 0,
+		"Got user value from the wrong layer");
+	free(result.store.d_string.value);
+	free(dlabel.value);
+
+	key.name = buxton_string_pack("bxt_order_missing");
+	fail_if(buxton_direct_get_value(&c, &key, &result, &dlabel, BUXTON_LABEL_NONE) != ENOENT,
+		"Missing key was found");
+	buxton_direct_close(&c);
+}
+END_TEST
+
+START_TEST(buxton_direct_group_cache_check)
+{
+	BuxtonControl c;
+	BuxtonData data;
+	BuxtonString label = buxton_string_pack("cache_label");
+	BuxtonLayer *layer;
+	_BuxtonKey group, key;
+	char *root_check = getenv(BUXTON_ROOT_CHECK_ENV);
+
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+	c.client.uid = getuid();
+	setenv(BUXTON_ROOT_CHECK_ENV, "0", 1);
+
+	group.layer = buxton_string_pack("test-gdbm");
+	group.group = buxton_string_pack("bxt_cache_group");
+	group.name = (BuxtonString){ NULL, 0 };
+	group.type = BUXTON_TYPE_STRING;
+	key = group;
+	key.name = buxton_string_pack("bxt_cache_key");
+	data.type = BUXTON_TYPE_STRING;
+	data.store.d_string = buxton_string_pack("bxt_cache_value");
+
+	fail_if(!buxton_direct_create_group(&c, &group, BUXTON_LABEL_NONE),
+		"Failed to create group");
+	fail_if(!buxton_direct_set_value(&c, &key, &data, BUXTON_LABEL_NONE),
+		"Failed to set value");
+	layer = hashmap_get(c.config.layers, "test-gdbm");
+	fail_if(!layer->groups ||
+		!hashmap_get(layer->groups, "bxt_cache_group"),
+		"Group was not cached");
+
+	/* A relabelled group is looked up again */
+	fail_if(!buxton_direct_set_label(&c, &group, &label),
+		"Failed to set group label");
+	fail_if(hashmap_get(layer->groups, "bxt_cache_group"),
+		"Relabelled group is still cached");
+	fail_if(!buxton_direct_set_value(&c, &key, &data, BUXTON_LABEL_NONE),
+		"Failed to set value after relabel");
+	fail_if(!hashmap_get(layer->groups, "bxt_cache_group"),
+		"Relabelled group was not cached again");
+
+	/* A removed group must not be found in the cache */
+	fail_if(!buxton_direct_remove_group(&c, &group, BUXTON_LABEL_NONE),
+		"Failed to remove group");
+	fail_if(buxton_direct_set_value(&c, &key, &data, BUXTON_LABEL_NONE),
+		"Set value in a removed group");
+	fail_if(!buxton_direct_create_group(&c, &group, BUXTON_LABEL_NONE),
+		"Failed to create group again");
+	fail_if(!buxton_direct_set_value(&c, &key, &data, BUXTON_LABEL_NONE),
+		"Failed to set value in the new group");
+	fail_if(!buxton_direct_remove_group(&c, &group, BUXTON_LABEL_NONE),
+		"Failed to clean up group");
+
+	if (root_check) {
+		setenv(BUXTON_ROOT_CHECK_ENV, root_check, 1);
+	} else {
+		unsetenv(BUXTON_ROOT_CHECK_ENV);
+	}
+	buxton_direct_close(&c);
+}
+END_TEST
+
+START_TEST(buxton_direct_commit_check)
+{
+	BuxtonControl c;
+	BuxtonData result;
+	BuxtonString dlabel;
+	BuxtonBatchOp ops[2];
+	_BuxtonKey key;
+
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+	c.client.uid = getuid();
+
+	memzero(ops, sizeof(ops));
+	ops[0].type = BUXTON_CONTROL_SET;
+	ops[0].key.layer = buxton_string_pack("test-gdbm");
+	ops[0].key.group = buxton_string_pack("bxt_test_group");
+	ops[0].key.name = buxton_string_pack("bxt_txn_key1");
+	ops[0].key.type = BUXTON_TYPE_STRING;
+	ops[0].value.type = BUXTON_TYPE_STRING;
+	ops[0].value.store.d_string = buxton_string_pack("bxt_txn_value1");
+	ops[1].type = BUXTON_CONTROL_SET;
+	ops[1].key.layer = buxton_string_pack("test-gdbm");
+	ops[1].key.group = buxton_string_pack("bxt_test_group");
+	ops[1].key.name = buxton_string_pack("bxt_txn_key2");
+	ops[1].key.type = BUXTON_TYPE_INT32;
+	ops[1].value.type = BUXTON_TYPE_INT32;
+	ops[1].value.store.d_int32 = 7;
+	fail_if(buxton_direct_commit(&c, ops, 2, BUXTON_LABEL_NONE) != 0,
+		"Failed to commit transaction");
+
+	key = ops[1].key;
+	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel,
+						  BUXTON_LABEL_NONE),
+		"Failed to get value set by transaction");
+	fail_if(result.type != BUXTON_TYPE_INT32 || result.store.d_int32 != 7,
+		"Got wrong value set by transaction");
+	free(dlabel.value);
+
+	/* Nothing is changed when an operation can't run */
+	ops[0].value.store.d_string = buxton_string_pack("bxt_txn_value2");
+	ops[1].type = BUXTON_CONTROL_UNSET;
+	ops[1].key.name = buxton_string_pack("bxt_txn_missing");
+	fail_if(buxton_direct_commit(&c, ops, 2, BUXTON_LABEL_NONE) != ENOENT,
+		"Committed unset of missing key");
+	key = ops[0].key;
+	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel,
+						  BUXTON_LABEL_NONE),
+		"Failed to get value after failed transaction");
+	fail_if(!streq(result.store.d_string.value, "bxt_txn_value1"),
+		"Failed transaction changed a value");
+	free(result.store.d_string.value);
+	free(dlabel.value);
+
+	/* Transactions are limited to one layer */
+	ops[1].key.layer = buxton_string_pack("base");
+	fail_if(buxton_direct_commit(&c, ops, 2, BUXTON_LABEL_NONE) != EINVAL,
+		"Committed transaction across layers");
+
+	ops[0].type = BUXTON_CONTROL_UNSET;
+	ops[1].type = BUXTON_CONTROL_UNSET;
+	ops[1].key.layer = buxton_string_pack("test-gdbm");
+	ops[1].key.name = buxton_string_pack("bxt_txn_key2");
+	ops[1].key.type = BUXTON_TYPE_INT32;
+	fail_if(buxton_direct_commit(&c, ops, 2, BUXTON_LABEL_NONE) != 0,
+		"Failed to commit unsets");
+	key = ops[0].key;
+	fail_if(!buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel,
+						   BUXTON_LABEL_NONE),
+		"Got value unset by transaction");
+
+	buxton_direct_close(&c);
+}
+END_TEST
+
+/* Stands in for a backend's set_value, failing failures_left calls
+ * after sets_left calls */
+static module_value_func real_set_value;
+static int sets_left;
+static int failures_left;
+
+static int failing_set_value(BuxtonLayer *layer, _BuxtonKey *key,
+			     BuxtonData *data, BuxtonString *label)
+{
+	if (sets_left > 0) {
+		sets_left--;
+	} else if (failures_left > 0) {
+		failures_left--;
+		return EIO;
+	}
+	return real_set_value(layer, key, data, label);
+}
+
+START_TEST(buxton_direct_rollback_check)
+{
+	BuxtonControl c;
+	BuxtonBackend *backend;
+	BuxtonLayer *layer;
+	BuxtonBatchOp ops[2];
+
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+	c.client.uid = getuid();
+
+	memzero(ops, sizeof(ops));
+	ops[0].type = BUXTON_CONTROL_SET;
+	ops[0].key.layer = buxton_string_pack("test-gdbm");
+	ops[0].key.group = buxton_string_pack("bxt_test_group");
+	ops[0].key.name = buxton_string_pack("bxt_undo_key1");
+	ops[0].key.type = BUXTON_TYPE_STRING;
+	ops[0].value.type = BUXTON_TYPE_STRING;
+	ops[0].value.store.d_string = buxton_string_pack("bxt_undo_value1");
+	ops[1] = ops[0];
+	ops[1].key.name = buxton_string_pack("bxt_undo_key2");
+	fail_if(buxton_direct_commit(&c, ops, 1, BUXTON_LABEL_NONE) != 0,
+		"Failed to commit transaction");
+
+	layer = hashmap_get(c.config.layers, "test-gdbm");
+	fail_if(!layer, "Failed to get layer");
+	backend = backend_for_layer(&c.config, layer);
+	fail_if(!backend, "Failed to get backend");
+	real_set_value = backend->set_value;
+	backend->set_value = failing_set_value;
+
+	/* The second set fails, and so does putting back the first */
+	ops[0].value.store.d_string = buxton_string_pack("bxt_undo_value2");
+	sets_left = 1;
+	failures_left = 2;
+	fail_if(buxton_direct_commit(&c, ops, 2, BUXTON_LABEL_NONE) != ENOTRECOVERABLE,
+		"Failed to report a transaction that couldn't be put back");
+
+	/* When it can be put back, the error of the failed operation
+	 * is returned */
+	sets_left = 1;
+	failures_left = 1;
+	fail_if(buxton_direct_commit(&c, ops, 2, BUXTON_LABEL_NONE) != EIO,
+		"Failed to report the failed operation");
+
+	backend->set_value = real_set_value;
+	buxton_direct_close(&c);
+}
+END_TEST
+
 START_TEST(buxton_memory_backend_check)
 {
 	BuxtonControl c;
@@ -236,22 +511,22 @@ START_TEST(buxton_memory_backend_check)
 		"Direct open failed without daemon.");
 
 	c.client.uid = getuid();
-	fail_if(buxton_direct_create_group(&c, &group, NULL) == false,
+	fail_if(buxton_direct_create_group(&c, &group, BUXTON_LABEL_NONE) == false,
 		"Creating group failed.");
 	fail_if(buxton_direct_set_label(&c, &group, &glabel) == false,
 		"Setting group label failed.");
 	data.type = BUXTON_TYPE_STRING;
 	data.store.d_string = buxton_string_pack("bxt_test_value");
-	fail_if(buxton_direct_set_value(&c, &key, &data, NULL) == false,
+	fail_if(buxton_direct_set_value(&c, &key, &data, BUXTON_LABEL_NONE) == false,
 		"Setting value in buxton memory backend directly failed.");
-	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel, NULL),
+	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel, BUXTON_LABEL_NONE),
 		"Retrieving value from buxton memory backend directly failed.");
 	// FIXME: BUXTON_GROUP_VALUE is the dummy group data value, but the memory
 	// backend doesn't understand groups, so this is the current workaround.
 	fail_if(!streq(result.store.d_string.value, "bxt_test_value"),
 		"Buxton memory returned a different value to that set.");
 	key.type = BUXTON_TYPE_UNSET;
-	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel, NULL),
+	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel, BUXTON_LABEL_NONE),
 		"Retrieving value from buxton memory backend directly failed.");
 	fail_if(!streq(result.store.d_string.value, "bxt_test_value"),
 		"Buxton memory returned a different value to that set.");
@@ -259,6 +534,471 @@ START_TEST(buxton_memory_backend_check)
 }
 END_TEST
 
+START_TEST(buxton_memory_record_check)
+{
+	BuxtonControl c;
+	BuxtonData data, result;
+	BuxtonString label, dlabel;
+	BuxtonArray *list = NULL;
+	_BuxtonKey group, key;
+	char big[2000];
+
+	group.layer = buxton_string_pack("temp");
+	group.group = buxton_string_pack("bxt_mem_record_group");
+	group.name = (BuxtonString){ NULL, 0 };
+	group.type = BUXTON_TYPE_STRING;
+	key = group;
+	key.name = buxton_string_pack("bxt_mem_record_key");
+
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+	c.client.uid = getuid();
+	fail_if(!buxton_direct_create_group(&c, &group, BUXTON_LABEL_NONE),
+		"Creating group failed.");
+
+	/* Values grow past their tile and shrink back */
+	memset(big, 'x', sizeof(big) - 1);
+	big[sizeof(big) - 1] = '\0';
+	char *values[] = { "short", big, "shorter", big + 1900, "" };
+	data.type = BUXTON_TYPE_STRING;
+	for (int i = 0; i < 5; i++) {
+		data.store.d_string = buxton_string_pack(values[i]);
+		fail_if(!buxton_direct_set_value(&c, &key, &data, BUXTON_LABEL_NONE),
+			"Failed to set value %d", i);
+		fail_if(buxton_direct_get_value_for_layer(&c, &key, &result,
+							  &dlabel, BUXTON_LABEL_NONE),
+			"Failed to get value %d", i);
+		fail_if(!streq(result.store.d_string.value, values[i]),
+			"Got a different value %d", i);
+		free(result.store.d_string.value);
+		free(dlabel.value);
+	}
+
+	/* A new label keeps the value, however long the label */
+	data.store.d_string = buxton_string_pack("kept");
+	fail_if(!buxton_direct_set_value(&c, &key, &data, BUXTON_LABEL_NONE),
+		"Failed to set value");
+	for (int i = 0; i < 3; i++) {
+		label = buxton_string_pack(i == 1 ? big + 1000 : "_");
+		fail_if(!buxton_direct_set_label(&c, &key, &label),
+			"Failed to set label %d", i);
+		fail_if(buxton_direct_get_value_for_layer(&c, &key, &result,
+							  &dlabel, BUXTON_LABEL_NONE),
+			"Failed to get value");
+		fail_if(!streq(result.store.d_string.value, "kept"),
+			"Value changed with the label");
+		fail_if(!streq(dlabel.value, label.value),
+			"Got a different label %d", i);
+		free(result.store.d_string.value);
+		free(dlabel.value);
+	}
+
+	/* Moved records are still in the group index */
+	fail_if(!buxton_direct_list_names(&c, &key.layer, &key.group, NULL,
+					  &list),
+		"Failed to list names");
+	fail_if(list->len != 1, "Listed %d names, not 1", list->len);
+	buxton_array_free(&list, (buxton_free_func)data_free);
+	fail_if(!buxton_direct_unset_value(&c, &key, BUXTON_LABEL_NONE),
+		"Failed to unset key");
+	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel,
+						  BUXTON_LABEL_NONE) != ENOENT,
+		"Unset key is left");
+	fail_if(!buxton_direct_remove_group(&c, &group, BUXTON_LABEL_NONE),
+		"Failed to remove group");
+
+	buxton_direct_close(&c);
+}
+END_TEST
+
+START_TEST(buxton_group_index_check)
+{
+	BuxtonControl c;
+	BuxtonData data, result;
+	BuxtonString dlabel;
+	BuxtonString empty = { NULL, 0 };
+	BuxtonString prefix = buxton_string_pack("bxt_k1");
+	BuxtonArray *list = NULL;
+	_BuxtonKey a, b, key;
+	char *layers[] = { "test-gdbm", "temp" };
+	char name[32];
+
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+	c.client.uid = getuid();
+
+	for (int l = 0; l < 2; l++) {
+		a.layer = buxton_string_pack(layers[l]);
+		a.group = buxton_string_pack("bxt_index_a");
+		a.name = (BuxtonString){ NULL, 0 };
+		a.type = BUXTON_TYPE_STRING;
+		b = a;
+		b.group = buxton_string_pack("bxt_index_b");
+		fail_if(!buxton_direct_create_group(&c, &a, BUXTON_LABEL_NONE),
+			"Failed to create group a");
+		fail_if(!buxton_direct_create_group(&c, &b, BUXTON_LABEL_NONE),
+			"Failed to create group b");
+
+		data.type = BUXTON_TYPE_INT32;
+		for (int32_t i = 0; i < 20; i++) {
+			snprintf(name, sizeof(name), "bxt_k%d", i);
+			data.store.d_int32 = i;
+			key = i % 2 ? b : a;
+			key.name = buxton_string_pack(name);
+			key.type = BUXTON_TYPE_INT32;
+			fail_if(!buxton_direct_set_value(&c, &key, &data, BUXTON_LABEL_NONE),
+				"Failed to set %s", name);
+		}
+
+		fail_if(!buxton_direct_list_names(&c, &a.layer, &a.group, NULL,
+						  &list),
+			"Failed to list names");
+		fail_if(list->len != 10, "Listed %d names, not 10", list->len);
+		buxton_array_free(&list, (buxton_free_func)data_free);
+		fail_if(!buxton_direct_list_names(&c, &a.layer, &a.group,
+						  &prefix, &list),
+			"Failed to list names with a prefix");
+		/* bxt_k10 to bxt_k18, even ones only, in order */
+		fail_if(list->len != 5, "Listed %d names, not 5", list->len);
+		for (uint16_t i = 0; i < 5; i++) {
+			snprintf(name, sizeof(name), "bxt_k1%d", i * 2);
+			fail_if(!streq(((BuxtonData *)buxton_array_get(list, i))->store.d_string.value,
+				       name), "Names aren't sorted");
+		}
+		buxton_array_free(&list, (buxton_free_func)data_free);
+
+		/* Removing a group removes all its keys, and only those */
+		fail_if(!buxton_direct_remove_group(&c, &a, BUXTON_LABEL_NONE),
+			"Failed to remove group a");
+		key = a;
+		key.name = buxton_string_pack("bxt_k0");
+		key.type = BUXTON_TYPE_INT32;
+		fail_if(buxton_direct_get_value_for_layer(&c, &key, &result,
+							  &dlabel, BUXTON_LABEL_NONE) != ENOENT,
+			"Key of a removed group is left");
+		fail_if(!buxton_direct_create_group(&c, &a, BUXTON_LABEL_NONE),
+			"Failed to create group a again");
+		fail_if(!buxton_direct_list_names(&c, &a.layer, &a.group, NULL,
+						  &list),
+			"Failed to list names");
+		fail_if(list->len != 0, "Recreated group has old keys");
+		buxton_array_free(&list, (buxton_free_func)data_free);
+		fail_if(!buxton_direct_list_names(&c, &b.layer, &b.group, NULL,
+						  &list),
+			"Failed to list names");
+		fail_if(list->len != 10, "Listed %d names, not 10", list->len);
+		buxton_array_free(&list, (buxton_free_func)data_free);
+		fail_if(!buxton_direct_list_names(&c, &a.layer, &empty, NULL,
+						  &list),
+			"Failed to list groups");
+		fail_if(list->len < 2, "Listed %d groups, not 2", list->len);
+		buxton_array_free(&list, (buxton_free_func)data_free);
+	}
+
+	/* The gdbm index is rebuilt from the file when it is opened again */
+	buxton_direct_close(&c);
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+	c.client.uid = getuid();
+	b.layer = buxton_string_pack("test-gdbm");
+	fail_if(!buxton_direct_list_names(&c, &b.layer, &b.group, NULL, &list),
+		"Failed to list names");
+	fail_if(list->len != 10, "Listed %d names, not 10", list->len);
+	buxton_array_free(&list, (buxton_free_func)data_free);
+
+	a.layer = b.layer;
+	fail_if(!buxton_direct_remove_group(&c, &a, BUXTON_LABEL_NONE),
+		"Failed to remove group a");
+	fail_if(!buxton_direct_remove_group(&c, &b, BUXTON_LABEL_NONE),
+		"Failed to remove group b");
+	buxton_direct_close(&c);
+}
+END_TEST
+
+#ifdef HAVE_LMDB
+START_TEST(buxton_lmdb_backend_check)
+{
+	BuxtonControl c;
+	BuxtonLayer *layer;
+	BuxtonData data, result;
+	BuxtonString dlabel;
+	BuxtonString empty = { NULL, 0 };
+	BuxtonString prefix = buxton_string_pack("bxt_b");
+	BuxtonArray *list = NULL;
+	BuxtonBatchOp ops[2];
+	_BuxtonKey group, key;
+	char *names[] = { "bxt_a", "bxt_b1", "bxt_b2", "bxt_c" };
+	/* Larger than the map LMDB is first given */
+	size_t big_len = 80UL * 1024UL * 1024UL;
+	char *big;
+
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+	c.client.uid = getuid();
+
+	/* test.conf can't name a backend that may not be built */
+	layer = malloc0(sizeof(BuxtonLayer));
+	fail_if(!layer, "Failed to allocate layer");
+	layer->name.value = strdup("test-lmdb");
+	layer->name.length = (uint32_t)strlen("test-lmdb") + 1;
+	layer->type = LAYER_SYSTEM;
+	layer->backend = BACKEND_LMDB;
+	fail_if(hashmap_put(c.config.layers, layer->name.value, layer) != 1,
+		"Failed to add lmdb layer");
+
+	group.layer = layer->name;
+	group.group = buxton_string_pack("bxt_lmdb_group");
+	group.name = (BuxtonString){ NULL, 0 };
+	group.type = BUXTON_TYPE_STRING;
+	fail_if(!buxton_direct_create_group(&c, &group, BUXTON_LABEL_NONE),
+		"Failed to create group");
+
+	key = group;
+	data.type = BUXTON_TYPE_STRING;
+	for (int n = 0; n < 4; n++) {
+		key.name = buxton_string_pack(names[n]);
+		data.store.d_string = buxton_string_pack(names[n]);
+		fail_if(!buxton_direct_set_value(&c, &key, &data, BUXTON_LABEL_NONE),
+			"Failed to set %s", names[n]);
+	}
+
+	key.name = buxton_string_pack("bxt_b2");
+	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel,
+						  BUXTON_LABEL_NONE),
+		"Failed to get value");
+	fail_if(!streq(result.store.d_string.value, "bxt_b2"),
+		"Got the wrong value");
+	free(result.store.d_string.value);
+	free(dlabel.value);
+	key.type = BUXTON_TYPE_INT32;
+	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel,
+						  BUXTON_LABEL_NONE) != EINVAL,
+		"Got a value of the wrong type");
+	key.type = BUXTON_TYPE_STRING;
+
+	/* Names come back sorted, and only those in range */
+	fail_if(!buxton_direct_list_names(&c, &layer->name, &group.group,
+					  &prefix, &list),
+		"Failed to list names");
+	fail_if(list->len != 2, "Listed %d names, not 2", list->len);
+	fail_if(!streq(((BuxtonData *)buxton_array_get(list, 0))->store.d_string.value,
+		       "bxt_b1"), "First name is wrong");
+	fail_if(!streq(((BuxtonData *)buxton_array_get(list, 1))->store.d_string.value,
+		       "bxt_b2"), "Second name is wrong");
+	buxton_array_free(&list, (buxton_free_func)data_free);
+
+	fail_if(!buxton_direct_list_names(&c, &layer->name, &empty, NULL,
+					  &list),
+		"Failed to list groups");
+	fail_if(list->len != 1, "Listed %d groups, not 1", list->len);
+	buxton_array_free(&list, (buxton_free_func)data_free);
+
+	fail_if(!buxton_direct_unset_value(&c, &key, BUXTON_LABEL_NONE),
+		"Failed to unset value");
+	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel,
+						  BUXTON_LABEL_NONE) != ENOENT,
+		"Unset value is still there");
+
+	/* A transaction that can't be written changes nothing */
+	big = malloc(big_len);
+	fail_if(!big, "Failed to allocate big value");
+	memset(big, 'x', big_len - 1);
+	big[big_len - 1] = '\0';
+	memzero(ops, sizeof(ops));
+	ops[0].type = BUXTON_CONTROL_SET;
+	ops[0].key = group;
+	ops[0].key.name = buxton_string_pack("bxt_a");
+	ops[0].value.type = BUXTON_TYPE_STRING;
+	ops[0].value.store.d_string = buxton_string_pack("bxt_txn");
+	ops[1].type = BUXTON_CONTROL_SET;
+	ops[1].key = group;
+	ops[1].key.name = buxton_string_pack("bxt_big");
+	ops[1].value.type = BUXTON_TYPE_STRING;
+	ops[1].value.store.d_string.value = big;
+	ops[1].value.store.d_string.length = (uint32_t)big_len;
+	fail_if(buxton_direct_commit(&c, ops, 2, BUXTON_LABEL_NONE) != ENOSPC,
+		"Committed transaction larger than the map");
+	key.name = buxton_string_pack("bxt_a");
+	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel,
+						  BUXTON_LABEL_NONE),
+		"Failed to get value after failed transaction");
+	fail_if(!streq(result.store.d_string.value, "bxt_a"),
+		"Failed transaction changed a value");
+	free(result.store.d_string.value);
+	free(dlabel.value);
+
+	/* The map grew, so the same transaction fits now */
+	fail_if(buxton_direct_commit(&c, ops, 2, BUXTON_LABEL_NONE) != 0,
+		"Failed to commit transaction after the map grew");
+	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel,
+						  BUXTON_LABEL_NONE),
+		"Failed to get value set by transaction");
+	fail_if(!streq(result.store.d_string.value, "bxt_txn"),
+		"Got wrong value set by transaction");
+	free(result.store.d_string.value);
+	free(dlabel.value);
+
+	/* Single writes grow the map as much as they need */
+	big[0] = 'y';
+	key.name = buxton_string_pack("bxt_big");
+	data.store.d_string = ops[1].value.store.d_string;
+	fail_if(!buxton_direct_set_value(&c, &key, &data, BUXTON_LABEL_NONE),
+		"Failed to set value larger than the free space");
+	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel,
+						  BUXTON_LABEL_NONE),
+		"Failed to get big value");
+	fail_if(result.store.d_string.length != big_len ||
+		result.store.d_string.value[0] != 'y',
+		"Got the wrong big value");
+	free(result.store.d_string.value);
+	free(dlabel.value);
+	free(big);
+
+	/* Removing the group takes its keys with it */
+	fail_if(!buxton_direct_remove_group(&c, &group, BUXTON_LABEL_NONE),
+		"Failed to remove group");
+	fail_if(!buxton_direct_list_names(&c, &layer->name, &group.group,
+					  NULL, &list),
+		"Failed to list names of removed group");
+	fail_if(list->len != 0, "Keys of a removed group are left");
+	buxton_array_free(&list, (buxton_free_func)data_free);
+
+	buxton_direct_close(&c);
+}
+END_TEST
+#endif
+
+START_TEST(buxton_snapshot_backend_check)
+{
+	BuxtonControl c;
+	BuxtonLayer *layer;
+	BuxtonData data, result;
+	BuxtonString dlabel;
+	BuxtonString empty = { NULL, 0 };
+	BuxtonString source = buxton_string_pack("test-gdbm");
+	BuxtonString prefix = buxton_string_pack("bxt_b");
+	BuxtonArray *list = NULL;
+	_BuxtonKey group, key;
+	char *names[] = { "bxt_a", "bxt_b1", "bxt_b2", "bxt_c" };
+	char *path;
+
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+	c.client.uid = getuid();
+
+	group.layer = source;
+	group.group = buxton_string_pack("bxt_snap_group");
+	group.name = (BuxtonString){ NULL, 0 };
+	group.type = BUXTON_TYPE_STRING;
+	fail_if(!buxton_direct_create_group(&c, &group, BUXTON_LABEL_NONE),
+		"Failed to create group");
+	key = group;
+	data.type = BUXTON_TYPE_STRING;
+	for (int n = 0; n < 4; n++) {
+		key.name = buxton_string_pack(names[n]);
+		data.store.d_string = buxton_string_pack(names[n]);
+		fail_if(!buxton_direct_set_value(&c, &key, &data, BUXTON_LABEL_NONE),
+			"Failed to set %s", names[n]);
+	}
+	key.group = buxton_string_pack("bxt_snap_int");
+	key.name = (BuxtonString){ NULL, 0 };
+	fail_if(!buxton_direct_create_group(&c, &key, BUXTON_LABEL_NONE),
+		"Failed to create group");
+	key.name = buxton_string_pack("bxt_int");
+	key.type = BUXTON_TYPE_INT32;
+	data.type = BUXTON_TYPE_INT32;
+	data.store.d_int32 = 42;
+	fail_if(!buxton_direct_set_value(&c, &key, &data, BUXTON_LABEL_NONE),
+		"Failed to set int");
+
+	/* Snapshot layers are read from their usual database path */
+	layer = malloc0(sizeof(BuxtonLayer));
+	fail_if(!layer, "Failed to allocate layer");
+	layer->name.value = strdup("test-snapshot");
+	layer->name.length = (uint32_t)strlen("test-snapshot") + 1;
+	layer->type = LAYER_SYSTEM;
+	layer->backend = BACKEND_SNAPSHOT;
+	layer->readonly = true;
+	path = get_layer_path(layer);
+	fail_if(!path, "Failed to get snapshot path");
+	fail_if(!buxton_snapshot_compile(&c, &source, path),
+		"Failed to compile snapshot");
+	free(path);
+	fail_if(hashmap_put(c.config.layers, layer->name.value, layer) != 1,
+		"Failed to add snapshot layer");
+
+	key.layer = layer->name;
+	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel,
+						  BUXTON_LABEL_NONE),
+		"Failed to get int from snapshot");
+	fail_if(result.store.d_int32 != 42, "Got the wrong int");
+	free(dlabel.value);
+
+	key.group = group.group;
+	key.type = BUXTON_TYPE_STRING;
+	for (int n = 0; n < 4; n++) {
+		key.name = buxton_string_pack(names[n]);
+		fail_if(buxton_direct_get_value_for_layer(&c, &key, &result,
+							  &dlabel, BUXTON_LABEL_NONE),
+			"Failed to get %s from snapshot", names[n]);
+		fail_if(!streq(result.store.d_string.value, names[n]),
+			"Got the wrong value for %s", names[n]);
+		fail_if(!streq(dlabel.value, "_"), "Got the wrong label");
+		free(result.store.d_string.value);
+		free(dlabel.value);
+	}
+	key.type = BUXTON_TYPE_INT32;
+	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel,
+						  BUXTON_LABEL_NONE) != EINVAL,
+		"Got a value of the wrong type");
+	key.type = BUXTON_TYPE_STRING;
+	key.name = buxton_string_pack("bxt_missing");
+	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel,
+						  BUXTON_LABEL_NONE) != ENOENT,
+		"Got a key that isn't in the snapshot");
+
+	fail_if(!buxton_direct_list_names(&c, &layer->name, &group.group,
+					  &prefix, &list),
+		"Failed to list names");
+	fail_if(list->len != 2, "Listed %d names, not 2", list->len);
+	fail_if(!streq(((BuxtonData *)buxton_array_get(list, 0))->store.d_string.value,
+		       "bxt_b1"), "First name is wrong");
+	fail_if(!streq(((BuxtonData *)buxton_array_get(list, 1))->store.d_string.value,
+		       "bxt_b2"), "Second name is wrong");
+	buxton_array_free(&list, (buxton_free_func)data_free);
+
+	fail_if(!buxton_direct_list_names(&c, &layer->name, &empty, &prefix,
+					  &list),
+		"Failed to list groups");
+	fail_if(list->len != 0, "Listed groups not matching the prefix");
+	buxton_array_free(&list, (buxton_free_func)data_free);
+	fail_if(!buxton_direct_list_names(&c, &layer->name, &empty, NULL,
+					  &list),
+		"Failed to list groups");
+	fail_if(list->len < 2, "Listed %d groups, not at least 2", list->len);
+	buxton_array_free(&list, (buxton_free_func)data_free);
+
+	/* Nothing is written through a snapshot */
+	key.name = buxton_string_pack("bxt_a");
+	data.type = BUXTON_TYPE_STRING;
+	data.store.d_string = buxton_string_pack("changed");
+	fail_if(buxton_direct_set_value(&c, &key, &data, BUXTON_LABEL_NONE),
+		"Set a value in a snapshot");
+	fail_if(buxton_direct_unset_value(&c, &key, BUXTON_LABEL_NONE),
+		"Unset a value in a snapshot");
+
+	key.layer = source;
+	fail_if(!buxton_direct_remove_group(&c, &group, BUXTON_LABEL_NONE),
+		"Failed to remove group");
+	key.group = buxton_string_pack("bxt_snap_int");
+	key.name = (BuxtonString){ NULL, 0 };
+	fail_if(!buxton_direct_remove_group(&c, &key, BUXTON_LABEL_NONE),
+		"Failed to remove group");
+
+	buxton_direct_close(&c);
+}
+END_TEST
+
 START_TEST(buxton_key_check)
 {
 	char *group = "group";
@@ -321,7 +1061,7 @@ START_TEST(buxton_set_label_check)
 	c.client.uid = 0;
 	fail_if(buxton_direct_open(&c) == false,
 		"Direct open failed without daemon.");
-	fail_if(buxton_direct_create_group(&c, &key, NULL) == false,
+	fail_if(buxton_direct_create_group(&c, &key, BUXTON_LABEL_NONE) == false,
 		"Creating group failed.");
 	fail_if(buxton_direct_set_label(&c, &key, &label) == false,
 		"Failed to set label as root user.");
@@ -355,11 +1095,11 @@ START_TEST(buxton_group_label_check)
 	c.client.uid = 0;
 	fail_if(buxton_direct_open(&c) == false,
 		"Direct open failed without daemon.");
-	fail_if(buxton_direct_create_group(&c, &key, NULL) == false,
+	fail_if(buxton_direct_create_group(&c, &key, BUXTON_LABEL_NONE) == false,
 		"Creating group failed.");
 	fail_if(buxton_direct_set_label(&c, &key, &label) == false,
 		"Failed to set group label.");
-	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel, NULL),
+	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel, BUXTON_LABEL_NONE),
 		"Retrieving group label failed.");
 	fail_if(!streq("*", dlabel.value),
 		"Retrieved group label is incorrect.");
@@ -386,11 +1126,11 @@ START_TEST(buxton_name_label_check)
 	c.client.uid = 0;
 	fail_if(buxton_direct_open(&c) == false,
 		"Direct open failed without daemon.");
-	fail_if(buxton_direct_create_group(&c, &key, NULL) == false,
+	fail_if(buxton_direct_create_group(&c, &key, BUXTON_LABEL_NONE) == false,
 		"Creating group failed.");
 	fail_if(buxton_direct_set_label(&c, &key, &label) == false,
 		"Failed to set group label.");
-	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel, NULL),
+	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel, BUXTON_LABEL_NONE),
 		"Retrieving group label failed.");
 	fail_if(!streq("*", dlabel.value),
 		"Retrieved group label is incorrect.");
@@ -401,9 +1141,9 @@ START_TEST(buxton_name_label_check)
 	key.name = buxton_string_pack("name-foo");
 	data.type = BUXTON_TYPE_STRING;
 	data.store.d_string = buxton_string_pack("value1-foo");
-	fail_if(buxton_direct_set_value(&c, &key, &data, NULL) == false,
+	fail_if(buxton_direct_set_value(&c, &key, &data, BUXTON_LABEL_NONE) == false,
 		"Failed to set key name-foo.");
-	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel, NULL),
+	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel, BUXTON_LABEL_NONE),
 		"Failed to get value for name-foo 1");
 	fail_if(!streq("value1-foo", result.store.d_string.value),
 		"Retrieved key value is incorrect 1");
@@ -412,7 +1152,7 @@ START_TEST(buxton_name_label_check)
 	free(result.store.d_string.value);
 	fail_if(buxton_direct_set_label(&c, &key, &label) == false,
 		"Failed to set name label.");
-	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel, NULL),
+	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel, BUXTON_LABEL_NONE),
 		"Failed to get value for name-foo 2");
 	fail_if(!streq("value1-foo", result.store.d_string.value),
 		"Retrieved key value is incorrect 2");
@@ -423,9 +1163,9 @@ START_TEST(buxton_name_label_check)
 
 	/* modify the same key, with a new value, and validate the label */
 	data.store.d_string = buxton_string_pack("value2-foo");
-	fail_if(buxton_direct_set_value(&c, &key, &data, NULL) == false,
+	fail_if(buxton_direct_set_value(&c, &key, &data, BUXTON_LABEL_NONE) == false,
 		"Failed to modify key name-foo.");
-	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel, NULL),
+	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel, BUXTON_LABEL_NONE),
 		"Failed to get new value for name-foo.");
 	fail_if(!streq("value2-foo", result.store.d_string.value),
 		"New key value is incorrect.");
@@ -513,6 +1253,8 @@ START_TEST(send_message_check)
 	size_t size;
 	BuxtonData data;
 
+	memzero(&client, sizeof(_BuxtonClient));
+
 	setup_socket_pair(&(client.fd), &server);
 	fail_if(fcntl(client.fd, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
@@ -574,6 +1316,8 @@ START_TEST(handle_callback_response_check)
 		{BUXTON_TYPE_INT32, {.d_int32 = 1}}
 	};
 
+	memzero(&client, sizeof(_BuxtonClient));
+
 	setup_socket_pair(&(client.fd), &server);
 	fail_if(fcntl(client.fd, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
@@ -693,6 +1437,8 @@ START_TEST(buxton_wire_handle_response_check)
 	BuxtonData data;
 	bool test_data = true;
 
+	memzero(&client, sizeof(_BuxtonClient));
+
 	setup_socket_pair(&(client.fd), &server);
 	fail_if(fcntl(client.fd, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
@@ -741,6 +1487,8 @@ START_TEST(buxton_wire_get_response_check)
 	BuxtonData data;
 	bool test_data = true;
 
+	memzero(&client, sizeof(_BuxtonClient));
+
 	setup_socket_pair(&(client.fd), &server);
 	fail_if(fcntl(client.fd, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
@@ -791,6 +1539,8 @@ START_TEST(buxton_wire_set_value_check)
 	BuxtonControlMessage msg;
 	uint32_t msgid;
 
+	memzero(&client, sizeof(_BuxtonClient));
+
 	setup_socket_pair(&(client.fd), &server);
 	fail_if(fcntl(client.fd, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
@@ -852,6 +1602,8 @@ START_TEST(buxton_wire_set_label_check)
 	BuxtonControlMessage msg;
 	uint32_t msgid;
 
+	memzero(&client, sizeof(_BuxtonClient));
+
 	client.uid = 0;
 	setup_socket_pair(&(client.fd), &server);
 	fail_if(fcntl(client.fd, F_SETFL, O_NONBLOCK),
@@ -944,6 +1696,8 @@ START_TEST(buxton_wire_get_value_check)
 	BuxtonControlMessage msg;
 	uint32_t msgid;
 
+	memzero(&client, sizeof(_BuxtonClient));
+
 	setup_socket_pair(&(client.fd), &server);
 	fail_if(fcntl(client.fd, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
@@ -1028,6 +1782,8 @@ START_TEST(buxton_wire_get_label_check)
 	BuxtonControlMessage msg;
 	uint32_t msgid;
 
+	memzero(&client, sizeof(_BuxtonClient));
+
 	client.uid = 0;
 	setup_socket_pair(&(client.fd), &server);
 	fail_if(fcntl(client.fd, F_SETFL, O_NONBLOCK),
@@ -1110,6 +1866,8 @@ START_TEST(buxton_wire_unset_value_check)
 	BuxtonControlMessage msg;
 	uint32_t msgid;
 
+	memzero(&client, sizeof(_BuxtonClient));
+
 	setup_socket_pair(&(client.fd), &server);
 	fail_if(fcntl(client.fd, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
@@ -1157,6 +1915,298 @@ START_TEST(buxton_wire_unset_value_check)
 }
 END_TEST
 
+static int batch_cb_count = 0;
+static void batch_cb_test(BuxtonResponse response, void *data)
+{
+	_BuxtonResponse *r = (_BuxtonResponse *)response;
+	int32_t *expect = (int32_t *)data;
+
+	fail_if(buxton_response_status(response) != expect[batch_cb_count],
+		"Unexpected status for batch operation %d", batch_cb_count);
+	switch (batch_cb_count) {
+	case 0:
+		fail_if(r->type != BUXTON_CONTROL_SET,
+			"Unexpected type for batch set");
+		break;
+	case 1:
+		fail_if(r->type != BUXTON_CONTROL_GET,
+			"Unexpected type for batch get");
+		fail_if(!streq(r->key->name.value, "name2"),
+			"Failed to pass key of batch get");
+		if (expect[batch_cb_count] == 0) {
+			fail_if(r->data->len != 2,
+				"Failed to pass value of batch get");
+		}
+		break;
+	default:
+		fail("Unexpected batch callback");
+		break;
+	}
+	batch_cb_count++;
+}
+START_TEST(buxton_wire_batch_check)
+{
+	_BuxtonClient client;
+	int server;
+	ssize_t size;
+	BuxtonData *list = NULL;
+	uint8_t buf[4096];
+	ssize_t r;
+	_BuxtonBatch batch;
+	BuxtonBatchOp ops[2];
+	BuxtonBatchOp *gets;
+	BuxtonControlMessage msg;
+	uint32_t msgid;
+	int32_t expect[2];
+	BuxtonData good[] = {
+		{BUXTON_TYPE_INT32, {.d_int32 = 0}},
+		{BUXTON_TYPE_INT32, {.d_int32 = 0}},
+		{BUXTON_TYPE_INT32, {.d_int32 = 0}},
+		{BUXTON_TYPE_STRING, {.d_string = {0}}}
+	};
+	BuxtonData bad[] = {
+		{BUXTON_TYPE_INT32, {.d_int32 = -1}}
+	};
+
+	memzero(&client, sizeof(_BuxtonClient));
+	memzero(ops, sizeof(ops));
+
+	setup_socket_pair(&(client.fd), &server);
+	fail_if(fcntl(client.fd, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+	fail_if(fcntl(server, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+
+	fail_if(!setup_callbacks(),
+		"Failed to initialeze callbacks");
+
+	ops[0].type = BUXTON_CONTROL_SET;
+	ops[0].key.layer = buxton_string_pack("layer");
+	ops[0].key.group = buxton_string_pack("group");
+	ops[0].key.name = buxton_string_pack("name");
+	ops[0].key.type = BUXTON_TYPE_STRING;
+	ops[0].value.type = BUXTON_TYPE_STRING;
+	ops[0].value.store.d_string = buxton_string_pack("value");
+	ops[1].type = BUXTON_CONTROL_GET;
+	ops[1].key.group = buxton_string_pack("group");
+	ops[1].key.name = buxton_string_pack("name2");
+	ops[1].key.type = BUXTON_TYPE_STRING;
+	batch.ops = ops;
+	batch.len = 2;
+	fail_if(!buxton_wire_batch(&client, &batch, batch_cb_test, expect),
+		"Failed to send batch");
+
+	r = read(server, buf, 4096);
+	fail_if(r < 0, "Read from client failed");
+	size = buxton_deserialize_message(buf, &msg, (size_t)r, &msgid, &list);
+	fail_if(size != 11, "Failed to get valid message from buffer");
+	fail_if(msg != BUXTON_CONTROL_BATCH,
+		"Failed to get correct control type");
+	fail_if(list[0].store.d_uint32 != BUXTON_CONTROL_SET,
+		"Failed to set first operation type");
+	fail_if(list[1].store.d_uint32 != 4,
+		"Failed to set first operation size");
+	fail_if(!streq(list[5].store.d_string.value, "value"),
+		"Failed to set value of first operation");
+	fail_if(list[6].store.d_uint32 != BUXTON_CONTROL_GET,
+		"Failed to set second operation type");
+	fail_if(list[7].store.d_uint32 != 3,
+		"Failed to set second operation size");
+	fail_if(!streq(list[9].store.d_string.value, "name2"),
+		"Failed to set name of second operation");
+	fail_if(list[10].store.d_uint32 != BUXTON_TYPE_STRING,
+		"Failed to set type of second operation");
+	for (ssize_t i = 0; i < size; i++) {
+		if (list[i].type == BUXTON_TYPE_STRING) {
+			free(list[i].store.d_string.value);
+		}
+	}
+	free(list);
+
+	/* Callback runs once per operation */
+	good[3].store.d_string = buxton_string_pack("value2");
+	expect[0] = 0;
+	expect[1] = 0;
+	batch_cb_count = 0;
+	handle_callback_response(BUXTON_CONTROL_STATUS, msgid, good, 4);
+	fail_if(batch_cb_count != 2, "Failed to run batch callbacks");
+
+	/* A rejected batch fails every operation */
+	fail_if(!buxton_wire_batch(&client, &batch, batch_cb_test, expect),
+		"Failed to send batch 2");
+	r = read(server, buf, 4096);
+	fail_if(r < 0, "Read from client failed 2");
+	size = buxton_deserialize_message(buf, &msg, (size_t)r, &msgid, &list);
+	fail_if(size != 11, "Failed to get valid message from buffer 2");
+	for (ssize_t i = 0; i < size; i++) {
+		if (list[i].type == BUXTON_TYPE_STRING) {
+			free(list[i].store.d_string.value);
+		}
+	}
+	free(list);
+	expect[0] = -1;
+	expect[1] = -1;
+	batch_cb_count = 0;
+	handle_callback_response(BUXTON_CONTROL_STATUS, msgid, bad, 1);
+	fail_if(batch_cb_count != 2, "Failed to run rejected batch callbacks");
+
+	/* So many gets that the reply may not fit aren't sent */
+	gets = malloc0(sizeof(BuxtonBatchOp) * (BUXTON_BATCH_MAX_GETS + 1));
+	fail_if(!gets, "Failed to allocate batch");
+	for (int i = 0; i <= BUXTON_BATCH_MAX_GETS; i++) {
+		gets[i] = ops[1];
+	}
+	batch.ops = gets;
+	batch.len = BUXTON_BATCH_MAX_GETS + 1;
+	fail_if(buxton_wire_batch(&client, &batch, batch_cb_test, expect),
+		"Sent batch with too many gets");
+	fail_if(read(server, buf, 4096) != -1 || errno != EAGAIN,
+		"Wrote batch with too many gets");
+	free(gets);
+
+	cleanup_callbacks();
+	free(client.send_buf);
+	close(client.fd);
+	close(server);
+}
+END_TEST
+
+static int pipeline_order[3];
+static int pipeline_count = 0;
+static void pipeline_cb_test(BuxtonResponse response, void *data)
+{
+	fail_if(buxton_response_status(response) != 0,
+		"Unexpected status for pipelined request");
+	fail_if(pipeline_count >= 3, "Too many pipelined responses");
+	pipeline_order[pipeline_count++] = *(int *)data;
+}
+START_TEST(buxton_wire_pipeline_check)
+{
+	_BuxtonClient client, other;
+	int server, other_server;
+	ssize_t size;
+	BuxtonData *list = NULL;
+	BuxtonData reply[2];
+	BuxtonControlMessage msg;
+	uint8_t buf[4096];
+	uint8_t *out = NULL;
+	size_t out_alloc = 0;
+	size_t out_len;
+	size_t offset = 0;
+	uint32_t msgids[3];
+	int ids[3] = {0, 1, 2};
+	ssize_t r;
+	_BuxtonKey key;
+
+	memzero(&client, sizeof(_BuxtonClient));
+
+	setup_socket_pair(&(client.fd), &server);
+	fail_if(fcntl(client.fd, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+	fail_if(fcntl(server, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+
+	fail_if(!setup_callbacks(),
+		"Failed to initialeze callbacks");
+
+	key.layer = buxton_string_pack("layer");
+	key.group = buxton_string_pack("group");
+	key.name = buxton_string_pack("name");
+	key.type = BUXTON_TYPE_STRING;
+
+	/* Another client's request stays unanswered throughout */
+	memzero(&other, sizeof(_BuxtonClient));
+	setup_socket_pair(&(other.fd), &other_server);
+	fail_if(!buxton_wire_get_value(&other, &key, NULL, NULL),
+		"Failed to send other client's get value");
+	fail_if(other.outstanding != 1, "Failed to count other request");
+
+	client.pipelined = true;
+	for (int i = 0; i < 3; i++) {
+		fail_if(!buxton_wire_get_value(&client, &key, pipeline_cb_test,
+					       &ids[i]),
+			"Failed to queue get value %d", i);
+	}
+	fail_if(client.queue_len != 3, "Failed to queue requests");
+	r = read(server, buf, 4096);
+	fail_if(r != -1 || errno != EAGAIN, "Sent request before flush");
+
+	fail_if(!buxton_wire_flush(&client), "Failed to flush requests");
+	fail_if(client.queue_len != 0, "Failed to empty queue");
+
+	r = read(server, buf, 4096);
+	fail_if(r <= 0, "Read from client failed");
+	for (int i = 0; i < 3; i++) {
+		fail_if(offset >= (size_t)r, "Missing request %d", i);
+		size = buxton_deserialize_message(buf + offset, &msg,
+						  (size_t)r - offset,
+						  &msgids[i], &list);
+		fail_if(size != 4, "Failed to get valid request %d", i);
+		fail_if(msg != BUXTON_CONTROL_GET,
+			"Failed to get correct control type %d", i);
+		for (ssize_t j = 0; j < size; j++) {
+			if (list[j].type == BUXTON_TYPE_STRING) {
+				free(list[j].store.d_string.value);
+			}
+		}
+		free(list);
+		offset += buxton_get_message_size(buf + offset,
+						  (size_t)r - offset);
+	}
+	fail_if(offset != (size_t)r, "Got more than the queued requests");
+
+	/* Answer the requests latest first */
+	reply[0].type = BUXTON_TYPE_INT32;
+	reply[0].store.d_int32 = 0;
+	reply[1].type = BUXTON_TYPE_STRING;
+	reply[1].store.d_string = buxton_string_pack("value");
+	for (int i = 2; i >= 0; i--) {
+		out_len = buxton_serialize_message_into(&out, &out_alloc,
+							BUXTON_CONTROL_STATUS,
+							msgids[i], reply, 2,
+							NULL);
+		fail_if(out_len == 0, "Failed to serialize reply %d", i);
+		fail_if(write(server, out, out_len) != (ssize_t)out_len,
+			"Failed to write reply %d", i);
+	}
+
+	pipeline_count = 0;
+	fail_if(buxton_wire_wait_all(&client, 1000) != 0,
+		"Failed to wait for every reply");
+	fail_if(pipeline_count != 3, "Failed to run every callback");
+	fail_if(pipeline_order[0] != 2 || pipeline_order[2] != 0,
+		"Failed to run callbacks in order of replies");
+
+	/* Nothing outstanding, so nothing to wait for */
+	fail_if(buxton_wire_wait_all(&client, 0) != 0,
+		"Failed to return with nothing outstanding");
+
+	/* Requests that can't be sent aren't waited for */
+	close(server);
+	for (int i = 0; i < 3; i++) {
+		fail_if(!buxton_wire_get_value(&client, &key, pipeline_cb_test,
+					       &ids[i]),
+			"Failed to queue get value %d", i);
+	}
+	fail_if(client.outstanding != 3, "Failed to count queued requests");
+	fail_if(buxton_wire_flush(&client), "Flushed to a closed socket");
+	fail_if(client.outstanding != 0, "Kept requests that weren't sent");
+	fail_if(buxton_wire_wait_all(&client, 0) != 0,
+		"Waited for requests that weren't sent");
+	fail_if(other.outstanding != 1, "Dropped other client's request");
+
+	cleanup_callbacks();
+	fail_if(other.outstanding != 0, "Failed to drop other request");
+	free(out);
+	free(client.queue);
+	free(client.send_buf);
+	free(other.send_buf);
+	close(client.fd);
+	close(other.fd);
+	close(other_server);
+}
+END_TEST
+
 START_TEST(buxton_wire_create_group_check)
 {
 	_BuxtonClient client;
@@ -1169,6 +2219,8 @@ START_TEST(buxton_wire_create_group_check)
 	BuxtonControlMessage msg;
 	uint32_t msgid;
 
+	memzero(&client, sizeof(_BuxtonClient));
+
 	client.uid = 0;
 	setup_socket_pair(&(client.fd), &server);
 	fail_if(fcntl(client.fd, F_SETFL, O_NONBLOCK),
@@ -1220,6 +2272,8 @@ START_TEST(buxton_wire_remove_group_check)
 	BuxtonControlMessage msg;
 	uint32_t msgid;
 
+	memzero(&client, sizeof(_BuxtonClient));
+
 	client.uid = 0;
 	setup_socket_pair(&(client.fd), &server);
 	fail_if(fcntl(client.fd, F_SETFL, O_NONBLOCK),
@@ -1275,7 +2329,17 @@ buxton_suite(void)
 	tcase_add_test(tc, buxton_direct_set_value_check);
 	tcase_add_test(tc, buxton_direct_get_value_for_layer_check);
 	tcase_add_test(tc, buxton_direct_get_value_check);
+	tcase_add_test(tc, buxton_direct_get_value_layer_order_check);
+	tcase_add_test(tc, buxton_direct_group_cache_check);
+	tcase_add_test(tc, buxton_direct_commit_check);
+	tcase_add_test(tc, buxton_direct_rollback_check);
 	tcase_add_test(tc, buxton_memory_backend_check);
+	tcase_add_test(tc, buxton_memory_record_check);
+	tcase_add_test(tc, buxton_group_index_check);
+#ifdef HAVE_LMDB
+	tcase_add_test(tc, buxton_lmdb_backend_check);
+#endif
+	tcase_add_test(tc, buxton_snapshot_backend_check);
 	tcase_add_test(tc, buxton_key_check);
 	tcase_add_test(tc, buxton_set_label_check);
 	tcase_add_test(tc, buxton_group_label_check);
@@ -1293,6 +2357,8 @@ buxton_suite(void)
 	tcase_add_test(tc, buxton_wire_get_value_check);
 	tcase_add_test(tc, buxton_wire_get_label_check);
 	tcase_add_test(tc, buxton_wire_unset_value_check);
+	tcase_add_test(tc, buxton_wire_batch_check);
+	tcase_add_test(tc, buxton_wire_pipeline_check);
 	tcase_add_test(tc, buxton_wire_create_group_check);
 	tcase_add_test(tc, buxton_wire_remove_group_check);
 	suite_add_tcase(s, tc);
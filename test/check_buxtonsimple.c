@@ -22,16 +22,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include "buxton.h"
+#include "buxtonclient.h"
 #include "buxtonresponse.h"
 #include "buxtonsimple.h"
 #include "buxtonsimple-internals.h"
 #include "configurator.h"
+#include "serialize.h"
 #include "util.h"
 #ifdef NDEBUG
 #error "re-run configure with --enable-debug"
@@ -370,6 +373,70 @@ START_TEST (sbuxton_remove_group_check)
 }
 END_TEST
 
+START_TEST (client_request_reconnect_check)
+{
+	vstatus ret;
+	int32_t value = 7;
+	int fd;
+
+	fail_if(!_client_connection(), "Client connection failed");
+	ret.type = BUXTON_TYPE_INT32;
+	ret.status = 0;
+	fail_if(_client_request(BUXTON_CONTROL_SET, "tg_s0", "reconnkey",
+				"user", BUXTON_TYPE_INT32, &value, _bs_cb,
+				&ret), "Set request failed");
+	fail_if(!ret.status, "Set request was refused");
+
+	/* Break the connection behind the library's back */
+	fd = ((_BuxtonClient *)client)->fd;
+	fail_if(shutdown(fd, SHUT_RDWR) < 0, "shutdown: %m");
+
+	ret.status = 0;
+	ret.val.i32val = 0;
+	fail_if(_client_request(BUXTON_CONTROL_GET, "tg_s0", "reconnkey",
+				"user", BUXTON_TYPE_INT32, NULL, _bg_cb,
+				&ret), "Get request did not reconnect");
+	fail_if(!ret.status, "Get request was refused");
+	fail_if(ret.val.i32val != value, "Got wrong value after reconnect");
+	fail_if(client == NULL, "Connection was not reopened");
+	_client_disconnect();
+}
+END_TEST
+
+START_TEST (client_request_timeout_check)
+{
+	vstatus ret;
+	int32_t value = 7;
+	int fd;
+	int silent[2];
+	uint8_t buf[4096];
+	ssize_t r;
+
+	fail_if(!_client_connection(), "Client connection failed");
+
+	/* Put a peer that never answers behind the connection */
+	fail_if(socketpair(AF_UNIX, SOCK_STREAM, 0, silent) < 0,
+		"socketpair: %m");
+	fd = ((_BuxtonClient *)client)->fd;
+	fail_if(dup2(silent[0], fd) < 0, "dup2: %m");
+	close(silent[0]);
+
+	ret.type = BUXTON_TYPE_INT32;
+	ret.status = 0;
+	fail_if(!_client_request(BUXTON_CONTROL_SET, "tg_s0", "timeoutkey",
+				 "user", BUXTON_TYPE_INT32, &value, _bs_cb,
+				 &ret), "Set request without a reply succeeded");
+
+	/* The request went out once */
+	r = recv(silent[1], buf, sizeof(buf), MSG_DONTWAIT);
+	fail_if(r <= 0, "Set request wasn't sent");
+	fail_if(buxton_get_message_size(buf, (size_t)r) != (size_t)r,
+		"Set request was sent again");
+	_client_disconnect();
+	close(silent[1]);
+}
+END_TEST
+
 /* Start buxtonsimple-internal tests */
 START_TEST (client_connection_check)
 {
@@ -391,6 +458,26 @@ START_TEST (client_disconnect_check)
 }
 END_TEST
 
+START_TEST (client_key_check)
+{
+	BuxtonKey a, b;
+
+	a = _client_key("tg_s0", "keyname", "user", BUXTON_TYPE_INT32);
+	fail_if(!a, "Failed to create cached key");
+	b = _client_key("tg_s0", "keyname", "user", BUXTON_TYPE_INT32);
+	fail_if(a != b, "Same key was not reused");
+	b = _client_key("tg_s0", "keyname", "user", BUXTON_TYPE_STRING);
+	fail_if(!b || a == b, "Key type was not part of the cache key");
+	b = _client_key("tg_s0", NULL, "user", BUXTON_TYPE_STRING);
+	fail_if(!b || a == b, "Group key collided with a named key");
+	fail_if(b != _client_key("tg_s0", NULL, "user", BUXTON_TYPE_STRING),
+		"Group key was not reused");
+	fail_if(_client_key(NULL, "keyname", "user", BUXTON_TYPE_INT32),
+		"Created a key without a group");
+	_client_disconnect();
+}
+END_TEST
+
 START_TEST (cg_cb_check)
 {
 	_BuxtonResponse resp;
@@ -495,6 +582,8 @@ buxtonsimp_suite(void)
 	/* run in this order so group is set up for all sets and gets */
 	tc = tcase_create("buxtonsimple_public");
 	tcase_add_unchecked_fixture(tc, setup, teardown);
+	/* Waiting out a reply that never comes takes a while */
+	tcase_set_timeout(tc, 10);
 	tcase_add_test(tc, sbuxton_set_group_check);
 	tcase_add_test(tc, sbuxton_set_int32_check);
 	tcase_add_test(tc, sbuxton_get_int32_check);
@@ -512,12 +601,15 @@ buxtonsimp_suite(void)
 	tcase_add_test(tc, sbuxton_get_double_check);
 	tcase_add_test(tc, sbuxton_set_bool_check);
 	tcase_add_test(tc, sbuxton_get_bool_check);
+	tcase_add_test(tc, client_request_reconnect_check);
+	tcase_add_test(tc, client_request_timeout_check);
 	tcase_add_test(tc, sbuxton_remove_group_check);
 	suite_add_tcase(s, tc);
 
 	tc = tcase_create("buxtonsimple_internal");
 	tcase_add_test(tc, client_connection_check);
 	tcase_add_test(tc, client_disconnect_check);
+	tcase_add_test(tc, client_key_check);
 	tcase_add_test(tc, cg_cb_check);
 	tcase_add_test(tc, bs_print_check);
 	tcase_add_test(tc, bs_cb_check);
@@ -86,6 +86,20 @@ START_TEST(configurator_default_buxton_socket)
 }
 END_TEST
 
+START_TEST(configurator_default_max_client_buffer)
+{
+	fail_if(buxton_max_client_buffer() != 1048576,
+		"buxton_max_client_buffer() was not 1048576");
+}
+END_TEST
+
+START_TEST(configurator_default_notify_budget)
+{
+	fail_if(buxton_notify_budget() != 0,
+		"buxton_notify_budget() was not 0");
+}
+END_TEST
+
 
 START_TEST(configurator_env_conf_file)
 {
@@ -122,6 +136,30 @@ START_TEST(configurator_env_buxton_socket)
 }
 END_TEST
 
+START_TEST(configurator_env_max_client_buffer)
+{
+	putenv("BUXTON_MAX_CLIENT_BUFFER=4096");
+	fail_if(buxton_max_client_buffer() != 4096,
+		"buxton_max_client_buffer() was not 4096");
+}
+END_TEST
+
+START_TEST(configurator_env_invalid_max_client_buffer)
+{
+	putenv("BUXTON_MAX_CLIENT_BUFFER=lots");
+	fail_if(buxton_max_client_buffer() != 1048576,
+		"buxton_max_client_buffer() did not fall back to 1048576");
+}
+END_TEST
+
+START_TEST(configurator_env_notify_budget)
+{
+	putenv("BUXTON_NOTIFY_BUDGET=100");
+	fail_if(buxton_notify_budget() != 100,
+		"buxton_notify_budget() was not 100");
+}
+END_TEST
+
 
 START_TEST(configurator_cmd_conf_file)
 {
@@ -281,6 +319,8 @@ configurator_suite(void)
 	tcase_add_test(tc, configurator_default_db_path);
 	tcase_add_test(tc, configurator_default_smack_load_file);
 	tcase_add_test(tc, configurator_default_buxton_socket);
+	tcase_add_test(tc, configurator_default_max_client_buffer);
+	tcase_add_test(tc, configurator_default_notify_budget);
 	suite_add_tcase(s, tc);
 
 	tc = tcase_create("env clobbers defaults");
@@ -289,6 +329,9 @@ configurator_suite(void)
 	tcase_add_test(tc, configurator_env_db_path);
 	tcase_add_test(tc, configurator_env_smack_load_file);
 	tcase_add_test(tc, configurator_env_buxton_socket);
+	tcase_add_test(tc, configurator_env_max_client_buffer);
+	tcase_add_test(tc, configurator_env_invalid_max_client_buffer);
+	tcase_add_test(tc, configurator_env_notify_budget);
 	suite_add_tcase(s, tc);
 
 	tc = tcase_create("command line clobbers all");
@@ -22,6 +22,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -182,6 +183,68 @@ static void do_write(int fd, const void *buf, size_t count)
 	}
 }
 
+/* Set up the notification state buxtond starts with */
+static void setup_daemon_notify(BuxtonDaemon *daemon)
+{
+	daemon->notify_mapping = hashmap_new(string_hash_func,
+					     string_compare_func);
+	fail_if(!daemon->notify_mapping, "Failed to allocate hashmap");
+	daemon->notify_groups = hashmap_new(string_hash_func,
+					    string_compare_func);
+	fail_if(!daemon->notify_groups, "Failed to allocate hashmap");
+	daemon->notify_pending = NULL;
+	daemon->notify_pending_tail = NULL;
+	daemon->notify_clock = NULL;
+	daemon->notify_budget = 0;
+	daemon->notify_subscriptions = hashmap_new(notification_hash_func,
+						   notification_compare_func);
+	fail_if(!daemon->notify_subscriptions, "Failed to allocate hashmap");
+}
+
+/* Free the notification state and the labels interned by the daemon */
+static void teardown_daemon_notify(BuxtonDaemon *daemon)
+{
+	hashmap_free(daemon->notify_mapping);
+	hashmap_free(daemon->notify_groups);
+	hashmap_free(daemon->notify_subscriptions);
+	buxton_label_free_all();
+}
+
+/* Connect a client the daemon can send notifications to */
+static void setup_subscriber(client_list_item *cl, int *client, int *server,
+			     BuxtonString *slabel)
+{
+	memzero(cl, sizeof(client_list_item));
+	setup_socket_pair(client, server);
+	cl->fd = *server;
+	cl->smack_label = use_smack() ? buxton_label_intern(slabel) :
+		BUXTON_LABEL_NONE;
+	cl->cred.uid = 1002;
+}
+
+static void check_notification(int fd, uint32_t id, const char *value)
+{
+	BuxtonData *list;
+	BuxtonControlMessage msg;
+	ssize_t csize;
+	ssize_t s;
+	uint8_t buf[4096];
+	uint32_t msgid;
+
+	s = read(fd, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 1, "Failed to get notification");
+	fail_if(msg != BUXTON_CONTROL_CHANGED,
+		"Failed to get correct control type");
+	fail_if(msgid != id, "Got another subscriber's message id");
+	fail_if(!streq(list[0].store.d_string.value, value),
+		"Got value %s instead of %s", list[0].store.d_string.value,
+		value);
+	free(list[0].store.d_string.value);
+	free(list);
+}
+
 START_TEST(buxton_open_check)
 {
 	BuxtonClient c = NULL;
@@ -527,6 +590,55 @@ START_TEST(buxton_get_label_check)
 }
 END_TEST
 
+static void client_pipeline_test(BuxtonResponse response, void *data)
+{
+	int *done = (int *)data;
+
+	fail_if(buxton_response_type(response) != BUXTON_CONTROL_GET,
+		"Failed to get pipelined get response type");
+	fail_if(buxton_response_status(response) != 0,
+		"Pipelined get failed");
+	(*done)++;
+}
+
+START_TEST(buxton_pipeline_check)
+{
+	BuxtonClient c = NULL;
+	int done = 0;
+
+	BuxtonKey group = buxton_key_create("group", NULL, "test-gdbm", BUXTON_TYPE_STRING);
+	fail_if(!group, "Failed to create key for group");
+	BuxtonKey key = buxton_key_create("group", "name", "test-gdbm", BUXTON_TYPE_STRING);
+	fail_if(!key, "Failed to create key");
+
+	fail_if(buxton_open(&c) == -1,
+		"Open failed with daemon.");
+
+	fail_if(buxton_create_group(c, group, NULL, NULL, true),
+		"Creating group in buxton failed.");
+	fail_if(buxton_set_label(c, group, "*", NULL, NULL, true),
+		"Setting group in buxton failed.");
+	fail_if(buxton_set_value(c, key, "bxt_test_value",
+				 client_set_value_test, "group", true),
+		"Setting value in buxton failed.");
+
+	/* More requests than the daemon handles per wakeup */
+	fail_if(buxton_pipeline_begin(c), "Failed to start pipelining");
+	for (int i = 0; i < 200; i++) {
+		fail_if(buxton_get_value(c, key, client_pipeline_test, &done,
+					 false),
+			"Failed to queue pipelined get");
+	}
+	fail_if(buxton_wait_all(c, 5000) != 0,
+		"Failed to wait for pipelined replies");
+	fail_if(done != 200, "Missed pipelined replies");
+	fail_if(buxton_pipeline_end(c), "Failed to stop pipelining");
+
+	buxton_key_free(group);
+	buxton_key_free(key);
+}
+END_TEST
+
 START_TEST(parse_list_check)
 {
 	BuxtonData l3[2];
@@ -940,14 +1052,16 @@ START_TEST(create_group_check)
 	BuxtonDaemon server;
 	BuxtonString clabel = buxton_string_pack("_");
 
+	memzero(&client, sizeof(client_list_item));
+
 	fail_if(!buxton_direct_open(&server.buxton),
 		"Failed to open buxton direct connection");
 
 	client.cred.uid = getuid();
 	if (use_smack())
-		client.smack_label = &clabel;
+		client.smack_label = buxton_label_intern(&clabel);
 	else
-		client.smack_label = NULL;
+		client.smack_label = BUXTON_LABEL_NONE;
 	server.buxton.client.uid = 0;
 
 	key.layer = buxton_string_pack("test-gdbm-user");
@@ -977,14 +1091,16 @@ START_TEST(remove_group_check)
 	BuxtonDaemon server;
 	BuxtonString clabel = buxton_string_pack("_");
 
+	memzero(&client, sizeof(client_list_item));
+
 	fail_if(!buxton_direct_open(&server.buxton),
 		"Failed to open buxton direct connection");
 
 	client.cred.uid = getuid();
 	if (use_smack())
-		client.smack_label = &clabel;
+		client.smack_label = buxton_label_intern(&clabel);
 	else
-		client.smack_label = NULL;
+		client.smack_label = BUXTON_LABEL_NONE;
 	server.buxton.client.uid = 0;
 
 	key.layer = buxton_string_pack("base");
@@ -1007,14 +1123,16 @@ START_TEST(set_label_check)
 	BuxtonDaemon server;
 	BuxtonString clabel = buxton_string_pack("_");
 
+	memzero(&client, sizeof(client_list_item));
+
 	fail_if(!buxton_direct_open(&server.buxton),
 		"Failed to open buxton direct connection");
 
 	client.cred.uid = getuid();
 	if (use_smack())
-		client.smack_label = &clabel;
+		client.smack_label = buxton_label_intern(&clabel);
 	else
-		client.smack_label = NULL;
+		client.smack_label = BUXTON_LABEL_NONE;
 	server.buxton.client.uid = 0;
 	key.layer = buxton_string_pack("test-gdbm");
 	key.group = buxton_string_pack("daemon-check");
@@ -1037,6 +1155,8 @@ START_TEST(set_value_check)
 	BuxtonDaemon server;
 	BuxtonString clabel = buxton_string_pack("_");
 
+	memzero(&client, sizeof(client_list_item));
+
 	fail_if(!buxton_direct_open(&server.buxton),
 		"Failed to open buxton direct connection");
 
@@ -1044,9 +1164,9 @@ START_TEST(set_value_check)
 	server.buxton.client.uid = 0;
 
 	if (use_smack())
-		client.smack_label = &clabel;
+		client.smack_label = buxton_label_intern(&clabel);
 	else
-		client.smack_label = NULL;
+		client.smack_label = BUXTON_LABEL_NONE;
 
 	key.layer = buxton_string_pack("test-gdbm-user");
 	key.group = buxton_string_pack("daemon-check");
@@ -1076,6 +1196,8 @@ START_TEST(get_value_check)
 	BuxtonDaemon server;
 	BuxtonString clabel = buxton_string_pack("_");
 
+	memzero(&client, sizeof(client_list_item));
+
 	fail_if(!buxton_direct_open(&server.buxton),
 		"Failed to open buxton direct connection");
 
@@ -1083,9 +1205,9 @@ START_TEST(get_value_check)
 		"Failed to cache smack rules");
 	client.cred.uid = getuid();
 	if (use_smack())
-		client.smack_label = &clabel;
+		client.smack_label = buxton_label_intern(&clabel);
 	else
-		client.smack_label = NULL;
+		client.smack_label = BUXTON_LABEL_NONE;
 	server.buxton.client.uid = 0;
 	key.layer = buxton_string_pack("test-gdbm-user");
 	key.group = buxton_string_pack("daemon-check");
@@ -1124,14 +1246,16 @@ START_TEST(get_label_check)
 	BuxtonDaemon server;
 	BuxtonString clabel = buxton_string_pack("_");
 
+	memzero(&client, sizeof(client_list_item));
+
 	fail_if(!buxton_direct_open(&server.buxton),
 		"Failed to open buxton direct connection");
 
 	client.cred.uid = getuid();
 	if (use_smack())
-		client.smack_label = &clabel;
+		client.smack_label = buxton_label_intern(&clabel);
 	else
-		client.smack_label = NULL;
+		client.smack_label = BUXTON_LABEL_NONE;
 	server.buxton.client.uid = 0;
 	key.layer = buxton_string_pack("test-gdbm");
 	key.group = buxton_string_pack("daemon-check");
@@ -1158,28 +1282,30 @@ START_TEST(register_notification_check)
 	BuxtonDaemon server;
 	uint32_t msgid;
 
+	memzero(&client, sizeof(client_list_item));
+	memzero(&no_client, sizeof(client_list_item));
+
 	fail_if(!buxton_cache_smack_rules(),
 		"Failed to cache smack rules");
 	if (use_smack())
-		client.smack_label = &clabel;
+		client.smack_label = buxton_label_intern(&clabel);
 	else
-		client.smack_label = NULL;
+		client.smack_label = BUXTON_LABEL_NONE;
 	client.cred.uid = 1002;
 	fail_if(!buxton_direct_open(&server.buxton),
 		"Failed to open buxton direct connection");
-	server.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
-	fail_if(!server.notify_mapping, "Failed to allocate hashmap");
-	server.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!server.client_key_mapping, "Failed to allocate hashmap");
+	setup_daemon_notify(&server);
 
 	key.group = buxton_string_pack("group");
 	key.name = buxton_string_pack("name");
 	key.type = BUXTON_TYPE_STRING;
-	register_notification(&server, &client, &key, 1, &status);
+	register_notification(&server, &client, &key, 2, 0, &status);
 	fail_if(status != 0, "Failed to register notification");
-	register_notification(&server, &client, &key, 1, &status);
+	/* Registering again replaces the message ID */
+	register_notification(&server, &client, &key, 1, 0, &status);
 	fail_if(status != 0, "Failed to register notification");
-	//FIXME: Figure out what to do with duplicates
+	fail_if(hashmap_size(server.notify_subscriptions) != 1,
+		"Duplicate registration kept");
 	key.group = buxton_string_pack("no-key");
 	msgid = unregister_notification(&server, &client, &key, &status);
 	fail_if(status == 0,
@@ -1195,11 +1321,10 @@ START_TEST(register_notification_check)
 		"Unable to unregister from notifications");
 	fail_if(msgid != 1, "Failed to get correct notify message id");
 	key.group = buxton_string_pack("key2");
-	register_notification(&server, &client, &key, 0, &status);
+	register_notification(&server, &client, &key, 0, 0, &status);
 	fail_if(status == 0, "Registered notification with key not in db");
 
-	hashmap_free(server.notify_mapping);
-	hashmap_free(server.client_key_mapping);
+	teardown_daemon_notify(&server);
 	buxton_direct_close(&server.buxton);
 }
 END_TEST
@@ -1215,6 +1340,8 @@ START_TEST(buxtond_handle_message_error_check)
 	BuxtonArray *list = NULL;
 	uint16_t control;
 
+	memzero(&cl, sizeof(client_list_item));
+
 	setup_socket_pair(&client, &server);
 	fail_if(fcntl(client, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
@@ -1225,7 +1352,7 @@ START_TEST(buxtond_handle_message_error_check)
 
 	cl.fd = server;
 	slabel = buxton_string_pack("_");
-	cl.smack_label = &slabel;
+	cl.smack_label = buxton_label_intern(&slabel);
 	daemon.buxton.client.uid = 1001;
 	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
 	fail_if(!buxton_direct_open(&daemon.buxton),
@@ -1238,7 +1365,7 @@ START_TEST(buxtond_handle_message_error_check)
 	cl.data[2] = 0;
 	cl.data[3] = 0;
 	size = 100;
-	r = buxtond_handle_message(&daemon, &cl, size);
+	r = buxtond_handle_message(&daemon, &cl, cl.data, size);
 	fail_if(r, "Failed to detect invalid message data");
 	free(cl.data);
 
@@ -1251,11 +1378,11 @@ START_TEST(buxtond_handle_message_error_check)
 	fail_if(size == 0, "Failed to serialize message");
 	control = BUXTON_CONTROL_MIN;
 	memcpy(cl.data, &control, sizeof(uint16_t));
-	r = buxtond_handle_message(&daemon, &cl, size);
+	r = buxtond_handle_message(&daemon, &cl, cl.data, size);
 	fail_if(r, "Failed to detect min control size");
 	control = BUXTON_CONTROL_MAX;
 	memcpy(cl.data, &control, sizeof(uint16_t));
-	r = buxtond_handle_message(&daemon, &cl, size);
+	r = buxtond_handle_message(&daemon, &cl, cl.data, size);
 	free(cl.data);
 	fail_if(r, "Failed to detect max control size");
 
@@ -1282,6 +1409,8 @@ START_TEST(buxtond_handle_message_create_group_check)
 	uint8_t buf[4096];
 	uint32_t msgid;
 
+	memzero(&cl, sizeof(client_list_item));
+
 	setup_socket_pair(&client, &server);
 	fail_if(fcntl(client, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
@@ -1291,18 +1420,15 @@ START_TEST(buxtond_handle_message_create_group_check)
 	cl.fd = server;
 	slabel = buxton_string_pack("_");
 	if (use_smack())
-		cl.smack_label = &slabel;
+		cl.smack_label = buxton_label_intern(&slabel);
 	else
-		cl.smack_label = NULL;
+		cl.smack_label = BUXTON_LABEL_NONE;
 	cl.cred.uid = 1002;
 	daemon.buxton.client.uid = 1001;
 	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
 	fail_if(!buxton_direct_open(&daemon.buxton),
 		"Failed to open buxton direct connection");
-	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
-	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
+	setup_daemon_notify(&daemon);
 
 	out_list1 = buxton_array_new();
 	fail_if(!out_list1, "Failed to allocate list");
@@ -1318,7 +1444,7 @@ START_TEST(buxtond_handle_message_create_group_check)
 	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_CREATE_GROUP, 0,
 					out_list1);
 	fail_if(size == 0, "Failed to serialize message");
-	r = buxtond_handle_message(&daemon, &cl, size);
+	r = buxtond_handle_message(&daemon, &cl, cl.data, size);
 	free(cl.data);
 	fail_if(!r, "Failed to handle create group message");
 
@@ -1347,7 +1473,7 @@ START_TEST(buxtond_handle_message_create_group_check)
 	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_CREATE_GROUP, 1,
 					out_list2);
 	fail_if(size == 0, "Failed to serialize message");
-	r = buxtond_handle_message(&daemon, &cl, size);
+	r = buxtond_handle_message(&daemon, &cl, cl.data, size);
 	free(cl.data);
 	fail_if(!r, "Failed to handle create group message");
 
@@ -1364,10 +1490,11 @@ START_TEST(buxtond_handle_message_create_group_check)
 	fail_if(msgid != 1, "Failed to get correct message id");
 
 	free(list);
+	free(cl.params);
+	free(cl.reply);
 	cleanup_callbacks();
 	close(client);
-	hashmap_free(daemon.notify_mapping);
-	hashmap_free(daemon.client_key_mapping);
+	teardown_daemon_notify(&daemon);
 	buxton_direct_close(&daemon.buxton);
 	buxton_array_free(&out_list1, NULL);
 	buxton_array_free(&out_list2, NULL);
@@ -1391,6 +1518,8 @@ START_TEST(buxtond_handle_message_remove_group_check)
 	uint8_t buf[4096];
 	uint32_t msgid;
 
+	memzero(&cl, sizeof(client_list_item));
+
 	setup_socket_pair(&client, &server);
 	fail_if(fcntl(client, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
@@ -1402,18 +1531,15 @@ START_TEST(buxtond_handle_message_remove_group_check)
 	cl.fd = server;
 	slabel = buxton_string_pack("_");
 	if (use_smack())
-		cl.smack_label = &slabel;
+		cl.smack_label = buxton_label_intern(&slabel);
 	else
-		cl.smack_label = NULL;
+		cl.smack_label = BUXTON_LABEL_NONE;
 	cl.cred.uid = 1002;
 	daemon.buxton.client.uid = 1001;
 	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
 	fail_if(!buxton_direct_open(&daemon.buxton),
 		"Failed to open buxton direct connection");
-	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
-	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
+	setup_daemon_notify(&daemon);
 
 	data1.type = BUXTON_TYPE_STRING;
 	data1.store.d_string = buxton_string_pack("base");
@@ -1427,7 +1553,7 @@ START_TEST(buxtond_handle_message_remove_group_check)
 	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_REMOVE_GROUP, 0,
 					out_list);
 	fail_if(size == 0, "Failed to serialize message");
-	r = buxtond_handle_message(&daemon, &cl, size);
+	r = buxtond_handle_message(&daemon, &cl, cl.data, size);
 	free(cl.data);
 	fail_if(!r, "Failed to handle remove group message");
 
@@ -1444,10 +1570,11 @@ START_TEST(buxtond_handle_message_remove_group_check)
 	fail_if(msgid != 0, "Failed to get correct message id");
 
 	free(list);
+	free(cl.params);
+	free(cl.reply);
 	cleanup_callbacks();
 	close(client);
-	hashmap_free(daemon.notify_mapping);
-	hashmap_free(daemon.client_key_mapping);
+	teardown_daemon_notify(&daemon);
 	buxton_direct_close(&daemon.buxton);
 	buxton_array_free(&out_list, NULL);
 }
@@ -1470,6 +1597,8 @@ START_TEST(buxtond_handle_message_set_label_check)
 	uint8_t buf[4096];
 	uint32_t msgid;
 
+	memzero(&cl, sizeof(client_list_item));
+
 	setup_socket_pair(&client, &server);
 	fail_if(fcntl(client, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
@@ -1481,18 +1610,15 @@ START_TEST(buxtond_handle_message_set_label_check)
 	cl.fd = server;
 	slabel = buxton_string_pack("_");
 	if (use_smack())
-		cl.smack_label = &slabel;
+		cl.smack_label = buxton_label_intern(&slabel);
 	else
-		cl.smack_label = NULL;
+		cl.smack_label = BUXTON_LABEL_NONE;
 	cl.cred.uid = 1002;
 	daemon.buxton.client.uid = 1001;
 	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
 	fail_if(!buxton_direct_open(&daemon.buxton),
 		"Failed to open buxton direct connection");
-	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
-	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
+	setup_daemon_notify(&daemon);
 
 	data1.type = BUXTON_TYPE_STRING;
 	data1.store.d_string = buxton_string_pack("base");
@@ -1510,7 +1636,7 @@ START_TEST(buxtond_handle_message_set_label_check)
 	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_SET_LABEL, 0,
 					out_list);
 	fail_if(size == 0, "Failed to serialize message");
-	r = buxtond_handle_message(&daemon, &cl, size);
+	r = buxtond_handle_message(&daemon, &cl, cl.data, size);
 	free(cl.data);
 	fail_if(!r, "Failed to handle set label message");
 
@@ -1527,10 +1653,11 @@ START_TEST(buxtond_handle_message_set_label_check)
 	fail_if(msgid != 0, "Failed to get correct message id");
 
 	free(list);
+	free(cl.params);
+	free(cl.reply);
 	cleanup_callbacks();
 	close(client);
-	hashmap_free(daemon.notify_mapping);
-	hashmap_free(daemon.client_key_mapping);
+	teardown_daemon_notify(&daemon);
 	buxton_direct_close(&daemon.buxton);
 	buxton_array_free(&out_list, NULL);
 }
@@ -1553,6 +1680,8 @@ START_TEST(buxtond_handle_message_set_value_check)
 	uint8_t buf[4096];
 	uint32_t msgid;
 
+	memzero(&cl, sizeof(client_list_item));
+
 	setup_socket_pair(&client, &server);
 	fail_if(fcntl(client, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
@@ -1564,18 +1693,15 @@ START_TEST(buxtond_handle_message_set_value_check)
 	cl.fd = server;
 	slabel = buxton_string_pack("_");
 	if (use_smack())
-		cl.smack_label = &slabel;
+		cl.smack_label = buxton_label_intern(&slabel);
 	else
-		cl.smack_label = NULL;
+		cl.smack_label = BUXTON_LABEL_NONE;
 	cl.cred.uid = 1002;
 	daemon.buxton.client.uid = 1001;
 	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
 	fail_if(!buxton_direct_open(&daemon.buxton),
 		"Failed to open buxton direct connection");
-	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
-	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
+	setup_daemon_notify(&daemon);
 
 	data1.type = BUXTON_TYPE_STRING;
 	data1.store.d_string = buxton_string_pack("base");
@@ -1596,14 +1722,14 @@ START_TEST(buxtond_handle_message_set_value_check)
 	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_NOTIFY, 0,
 					out_list);
 	fail_if(size == 0, "Failed to serialize message");
-	r = buxtond_handle_message(&daemon, &cl, size);
+	r = buxtond_handle_message(&daemon, &cl, cl.data, size);
 	free(cl.data);
 	fail_if(r, "Failed to detect parse_list failure");
 
 	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_SET, 0,
 					out_list);
 	fail_if(size == 0, "Failed to serialize message");
-	r = buxtond_handle_message(&daemon, &cl, size);
+	r = buxtond_handle_message(&daemon, &cl, cl.data, size);
 	free(cl.data);
 	fail_if(!r, "Failed to handle set message");
 
@@ -1620,10 +1746,11 @@ START_TEST(buxtond_handle_message_set_value_check)
 	fail_if(msgid != 0, "Failed to get correct message id");
 
 	free(list);
+	free(cl.params);
+	free(cl.reply);
 	cleanup_callbacks();
 	close(client);
-	hashmap_free(daemon.notify_mapping);
-	hashmap_free(daemon.client_key_mapping);
+	teardown_daemon_notify(&daemon);
 	buxton_direct_close(&daemon.buxton);
 	buxton_array_free(&out_list, NULL);
 }
@@ -1647,6 +1774,8 @@ START_TEST(buxtond_handle_message_get_check)
 	uint8_t buf[4096];
 	uint32_t msgid;
 
+	memzero(&cl, sizeof(client_list_item));
+
 	setup_socket_pair(&client, &server);
 	out_list = buxton_array_new();
 	fail_if(!out_list, "Failed to allocate list");
@@ -1654,9 +1783,9 @@ START_TEST(buxtond_handle_message_get_check)
 	cl.fd = server;
 	slabel = buxton_string_pack("_");
 	if (use_smack())
-		cl.smack_label = &slabel;
+		cl.smack_label = buxton_label_intern(&slabel);
 	else
-		cl.smack_label = NULL;
+		cl.smack_label = BUXTON_LABEL_NONE;
 	cl.cred.uid = getuid();
 	daemon.buxton.client.uid = 1001;
 	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
@@ -1682,7 +1811,7 @@ START_TEST(buxtond_handle_message_get_check)
 	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_GET, 0,
 					out_list);
 	fail_if(size == 0, "Failed to serialize message");
-	r = buxtond_handle_message(&daemon, &cl, size);
+	r = buxtond_handle_message(&daemon, &cl, cl.data, size);
 	free(cl.data);
 	fail_if(!r, "Failed to get message 1");
 
@@ -1714,7 +1843,7 @@ START_TEST(buxtond_handle_message_get_check)
 	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_GET, 0,
 					out_list2);
 	fail_if(size == 0, "Failed to serialize message 2");
-	r = buxtond_handle_message(&daemon, &cl, size);
+	r = buxtond_handle_message(&daemon, &cl, cl.data, size);
 	free(cl.data);
 	fail_if(!r, "Failed to get message 2");
 
@@ -1734,6 +1863,8 @@ START_TEST(buxtond_handle_message_get_check)
 
 	free(list[1].store.d_string.value);
 	free(list);
+	free(cl.params);
+	free(cl.reply);
 	close(client);
 	buxton_direct_close(&daemon.buxton);
 	buxton_array_free(&out_list, NULL);
@@ -1758,6 +1889,8 @@ START_TEST(buxtond_handle_message_get_label_check)
 	uint8_t buf[4096];
 	uint32_t msgid;
 
+	memzero(&cl, sizeof(client_list_item));
+
 	setup_socket_pair(&client, &server);
 	fail_if(fcntl(client, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
@@ -1769,18 +1902,15 @@ START_TEST(buxtond_handle_message_get_label_check)
 	cl.fd = server;
 	slabel = buxton_string_pack("_");
 	if (use_smack())
-		cl.smack_label = &slabel;
+		cl.smack_label = buxton_label_intern(&slabel);
 	else
-		cl.smack_label = NULL;
+		cl.smack_label = BUXTON_LABEL_NONE;
 	cl.cred.uid = 1002;
 	daemon.buxton.client.uid = 1001;
 	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
 	fail_if(!buxton_direct_open(&daemon.buxton),
 		"Failed to open buxton direct connection");
-	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
-	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
+	setup_daemon_notify(&daemon);
 
 	data1.type = BUXTON_TYPE_STRING;
 	data1.store.d_string = buxton_string_pack("base");
@@ -1794,7 +1924,7 @@ START_TEST(buxtond_handle_message_get_label_check)
 	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_GET_LABEL, 0,
 					out_list);
 	fail_if(size == 0, "Failed to serialize message");
-	r = buxtond_handle_message(&daemon, &cl, size);
+	r = buxtond_handle_message(&daemon, &cl, cl.data, size);
 	free(cl.data);
 	fail_if(!r, "Failed to handle get label message");
 
@@ -1813,11 +1943,13 @@ START_TEST(buxtond_handle_message_get_label_check)
 	fail_if(!streq(list[1].store.d_string.value, "*"),
 		"Failed to get correct label");
 
+	free(list[1].store.d_string.value);
 	free(list);
+	free(cl.params);
+	free(cl.reply);
 	cleanup_callbacks();
 	close(client);
-	hashmap_free(daemon.notify_mapping);
-	hashmap_free(daemon.client_key_mapping);
+	teardown_daemon_notify(&daemon);
 	buxton_direct_close(&daemon.buxton);
 	buxton_array_free(&out_list, NULL);
 }
@@ -1840,6 +1972,8 @@ START_TEST(buxtond_handle_message_notify_check)
 	uint8_t buf[4096];
 	uint32_t msgid;
 
+	memzero(&cl, sizeof(client_list_item));
+
 	setup_socket_pair(&client, &server);
 	out_list = buxton_array_new();
 	fail_if(!out_list, "Failed to allocate list");
@@ -1847,15 +1981,12 @@ START_TEST(buxtond_handle_message_notify_check)
 	cl.fd = server;
 	slabel = buxton_string_pack("_");
 	if (use_smack())
-		cl.smack_label = &slabel;
+		cl.smack_label = buxton_label_intern(&slabel);
 	else
-		cl.smack_label = NULL;
+		cl.smack_label = BUXTON_LABEL_NONE;
 	cl.cred.uid = 1002;
 	daemon.buxton.client.uid = 1001;
-	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
-	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
+	setup_daemon_notify(&daemon);
 	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
 	fail_if(!buxton_direct_open(&daemon.buxton),
 		"Failed to open buxton direct connection");
@@ -1875,7 +2006,7 @@ START_TEST(buxtond_handle_message_notify_check)
 	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_NOTIFY, 0,
 					out_list);
 	fail_if(size == 0, "Failed to serialize message");
-	r = buxtond_handle_message(&daemon, &cl, size);
+	r = buxtond_handle_message(&daemon, &cl, cl.data, size);
 	free(cl.data);
 	fail_if(!r, "Failed to register for notification");
 
@@ -1896,7 +2027,7 @@ START_TEST(buxtond_handle_message_notify_check)
 	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_UNNOTIFY, 0,
 					out_list);
 	fail_if(size == 0, "Failed to serialize message");
-	r = buxtond_handle_message(&daemon, &cl, size);
+	r = buxtond_handle_message(&daemon, &cl, cl.data, size);
 	free(cl.data);
 	fail_if(!r, "Failed to unregister from notification");
 
@@ -1917,9 +2048,10 @@ START_TEST(buxtond_handle_message_notify_check)
 	fail_if(msgid != 0, "Failed to get correct message id 2");
 
 	free(list);
+	free(cl.params);
+	free(cl.reply);
 	close(client);
-	hashmap_free(daemon.notify_mapping);
-	hashmap_free(daemon.client_key_mapping);
+	teardown_daemon_notify(&daemon);
 	buxton_direct_close(&daemon.buxton);
 	buxton_array_free(&out_list, NULL);
 }
@@ -1942,6 +2074,8 @@ START_TEST(buxtond_handle_message_unset_check)
 	uint8_t buf[4096];
 	uint32_t msgid;
 
+	memzero(&cl, sizeof(client_list_item));
+
 	setup_socket_pair(&client, &server);
 	out_list = buxton_array_new();
 	fail_if(!out_list, "Failed to allocate list");
@@ -1949,18 +2083,15 @@ START_TEST(buxtond_handle_message_unset_check)
 	cl.fd = server;
 	slabel = buxton_string_pack("_");
 	if (use_smack())
-		cl.smack_label = &slabel;
+		cl.smack_label = buxton_label_intern(&slabel);
 	else
-		cl.smack_label = NULL;
+		cl.smack_label = BUXTON_LABEL_NONE;
 	cl.cred.uid = 1002;
 	daemon.buxton.client.uid = 1001;
 	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
 	fail_if(!buxton_direct_open(&daemon.buxton),
 		"Failed to open buxton direct connection");
-	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
-	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
+	setup_daemon_notify(&daemon);
 
 	data1.type = BUXTON_TYPE_STRING;
 	data1.store.d_string = buxton_string_pack("base");
@@ -1981,7 +2112,7 @@ START_TEST(buxtond_handle_message_unset_check)
 	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_UNSET, 0,
 					out_list);
 	fail_if(size == 0, "Failed to serialize message");
-	r = buxtond_handle_message(&daemon, &cl, size);
+	r = buxtond_handle_message(&daemon, &cl, cl.data, size);
 	free(cl.data);
 	fail_if(!r, "Failed to unset message");
 
@@ -1998,14 +2129,518 @@ START_TEST(buxtond_handle_message_unset_check)
 	fail_if(msgid != 0, "Failed to get correct message id");
 
 	free(list);
+	free(cl.params);
+	free(cl.reply);
 	close(client);
-	hashmap_free(daemon.notify_mapping);
-	hashmap_free(daemon.client_key_mapping);
+	teardown_daemon_notify(&daemon);
 	buxton_direct_close(&daemon.buxton);
 	buxton_array_free(&out_list, NULL);
 }
 END_TEST
 
+START_TEST(buxtond_handle_message_batch_check)
+{
+	int client, server;
+	BuxtonDaemon daemon;
+	BuxtonString slabel;
+	size_t size;
+	BuxtonData params[17];
+	size_t count = 0;
+	client_list_item cl;
+	bool r;
+	BuxtonData *list;
+	BuxtonControlMessage msg;
+	ssize_t csize;
+	ssize_t s;
+	uint8_t buf[4096];
+	uint8_t *send = NULL;
+	size_t send_alloc = 0;
+	uint32_t msgid;
+
+	memzero(&cl, sizeof(client_list_item));
+
+	setup_socket_pair(&client, &server);
+	cl.fd = server;
+	slabel = buxton_string_pack("_");
+	if (use_smack())
+		cl.smack_label = buxton_label_intern(&slabel);
+	else
+		cl.smack_label = BUXTON_LABEL_NONE;
+	cl.cred.uid = 1002;
+	daemon.buxton.client.uid = 1001;
+	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
+	fail_if(!buxton_direct_open(&daemon.buxton),
+		"Failed to open buxton direct connection");
+	setup_daemon_notify(&daemon);
+
+	/* set base/daemon-check/name */
+	params[count].type = BUXTON_TYPE_UINT32;
+	params[count++].store.d_uint32 = BUXTON_CONTROL_SET;
+	params[count].type = BUXTON_TYPE_UINT32;
+	params[count++].store.d_uint32 = 4;
+	params[count].type = BUXTON_TYPE_STRING;
+	params[count++].store.d_string = buxton_string_pack("base");
+	params[count].type = BUXTON_TYPE_STRING;
+	params[count++].store.d_string = buxton_string_pack("daemon-check");
+	params[count].type = BUXTON_TYPE_STRING;
+	params[count++].store.d_string = buxton_string_pack("name");
+	params[count].type = BUXTON_TYPE_STRING;
+	params[count++].store.d_string = buxton_string_pack("bxt_batch_value");
+	/* get it back */
+	params[count].type = BUXTON_TYPE_UINT32;
+	params[count++].store.d_uint32 = BUXTON_CONTROL_GET;
+	params[count].type = BUXTON_TYPE_UINT32;
+	params[count++].store.d_uint32 = 4;
+	params[count].type = BUXTON_TYPE_STRING;
+	params[count++].store.d_string = buxton_string_pack("base");
+	params[count].type = BUXTON_TYPE_STRING;
+	params[count++].store.d_string = buxton_string_pack("daemon-check");
+	params[count].type = BUXTON_TYPE_STRING;
+	params[count++].store.d_string = buxton_string_pack("name");
+	params[count].type = BUXTON_TYPE_UINT32;
+	params[count++].store.d_uint32 = BUXTON_TYPE_STRING;
+	/* get a key that doesn't exist */
+	params[count].type = BUXTON_TYPE_UINT32;
+	params[count++].store.d_uint32 = BUXTON_CONTROL_GET;
+	params[count].type = BUXTON_TYPE_UINT32;
+	params[count++].store.d_uint32 = 3;
+	params[count].type = BUXTON_TYPE_STRING;
+	params[count++].store.d_string = buxton_string_pack("daemon-check");
+	params[count].type = BUXTON_TYPE_STRING;
+	params[count++].store.d_string = buxton_string_pack("batch-missing");
+	params[count].type = BUXTON_TYPE_UINT32;
+	params[count++].store.d_uint32 = BUXTON_TYPE_STRING;
+
+	size = buxton_serialize_message_into(&send, &send_alloc,
+					     BUXTON_CONTROL_BATCH, 7, params,
+					     count, NULL);
+	fail_if(size == 0, "Failed to serialize batch message");
+	r = buxtond_handle_message(&daemon, &cl, send, size);
+	fail_if(!r, "Failed to handle batch message");
+
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 5, "Failed to get correct response to batch");
+	fail_if(msg != BUXTON_CONTROL_STATUS,
+		"Failed to get correct control type");
+	fail_if(msgid != 7, "Failed to get correct message id");
+	fail_if(list[0].type != BUXTON_TYPE_INT32 ||
+		list[0].store.d_int32 != 0, "Failed to run batch");
+	fail_if(list[1].type != BUXTON_TYPE_INT32 ||
+		list[1].store.d_int32 != 0, "Failed to set in batch");
+	fail_if(list[2].type != BUXTON_TYPE_INT32 ||
+		list[2].store.d_int32 != 0, "Failed to get in batch");
+	fail_if(list[3].type != BUXTON_TYPE_STRING,
+		"Failed to get correct value type in batch");
+	fail_if(!streq(list[3].store.d_string.value, "bxt_batch_value"),
+		"Failed to get value set earlier in batch");
+	fail_if(list[4].type != BUXTON_TYPE_INT32 ||
+		list[4].store.d_int32 == 0, "Got missing key in batch");
+	free(list[3].store.d_string.value);
+	free(list);
+
+	/* An operation that can't be batched rejects the whole batch */
+	params[0].store.d_uint32 = BUXTON_CONTROL_CREATE_GROUP;
+	size = buxton_serialize_message_into(&send, &send_alloc,
+					     BUXTON_CONTROL_BATCH, 8, params,
+					     count, NULL);
+	fail_if(size == 0, "Failed to serialize batch message 2");
+	r = buxtond_handle_message(&daemon, &cl, send, size);
+	fail_if(!r, "Failed to handle batch message 2");
+
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed 2");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 1, "Failed to get correct response to bad batch");
+	fail_if(msgid != 8, "Failed to get correct message id 2");
+	fail_if(list[0].type != BUXTON_TYPE_INT32 ||
+		list[0].store.d_int32 != -1, "Failed to reject bad batch");
+	free(list);
+
+	/* A truncated operation rejects the whole batch */
+	params[0].store.d_uint32 = BUXTON_CONTROL_SET;
+	size = buxton_serialize_message_into(&send, &send_alloc,
+					     BUXTON_CONTROL_BATCH, 9, params,
+					     count - 1, NULL);
+	fail_if(size == 0, "Failed to serialize batch message 3");
+	r = buxtond_handle_message(&daemon, &cl, send, size);
+	fail_if(!r, "Failed to handle batch message 3");
+
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed 3");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 1, "Failed to get correct response to short batch");
+	fail_if(list[0].store.d_int32 != -1, "Failed to reject short batch");
+	free(list);
+
+	free(send);
+	free(cl.params);
+	free(cl.results);
+	free(cl.reply);
+	close(client);
+	teardown_daemon_notify(&daemon);
+	buxton_direct_close(&daemon.buxton);
+}
+END_TEST
+
+/* Add a get of a daemon-check key on the base layer to a batch */
+static size_t add_batch_get(BuxtonData *params, size_t count, char *name)
+{
+	params[count].type = BUXTON_TYPE_UINT32;
+	params[count++].store.d_uint32 = BUXTON_CONTROL_GET;
+	params[count].type = BUXTON_TYPE_UINT32;
+	params[count++].store.d_uint32 = 4;
+	params[count].type = BUXTON_TYPE_STRING;
+	params[count++].store.d_string = buxton_string_pack("base");
+	params[count].type = BUXTON_TYPE_STRING;
+	params[count++].store.d_string = buxton_string_pack("daemon-check");
+	params[count].type = BUXTON_TYPE_STRING;
+	params[count++].store.d_string = buxton_string_pack(name);
+	params[count].type = BUXTON_TYPE_UINT32;
+	params[count++].store.d_uint32 = BUXTON_TYPE_STRING;
+
+	return count;
+}
+
+START_TEST(buxtond_handle_message_batch_reply_check)
+{
+	int client, server;
+	BuxtonDaemon daemon;
+	BuxtonString slabel;
+	BuxtonString dlabel;
+	_BuxtonKey key;
+	BuxtonData value;
+	BuxtonData *params;
+	size_t size;
+	size_t count;
+	client_list_item cl;
+	bool r;
+	BuxtonData *list;
+	BuxtonControlMessage msg;
+	ssize_t csize;
+	ssize_t s;
+	uint8_t *buf;
+	uint8_t *send = NULL;
+	size_t send_alloc = 0;
+	uint32_t msgid;
+	char *big;
+	char *names[] = { "batch-big0", "batch-big1", "batch-big2" };
+
+	memzero(&daemon, sizeof(BuxtonDaemon));
+	slabel = buxton_string_pack("_");
+	setup_subscriber(&cl, &client, &server, &slabel);
+	daemon.buxton.client.uid = 1001;
+	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
+	fail_if(!buxton_direct_open(&daemon.buxton),
+		"Failed to open buxton direct connection");
+	setup_daemon_notify(&daemon);
+	params = malloc0(sizeof(BuxtonData) * BUXTON_MESSAGE_MAX_PARAMS);
+	buf = malloc(BUXTON_MESSAGE_MAX_LENGTH);
+	fail_if(!params || !buf, "Failed to allocate batch buffers");
+
+	/* Three values that don't all fit in one message */
+	big = malloc(12000);
+	fail_if(!big, "Failed to allocate value");
+	memset(big, 'x', 11999);
+	big[11999] = '\0';
+	key.layer = buxton_string_pack("base");
+	key.group = buxton_string_pack("daemon-check");
+	key.type = BUXTON_TYPE_STRING;
+	value.type = BUXTON_TYPE_STRING;
+	value.store.d_string = buxton_string_pack(big);
+	for (int i = 0; i < 3; i++) {
+		key.name = buxton_string_pack(names[i]);
+		r = buxton_direct_set_value(&daemon.buxton, &key, &value, BUXTON_LABEL_NONE);
+		fail_if(!r, "Failed to set large value");
+	}
+	key.name = buxton_string_pack("batch-small");
+	value.store.d_string = buxton_string_pack("small");
+	r = buxton_direct_set_value(&daemon.buxton, &key, &value, BUXTON_LABEL_NONE);
+	fail_if(!r, "Failed to set small value");
+
+	/* Two of them do */
+	count = add_batch_get(params, 0, names[0]);
+	count = add_batch_get(params, count, names[1]);
+	size = buxton_serialize_message_into(&send, &send_alloc,
+					     BUXTON_CONTROL_BATCH, 1, params,
+					     count, NULL);
+	fail_if(size == 0, "Failed to serialize batch message");
+	fail_if(!buxtond_handle_message(&daemon, &cl, send, size),
+		"Failed to handle batch message");
+	s = read(client, buf, BUXTON_MESSAGE_MAX_LENGTH);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 5, "Failed to get large batch reply");
+	fail_if(list[0].store.d_int32 != 0, "Failed to run batch");
+	fail_if(list[2].store.d_string.length != 12000,
+		"Failed to get large value");
+	free(list[2].store.d_string.value);
+	free(list[4].store.d_string.value);
+	free(list);
+
+	/* Reading all three is rejected rather than sent */
+	count = add_batch_get(params, count, names[2]);
+	size = buxton_serialize_message_into(&send, &send_alloc,
+					     BUXTON_CONTROL_BATCH, 2, params,
+					     count, NULL);
+	fail_if(size == 0, "Failed to serialize batch message 2");
+	fail_if(!buxtond_handle_message(&daemon, &cl, send, size),
+		"Failed to handle batch message 2");
+	s = read(client, buf, BUXTON_MESSAGE_MAX_LENGTH);
+	fail_if(s < 0, "Read from client failed 2");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 1 || msgid != 2,
+		"Failed to get correct response to large batch");
+	fail_if(list[0].store.d_int32 != -1, "Failed to reject large batch");
+	free(list);
+
+	/* A write of the batch is not applied either */
+	params[count].type = BUXTON_TYPE_UINT32;
+	params[count++].store.d_uint32 = BUXTON_CONTROL_SET;
+	params[count].type = BUXTON_TYPE_UINT32;
+	params[count++].store.d_uint32 = 4;
+	params[count].type = BUXTON_TYPE_STRING;
+	params[count++].store.d_string = buxton_string_pack("base");
+	params[count].type = BUXTON_TYPE_STRING;
+	params[count++].store.d_string = buxton_string_pack("daemon-check");
+	params[count].type = BUXTON_TYPE_STRING;
+	params[count++].store.d_string = buxton_string_pack("batch-small");
+	params[count].type = BUXTON_TYPE_STRING;
+	params[count++].store.d_string = buxton_string_pack("changed");
+	size = buxton_serialize_message_into(&send, &send_alloc,
+					     BUXTON_CONTROL_BATCH, 3, params,
+					     count, NULL);
+	fail_if(size == 0, "Failed to serialize batch message 3");
+	fail_if(!buxtond_handle_message(&daemon, &cl, send, size),
+		"Failed to handle batch message 3");
+	s = read(client, buf, BUXTON_MESSAGE_MAX_LENGTH);
+	fail_if(s < 0, "Read from client failed 3");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 1 || list[0].store.d_int32 != -1,
+		"Failed to reject large batch with a write");
+	free(list);
+	key.name = buxton_string_pack("batch-small");
+	fail_if(buxton_direct_get_value(&daemon.buxton, &key, &value, &dlabel,
+					BUXTON_LABEL_NONE),
+		"Failed to get small value");
+	fail_if(!streq(value.store.d_string.value, "small"),
+		"Applied write of rejected batch");
+	free(value.store.d_string.value);
+	free(dlabel.value);
+
+	/* Neither are more gets than a reply may carry */
+	count = 0;
+	for (int i = 0; i <= BUXTON_BATCH_MAX_GETS; i++) {
+		count = add_batch_get(params, count, "batch-small");
+	}
+	size = buxton_serialize_message_into(&send, &send_alloc,
+					     BUXTON_CONTROL_BATCH, 4, params,
+					     count, NULL);
+	fail_if(size == 0, "Failed to serialize batch message 4");
+	fail_if(!buxtond_handle_message(&daemon, &cl, send, size),
+		"Failed to handle batch message 4");
+	s = read(client, buf, BUXTON_MESSAGE_MAX_LENGTH);
+	fail_if(s < 0, "Read from client failed 4");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 1 || list[0].store.d_int32 != -1,
+		"Failed to reject batch with too many gets");
+	free(list);
+
+	for (int i = 0; i < 3; i++) {
+		key.name = buxton_string_pack(names[i]);
+		r = buxton_direct_unset_value(&daemon.buxton, &key, BUXTON_LABEL_NONE);
+		fail_if(!r, "Failed to unset large value");
+	}
+	free(big);
+	free(buf);
+	free(params);
+	free(send);
+	free(cl.params);
+	free(cl.results);
+	free(cl.reply);
+	close(client);
+	close(server);
+	teardown_daemon_notify(&daemon);
+	buxton_direct_close(&daemon.buxton);
+}
+END_TEST
+
+START_TEST(buxtond_handle_message_commit_check)
+{
+	int client, server;
+	int client2, server2;
+	BuxtonDaemon daemon;
+	BuxtonString slabel;
+	BuxtonString dlabel;
+	size_t size;
+	BuxtonData params[12];
+	BuxtonData result;
+	size_t count = 0;
+	client_list_item cl, cl2;
+	_BuxtonKey key;
+	int32_t status;
+	bool r;
+	BuxtonData *list;
+	BuxtonControlMessage msg;
+	ssize_t csize;
+	ssize_t s;
+	uint8_t buf[4096];
+	uint8_t *send = NULL;
+	size_t send_alloc = 0;
+	uint32_t msgid;
+
+	memzero(&cl, sizeof(client_list_item));
+
+	setup_socket_pair(&client, &server);
+	cl.fd = server;
+	slabel = buxton_string_pack("_");
+	if (use_smack())
+		cl.smack_label = buxton_label_intern(&slabel);
+	else
+		cl.smack_label = BUXTON_LABEL_NONE;
+	cl.cred.uid = 1002;
+	daemon.buxton.client.uid = 1001;
+	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
+	fail_if(!buxton_direct_open(&daemon.buxton),
+		"Failed to open buxton direct connection");
+	setup_daemon_notify(&daemon);
+
+	/* set base/daemon-check/name, then unset base/daemon-check/name */
+	params[count].type = BUXTON_TYPE_UINT32;
+	params[count++].store.d_uint32 = BUXTON_CONTROL_SET;
+	params[count].type = BUXTON_TYPE_UINT32;
+	params[count++].store.d_uint32 = 4;
+	params[count].type = BUXTON_TYPE_STRING;
+	params[count++].store.d_string = buxton_string_pack("base");
+	params[count].type = BUXTON_TYPE_STRING;
+	params[count++].store.d_string = buxton_string_pack("daemon-check");
+	params[count].type = BUXTON_TYPE_STRING;
+	params[count++].store.d_string = buxton_string_pack("name");
+	params[count].type = BUXTON_TYPE_STRING;
+	params[count++].store.d_string = buxton_string_pack("bxt_commit_value");
+	params[count].type = BUXTON_TYPE_UINT32;
+	params[count++].store.d_uint32 = BUXTON_CONTROL_UNSET;
+	params[count].type = BUXTON_TYPE_UINT32;
+	params[count++].store.d_uint32 = 4;
+	params[count].type = BUXTON_TYPE_STRING;
+	params[count++].store.d_string = buxton_string_pack("base");
+	params[count].type = BUXTON_TYPE_STRING;
+	params[count++].store.d_string = buxton_string_pack("daemon-check");
+	params[count].type = BUXTON_TYPE_STRING;
+	params[count++].store.d_string = buxton_string_pack("commit-missing");
+	params[count].type = BUXTON_TYPE_UINT32;
+	params[count++].store.d_uint32 = BUXTON_TYPE_STRING;
+
+	/* The unset fails, so the set mustn't happen either */
+	size = buxton_serialize_message_into(&send, &send_alloc,
+					     BUXTON_CONTROL_COMMIT, 3, params,
+					     count, NULL);
+	fail_if(size == 0, "Failed to serialize commit message");
+	r = buxtond_handle_message(&daemon, &cl, send, size);
+	fail_if(!r, "Failed to handle commit message");
+
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 1, "Failed to get correct response to commit");
+	fail_if(msg != BUXTON_CONTROL_STATUS,
+		"Failed to get correct control type");
+	fail_if(msgid != 3, "Failed to get correct message id");
+	fail_if(list[0].type != BUXTON_TYPE_INT32 ||
+		list[0].store.d_int32 != -1, "Failed to reject commit");
+	free(list);
+
+	key.layer = buxton_string_pack("base");
+	key.group = buxton_string_pack("daemon-check");
+	key.name = buxton_string_pack("name");
+	key.type = BUXTON_TYPE_STRING;
+	fail_if(buxton_direct_get_value_for_layer(&daemon.buxton, &key,
+						  &result, &dlabel, BUXTON_LABEL_NONE),
+		"Failed to get value after rejected commit");
+	fail_if(streq(result.store.d_string.value, "bxt_commit_value"),
+		"Rejected commit changed a value");
+	free(result.store.d_string.value);
+	free(dlabel.value);
+
+	/* Now only commit the set */
+	size = buxton_serialize_message_into(&send, &send_alloc,
+					     BUXTON_CONTROL_COMMIT, 4, params,
+					     6, NULL);
+	fail_if(size == 0, "Failed to serialize commit message 2");
+	r = buxtond_handle_message(&daemon, &cl, send, size);
+	fail_if(!r, "Failed to handle commit message 2");
+
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed 2");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 1, "Failed to get correct response to commit 2");
+	fail_if(list[0].store.d_int32 != 0, "Failed to commit");
+	free(list);
+
+	fail_if(buxton_direct_get_value_for_layer(&daemon.buxton, &key,
+						  &result, &dlabel, BUXTON_LABEL_NONE),
+		"Failed to get value after commit");
+	fail_if(!streq(result.store.d_string.value, "bxt_commit_value"),
+		"Commit didn't change value");
+	free(result.store.d_string.value);
+	free(dlabel.value);
+
+	/* Gets can't be part of a transaction */
+	params[0].store.d_uint32 = BUXTON_CONTROL_GET;
+	size = buxton_serialize_message_into(&send, &send_alloc,
+					     BUXTON_CONTROL_COMMIT, 5, params,
+					     6, NULL);
+	fail_if(size == 0, "Failed to serialize commit message 3");
+	r = buxtond_handle_message(&daemon, &cl, send, size);
+	fail_if(!r, "Failed to handle commit message 3");
+
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed 3");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 1, "Failed to get correct response to commit 3");
+	fail_if(list[0].store.d_int32 != -1, "Failed to reject get in commit");
+	free(list);
+
+	/* Subscribers hear of the last change to a key once, even if the
+	 * reply to the commit can't be sent */
+	memzero(&cl2, sizeof(client_list_item));
+	setup_socket_pair(&client2, &server2);
+	cl2.fd = server2;
+	cl2.smack_label = cl.smack_label;
+	cl2.cred.uid = 1002;
+	register_notification(&daemon, &cl2, &key, 6, 0, &status);
+	fail_if(status != 0, "Failed to register notification");
+	params[0].store.d_uint32 = BUXTON_CONTROL_SET;
+	params[5].store.d_string = buxton_string_pack("bxt_commit_first");
+	memcpy(params + 6, params, sizeof(BuxtonData) * 6);
+	params[11].store.d_string = buxton_string_pack("bxt_commit_last");
+	close(client);
+	size = buxton_serialize_message_into(&send, &send_alloc,
+					     BUXTON_CONTROL_COMMIT, 7, params,
+					     12, NULL);
+	fail_if(size == 0, "Failed to serialize commit message 4");
+	r = buxtond_handle_message(&daemon, &cl, send, size);
+	fail_if(r, "Replied to a closed client");
+	check_notification(client2, 6, "bxt_commit_last");
+	fail_if(recv(client2, buf, 4096, MSG_DONTWAIT) != -1,
+		"Notified of an overwritten change");
+	msgid = unregister_notification(&daemon, &cl2, &key, &status);
+	fail_if(status != 0 || msgid != 6,
+		"Failed to unregister notification");
+
+	free(send);
+	free(cl.params);
+	free(cl.txn);
+	free(cl.reply);
+	free(cl2.reply);
+	close(client2);
+	close(server2);
+	teardown_daemon_notify(&daemon);
+	buxton_direct_close(&daemon.buxton);
+}
+END_TEST
+
 START_TEST(buxtond_notify_clients_check)
 {
 	int client, server;
@@ -2023,20 +2658,18 @@ START_TEST(buxtond_notify_clients_check)
 	uint8_t buf[4096];
 	uint32_t msgid;
 
+	memzero(&cl, sizeof(client_list_item));
+
 	setup_socket_pair(&client, &server);
 
 	cl.fd = server;
 	slabel = buxton_string_pack("_");
 	if (use_smack())
-		cl.smack_label = &slabel;
+		cl.smack_label = buxton_label_intern(&slabel);
 	else
-		cl.smack_label = NULL;
+		cl.smack_label = BUXTON_LABEL_NONE;
 	cl.cred.uid = 1002;
-	daemon.notify_mapping = hashmap_new(string_hash_func,
-					    string_compare_func);
-	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
+	setup_daemon_notify(&daemon);
 	fail_if(!buxton_cache_smack_rules(),
 		"Failed to cache Smack rules");
 	fail_if(!buxton_direct_open(&daemon.buxton),
@@ -2054,9 +2687,9 @@ START_TEST(buxtond_notify_clients_check)
 	key.layer = buxton_string_pack("base");
 	key.type = BUXTON_TYPE_STRING;
 	r = buxton_direct_set_value(&daemon.buxton, &key,
-				    &value1, NULL);
+				    &value1, BUXTON_LABEL_NONE);
 	fail_if(!r, "Failed to set value for notify");
-	register_notification(&daemon, &cl, &key, 0, &status);
+	register_notification(&daemon, &cl, &key, 0, 0, &status);
 	fail_if(status != 0,
 		"Failed to register notification for notify");
 	buxtond_notify_clients(&daemon, &cl, &key, &value1);
@@ -2084,7 +2717,7 @@ START_TEST(buxtond_notify_clients_check)
 	key.group = buxton_string_pack("group");
 	key.name.value = NULL;
 	key.name.length = 0;
-	r = buxton_direct_create_group(&daemon.buxton, &key, NULL);
+	r = buxton_direct_create_group(&daemon.buxton, &key, BUXTON_LABEL_NONE);
 	fail_if(!r, "Unable to create group");
 	r = buxton_direct_set_label(&daemon.buxton, &key, &slabel);
 	fail_if(!r, "Unable set group label");
@@ -2097,9 +2730,9 @@ START_TEST(buxtond_notify_clients_check)
 	key.name = buxton_string_pack("name32");
 	key.type = BUXTON_TYPE_INT32;
 	r = buxton_direct_set_value(&daemon.buxton, &key,
-				    &value1, NULL);
+				    &value1, BUXTON_LABEL_NONE);
 	fail_if(!r, "Failed to set value for notify");
-	register_notification(&daemon, &cl, &key, 0, &status);
+	register_notification(&daemon, &cl, &key, 0, 0, &status);
 	fail_if(status != 0,
 		"Failed to register notification for notify");
 	buxtond_notify_clients(&daemon, &cl, &key, &value2);
@@ -2127,9 +2760,9 @@ START_TEST(buxtond_notify_clients_check)
 	key.name = buxton_string_pack("nameu32");
 	key.type = BUXTON_TYPE_UINT32;
 	r = buxton_direct_set_value(&daemon.buxton, &key,
-				    &value1, NULL);
+				    &value1, BUXTON_LABEL_NONE);
 	fail_if(!r, "Failed to set value for notify");
-	register_notification(&daemon, &cl, &key, 0, &status);
+	register_notification(&daemon, &cl, &key, 0, 0, &status);
 	fail_if(status != 0,
 		"Failed to register notification for notify");
 	buxtond_notify_clients(&daemon, &cl, &key, &value2);
@@ -2157,9 +2790,9 @@ START_TEST(buxtond_notify_clients_check)
 	key.name = buxton_string_pack("name64");
 	key.type = BUXTON_TYPE_INT64;
 	r = buxton_direct_set_value(&daemon.buxton, &key,
-				    &value1, NULL);
+				    &value1, BUXTON_LABEL_NONE);
 	fail_if(!r, "Failed to set value for notify");
-	register_notification(&daemon, &cl, &key, 0, &status);
+	register_notification(&daemon, &cl, &key, 0, 0, &status);
 	fail_if(status != 0,
 		"Failed to register notification for notify");
 	buxtond_notify_clients(&daemon, &cl, &key, &value2);
@@ -2187,9 +2820,9 @@ START_TEST(buxtond_notify_clients_check)
 	key.name = buxton_string_pack("nameu64");
 	key.type = BUXTON_TYPE_UINT64;
 	r = buxton_direct_set_value(&daemon.buxton, &key,
-				    &value1, NULL);
+				    &value1, BUXTON_LABEL_NONE);
 	fail_if(!r, "Failed to set value for notify");
-	register_notification(&daemon, &cl, &key, 0, &status);
+	register_notification(&daemon, &cl, &key, 0, 0, &status);
 	fail_if(status != 0,
 		"Failed to register notification for notify");
 	buxtond_notify_clients(&daemon, &cl, &key, &value2);
@@ -2217,9 +2850,9 @@ START_TEST(buxtond_notify_clients_check)
 	key.name = buxton_string_pack("namef");
 	key.type = BUXTON_TYPE_FLOAT;
 	r = buxton_direct_set_value(&daemon.buxton, &key,
-				    &value1, NULL);
+				    &value1, BUXTON_LABEL_NONE);
 	fail_if(!r, "Failed to set value for notify");
-	register_notification(&daemon, &cl, &key, 0, &status);
+	register_notification(&daemon, &cl, &key, 0, 0, &status);
 	fail_if(status != 0,
 		"Failed to register notification for notify");
 	buxtond_notify_clients(&daemon, &cl, &key, &value2);
@@ -2247,9 +2880,9 @@ START_TEST(buxtond_notify_clients_check)
 	key.name = buxton_string_pack("named");
 	key.type = BUXTON_TYPE_DOUBLE;
 	r = buxton_direct_set_value(&daemon.buxton, &key,
-				    &value1, NULL);
+				    &value1, BUXTON_LABEL_NONE);
 	fail_if(!r, "Failed to set value for notify");
-	register_notification(&daemon, &cl, &key, 0, &status);
+	register_notification(&daemon, &cl, &key, 0, 0, &status);
 	fail_if(status != 0,
 		"Failed to register notification for notify");
 	buxtond_notify_clients(&daemon, &cl, &key, &value2);
@@ -2277,9 +2910,9 @@ START_TEST(buxtond_notify_clients_check)
 	key.name = buxton_string_pack("nameb");
 	key.type = BUXTON_TYPE_BOOLEAN;
 	r = buxton_direct_set_value(&daemon.buxton, &key,
-				    &value1, NULL);
+				    &value1, BUXTON_LABEL_NONE);
 	fail_if(!r, "Failed to set value for notify");
-	register_notification(&daemon, &cl, &key, 0, &status);
+	register_notification(&daemon, &cl, &key, 0, 0, &status);
 	fail_if(status != 0,
 		"Failed to register notification for notify");
 	buxtond_notify_clients(&daemon, &cl, &key, &value2);
@@ -2303,6 +2936,361 @@ START_TEST(buxtond_notify_clients_check)
 }
 END_TEST
 
+START_TEST(buxtond_notify_fanout_check)
+{
+	int client[2], server[2];
+	BuxtonDaemon daemon;
+	_BuxtonKey key;
+	BuxtonString slabel;
+	BuxtonData value;
+	client_list_item cl[2];
+	BuxtonNotifyKey *nkey;
+	int32_t status;
+	bool r;
+	ssize_t s;
+	uint8_t buf[4096];
+	uint32_t msgid;
+
+	setup_daemon_notify(&daemon);
+	fail_if(!buxton_cache_smack_rules(),
+		"Failed to cache Smack rules");
+	fail_if(!buxton_direct_open(&daemon.buxton),
+		"Failed to open buxton direct connection");
+
+	value.type = BUXTON_TYPE_STRING;
+	value.store.d_string = buxton_string_pack("fan");
+	key.group = buxton_string_pack("daemon-check");
+	key.name = buxton_string_pack("fanout");
+	key.layer = buxton_string_pack("base");
+	key.type = BUXTON_TYPE_STRING;
+	r = buxton_direct_set_value(&daemon.buxton, &key, &value, BUXTON_LABEL_NONE);
+	fail_if(!r, "Failed to set value for notify");
+
+	slabel = buxton_string_pack("_");
+	for (int i = 0; i < 2; i++) {
+		setup_subscriber(&cl[i], &client[i], &server[i], &slabel);
+		register_notification(&daemon, &cl[i], &key,
+				      (uint32_t)(10 + i), 0, &status);
+		fail_if(status != 0, "Failed to register notification");
+	}
+
+	nkey = hashmap_get(daemon.notify_mapping, "daemon-check\nfanout");
+	fail_if(!nkey, "Failed to find notification key");
+
+	/* A longer string sharing the old value's prefix is a change */
+	value.store.d_string = buxton_string_pack("fan out");
+	buxtond_notify_clients(&daemon, &cl[0], &key, &value);
+	fail_if(!nkey->value || !streq(nkey->value->store.d_string.value,
+				       "fan out"),
+		"Failed to keep the value the subscribers saw");
+
+	for (int i = 0; i < 2; i++) {
+		check_notification(client[i], (uint32_t)(10 + i), "fan out");
+	}
+
+	/* The same value again is not a change for anyone */
+	buxtond_notify_clients(&daemon, &cl[0], &key, &value);
+	for (int i = 0; i < 2; i++) {
+		s = recv(client[i], buf, 4096, MSG_DONTWAIT);
+		fail_if(s >= 0, "Notified of an unchanged value");
+	}
+
+	for (int i = 0; i < 2; i++) {
+		msgid = unregister_notification(&daemon, &cl[i], &key, &status);
+		fail_if(status != 0, "Failed to unregister notification");
+		fail_if(msgid != (uint32_t)(10 + i),
+			"Unregistered another subscriber");
+		close(client[i]);
+		close(server[i]);
+	}
+	fail_if(hashmap_size(daemon.notify_mapping) != 0,
+		"Notification key left after its last subscriber");
+
+	teardown_daemon_notify(&daemon);
+	buxton_direct_close(&daemon.buxton);
+}
+END_TEST
+
+START_TEST(buxtond_notify_wildcard_check)
+{
+	int client[2], server[2];
+	BuxtonDaemon daemon;
+	_BuxtonKey key, watch[2];
+	BuxtonString slabel;
+	BuxtonData value;
+	client_list_item cl[2];
+	BuxtonNotifyGroup *group;
+	int32_t status;
+	bool r;
+	BuxtonData *list;
+	BuxtonControlMessage msg;
+	ssize_t csize;
+	ssize_t s;
+	uint8_t buf[4096];
+	uint32_t msgid;
+
+	setup_daemon_notify(&daemon);
+	fail_if(!buxton_cache_smack_rules(),
+		"Failed to cache Smack rules");
+	fail_if(!buxton_direct_open(&daemon.buxton),
+		"Failed to open buxton direct connection");
+
+	value.type = BUXTON_TYPE_STRING;
+	value.store.d_string = buxton_string_pack("wild");
+	key.group = buxton_string_pack("daemon-check");
+	key.layer = buxton_string_pack("base");
+	key.type = BUXTON_TYPE_STRING;
+	key.name = buxton_string_pack("wild-a");
+	r = buxton_direct_set_value(&daemon.buxton, &key, &value, BUXTON_LABEL_NONE);
+	fail_if(!r, "Failed to set value for notify");
+	key.name = buxton_string_pack("tame");
+	r = buxton_direct_set_value(&daemon.buxton, &key, &value, BUXTON_LABEL_NONE);
+	fail_if(!r, "Failed to set value for notify");
+
+	/* One client watches the group, the other a prefix of its names */
+	watch[0] = key;
+	watch[0].name = buxton_string_pack("*");
+	watch[1] = key;
+	watch[1].name = buxton_string_pack("wild-*");
+	slabel = buxton_string_pack("_");
+	for (int i = 0; i < 2; i++) {
+		setup_subscriber(&cl[i], &client[i], &server[i], &slabel);
+		register_notification(&daemon, &cl[i], &watch[i],
+				      (uint32_t)(20 + i), 0, &status);
+		fail_if(status != 0, "Failed to register wildcard notification");
+	}
+
+	group = hashmap_get(daemon.notify_groups, "daemon-check");
+	fail_if(!group, "Failed to index wildcard watches");
+	fail_if(group->n_watches != 2, "Wrong number of wildcard watches");
+	fail_if(group->n_prefixes != 6, "Wrong longest wildcard prefix");
+
+	/* A key matching both watches */
+	key.name = buxton_string_pack("wild-a");
+	buxtond_notify_clients(&daemon, &cl[0], &key, &value);
+	for (int i = 0; i < 2; i++) {
+		s = read(client[i], buf, 4096);
+		fail_if(s < 0, "Read from client failed");
+		csize = buxton_deserialize_message(buf, &msg, (size_t)s,
+						   &msgid, &list);
+		fail_if(csize != 2, "Failed to get wildcard notification");
+		fail_if(msg != BUXTON_CONTROL_CHANGED,
+			"Failed to get correct control type");
+		fail_if(msgid != (uint32_t)(20 + i),
+			"Got another subscriber's message id");
+		fail_if(!streq(list[0].store.d_string.value, "wild-a"),
+			"Failed to get name of changed key");
+		fail_if(!streq(list[1].store.d_string.value, "wild"),
+			"Failed to get wildcard notification value");
+		free(list[0].store.d_string.value);
+		free(list[1].store.d_string.value);
+		free(list);
+	}
+
+	/* A key outside the prefix only reaches the group watch */
+	key.name = buxton_string_pack("tame");
+	buxtond_notify_clients(&daemon, &cl[0], &key, &value);
+	s = read(client[0], buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 2, "Failed to get wildcard notification");
+	fail_if(!streq(list[0].store.d_string.value, "tame"),
+		"Failed to get name of changed key");
+	free(list[0].store.d_string.value);
+	free(list[1].store.d_string.value);
+	free(list);
+
+	/* Unsets carry the name alone, and are the next thing the prefix
+	 * watch hears of */
+	key.name = buxton_string_pack("wild-a");
+	buxtond_notify_clients(&daemon, &cl[0], &key, NULL);
+	for (int i = 0; i < 2; i++) {
+		s = read(client[i], buf, 4096);
+		fail_if(s < 0, "Read from client failed");
+		csize = buxton_deserialize_message(buf, &msg, (size_t)s,
+						   &msgid, &list);
+		fail_if(csize != 1, "Failed to get wildcard unset notification");
+		fail_if(!streq(list[0].store.d_string.value, "wild-a"),
+			"Failed to get name of unset key");
+		free(list[0].store.d_string.value);
+		free(list);
+	}
+
+	for (int i = 0; i < 2; i++) {
+		msgid = unregister_notification(&daemon, &cl[i], &watch[i],
+						&status);
+		fail_if(status != 0, "Failed to unregister notification");
+		fail_if(msgid != (uint32_t)(20 + i),
+			"Unregistered another subscriber");
+		close(client[i]);
+		close(server[i]);
+	}
+	fail_if(hashmap_size(daemon.notify_groups) != 0,
+		"Wildcard index left after its last watch");
+
+	teardown_daemon_notify(&daemon);
+	buxton_direct_close(&daemon.buxton);
+}
+END_TEST
+
+/* Time the daemon sees in the notification tests */
+static uint64_t test_now;
+
+static uint64_t test_clock(void)
+{
+	return test_now;
+}
+
+START_TEST(buxtond_notify_coalesce_check)
+{
+	int client[2], server[2];
+	BuxtonDaemon daemon;
+	_BuxtonKey key;
+	BuxtonString slabel;
+	BuxtonData value;
+	client_list_item cl[2];
+	BuxtonNotifyKey *nkey;
+	BuxtonNotification *held;
+	int32_t status;
+	bool r;
+	uint8_t buf[4096];
+	uint32_t msgid;
+	char *values[] = { "1", "2", "3", "4", "5", "6", "7" };
+
+	memzero(&daemon, sizeof(BuxtonDaemon));
+	setup_daemon_notify(&daemon);
+	daemon.notify_clock = test_clock;
+	test_now = 10000;
+	fail_if(!buxton_cache_smack_rules(),
+		"Failed to cache Smack rules");
+	fail_if(!buxton_direct_open(&daemon.buxton),
+		"Failed to open buxton direct connection");
+
+	value.type = BUXTON_TYPE_STRING;
+	value.store.d_string = buxton_string_pack("0");
+	key.group = buxton_string_pack("daemon-check");
+	key.name = buxton_string_pack("coalesce");
+	key.layer = buxton_string_pack("base");
+	key.type = BUXTON_TYPE_STRING;
+	r = buxton_direct_set_value(&daemon.buxton, &key, &value, BUXTON_LABEL_NONE);
+	fail_if(!r, "Failed to set value for notify");
+
+	/* The first client takes a change every 100ms at most, the second
+	 * every change */
+	slabel = buxton_string_pack("_");
+	for (int i = 0; i < 2; i++) {
+		setup_subscriber(&cl[i], &client[i], &server[i], &slabel);
+		fail_if(fcntl(client[i], F_SETFL, O_NONBLOCK),
+			"Failed to set socket to non blocking");
+		register_notification(&daemon, &cl[i], &key,
+				      (uint32_t)(30 + i), i ? 0 : 100, &status);
+		fail_if(status != 0, "Failed to register notification");
+	}
+	nkey = hashmap_get(daemon.notify_mapping, "daemon-check\ncoalesce");
+	fail_if(!nkey, "Failed to find notification key");
+	fail_if(buxtond_notify_timeout(&daemon) != -1,
+		"Notifications due before any change");
+
+	for (int v = 0; v < 3; v++) {
+		value.store.d_string = buxton_string_pack(values[v]);
+		buxtond_notify_clients(&daemon, &cl[1], &key, &value);
+		check_notification(client[1], 31, values[v]);
+	}
+	check_notification(client[0], 30, "1");
+	held = daemon.notify_pending;
+	fail_if(held == NULL || held->pending_next != NULL,
+		"Coalesced subscriber not held back");
+	fail_if(held->msgid != 30, "Held back another subscriber");
+
+	/* Nothing is sent before the window is over */
+	fail_if(buxtond_notify_timeout(&daemon) != 100,
+		"Wrong notification timeout");
+	test_now += 99;
+	fail_if(buxtond_notify_timeout(&daemon) != 1,
+		"Wrong notification timeout");
+	buxtond_flush_notifications(&daemon);
+	fail_if(read(client[0], buf, 4096) != -1 || errno != EAGAIN,
+		"Coalesced change sent within its window");
+
+	/* Then the latest change is, once */
+	test_now++;
+	fail_if(buxtond_notify_timeout(&daemon) != 0,
+		"Held back change not due after its window");
+	buxtond_flush_notifications(&daemon);
+	check_notification(client[0], 30, "3");
+	fail_if(read(client[0], buf, 4096) != -1 || errno != EAGAIN,
+		"Coalesced change sent more than once");
+	fail_if(daemon.notify_pending, "Sent subscriber still held back");
+	fail_if(buxtond_notify_timeout(&daemon) != -1,
+		"Notifications due after all were sent");
+
+	/* With a budget of one per second, starting afresh, the second of
+	 * two changes is held back until the next second */
+	msgid = unregister_notification(&daemon, &cl[0], &key, &status);
+	fail_if(status != 0 || msgid != 30,
+		"Failed to unregister notification");
+	daemon.notify_budget = 1;
+	test_now += 5000;
+	for (int v = 3; v < 5; v++) {
+		value.store.d_string = buxton_string_pack(values[v]);
+		buxtond_notify_clients(&daemon, &cl[1], &key, &value);
+	}
+	check_notification(client[1], 31, "4");
+	fail_if(read(client[1], buf, 4096) != -1 || errno != EAGAIN,
+		"Change sent over budget");
+	fail_if(buxtond_notify_timeout(&daemon) != 1000,
+		"Wrong notification timeout");
+	test_now += 1000;
+	buxtond_flush_notifications(&daemon);
+	check_notification(client[1], 31, "5");
+
+	/* Subscribers are held back in the order they are due, whatever
+	 * the order they are looked at in */
+	daemon.notify_budget = 0;
+	test_now += 5000;
+	register_notification(&daemon, &cl[0], &key, 30, 300, &status);
+	fail_if(status != 0, "Failed to register notification");
+	register_notification(&daemon, &cl[1], &key, 31, 100, &status);
+	fail_if(status != 0, "Failed to register notification");
+	for (int v = 5; v < 7; v++) {
+		value.store.d_string = buxton_string_pack(values[v]);
+		buxtond_notify_clients(&daemon, &cl[1], &key, &value);
+	}
+	check_notification(client[0], 30, "6");
+	check_notification(client[1], 31, "6");
+	held = daemon.notify_pending;
+	fail_if(!held || held->msgid != 31 || !held->pending_next ||
+		held->pending_next->msgid != 30 ||
+		daemon.notify_pending_tail != held->pending_next,
+		"Held back subscribers out of order");
+	fail_if(buxtond_notify_timeout(&daemon) != 100,
+		"Wrong notification timeout");
+	test_now += 100;
+	buxtond_flush_notifications(&daemon);
+	check_notification(client[1], 31, "7");
+	fail_if(read(client[0], buf, 4096) != -1 || errno != EAGAIN,
+		"Change sent within its window");
+	fail_if(buxtond_notify_timeout(&daemon) != 200,
+		"Wrong notification timeout");
+	test_now += 200;
+	buxtond_flush_notifications(&daemon);
+	check_notification(client[0], 30, "7");
+	fail_if(daemon.notify_pending || daemon.notify_pending_tail,
+		"Sent subscribers still held back");
+
+	for (int i = 0; i < 2; i++) {
+		msgid = unregister_notification(&daemon, &cl[i], &key, &status);
+		fail_if(status != 0 || msgid != (uint32_t)(30 + i),
+			"Failed to unregister notification");
+		close(client[i]);
+		close(server[i]);
+	}
+
+	teardown_daemon_notify(&daemon);
+	buxton_direct_close(&daemon.buxton);
+}
+END_TEST
+
 START_TEST(identify_client_check)
 {
 	int sender;
@@ -2310,6 +3298,8 @@ START_TEST(identify_client_check)
 	bool r;
 	int32_t msg = 5;
 
+	memzero(&client, sizeof(client_list_item));
+
 	setup_socket_pair(&client.fd, &sender);
 	r = identify_client(&client);
 	fail_if(r, "Identified client without message");
@@ -2323,77 +3313,94 @@ START_TEST(identify_client_check)
 }
 END_TEST
 
+static void setup_daemon_epoll(BuxtonDaemon *daemon)
+{
+	memzero(daemon, sizeof(BuxtonDaemon));
+	daemon->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	fail_if(daemon->epoll_fd == -1, "Failed to create epoll fd");
+}
+
+static void teardown_daemon_epoll(BuxtonDaemon *daemon)
+{
+	free(daemon->pollfds);
+	close(daemon->epoll_fd);
+}
+
 START_TEST(add_pollfd_check)
 {
 	BuxtonDaemon daemon;
-	int fd;
-	short events;
+	int fd, dummy;
+	uint32_t events;
 	bool a;
+	struct epoll_event ev;
 
-	fd = 3;
-	daemon.nfds_alloc = 0;
-	daemon.accepting_alloc = 0;
-	daemon.nfds = 0;
-	daemon.pollfds = NULL;
-	daemon.accepting = NULL;
-	events = 1;
+	setup_socket_pair(&fd, &dummy);
+	setup_daemon_epoll(&daemon);
+	events = EPOLLIN;
 	a = true;
-	add_pollfd(&daemon, fd, events, a);
+	fail_if(!add_pollfd(&daemon, fd, events, a), "Failed to add pollfd");
 	fail_if(daemon.nfds != 1, "Failed to increase nfds");
-	fail_if(daemon.pollfds[0].fd != fd, "Failed to set pollfd");
-	fail_if(daemon.pollfds[0].events != events, "Failed to set events");
-	fail_if(daemon.pollfds[0].revents != 0, "Failed to set revents");
-	fail_if(daemon.accepting[0] != a, "Failed to set accepting status");
-	free(daemon.pollfds);
-	free(daemon.accepting);
+	fail_if(daemon.pollfds_alloc <= (size_t)fd, "Failed to grow fd table");
+	fail_if(!daemon.pollfds[fd].registered, "Failed to register fd");
+	fail_if(daemon.pollfds[fd].accepting != a, "Failed to set accepting status");
+	fail_if(add_pollfd(&daemon, fd, events, a), "Added fd twice");
+	fail_if(daemon.nfds != 1, "Increased nfds for duplicate fd");
+
+	do_write(dummy, "x", 1);
+	fail_if(epoll_wait(daemon.epoll_fd, &ev, 1, 0) != 1,
+		"Failed to wait for events");
+	fail_if(ev.data.fd != fd, "Failed to set epoll data");
+	fail_if(!(ev.events & EPOLLIN), "Failed to set events");
+
+	teardown_daemon_epoll(&daemon);
+	close(fd);
+	close(dummy);
 }
 END_TEST
 
 START_TEST(del_pollfd_check)
 {
 	BuxtonDaemon daemon;
-	int fd;
-	short events;
-	bool a;
+	int fd1, fd2, dummy1, dummy2;
+	struct epoll_event ev;
 
-	fd = 3;
-	daemon.nfds_alloc = 0;
-	daemon.accepting_alloc = 0;
-	daemon.nfds = 0;
-	daemon.pollfds = NULL;
-	daemon.accepting = NULL;
-	events = 1;
-	a = true;
-	add_pollfd(&daemon, fd, events, a);
+	setup_socket_pair(&fd1, &dummy1);
+	setup_socket_pair(&fd2, &dummy2);
+	setup_daemon_epoll(&daemon);
+	fail_if(!add_pollfd(&daemon, fd1, EPOLLIN, true), "Failed to add pollfd");
 	fail_if(daemon.nfds != 1, "Failed to add pollfd");
-	del_pollfd(&daemon, 0);
+	del_pollfd(&daemon, fd1);
 	fail_if(daemon.nfds != 0, "Failed to decrease nfds 1");
+	fail_if(daemon.pollfds[fd1].registered, "Failed to unregister fd 1");
+	fail_if(daemon.pollfds[fd1].accepting,
+		"Failed to clear accepting status after del");
 
-	fd = 4;
-	events = 2;
-	a = false;
-	add_pollfd(&daemon, fd, events, a);
+	fail_if(!add_pollfd(&daemon, fd1, EPOLLIN, false),
+		"Failed to add pollfd after del");
 	fail_if(daemon.nfds != 1, "Failed to increase nfds after del");
-	fail_if(daemon.pollfds[0].fd != fd, "Failed to set pollfd after del");
-	fail_if(daemon.pollfds[0].events != events,
-		"Failed to set events after del");
-	fail_if(daemon.pollfds[0].revents != 0,
-		"Failed to set revents after del");
-	fail_if(daemon.accepting[0] != a,
+	fail_if(!daemon.pollfds[fd1].registered, "Failed to register fd after del");
+	fail_if(daemon.pollfds[fd1].accepting,
 		"Failed to set accepting status after del");
-	fd = 5;
-	events = 3;
-	a = true;
-	add_pollfd(&daemon, fd, events, a);
-	del_pollfd(&daemon, 0);
+
+	fail_if(!add_pollfd(&daemon, fd2, EPOLLIN, true), "Failed to add pollfd 2");
+	del_pollfd(&daemon, fd1);
 	fail_if(daemon.nfds != 1, "Failed to delete fd 2");
-	fail_if(daemon.pollfds[0].fd != fd, "Failed to set pollfd after del2");
-	fail_if(daemon.pollfds[0].events != events,
-		"Failed to set events after del2");
-	fail_if(daemon.pollfds[0].revents != 0,
-		"Failed to set revents after del2");
-	fail_if(daemon.accepting[0] != a,
-		"Failed to set accepting status after del2");
+	fail_if(!daemon.pollfds[fd2].registered, "Removed wrong fd");
+	fail_if(!daemon.pollfds[fd2].accepting,
+		"Failed to keep accepting status after del2");
+
+	/* Only the remaining fd may be reported */
+	do_write(dummy1, "x", 1);
+	do_write(dummy2, "x", 1);
+	fail_if(epoll_wait(daemon.epoll_fd, &ev, 1, 0) != 1,
+		"Failed to wait for events");
+	fail_if(ev.data.fd != fd2, "Got events for deleted fd");
+
+	teardown_daemon_epoll(&daemon);
+	close(fd1);
+	close(fd2);
+	close(dummy1);
+	close(dummy2);
 }
 END_TEST
 
@@ -2402,11 +3409,14 @@ START_TEST(handle_smack_label_check)
 	client_list_item client;
 	int server;
 
+	memzero(&client, sizeof(client_list_item));
+
 	setup_socket_pair(&client.fd, &server);
 	handle_smack_label(&client);
 
 	close(client.fd);
 	close(server);
+	buxton_label_free_all();
 }
 END_TEST
 
@@ -2415,61 +3425,52 @@ START_TEST(terminate_client_check)
 	client_list_item *client;
 	BuxtonDaemon daemon;
 	int dummy;
-	BuxtonList *n_list = NULL;
-	BuxtonList *key_list = NULL;
-	char *key_name = strdup("groupkey");
-	char *key_name_copy = strdup("groupkey");
+	BuxtonNotifyKey *nkey = NULL;
 	int ret = -1;
-	uint64_t *fd = NULL;
 	BuxtonNotification *nitem = NULL;
+	BuxtonString slabel = buxton_string_pack("dummy");
 
 	client = malloc0(sizeof(client_list_item));
 	fail_if(!client, "client malloc failed");
-	client->smack_label = malloc0(sizeof(BuxtonString));
-	fail_if(!client->smack_label, "smack label malloc failed");
+	setup_daemon_epoll(&daemon);
 	daemon.client_list = client;
 	setup_socket_pair(&client->fd, &dummy);
-	daemon.nfds_alloc = 0;
-	daemon.accepting_alloc = 0;
-	daemon.nfds = 0;
-	daemon.pollfds = NULL;
-	daemon.accepting = NULL;
-	add_pollfd(&daemon, client->fd, 2, false);
+	fail_if(!add_pollfd(&daemon, client->fd, EPOLLIN, false),
+		"Failed to add pollfd");
 	fail_if(daemon.nfds != 1, "Failed to add pollfd");
-	client->smack_label->value = strdup("dummy");
-	client->smack_label->length = 6;
-	fail_if(!client->smack_label->value, "label strdup failed");
-	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
-	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
+	client->smack_label = buxton_label_intern(&slabel);
+	setup_daemon_notify(&daemon);
+
+	nkey = malloc0(sizeof(BuxtonNotifyKey));
+	fail_if(!nkey, "Failed to allocate notification key\n");
+	nkey->name = strdup("group\nkey");
+	fail_if(!nkey->name, "Failed to allocate notification key name\n");
 
 	nitem = malloc0(sizeof(BuxtonNotification));
 	fail_if(!nitem,"Failed to allocate notification item\n");
 	nitem->client = client;
-	nitem->old_data = NULL;
+	nitem->key = nkey;
 	nitem->msgid = 0;
+	LIST_PREPEND(BuxtonNotification, by_key, nkey->subscribers, nitem);
+	LIST_PREPEND(BuxtonNotification, by_client, client->notifications,
+		     nitem);
 
-	ret = buxton_list_append(&n_list, nitem);
-	fail_if(!ret, "Failed to append to list\n");
-	ret = buxton_list_append(&key_list, key_name_copy);
-	fail_if(!ret, "Failed to append to list\n");
-
-	fd = malloc0(sizeof(uint64_t));
-	fail_if(!fd, "Failed to allocate fd\n");
-	*fd = (uint64_t)client->fd;
-
-	ret = hashmap_put(daemon.notify_mapping, key_name, n_list);
+	ret = hashmap_put(daemon.notify_mapping, nkey->name, nkey);
 	fail_if(ret < 0,"Failed to put in hashmap\n");
-	ret = hashmap_put(daemon.client_key_mapping, fd, key_list);
+	ret = hashmap_put(daemon.notify_subscriptions, nitem, nitem);
 	fail_if(ret < 0,"Failed to put in hashmap\n");
 
-	terminate_client(&daemon, client, 0);
+	terminate_client(&daemon, client);
 	fail_if(daemon.client_list, "Failed to set client list item to NULL");
-
-	hashmap_free(daemon.notify_mapping);
-	hashmap_free(daemon.client_key_mapping);
-	close(dummy);
+	fail_if(daemon.nfds != 0, "Failed to remove pollfd");
+	fail_if(hashmap_size(daemon.notify_mapping) != 0,
+		"Failed to remove the client's notification key");
+	fail_if(hashmap_size(daemon.notify_subscriptions) != 0,
+		"Failed to remove the client's registration");
+
+	teardown_daemon_notify(&daemon);
+	teardown_daemon_epoll(&daemon);
+	close(dummy);	buxton_label_free_all();
 }
 END_TEST
 
@@ -2504,23 +3505,17 @@ START_TEST(handle_client_check)
 	fail_if(!r, "Failed to add data to array");
 	ret = buxton_serialize_message(&message, BUXTON_CONTROL_GET, 0, list);
 	fail_if(ret == 0, "Failed to serialize string data");
+	setup_daemon_epoll(&daemon);
 	daemon.client_list = malloc0(sizeof(client_list_item));
 	fail_if(!daemon.client_list, "client malloc failed");
 	setup_socket_pair(&daemon.client_list->fd, &dummy);
 	fcntl(daemon.client_list->fd, F_SETFL, O_NONBLOCK);
-	daemon.nfds_alloc = 0;
-	daemon.accepting_alloc = 0;
-	daemon.nfds = 0;
-	daemon.pollfds = NULL;
-	daemon.accepting = NULL;
-	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
-	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
-
-	add_pollfd(&daemon, daemon.client_list->fd, 2, false);
+	setup_daemon_notify(&daemon);
+
+	fail_if(!add_pollfd(&daemon, daemon.client_list->fd, EPOLLIN, false),
+		"Failed to add pollfd 1");
 	fail_if(daemon.nfds != 1, "Failed to add pollfd 1");
-	fail_if(handle_client(&daemon, daemon.client_list, 0), "More data available 1");
+	fail_if(handle_client(&daemon, daemon.client_list), "More data available 1");
 	fail_if(daemon.client_list, "Failed to terminate client with no data");
 	close(dummy);
 
@@ -2528,17 +3523,20 @@ START_TEST(handle_client_check)
 	fail_if(!daemon.client_list, "client malloc failed");
 	setup_socket_pair(&daemon.client_list->fd, &dummy);
 	fcntl(daemon.client_list->fd, F_SETFL, O_NONBLOCK);
-	add_pollfd(&daemon, daemon.client_list->fd, 2, false);
+	fail_if(!add_pollfd(&daemon, daemon.client_list->fd, EPOLLIN, false),
+		"Failed to add pollfd 2");
 	fail_if(daemon.nfds != 1, "Failed to add pollfd 2");
 	do_write(dummy, buf, 1);
-	fail_if(handle_client(&daemon, daemon.client_list, 0), "More data available 2");
+	fail_if(handle_client(&daemon, daemon.client_list), "More data available 2");
 	fail_if(!daemon.client_list, "Terminated client with insufficient data");
-	fail_if(daemon.client_list->data, "Didn't clean up left over client data 1");
+	fail_if(daemon.client_list->offset != 1, "Didn't keep partial client data 1");
+	/* Start the next header on a message boundary */
+	daemon.client_list->offset = 0;
 
 	bsize = 0;
 	memcpy(message + BUXTON_LENGTH_OFFSET, &bsize, sizeof(uint32_t));
 	do_write(dummy, message, BUXTON_MESSAGE_HEADER_LENGTH);
-	fail_if(handle_client(&daemon, daemon.client_list, 0), "More data available 3");
+	fail_if(handle_client(&daemon, daemon.client_list), "More data available 3");
 	fail_if(daemon.client_list, "Failed to terminate client with bad size 1");
 	close(dummy);
 
@@ -2546,12 +3544,13 @@ START_TEST(handle_client_check)
 	fail_if(!daemon.client_list, "client malloc failed");
 	setup_socket_pair(&daemon.client_list->fd, &dummy);
 	fcntl(daemon.client_list->fd, F_SETFL, O_NONBLOCK);
-	add_pollfd(&daemon, daemon.client_list->fd, 2, false);
+	fail_if(!add_pollfd(&daemon, daemon.client_list->fd, EPOLLIN, false),
+		"Failed to add pollfd 3");
 	fail_if(daemon.nfds != 1, "Failed to add pollfd 3");
 	bsize = BUXTON_MESSAGE_MAX_LENGTH + 1;
 	memcpy(message + BUXTON_LENGTH_OFFSET, &bsize, sizeof(uint32_t));
 	do_write(dummy, message, BUXTON_MESSAGE_HEADER_LENGTH);
-	fail_if(handle_client(&daemon, daemon.client_list, 0), "More data available 4");
+	fail_if(handle_client(&daemon, daemon.client_list), "More data available 4");
 	fail_if(daemon.client_list, "Failed to terminate client with bad size 2");
 	close(dummy);
 
@@ -2559,21 +3558,41 @@ START_TEST(handle_client_check)
 	fail_if(!daemon.client_list, "client malloc failed");
 	setup_socket_pair(&daemon.client_list->fd, &dummy);
 	fcntl(daemon.client_list->fd, F_SETFL, O_NONBLOCK);
-	add_pollfd(&daemon, daemon.client_list->fd, 2, false);
+	fail_if(!add_pollfd(&daemon, daemon.client_list->fd, EPOLLIN, false),
+		"Failed to add pollfd 4");
 	fail_if(daemon.nfds != 1, "Failed to add pollfd 4");
 	bsize = (uint32_t)ret;
 	memcpy(message + BUXTON_LENGTH_OFFSET, &bsize, sizeof(uint32_t));
 	do_write(dummy, message, ret);
-	fail_if(handle_client(&daemon, daemon.client_list, 0), "More data available 5");
+	fail_if(handle_client(&daemon, daemon.client_list), "More data available 5");
 	fail_if(!daemon.client_list, "Terminated client with correct data length");
 
+	do_write(dummy, message, ret / 2);
+	fail_if(handle_client(&daemon, daemon.client_list), "More data available 6");
+	fail_if(!daemon.client_list, "Terminated client with partial message");
+	fail_if(daemon.client_list->offset != ret / 2, "Didn't keep partial client data 2");
+	do_write(dummy, message + ret / 2, ret - ret / 2);
+	fail_if(handle_client(&daemon, daemon.client_list), "More data available 7");
+	fail_if(!daemon.client_list, "Terminated client with split message");
+	fail_if(daemon.client_list->offset != 0, "Didn't handle split message");
+
 	for (int i = 0; i < 33; i++) {
 		do_write(dummy, message, ret);
 	}
-	fail_if(!handle_client(&daemon, daemon.client_list, 0), "No more data available");
+	fail_if(!handle_client(&daemon, daemon.client_list), "No more data available");
 	fail_if(!daemon.client_list, "Terminated client with correct data length");
-	terminate_client(&daemon, daemon.client_list, 0);
+	fail_if(daemon.buffered_clients != daemon.client_list,
+		"Failed to list client with buffered messages");
+	fail_if(handle_client(&daemon, daemon.client_list), "More data available 8");
+	fail_if(daemon.buffered_clients, "Kept client with drained buffer listed");
+
+	for (int i = 0; i < 33; i++) {
+		do_write(dummy, message, ret);
+	}
+	fail_if(!handle_client(&daemon, daemon.client_list), "No more data available");
+	terminate_client(&daemon, daemon.client_list);
 	fail_if(daemon.client_list, "Failed to remove client 1");
+	fail_if(daemon.buffered_clients, "Kept terminated client listed");
 	close(dummy);
 
 	//FIXME: add SIGPIPE handler
@@ -2581,15 +3600,181 @@ START_TEST(handle_client_check)
 	/* fail_if(!daemon.client_list, "client malloc failed"); */
 	/* setup_socket_pair(&daemon.client_list->fd, &dummy); */
 	/* fcntl(daemon.client_list->fd, F_SETFL, O_NONBLOCK); */
-	/* add_pollfd(&daemon, daemon.client_list->fd, 2, false); */
+	/* add_pollfd(&daemon, daemon.client_list->fd, EPOLLIN, false); */
 	/* fail_if(daemon.nfds != 1, "Failed to add pollfd 5"); */
 	/* write(dummy, message, ret); */
 	/* close(dummy); */
-	/* fail_if(handle_client(&daemon, daemon.client_list, 0), "More data available 6"); */
+	/* fail_if(handle_client(&daemon, daemon.client_list), "More data available 6"); */
 	/* fail_if(daemon.client_list, "Failed to terminate client"); */
 
-	hashmap_free(daemon.notify_mapping);
-	hashmap_free(daemon.client_key_mapping);
+	teardown_daemon_notify(&daemon);
+	teardown_daemon_epoll(&daemon);
+}
+END_TEST
+
+START_TEST(find_client_check)
+{
+	BuxtonDaemon daemon;
+	struct rlimit rl;
+	int fd, peer, other_peer;
+	int nclients = 4096;
+	int *fds;
+	client_list_item **cls;
+	client_list_item *cl;
+
+	fail_if(getrlimit(RLIMIT_NOFILE, &rl) == -1, "Failed to get fd limit");
+	rl.rlim_cur = rl.rlim_max;
+	fail_if(setrlimit(RLIMIT_NOFILE, &rl) == -1, "Failed to raise fd limit");
+	if (rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < (rlim_t)nclients + 64) {
+		nclients = (int)rl.rlim_cur - 64;
+	}
+	fail_if(nclients < 512, "Not enough fds available");
+	fds = malloc0(sizeof(int) * (size_t)nclients);
+	cls = malloc0(sizeof(client_list_item *) * (size_t)nclients);
+	fail_if(!fds || !cls, "Failed to allocate client arrays");
+
+	setup_daemon_epoll(&daemon);
+	setup_daemon_notify(&daemon);
+
+	fail_if(find_client(&daemon, -1), "Found client for invalid fd");
+	fail_if(find_client(&daemon, 0), "Found client for unknown fd");
+
+	/* The first client ends up at the tail of the client list */
+	setup_socket_pair(&fd, &peer);
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	cl = add_client(&daemon, fd);
+	fail_if(!cl, "Failed to add client");
+	fail_if(cl->fd != fd, "Failed to set client fd");
+	fail_if(find_client(&daemon, fd) != cl, "Failed to look up client");
+	fds[0] = fd;
+	cls[0] = cl;
+
+	for (int i = 1; i < nclients; i++) {
+		setup_socket_pair(&fds[i], &other_peer);
+		close(other_peer);
+		cls[i] = add_client(&daemon, fds[i]);
+		fail_if(!cls[i], "Failed to add client %d", i);
+	}
+	fail_if(daemon.nfds != (size_t)nclients, "Failed to add all clients");
+	fail_if(daemon.pollfds_alloc <= (size_t)fds[nclients - 1],
+		"Failed to grow fd table");
+
+	/* Every fd maps straight to its own client */
+	for (int i = 0; i < nclients; i++) {
+		fail_if(find_client(&daemon, fds[i]) != cls[i],
+			"Failed to look up client %d", i);
+	}
+	fail_if(find_client(&daemon, (int)daemon.pollfds_alloc),
+		"Found client beyond the fd table");
+
+	/* The tail of the list is still dispatched from its fd */
+	do_write(peer, "x", 1);
+	fail_if(handle_client(&daemon, find_client(&daemon, fd)),
+		"More data available");
+	fail_if(find_client(&daemon, fd) != cl, "Terminated client");
+	cl->offset = 0;
+
+	/* Terminated clients leave the table, the others stay in place */
+	for (int i = 1; i < nclients; i += 2) {
+		terminate_client(&daemon, cls[i]);
+	}
+	for (int i = 0; i < nclients; i++) {
+		if (i % 2) {
+			fail_if(find_client(&daemon, fds[i]),
+				"Found terminated client %d", i);
+		} else {
+			fail_if(find_client(&daemon, fds[i]) != cls[i],
+				"Lost client %d", i);
+		}
+	}
+
+	while (daemon.client_list) {
+		terminate_client(&daemon, daemon.client_list);
+	}
+	fail_if(daemon.nfds != 0, "Failed to remove all clients");
+	fail_if(find_client(&daemon, fd), "Found terminated client");
+
+	teardown_daemon_notify(&daemon);
+	teardown_daemon_epoll(&daemon);
+	close(peer);
+	free(fds);
+	free(cls);
+}
+END_TEST
+
+START_TEST(buxtond_send_check)
+{
+	BuxtonDaemon daemon;
+	client_list_item *cl;
+	int fd, peer;
+	uint8_t chunk[1024];
+	uint8_t buf[4096];
+	int sent = 0;
+	size_t total = 0, received = 0;
+	ssize_t l;
+
+	setup_daemon_epoll(&daemon);
+	daemon.max_client_buffer = 64 * 1024;
+	setup_socket_pair(&fd, &peer);
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	fcntl(peer, F_SETFL, O_NONBLOCK);
+	cl = add_client(&daemon, fd);
+	fail_if(!cl, "Failed to add client");
+
+	/* Fill the socket until output has to be queued */
+	while (!cl->out_len) {
+		memset(chunk, sent, sizeof(chunk));
+		fail_if(!buxtond_send(&daemon, cl, chunk, sizeof(chunk)),
+			"Failed to send to client");
+		sent++;
+	}
+	fail_if(!(daemon.pollfds[fd].events & EPOLLOUT),
+		"Failed to wait for client to become writable");
+
+	/* Then until the high-water mark is hit */
+	for (;;) {
+		size_t pending = cl->out_len;
+
+		memset(chunk, sent, sizeof(chunk));
+		if (!buxtond_send(&daemon, cl, chunk, sizeof(chunk))) {
+			fail_if(pending < daemon.max_client_buffer,
+				"Refused output below the high-water mark");
+			fail_if(cl->out_len != pending, "Queued refused output");
+			break;
+		}
+		sent++;
+	}
+	fail_if(cl->out_len > daemon.max_client_buffer + sizeof(chunk),
+		"Queued output past the high-water mark");
+
+	/* Everything accepted arrives in order */
+	total = (size_t)sent * sizeof(chunk);
+	while (received < total) {
+		fail_if(!flush_client(&daemon, cl), "Failed to flush client");
+		l = read(peer, buf, sizeof(buf));
+		if (l < 0) {
+			fail_if(errno != EAGAIN, "Read from client failed");
+			continue;
+		}
+		for (ssize_t i = 0; i < l; i++) {
+			fail_if(buf[i] != (uint8_t)((received + (size_t)i) / sizeof(chunk)),
+				"Output out of order at byte %zu", received + (size_t)i);
+		}
+		received += (size_t)l;
+	}
+	fail_if(!flush_client(&daemon, cl), "Failed to flush drained client");
+	fail_if(cl->out_len, "Output left in queue");
+	fail_if(daemon.pollfds[fd].events & EPOLLOUT,
+		"Still waiting for client to become writable");
+	fail_if(read(peer, buf, sizeof(buf)) > 0, "Received refused output");
+
+	/* A closed connection fails instead of spinning */
+	close(peer);
+	fail_if(buxtond_send(&daemon, cl, chunk, sizeof(chunk)),
+		"Sent to closed client");
+
+	terminate_client(&daemon, cl);
+	teardown_daemon_epoll(&daemon);
 }
 END_TEST
 
@@ -2991,6 +4176,7 @@ daemon_suite(void)
 	tcase_add_test(tc, buxton_get_value_for_layer_check);
 	tcase_add_test(tc, buxton_get_value_check);
 	tcase_add_test(tc, buxton_get_label_check);
+	tcase_add_test(tc, buxton_pipeline_check);
 	suite_add_tcase(s, tc);
 
 	tc = tcase_create("buxton_daemon_functions");
@@ -3011,13 +4197,21 @@ daemon_suite(void)
 	tcase_add_test(tc, buxtond_handle_message_get_label_check);
 	tcase_add_test(tc, buxtond_handle_message_notify_check);
 	tcase_add_test(tc, buxtond_handle_message_unset_check);
+	tcase_add_test(tc, buxtond_handle_message_batch_check);
+	tcase_add_test(tc, buxtond_handle_message_batch_reply_check);
+	tcase_add_test(tc, buxtond_handle_message_commit_check);
 	tcase_add_test(tc, buxtond_notify_clients_check);
+	tcase_add_test(tc, buxtond_notify_fanout_check);
+	tcase_add_test(tc, buxtond_notify_wildcard_check);
+	tcase_add_test(tc, buxtond_notify_coalesce_check);
 	tcase_add_test(tc, identify_client_check);
 	tcase_add_test(tc, add_pollfd_check);
 	tcase_add_test(tc, del_pollfd_check);
 	tcase_add_test(tc, handle_smack_label_check);
 	tcase_add_test(tc, terminate_client_check);
 	tcase_add_test(tc, handle_client_check);
+	tcase_add_test(tc, find_client_check);
+	tcase_add_test(tc, buxtond_send_check);
 	suite_add_tcase(s, tc);
 
 	tc = tcase_create("buxton daemon evil tests");
@@ -14,6 +14,7 @@
 #endif
 
 #include <check.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <malloc.h>
 #include <stdlib.h>
@@ -23,7 +24,9 @@
 #include <limits.h>
 
 #include "backend.h"
+#include "buxtonlabel.h"
 #include "buxtonlist.h"
+#include "buxtonskiplist.h"
 #include "check_utils.h"
 #include "hashmap.h"
 #include "log.h"
@@ -97,6 +100,401 @@ START_TEST(hashmap_check)
 }
 END_TEST
 
+START_TEST(hashmap_growth_check)
+{
+	Hashmap *map;
+	Iterator it;
+	const void *key;
+	void *value;
+	unsigned expect;
+
+	map = hashmap_new(trivial_hash_func, trivial_compare_func);
+	fail_if(map == NULL, "Failed to allocate hashmap");
+
+	/* Look up earlier keys while the index is being migrated */
+	for (unsigned i = 1; i <= 10000; i++) {
+		fail_if(hashmap_put(map, UINT_TO_PTR(i), UINT_TO_PTR(i)) != 1,
+			"Failed to put %u", i);
+		fail_if(hashmap_get(map, UINT_TO_PTR(i / 2 + 1)) !=
+			UINT_TO_PTR(i / 2 + 1), "Lost %u", i / 2 + 1);
+	}
+	fail_if(hashmap_size(map) != 10000, "Wrong hashmap size");
+	fail_if(hashmap_put(map, UINT_TO_PTR(5), UINT_TO_PTR(6)) != -EEXIST,
+		"Put an existing key");
+
+	/* Iteration follows insertion order, removing as it goes */
+	expect = 1;
+	HASHMAP_FOREACH_KEY(value, key, map, it) {
+		fail_if(PTR_TO_UINT(key) != expect, "Iterated %u, not %u",
+			PTR_TO_UINT(key), expect);
+		if (expect % 2) {
+			fail_if(hashmap_remove(map, key) != value,
+				"Failed to remove %u", expect);
+		}
+		expect++;
+	}
+	fail_if(expect != 10001, "Iteration stopped early");
+	fail_if(hashmap_size(map) != 5000, "Wrong hashmap size");
+	fail_if(hashmap_contains(map, UINT_TO_PTR(9999)), "Kept 9999");
+	fail_if(PTR_TO_UINT(hashmap_first(map)) != 2, "Wrong first item");
+	fail_if(PTR_TO_UINT(hashmap_last(map)) != 10000, "Wrong last item");
+
+	expect = 10000;
+	HASHMAP_FOREACH_BACKWARDS(value, map, it) {
+		fail_if(PTR_TO_UINT(value) != expect, "Iterated %u, not %u",
+			PTR_TO_UINT(value), expect);
+		expect -= 2;
+	}
+	fail_if(expect != 0, "Backwards iteration stopped early");
+
+	/* New items go to the end once the holes are reclaimed */
+	for (unsigned i = 10001; i <= 15000; i++) {
+		fail_if(hashmap_put(map, UINT_TO_PTR(i), UINT_TO_PTR(i)) != 1,
+			"Failed to put %u", i);
+	}
+	fail_if(hashmap_size(map) != 10000, "Wrong hashmap size");
+	for (unsigned i = 2; i <= 15000; i += (i < 10000 ? 2 : 1)) {
+		fail_if(hashmap_get(map, UINT_TO_PTR(i)) != UINT_TO_PTR(i),
+			"Lost %u", i);
+	}
+	fail_if(PTR_TO_UINT(hashmap_next(map, UINT_TO_PTR(10000))) != 10001,
+		"Wrong item after 10000");
+
+	fail_if(hashmap_iterate_skip(map, UINT_TO_PTR(5000), &it) !=
+		UINT_TO_PTR(5000), "Failed to skip to 5000");
+	fail_if(hashmap_iterate(map, &it, NULL) != UINT_TO_PTR(5000),
+		"Skip did not resume at 5000");
+	fail_if(hashmap_iterate(map, &it, NULL) != UINT_TO_PTR(5002),
+		"Wrong item after 5000");
+
+	fail_if(hashmap_remove_and_put(map, UINT_TO_PTR(2), UINT_TO_PTR(1),
+				       UINT_TO_PTR(1)) != 0,
+		"Failed to rename 2");
+	fail_if(PTR_TO_UINT(hashmap_first(map)) != 4, "Wrong first item");
+	fail_if(PTR_TO_UINT(hashmap_last(map)) != 1, "Wrong last item");
+
+	expect = 0;
+	while (hashmap_steal_first(map)) {
+		expect++;
+	}
+	fail_if(expect != 10000, "Stole %u items, not 10000", expect);
+	fail_if(!hashmap_isempty(map), "Hashmap not empty");
+
+	hashmap_free(map);
+}
+END_TEST
+
+START_TEST(hashmap_put_iterate_check)
+{
+	Hashmap *map;
+	Iterator it;
+	const void *key;
+	void *value;
+	unsigned expect;
+
+	map = hashmap_new(trivial_hash_func, trivial_compare_func);
+	fail_if(map == NULL, "Failed to allocate hashmap");
+
+	/* Fill the entry array, then leave more than half of it holes */
+	for (unsigned i = 1; i <= 1536; i++) {
+		fail_if(hashmap_put(map, UINT_TO_PTR(i), UINT_TO_PTR(i)) != 1,
+			"Failed to put %u", i);
+	}
+	for (unsigned i = 1; i <= 800; i++) {
+		fail_if(hashmap_remove(map, UINT_TO_PTR(i)) != UINT_TO_PTR(i),
+			"Failed to remove %u", i);
+	}
+
+	/* Replace every item while iterating, the new ones come last */
+	expect = 801;
+	HASHMAP_FOREACH_KEY(value, key, map, it) {
+		fail_if(PTR_TO_UINT(key) != expect, "Iterated %u, not %u",
+			PTR_TO_UINT(key), expect);
+		fail_if(hashmap_remove(map, key) != value,
+			"Failed to remove %u", expect);
+		if (expect <= 1536) {
+			fail_if(hashmap_put(map, UINT_TO_PTR(expect + 2000),
+					    UINT_TO_PTR(expect + 2000)) != 1,
+				"Failed to put %u", expect + 2000);
+		}
+		expect = expect == 1536 ? 2801 : expect + 1;
+	}
+	fail_if(expect != 3537, "Stopped at %u, not 3537", expect);
+	fail_if(!hashmap_isempty(map), "Hashmap not empty");
+
+	/* Holes are squeezed out as items come and go, keeping the order */
+	for (unsigned i = 1; i <= 10000; i++) {
+		fail_if(hashmap_put(map, UINT_TO_PTR(i), UINT_TO_PTR(i)) != 1,
+			"Failed to put %u", i);
+		if (i > 100) {
+			fail_if(hashmap_remove(map, UINT_TO_PTR(i - 100)) !=
+				UINT_TO_PTR(i - 100), "Failed to remove %u",
+				i - 100);
+		}
+		fail_if(hashmap_get(map, UINT_TO_PTR(i / 2 + 1)) !=
+			(i / 2 + 1 + 100 > i ? UINT_TO_PTR(i / 2 + 1) : NULL),
+			"Wrong lookup of %u", i / 2 + 1);
+	}
+	expect = 9901;
+	HASHMAP_FOREACH(value, map, it) {
+		fail_if(PTR_TO_UINT(value) != expect, "Iterated %u, not %u",
+			PTR_TO_UINT(value), expect);
+		expect++;
+	}
+	fail_if(expect != 10001, "Iteration stopped early");
+
+	hashmap_free(map);
+}
+END_TEST
+
+START_TEST(hashmap_iterate_compact_check)
+{
+	Hashmap *map;
+	Iterator it, inner;
+	const void *key;
+	void *value, *v;
+	unsigned expect, n;
+
+	map = hashmap_new(trivial_hash_func, trivial_compare_func);
+	fail_if(map == NULL, "Failed to allocate hashmap");
+
+	for (unsigned i = 1; i <= 100; i++) {
+		fail_if(hashmap_put(map, UINT_TO_PTR(i), UINT_TO_PTR(i)) != 1,
+			"Failed to put %u", i);
+	}
+
+	/* Leaving an iteration early does not keep holes around */
+	HASHMAP_FOREACH(value, map, it) {
+		if (PTR_TO_UINT(value) == 10)
+			break;
+	}
+	for (unsigned i = 101; i <= 20000; i++) {
+		fail_if(hashmap_put(map, UINT_TO_PTR(i), UINT_TO_PTR(i)) != 1,
+			"Failed to put %u", i);
+		fail_if(hashmap_remove(map, UINT_TO_PTR(i - 100)) !=
+			UINT_TO_PTR(i - 100), "Failed to remove %u", i - 100);
+	}
+	fail_if(hashmap_size(map) != 100, "Wrong size %u", hashmap_size(map));
+	fail_if(hashmap_allocated(map) > 1024,
+		"Holes not squeezed out, %u entries allocated",
+		hashmap_allocated(map));
+
+	/* Nor do nested iterations, and the outer one keeps its place
+	 * while the holes it leaves are squeezed out under it */
+	expect = 19901;
+	HASHMAP_FOREACH_KEY(value, key, map, it) {
+		fail_if(PTR_TO_UINT(key) != expect, "Iterated %u, not %u",
+			PTR_TO_UINT(key), expect);
+		n = 0;
+		HASHMAP_FOREACH(v, map, inner) {
+			if (++n == 2)
+				break;
+		}
+		hashmap_remove(map, UINT_TO_PTR(expect + 1));
+		if (expect < 100000) {
+			fail_if(hashmap_put(map, UINT_TO_PTR(expect + 100000),
+					    value) != 1, "Failed to put %u",
+				expect + 100000);
+		}
+		expect = expect == 19999 ? 119901 : expect + 2;
+	}
+	fail_if(expect != 120001, "Stopped at %u, not 120001", expect);
+	fail_if(hashmap_size(map) != 100, "Wrong size %u", hashmap_size(map));
+
+	/* Walking back keeps its place as well while the items in front
+	 * are taken away and the others moved down */
+	for (unsigned i = 0; i < 45; i++)
+		hashmap_steal_first(map);
+	expect = 120001;
+	n = 0;
+	for (it = ITERATOR_LAST;
+	     (value = hashmap_iterate_backwards(map, &it, &key)); n++) {
+		fail_if(PTR_TO_UINT(key) >= expect, "Iterated %u after %u",
+			PTR_TO_UINT(key), expect);
+		expect = PTR_TO_UINT(key);
+		fail_if(hashmap_get(map, key) != value, "Lost %u", expect);
+		if (hashmap_first_key(map) == key) {
+			n++;
+			break;
+		}
+		hashmap_steal_first(map);
+	}
+	fail_if(n != 28, "Iterated %u items, not 28", n);
+	fail_if(hashmap_size(map) != n, "Wrong size %u", hashmap_size(map));
+	hashmap_free(map);
+}
+END_TEST
+
+START_TEST(buxton_skiplist_check)
+{
+	BuxtonSkipList *list;
+	BuxtonSkipNode *node;
+	char *names[1000];
+	char *prev = NULL;
+	size_t n = 0;
+
+	list = buxton_skiplist_new(string_compare_func);
+	fail_if(!list, "Failed to allocate skip list");
+
+	/* Insert out of order, every name twice */
+	for (int i = 0; i < 1000; i++) {
+		fail_if(asprintf(&names[i], "key%d", (i * 7919) % 1000) == -1,
+			"Failed to allocate name");
+	}
+	for (int i = 0; i < 1000; i++) {
+		fail_if(!buxton_skiplist_insert(list, names[i]),
+			"Failed to insert %s", names[i]);
+	}
+	for (int i = 0; i < 1000; i++) {
+		fail_if(buxton_skiplist_insert(list, names[i]),
+			"Inserted %s twice", names[i]);
+	}
+	fail_if(buxton_skiplist_size(list) != 1000, "Wrong skip list size");
+
+	BUXTON_SKIPLIST_FOREACH(node, buxton_skiplist_seek(list, NULL)) {
+		fail_if(prev && strcmp(prev, node->data) >= 0,
+			"Skip list is out of order");
+		prev = node->data;
+		n++;
+	}
+	fail_if(n != 1000, "Iterated %zu items, not 1000", n);
+
+	/* A seek finds the first item of a prefix range */
+	node = buxton_skiplist_seek(list, "key99");
+	fail_if(!node || !streq(node->data, "key99"), "Seek missed key99");
+	node = node->next[0];
+	fail_if(!node || !streq(node->data, "key990"), "Wrong item after key99");
+	node = buxton_skiplist_seek(list, "kez");
+	fail_if(node, "Seek past the end found an item");
+
+	fail_if(!streq(buxton_skiplist_get(list, "key500"), "key500"),
+		"Failed to get key500");
+	fail_if(!buxton_skiplist_remove(list, "key500"),
+		"Failed to remove key500");
+	fail_if(buxton_skiplist_get(list, "key500"), "key500 is still there");
+	fail_if(buxton_skiplist_remove(list, "key500"), "Removed key500 twice");
+	fail_if(buxton_skiplist_size(list) != 999, "Wrong skip list size");
+
+	for (int i = 0; i < 1000; i++) {
+		free(names[i]);
+	}
+	buxton_skiplist_free(&list, NULL);
+	fail_if(list, "Skip list not cleared");
+}
+END_TEST
+
+START_TEST(buxton_label_intern_check)
+{
+	BuxtonString floor = buxton_string_pack("_");
+	BuxtonString user = buxton_string_pack("User");
+	BuxtonString copy;
+	BuxtonString *interned;
+	BuxtonLabelId f, u;
+
+	fail_if(buxton_label_intern(NULL) != BUXTON_LABEL_NONE,
+		"Interned a NULL label");
+	fail_if(buxton_label_string(BUXTON_LABEL_NONE),
+		"Got a string for no label");
+
+	f = buxton_label_intern(&floor);
+	u = buxton_label_intern(&user);
+	fail_if(f == BUXTON_LABEL_NONE || u == BUXTON_LABEL_NONE,
+		"Failed to intern labels");
+	fail_if(f == u, "Different labels share an identifier");
+
+	/* The same content gets the same identifier, wherever it lives */
+	copy.value = strdup("User");
+	fail_if(!copy.value, "Failed to allocate label");
+	copy.length = user.length;
+	fail_if(buxton_label_intern(&copy) != u, "Label interned twice");
+	free(copy.value);
+
+	interned = buxton_label_string(u);
+	fail_if(!interned || !streq(interned->value, "User") ||
+		interned->length != user.length, "Wrong interned label");
+	fail_if(interned == &user, "Interned string was not copied");
+	fail_if(buxton_label_intern(interned) != u,
+		"Interned string has another identifier");
+	fail_if(buxton_label_string(u) != interned,
+		"Interned string moved");
+
+	buxton_label_free_all();
+	fail_if(buxton_label_string(u), "Got a string for a freed label");
+	fail_if(buxton_label_intern(&user) == BUXTON_LABEL_NONE,
+		"Failed to intern a label again");
+	buxton_label_free_all();
+}
+END_TEST
+
+START_TEST(smack_compile_rules_check)
+{
+	BuxtonString subject, object;
+	FILE *rules;
+
+	rules = tmpfile();
+	fail_if(!rules, "Failed to create rules file");
+	fputs("System User/key r\n"
+	      "User User/key rw\n"
+	      "System Other/key rw\n"
+	      "System User/key rw\n"
+	      "Other System/key w\n", rules);
+	rewind(rules);
+	fail_if(!buxton_compile_smack_rules(rules), "Failed to compile rules");
+	fclose(rules);
+
+	subject = buxton_string_pack("System");
+	object = buxton_string_pack("User/key");
+	fail_if(!buxton_check_smack_access(&subject, &object, ACCESS_READ),
+		"Read access denied");
+	/* The first rule for a pair wins */
+	fail_if(buxton_check_smack_access(&subject, &object, ACCESS_WRITE),
+		"Write access granted by a duplicate rule");
+
+	object = buxton_string_pack("Other/key");
+	fail_if(!buxton_check_smack_access(&subject, &object, ACCESS_WRITE),
+		"Write access denied");
+
+	subject = buxton_string_pack("User");
+	object = buxton_string_pack("User/key");
+	fail_if(!buxton_check_smack_access(&subject, &object, ACCESS_WRITE),
+		"Write access denied");
+	object = buxton_string_pack("Other/key");
+	fail_if(buxton_check_smack_access(&subject, &object, ACCESS_READ),
+		"Read access granted without a rule");
+
+	/* Writing needs read access too */
+	subject = buxton_string_pack("Other");
+	object = buxton_string_pack("System/key");
+	fail_if(buxton_check_smack_access(&subject, &object, ACCESS_WRITE),
+		"Write access granted without read access");
+
+	/* Labels no rule mentions */
+	subject = buxton_string_pack("Stranger");
+	fail_if(buxton_check_smack_access(&subject, &object, ACCESS_READ),
+		"Read access granted to an unknown subject");
+	fail_if(!buxton_check_smack_access(&subject, &subject, ACCESS_WRITE),
+		"Write access denied to the subject's own label");
+	object = buxton_string_pack("_");
+	fail_if(!buxton_check_smack_access(&subject, &object, ACCESS_READ),
+		"Read access denied to the floor label");
+	fail_if(buxton_check_smack_access(&subject, &object, ACCESS_WRITE),
+		"Write access granted to the floor label");
+
+	/* Compiling again replaces the rules */
+	rules = tmpfile();
+	fail_if(!rules, "Failed to create rules file");
+	rewind(rules);
+	fail_if(!buxton_compile_smack_rules(rules), "Failed to compile rules");
+	fclose(rules);
+	subject = buxton_string_pack("User");
+	object = buxton_string_pack("User/key");
+	fail_if(buxton_check_smack_access(&subject, &object, ACCESS_READ),
+		"Rules were kept after a reload");
+
+	buxton_label_free_all();
+}
+END_TEST
+
 START_TEST(get_layer_path_check)
 {
 	BuxtonLayer layer;
@@ -682,6 +1080,149 @@ START_TEST(buxton_message_serialize_check)
 }
 END_TEST
 
+START_TEST(buxton_message_serialize_into_check)
+{
+	BuxtonControlMessage ctarget;
+	BuxtonData params[2];
+	BuxtonData tail_data;
+	BuxtonData *dtarget = NULL;
+	size_t allocated = 0;
+	uint8_t *buf = NULL;
+	uint8_t *first;
+	uint8_t *packed = NULL;
+	BuxtonArray *list = NULL;
+	BuxtonArray *tail = NULL;
+	size_t ret, ret2;
+	uint32_t mtarget;
+
+	params[0].type = BUXTON_TYPE_INT32;
+	params[0].store.d_int32 = -1;
+	params[1].type = BUXTON_TYPE_STRING;
+	params[1].store.d_string = buxton_string_pack("test-value");
+	tail_data.type = BUXTON_TYPE_UINT64;
+	tail_data.store.d_uint64 = UINT64_MAX;
+	tail = buxton_array_new();
+	fail_if(!tail, "Failed to allocate tail");
+	fail_if(!buxton_array_add(tail, &tail_data), "Failed to add to tail");
+
+	ret = buxton_serialize_message_into(&buf, &allocated,
+					    BUXTON_CONTROL_STATUS, 3, params,
+					    2, tail);
+	fail_if(ret == 0, "Failed to serialize into buffer");
+	fail_if(ret != buxton_get_message_size(buf, ret),
+		"Wrong size in serialized header");
+	fail_if(allocated < ret, "Buffer smaller than message");
+
+	/* Same bytes as the array based serializer */
+	list = buxton_array_new();
+	fail_if(!list, "Failed to allocate list");
+	fail_if(!buxton_array_add(list, &params[0]), "Failed to add to list");
+	fail_if(!buxton_array_add(list, &params[1]), "Failed to add to list");
+	fail_if(!buxton_array_add(list, &tail_data), "Failed to add to list");
+	ret2 = buxton_serialize_message(&packed, BUXTON_CONTROL_STATUS, 3, list);
+	fail_if(ret2 != ret, "Serializers disagree on size");
+	fail_if(memcmp(buf, packed, ret) != 0, "Serializers disagree on data");
+
+	fail_if(buxton_deserialize_message(buf, &ctarget, ret, &mtarget,
+					   &dtarget) != 3,
+		"Failed to deserialize message serialized into buffer");
+	fail_if(ctarget != BUXTON_CONTROL_STATUS || mtarget != 3,
+		"Wrong header deserialized");
+	fail_if(dtarget[0].store.d_int32 != -1, "Wrong int32 deserialized");
+	fail_if(!streq(dtarget[1].store.d_string.value, "test-value"),
+		"Wrong string deserialized");
+	fail_if(dtarget[2].store.d_uint64 != UINT64_MAX,
+		"Wrong uint64 deserialized");
+	free(dtarget[1].store.d_string.value);
+	free(dtarget);
+
+	/* The buffer is reused for a smaller message */
+	first = buf;
+	ret = buxton_serialize_message_into(&buf, &allocated,
+					    BUXTON_CONTROL_STATUS, 4, params,
+					    1, NULL);
+	fail_if(ret == 0, "Failed to serialize into used buffer");
+	fail_if(buf != first, "Buffer reallocated for a smaller message");
+
+	params[0].type = BUXTON_TYPE_MAX;
+	fail_if(buxton_serialize_message_into(&buf, &allocated,
+					      BUXTON_CONTROL_STATUS, 5,
+					      params, 1, NULL) != 0,
+		"Serialized into buffer with bad data type");
+
+	free(buf);
+	free(packed);
+	buxton_array_free(&list, NULL);
+	buxton_array_free(&tail, NULL);
+}
+END_TEST
+
+START_TEST(buxton_message_deserialize_view_check)
+{
+	BuxtonControlMessage ctarget;
+	BuxtonData dsource1, dsource2;
+	BuxtonData *dtarget = NULL;
+	BuxtonData *first;
+	size_t allocated = 0;
+	uint8_t *packed = NULL;
+	BuxtonArray *list = NULL;
+	size_t ret;
+	bool r;
+	uint32_t mtarget;
+
+	list = buxton_array_new();
+	fail_if(!list, "Failed to allocate list");
+	dsource1.type = BUXTON_TYPE_STRING;
+	dsource1.store.d_string = buxton_string_pack("test-key");
+	dsource2.type = BUXTON_TYPE_UINT32;
+	dsource2.store.d_uint32 = 42;
+	r = buxton_array_add(list, &dsource1);
+	fail_if(!r, "Failed to add element to array");
+	r = buxton_array_add(list, &dsource2);
+	fail_if(!r, "Failed to add element to array");
+	ret = buxton_serialize_message(&packed, BUXTON_CONTROL_GET, 7, list);
+	fail_if(ret == 0, "Failed to serialize data");
+
+	fail_if(buxton_deserialize_message_view(packed, &ctarget, ret, &mtarget,
+						&dtarget, &allocated) != 2,
+		"Failed to deserialize view");
+	fail_if(ctarget != BUXTON_CONTROL_GET, "Wrong control message for view");
+	fail_if(mtarget != 7, "Wrong message id for view");
+	fail_if(dtarget[0].type != BUXTON_TYPE_STRING, "Wrong type for string view");
+	fail_if(dtarget[0].store.d_string.value < (char *)packed ||
+		dtarget[0].store.d_string.value >= (char *)packed + ret,
+		"String view doesn't point into the message");
+	fail_if(!streq(dtarget[0].store.d_string.value, "test-key"),
+		"Wrong string view data");
+	fail_if(dtarget[1].type != BUXTON_TYPE_UINT32 ||
+		dtarget[1].store.d_uint32 != 42, "Wrong uint32 view data");
+	fail_if(allocated < sizeof(BuxtonData) * 2, "View array too small");
+
+	/* The parameter array is reused */
+	first = dtarget;
+	fail_if(buxton_deserialize_message_view(packed, &ctarget, ret, &mtarget,
+						&dtarget, &allocated) != 2,
+		"Failed to deserialize view twice");
+	fail_if(dtarget != first, "View array was reallocated");
+
+	/* Strings must still be NUL terminated */
+	packed[BUXTON_MESSAGE_HEADER_LENGTH + (sizeof(uint32_t) * 2) +
+	       sizeof(uint16_t) + sizeof(uint32_t) + strlen("test-key")] = 'x';
+	fail_if(buxton_deserialize_message_view(packed, &ctarget, ret, &mtarget,
+						&dtarget, &allocated) >= 0,
+		"Deserialized view of unterminated string");
+	fail_if(buxton_deserialize_message_view(packed, &ctarget,
+						BUXTON_MESSAGE_HEADER_LENGTH,
+						&mtarget, &dtarget,
+						&allocated) >= 0,
+		"Deserialized view of truncated header");
+
+	free(dtarget);
+	free(packed);
+	buxton_array_free(&list, NULL);
+}
+END_TEST
+
 START_TEST(buxton_get_message_size_check)
 {
 	BuxtonControlMessage csource;
@@ -723,6 +1264,15 @@ shared_lib_suite(void)
 
 	tc = tcase_create("hashmap_functions");
 	tcase_add_test(tc, hashmap_check);
+	tcase_add_test(tc, hashmap_growth_check);
+	tcase_add_test(tc, hashmap_put_iterate_check);
+	tcase_add_test(tc, hashmap_iterate_compact_check);
+	tcase_add_test(tc, buxton_skiplist_check);
+	tcase_add_test(tc, buxton_label_intern_check);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("smack_functions");
+	tcase_add_test(tc, smack_compile_rules_check);
 	suite_add_tcase(s, tc);
 
 	tc = tcase_create("util_functions");
@@ -735,6 +1285,8 @@ shared_lib_suite(void)
 	tc = tcase_create("buxton_serialize_functions");
 	tcase_add_test(tc, buxton_db_serialize_check);
 	tcase_add_test(tc, buxton_message_serialize_check);
+	tcase_add_test(tc, buxton_message_serialize_into_check);
+	tcase_add_test(tc, buxton_message_deserialize_view_check);
 	tcase_add_test(tc, buxton_get_message_size_check);
 	suite_add_tcase(s, tc);
 
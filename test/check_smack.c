@@ -169,6 +169,8 @@ START_TEST(smack_access_check)
 	object = buxton_string_pack("objecttest");
 	ret = buxton_check_smack_access(&subject, &object, ACCESS_WRITE);
 	fail_if(ret, "Write access granted for unrecognized subject/object");
+
+	buxton_label_free_all();
 }
 END_TEST
 